@@ -42,7 +42,10 @@ using namespace std;
 
 // error handling macro
 #define ALGEBRA_ERROR(E) { assert(false); }
-#define M_PI 3.14159265
+// assert for constexpr functions, which cannot contain an assert in C++11
+inline bool algebra_assert_failed() { assert(false); return false; }
+#define ALGEBRA_ASSERT(C) ((C) || algebra_assert_failed())
+#define M_PI 3.14159265
 
 class vec2;
 class vec3;
@@ -71,152 +74,185 @@ class vec2
 {
 protected:
 
-	union
-	{
-		struct { float x, y; };
-		float n[2];
-	};
+	union
+	{
+		struct { float x, y; };
+		float n[2];
+	};
 
 
 public:
 
 // Constructors
 
-vec2();
-vec2(const float x, const float y);
-vec2(const float d);
-vec2(const vec2& v);				// copy constructor
-vec2(const vec3& v);				// cast v3 to v2
-vec2(const vec3& v, int dropAxis);	// cast v3 to v2
+vec2() noexcept;
+constexpr vec2(const float x, const float y) noexcept;
+constexpr vec2(const float d) noexcept;
+constexpr vec2(const vec2& v) noexcept;				// copy constructor
+constexpr vec2(const vec3& v) noexcept;				// cast v3 to v2
+constexpr vec2(const vec3& v, int dropAxis) noexcept;	// cast v3 to v2
 
 // Assignment operators
 
-vec2& operator	= ( const vec2& v );	// assignment of a vec2
-vec2& operator += ( const vec2& v );	// incrementation by a vec2
-vec2& operator -= ( const vec2& v );	// decrementation by a vec2
-vec2& operator *= ( const float d );	// multiplication by a constant
-vec2& operator /= ( const float d );	// division by a constant
-float& operator [] ( int i);			// indexing
-float operator [] ( int i) const;// read-only indexing
+vec2& operator	= ( const vec2& v ) noexcept;	// assignment of a vec2
+vec2& operator += ( const vec2& v ) noexcept;	// incrementation by a vec2
+vec2& operator -= ( const vec2& v ) noexcept;	// decrementation by a vec2
+vec2& operator *= ( const float d ) noexcept;	// multiplication by a constant
+vec2& operator /= ( const float d ) noexcept;	// division by a constant
+float& operator [] ( int i) noexcept;			// indexing
+constexpr float operator [] ( int i) const noexcept;// read-only indexing
 
 // special functions
 
-float length() const;			// length of a vec2
-float length2() const;			// squared length of a vec2
-vec2& normalize() ;				// normalize a vec2 in place
+float length() const noexcept;			// length of a vec2
+constexpr float length2() const noexcept;			// squared length of a vec2
+vec2& normalize() noexcept;				// normalize a vec2 in place
+vec2 normalized() const noexcept;			// normalized copy of a vec2
 vec2& apply(V_FCT_PTR fct);		// apply a func. to each component
 
 // friends
 
-friend vec2 operator - (const vec2& v);						// -v1
-friend vec2 operator + (const vec2& a, const vec2& b);	    // v1 + v2
-friend vec2 operator - (const vec2& a, const vec2& b);	    // v1 - v2
-friend vec2 operator * (const vec2& a, const float d);	    // v1 * 3.0
-friend vec2 operator * (const float d, const vec2& a);	    // 3.0 * v1
-friend vec2 operator * (const mat3& a, const vec2& v);	    // M . v
-friend vec2 operator * (const vec2& v, const mat3& a);		// v . M
-friend float operator * (const vec2& a, const vec2& b);    // dot product
-friend vec2 operator / (const vec2& a, const float d);	    // v1 / 3.0
-friend vec3 operator ^ (const vec2& a, const vec2& b);	    // cross product
-friend int operator == (const vec2& a, const vec2& b);	    // v1 == v2 ?
-friend int operator != (const vec2& a, const vec2& b);	    // v1 != v2 ?
+friend constexpr vec2 operator - (const vec2& v) noexcept;						// -v1
+friend constexpr vec2 operator + (const vec2& a, const vec2& b) noexcept;	    // v1 + v2
+friend constexpr vec2 operator - (const vec2& a, const vec2& b) noexcept;	    // v1 - v2
+friend constexpr vec2 operator * (const vec2& a, const float d) noexcept;	    // v1 * 3.0
+friend constexpr vec2 operator * (const float d, const vec2& a) noexcept;	    // 3.0 * v1
+friend vec2 operator * (const mat3& a, const vec2& v) noexcept;	    // M . v
+friend vec2 operator * (const vec2& v, const mat3& a) noexcept;		// v . M
+friend constexpr float operator * (const vec2& a, const vec2& b) noexcept;    // dot product
+friend constexpr vec2 operator / (const vec2& a, const float d) noexcept;	    // v1 / 3.0
+friend constexpr vec3 operator ^ (const vec2& a, const vec2& b) noexcept;	    // cross product
+friend constexpr int operator == (const vec2& a, const vec2& b) noexcept;	    // v1 == v2 ?
+friend constexpr int operator != (const vec2& a, const vec2& b) noexcept;	    // v1 != v2 ?
 
 #ifdef ALGEBRA3IOSTREAMS
 friend ostream& operator << (ostream& s, const vec2& v);	// output to stream
 friend istream& operator >> (istream& s, vec2& v);	    // input from strm.
 #endif ALGEBRA3IOSTREAMS
 
-friend void swap(vec2& a, vec2& b);						// swap v1 & v2
-friend vec2 min(const vec2& a, const vec2& b);		    // min(v1, v2)
-friend vec2 max(const vec2& a, const vec2& b);		    // max(v1, v2)
-friend vec2 prod(const vec2& a, const vec2& b);		    // term by term *
+friend void swap(vec2& a, vec2& b) noexcept;						// swap v1 & v2
+friend constexpr vec2 min(const vec2& a, const vec2& b) noexcept;		    // min(v1, v2)
+friend constexpr vec2 max(const vec2& a, const vec2& b) noexcept;		    // max(v1, v2)
+friend constexpr vec2 prod(const vec2& a, const vec2& b) noexcept;		    // term by term *
 
 // necessary friend declarations
 
 friend class vec3;
 };
 
+/****************************************************************
+*																*
+*			    3D Vector Expressions							*
+*																*
+****************************************************************/
+
+// The arithmetic operators of vec3 return expression nodes instead of
+// vec3 temporaries; a compound expression such as a + b * d is evaluated
+// in one pass, component by component, when it is converted to a vec3.
+// A node has the read-only members of vec3 below, evaluating it first, but
+// no x, y, z (or r, g, b) fields, which only a stored vec3 can have: write
+// (a - b)[VX] or vec3(a - b).x where a vec3 temporary used to give .x.
+
+template <class E>
+class vec3expr
+{
+public:
+
+constexpr const E& self() const noexcept	// the node itself
+{ return static_cast<const E&>(*this); }
+constexpr float operator [] (int i) const noexcept	// read-only indexing
+{ return self()[i]; }
+
+// of the vec3 the expression evaluates to, as in (a - b).length()
+
+float length() const noexcept;
+constexpr float length2() const noexcept;
+vec3 normalized() const noexcept;
+vec3 normalize() const noexcept;			// the same as normalized, there is nothing to change in place
+vec3 apply(V_FCT_PTR fct) const;			// the vec3 with a func. applied to each component
+};
+
 /****************************************************************
 *																*
 *			    3D Vector										*
 *																*
 ****************************************************************/
 
-class vec3
+class vec3 : public vec3expr<vec3>
 {
 public:
 
-	union
-	{
-		struct { float x, y, z; };
-		struct { float r, g, b; };
-		float n[3];
-	};
+	typedef float value_type;		// as vec3t has them
+	typedef float real_type;
+
+	union
+	{
+		struct { float x, y, z; };
+		struct { float r, g, b; };
+		float n[3];
+	};
 
 
 public:
 
 // Constructors
 
-vec3();
-vec3(const float x, const float y, const float z);
-vec3(const float d);
-vec3(const vec3& v);					// copy constructor
-vec3(const vec2& v);					// cast v2 to v3
-vec3(const vec2& v, float d);		    // cast v2 to v3
-vec3(const vec4& v);					// cast v4 to v3
-vec3(const vec4& v, int dropAxis);	    // cast v4 to v3
+vec3() noexcept;
+constexpr vec3(const float x, const float y, const float z) noexcept;
+constexpr vec3(const float d) noexcept;
+constexpr vec3(const vec3& v) noexcept;					// copy constructor
+constexpr vec3(const vec2& v) noexcept;					// cast v2 to v3
+constexpr vec3(const vec2& v, float d) noexcept;		    // cast v2 to v3
+constexpr vec3(const vec4& v) noexcept;					// cast v4 to v3
+constexpr vec3(const vec4& v, int dropAxis) noexcept;	    // cast v4 to v3
+template <class E>
+constexpr vec3(const vec3expr<E>& e) noexcept;		    // evaluate an expression
 
 // Assignment operators
 
-vec3& operator	= ( const vec3& v );	    // assignment of a vec3
-vec3& operator += ( const vec3& v );	    // incrementation by a vec3
-vec3& operator -= ( const vec3& v );	    // decrementation by a vec3
-vec3& operator *= ( const float d );	    // multiplication by a constant
-vec3& operator /= ( const float d );	    // division by a constant
-float& operator [] ( int i);				// indexing
-float operator[] (int i) const;			// read-only indexing
+vec3& operator	= ( const vec3& v ) noexcept;	    // assignment of a vec3
+vec3& operator += ( const vec3& v ) noexcept;	    // incrementation by a vec3
+vec3& operator -= ( const vec3& v ) noexcept;	    // decrementation by a vec3
+vec3& operator *= ( const float d ) noexcept;	    // multiplication by a constant
+vec3& operator /= ( const float d ) noexcept;	    // division by a constant
+float& operator [] ( int i) noexcept;				// indexing
+constexpr float operator[] (int i) const noexcept;			// read-only indexing
 
 // special functions
 
-float length() const;				// length of a vec3
-float length2() const;				// squared length of a vec3
-vec3& normalize();					// normalize a vec3 in place
+float length() const noexcept;				// length of a vec3
+constexpr float length2() const noexcept;				// squared length of a vec3
+vec3& normalize() noexcept;					// normalize a vec3 in place
+vec3& fastNormalize() noexcept;				// the same with rsqrt, see below
+vec3 normalized() const noexcept;			// normalized copy of a vec3
 vec3& apply(V_FCT_PTR fct);		    // apply a func. to each component
 
 // friends
 
-friend vec3 operator - (const vec3& v);						// -v1
-friend vec3 operator + (const vec3& a, const vec3& b);	    // v1 + v2
-friend vec3 operator - (const vec3& a, const vec3& b);	    // v1 - v2
-friend vec3 operator * (const vec3& a, const float d);	    // v1 * 3.0
-friend vec3 operator * (const float d, const vec3& a);	    // 3.0 * v1
-friend vec3 operator * (const mat4& a, const vec3& v);	    // M . v
-friend vec3 operator * (const vec3& v, const mat4& a);		// v . M
-friend float operator * (const vec3& a, const vec3& b);    // dot product
-friend vec3 operator / (const vec3& a, const float d);	    // v1 / 3.0
-friend vec3 operator ^ (const vec3& a, const vec3& b);	    // cross product
-friend int operator == (const vec3& a, const vec3& b);	    // v1 == v2 ?
-friend int operator != (const vec3& a, const vec3& b);	    // v1 != v2 ?
+friend constexpr vec3 operator * (const mat4& a, const vec3& v) noexcept;	    // M . v
+friend constexpr vec3 operator * (const vec3& v, const mat4& a) noexcept;		// v . M
+friend constexpr float operator * (const vec3& a, const vec3& b) noexcept;    // dot product
+friend constexpr vec3 operator ^ (const vec3& a, const vec3& b) noexcept;	    // cross product
+friend constexpr int operator == (const vec3& a, const vec3& b) noexcept;	    // v1 == v2 ?
+friend constexpr int operator != (const vec3& a, const vec3& b) noexcept;	    // v1 != v2 ?
 
 #ifdef ALGEBRA3IOSTREAMS
 friend ostream& operator << (ostream& s, const vec3& v);	   // output to stream
 friend istream& operator >> (istream& s, vec3& v);	    // input from strm.
 #endif // ALGEBRA3IOSTREAMS
 
-friend void swap(vec3& a, vec3& b);						// swap v1 & v2
-friend vec3 min(const vec3& a, const vec3& b);		    // min(v1, v2)
-friend vec3 max(const vec3& a, const vec3& b);		    // max(v1, v2)
-friend vec3 prod(const vec3& a, const vec3& b);		    // term by term *
+friend void swap(vec3& a, vec3& b) noexcept;						// swap v1 & v2
+friend constexpr vec3 min(const vec3& a, const vec3& b) noexcept;		    // min(v1, v2)
+friend constexpr vec3 max(const vec3& a, const vec3& b) noexcept;		    // max(v1, v2)
 
 // necessary friend declarations
 
 friend class vec2;
 friend class vec4;
 friend class mat3;
-friend vec2 operator * (const mat3& a, const vec2& v);	// linear transform
-friend vec3 operator * (const mat3& a, const vec3& v);
-friend mat3 operator * (const mat3& a, const mat3& b);	// matrix 3 product
+friend vec2 operator * (const mat3& a, const vec2& v) noexcept;	// linear transform
+friend constexpr vec3 operator * (const mat3& a, const vec3& v) noexcept;
+friend constexpr mat3 operator * (const mat3& a, const mat3& b) noexcept;	// matrix 3 product
 };
 
 /****************************************************************
@@ -235,60 +271,61 @@ public:
 
 // Constructors
 
-vec4();
-vec4(const float x, const float y, const float z, const float w);
-vec4(const float d);
-vec4(const vec4& v);			    // copy constructor
-vec4(const vec3& v);			    // cast vec3 to vec4
-vec4(const vec3& v, const float d);	    // cast vec3 to vec4
+vec4() noexcept;
+constexpr vec4(const float x, const float y, const float z, const float w) noexcept;
+constexpr vec4(const float d) noexcept;
+constexpr vec4(const vec4& v) noexcept;			    // copy constructor
+constexpr vec4(const vec3& v) noexcept;			    // cast vec3 to vec4
+constexpr vec4(const vec3& v, const float d) noexcept;	    // cast vec3 to vec4
 
 // Assignment operators
 
-vec4& operator	= ( const vec4& v );	    // assignment of a vec4
-vec4& operator += ( const vec4& v );	    // incrementation by a vec4
-vec4& operator -= ( const vec4& v );	    // decrementation by a vec4
-vec4& operator *= ( const float d );	    // multiplication by a constant
-vec4& operator /= ( const float d );	    // division by a constant
-float& operator [] ( int i);				// indexing
-float operator[] (int i) const;			// read-only indexing
+vec4& operator	= ( const vec4& v ) noexcept;	    // assignment of a vec4
+vec4& operator += ( const vec4& v ) noexcept;	    // incrementation by a vec4
+vec4& operator -= ( const vec4& v ) noexcept;	    // decrementation by a vec4
+vec4& operator *= ( const float d ) noexcept;	    // multiplication by a constant
+vec4& operator /= ( const float d ) noexcept;	    // division by a constant
+float& operator [] ( int i) noexcept;				// indexing
+constexpr float operator[] (int i) const noexcept;			// read-only indexing
 
 // special functions
 
-float length() const;			// length of a vec4
-float length2() const;			// squared length of a vec4
-vec4& normalize();			    // normalize a vec4 in place
+float length() const noexcept;			// length of a vec4
+constexpr float length2() const noexcept;			// squared length of a vec4
+vec4& normalize() noexcept;			    // normalize a vec4 in place
+vec4 normalized() const noexcept;			// normalized copy of a vec4
 vec4& apply(V_FCT_PTR fct);		// apply a func. to each component
 
 // friends
 
-friend vec4 operator - (const vec4& v);						// -v1
-friend vec4 operator + (const vec4& a, const vec4& b);	    // v1 + v2
-friend vec4 operator - (const vec4& a, const vec4& b);	    // v1 - v2
-friend vec4 operator * (const vec4& a, const float d);	    // v1 * 3.0
-friend vec4 operator * (const float d, const vec4& a);	    // 3.0 * v1
-friend vec4 operator * (const mat4& a, const vec4& v);	    // M . v
-friend vec4 operator * (const vec4& v, const mat4& a);	    // v . M
-friend float operator * (const vec4& a, const vec4& b);    // dot product
-friend vec4 operator / (const vec4& a, const float d);	    // v1 / 3.0
-friend int operator == (const vec4& a, const vec4& b);	    // v1 == v2 ?
-friend int operator != (const vec4& a, const vec4& b);	    // v1 != v2 ?
+friend constexpr vec4 operator - (const vec4& v) noexcept;						// -v1
+friend constexpr vec4 operator + (const vec4& a, const vec4& b) noexcept;	    // v1 + v2
+friend constexpr vec4 operator - (const vec4& a, const vec4& b) noexcept;	    // v1 - v2
+friend constexpr vec4 operator * (const vec4& a, const float d) noexcept;	    // v1 * 3.0
+friend constexpr vec4 operator * (const float d, const vec4& a) noexcept;	    // 3.0 * v1
+friend constexpr vec4 operator * (const mat4& a, const vec4& v) noexcept;	    // M . v
+friend constexpr vec4 operator * (const vec4& v, const mat4& a) noexcept;	    // v . M
+friend constexpr float operator * (const vec4& a, const vec4& b) noexcept;    // dot product
+friend constexpr vec4 operator / (const vec4& a, const float d) noexcept;	    // v1 / 3.0
+friend constexpr int operator == (const vec4& a, const vec4& b) noexcept;	    // v1 == v2 ?
+friend constexpr int operator != (const vec4& a, const vec4& b) noexcept;	    // v1 != v2 ?
 
 #ifdef ALGEBRA3IOSTREAMS
 friend ostream& operator << (ostream& s, const vec4& v);	// output to stream
 friend istream& operator >> (istream& s, vec4& v);	    // input from strm.
 #endif //  ALGEBRA3IOSTREAMS
 
-friend void swap(vec4& a, vec4& b);						// swap v1 & v2
-friend vec4 min(const vec4& a, const vec4& b);		    // min(v1, v2)
-friend vec4 max(const vec4& a, const vec4& b);		    // max(v1, v2)
-friend vec4 prod(const vec4& a, const vec4& b);		    // term by term *
+friend void swap(vec4& a, vec4& b) noexcept;						// swap v1 & v2
+friend constexpr vec4 min(const vec4& a, const vec4& b) noexcept;		    // min(v1, v2)
+friend constexpr vec4 max(const vec4& a, const vec4& b) noexcept;		    // max(v1, v2)
+friend constexpr vec4 prod(const vec4& a, const vec4& b) noexcept;		    // term by term *
 
 // necessary friend declarations
 
 friend class vec3;
 friend class mat4;
-friend vec3 operator * (const mat4& a, const vec3& v);	// linear transform
-friend mat4 operator * (const mat4& a, const mat4& b);	// matrix 4 product
+friend constexpr vec3 operator * (const mat4& a, const vec3& v) noexcept;	// linear transform
+friend constexpr mat4 operator * (const mat4& a, const mat4& b) noexcept;	// matrix 4 product
 };
 
 /****************************************************************
@@ -307,50 +344,50 @@ public:
 
 // Constructors
 
-mat3();
-mat3(const vec3& v0, const vec3& v1, const vec3& v2);
-mat3(const float d);
-mat3(const mat3& m);
+mat3() noexcept;
+constexpr mat3(const vec3& v0, const vec3& v1, const vec3& v2) noexcept;
+constexpr mat3(const float d) noexcept;
+constexpr mat3(const mat3& m) noexcept;
 
 // Assignment operators
 
-mat3& operator	= ( const mat3& m );	    // assignment of a mat3
-mat3& operator += ( const mat3& m );	    // incrementation by a mat3
-mat3& operator -= ( const mat3& m );	    // decrementation by a mat3
-mat3& operator *= ( const float d );	    // multiplication by a constant
-mat3& operator /= ( const float d );	    // division by a constant
-vec3& operator [] ( int i);					// indexing
-const vec3& operator [] ( int i) const;		// read-only indexing
+mat3& operator	= ( const mat3& m ) noexcept;	    // assignment of a mat3
+mat3& operator += ( const mat3& m ) noexcept;	    // incrementation by a mat3
+mat3& operator -= ( const mat3& m ) noexcept;	    // decrementation by a mat3
+mat3& operator *= ( const float d ) noexcept;	    // multiplication by a constant
+mat3& operator /= ( const float d ) noexcept;	    // division by a constant
+vec3& operator [] ( int i) noexcept;					// indexing
+constexpr const vec3& operator [] ( int i) const noexcept;		// read-only indexing
 
 // special functions
 
-mat3 transpose() const;			    // transpose
-mat3 inverse() const;				// inverse
+constexpr mat3 transpose() const noexcept;			    // transpose
+mat3 inverse() const noexcept;				// inverse
 mat3& apply(V_FCT_PTR fct);		    // apply a func. to each element
 
 // friends
 
-friend mat3 operator - (const mat3& a);						// -m1
-friend mat3 operator + (const mat3& a, const mat3& b);	    // m1 + m2
-friend mat3 operator - (const mat3& a, const mat3& b);	    // m1 - m2
-friend mat3 operator * (const mat3& a, const mat3& b);		// m1 * m2
-friend mat3 operator * (const mat3& a, const float d);	    // m1 * 3.0
-friend mat3 operator * (const float d, const mat3& a);	    // 3.0 * m1
-friend mat3 operator / (const mat3& a, const float d);	    // m1 / 3.0
-friend int operator == (const mat3& a, const mat3& b);	    // m1 == m2 ?
-friend int operator != (const mat3& a, const mat3& b);	    // m1 != m2 ?
+friend constexpr mat3 operator - (const mat3& a) noexcept;						// -m1
+friend constexpr mat3 operator + (const mat3& a, const mat3& b) noexcept;	    // m1 + m2
+friend constexpr mat3 operator - (const mat3& a, const mat3& b) noexcept;	    // m1 - m2
+friend constexpr mat3 operator * (const mat3& a, const mat3& b) noexcept;		// m1 * m2
+friend constexpr mat3 operator * (const mat3& a, const float d) noexcept;	    // m1 * 3.0
+friend constexpr mat3 operator * (const float d, const mat3& a) noexcept;	    // 3.0 * m1
+friend constexpr mat3 operator / (const mat3& a, const float d) noexcept;	    // m1 / 3.0
+friend constexpr int operator == (const mat3& a, const mat3& b) noexcept;	    // m1 == m2 ?
+friend constexpr int operator != (const mat3& a, const mat3& b) noexcept;	    // m1 != m2 ?
 
 #ifdef ALGEBRA3IOSTREAMS
 friend ostream& operator << (ostream& s, const mat3& m);	// output to stream
 friend istream& operator >> (istream& s, mat3& m);	    // input from strm.
 #endif //  ALGEBRA3IOSTREAMS
 
-friend void swap(mat3& a, mat3& b);			    // swap m1 & m2
+friend void swap(mat3& a, mat3& b) noexcept;			    // swap m1 & m2
 
 // necessary friend declarations
 
-friend vec3 operator * (const mat3& a, const vec3& v);	    // linear transform
-friend vec2 operator * (const mat3& a, const vec2& v);	    // linear transform
+friend constexpr vec3 operator * (const mat3& a, const vec3& v) noexcept;	    // linear transform
+friend vec2 operator * (const mat3& a, const vec2& v) noexcept;	    // linear transform
 };
 
 /****************************************************************
@@ -369,50 +406,84 @@ public:
 
 // Constructors
 
-mat4();
-mat4(const vec4& v0, const vec4& v1, const vec4& v2, const vec4& v3);
-mat4(const float d);
-mat4(const mat4& m);
+mat4() noexcept;
+constexpr mat4(const vec4& v0, const vec4& v1, const vec4& v2, const vec4& v3) noexcept;
+constexpr mat4(const float d) noexcept;
+constexpr mat4(const mat4& m) noexcept;
 
 // Assignment operators
 
-mat4& operator	= ( const mat4& m );	    // assignment of a mat4
-mat4& operator += ( const mat4& m );	    // incrementation by a mat4
-mat4& operator -= ( const mat4& m );	    // decrementation by a mat4
-mat4& operator *= ( const float d );	    // multiplication by a constant
-mat4& operator /= ( const float d );	    // division by a constant
-vec4& operator [] ( int i);					// indexing
-const vec4& operator [] ( int i) const;		// read-only indexing
+mat4& operator	= ( const mat4& m ) noexcept;	    // assignment of a mat4
+mat4& operator += ( const mat4& m ) noexcept;	    // incrementation by a mat4
+mat4& operator -= ( const mat4& m ) noexcept;	    // decrementation by a mat4
+mat4& operator *= ( const float d ) noexcept;	    // multiplication by a constant
+mat4& operator /= ( const float d ) noexcept;	    // division by a constant
+vec4& operator [] ( int i) noexcept;					// indexing
+constexpr const vec4& operator [] ( int i) const noexcept;		// read-only indexing
 
 // special functions
 
-mat4 transpose() const;						// transpose
-mat4 inverse() const;						// inverse
+constexpr mat4 transpose() const noexcept;						// transpose
+mat4 inverse() const noexcept;						// inverse
 mat4& apply(V_FCT_PTR fct);					// apply a func. to each element
 
 // friends
 
-friend mat4 operator - (const mat4& a);						// -m1
-friend mat4 operator + (const mat4& a, const mat4& b);	    // m1 + m2
-friend mat4 operator - (const mat4& a, const mat4& b);	    // m1 - m2
-friend mat4 operator * (const mat4& a, const mat4& b);		// m1 * m2
-friend mat4 operator * (const mat4& a, const float d);	    // m1 * 4.0
-friend mat4 operator * (const float d, const mat4& a);	    // 4.0 * m1
-friend mat4 operator / (const mat4& a, const float d);	    // m1 / 3.0
-friend int operator == (const mat4& a, const mat4& b);	    // m1 == m2 ?
-friend int operator != (const mat4& a, const mat4& b);	    // m1 != m2 ?
+friend constexpr mat4 operator - (const mat4& a) noexcept;						// -m1
+friend constexpr mat4 operator + (const mat4& a, const mat4& b) noexcept;	    // m1 + m2
+friend constexpr mat4 operator - (const mat4& a, const mat4& b) noexcept;	    // m1 - m2
+friend constexpr mat4 operator * (const mat4& a, const mat4& b) noexcept;		// m1 * m2
+friend constexpr mat4 operator * (const mat4& a, const float d) noexcept;	    // m1 * 4.0
+friend constexpr mat4 operator * (const float d, const mat4& a) noexcept;	    // 4.0 * m1
+friend constexpr mat4 operator / (const mat4& a, const float d) noexcept;	    // m1 / 3.0
+friend constexpr int operator == (const mat4& a, const mat4& b) noexcept;	    // m1 == m2 ?
+friend constexpr int operator != (const mat4& a, const mat4& b) noexcept;	    // m1 != m2 ?
 
 #ifdef ALGEBRA3IOSTREAMS
 friend ostream& operator << (ostream& s, const mat4& m);	// output to stream
 friend istream& operator >> (istream& s, mat4& m);			// input from strm.
 #endif //  ALGEBRA3IOSTREAMS
 
-friend void swap(mat4& a, mat4& b);							// swap m1 & m2
+friend void swap(mat4& a, mat4& b) noexcept;							// swap m1 & m2
 
 // necessary friend declarations
 
-friend vec4 operator * (const mat4& a, const vec4& v);	    // linear transform
-friend vec3 operator * (const mat4& a, const vec3& v);	    // linear transform
+friend constexpr vec4 operator * (const mat4& a, const vec4& v) noexcept;	    // linear transform
+friend constexpr vec3 operator * (const mat4& a, const vec3& v) noexcept;	    // linear transform
+};
+
+/****************************************************************
+*																*
+*			   3D Affine Transform								*
+*																*
+****************************************************************/
+
+// p -> m * p + t; a chain of transforms folds into one with *, so
+// that the chain is paid for once rather than per point
+
+class affine3
+{
+public:
+
+	mat3 m;			// linear part
+	vec3 t;			// translation
+
+// Constructors
+
+affine3() noexcept {}
+constexpr affine3(const mat3& m) noexcept;					// linear transform only
+constexpr affine3(const mat3& m, const vec3& t) noexcept;	// m, then a translation by t
+
+// special functions
+
+constexpr mat4 matrix() const noexcept;			// as a 4x4 matrix
+mat3 normalMatrix() const noexcept;				// transforms normals
+affine3 inverse() const noexcept;				// inverse
+
+// friends
+
+friend constexpr vec3 operator * (const affine3& a, const vec3& p) noexcept;		// a applied to p
+friend constexpr affine3 operator * (const affine3& a, const affine3& b) noexcept;	// b, then a
 };
 
 /****************************************************************
@@ -421,15 +492,15 @@ friend vec3 operator * (const mat4& a, const vec3& v);	    // linear transform
 *																*
 ****************************************************************/
 
-mat3 identity2D();								// identity 2D
-mat3 translation2D(const vec2& v);				// translation 2D
-mat3 rotation2D(const vec2& Center, const float angleDeg);	// rotation 2D
-mat3 scaling2D(const vec2& scaleVector);		// scaling 2D
-mat4 identity3D();								// identity 3D
-mat4 translation3D(const vec3& v);				// translation 3D
-mat4 rotation3D(vec3 Axis, const float angleDeg);// rotation 3D
-mat4 scaling3D(const vec3& scaleVector);		// scaling 3D
-mat4 perspective3D(const float d);			    // perspective 3D
+constexpr mat3 identity2D() noexcept;								// identity 2D
+constexpr mat3 translation2D(const vec2& v) noexcept;				// translation 2D
+mat3 rotation2D(const vec2& Center, const float angleDeg) noexcept;	// rotation 2D
+constexpr mat3 scaling2D(const vec2& scaleVector) noexcept;		// scaling 2D
+constexpr mat4 identity3D() noexcept;								// identity 3D
+constexpr mat4 translation3D(const vec3& v) noexcept;				// translation 3D
+mat4 rotation3D(vec3 Axis, const float angleDeg) noexcept;// rotation 3D
+constexpr mat4 scaling3D(const vec3& scaleVector) noexcept;		// scaling 3D
+constexpr mat4 perspective3D(const float d) noexcept;			    // perspective 3D
 
 //
 //	Implementation
@@ -443,90 +514,87 @@ mat4 perspective3D(const float d);			    // perspective 3D
 
 // CONSTRUCTORS
 
-inline vec2::vec2() {}
+inline vec2::vec2() noexcept {}
 
-inline vec2::vec2(const float x, const float y)
-{ n[VX] = x; n[VY] = y; }
+inline constexpr vec2::vec2(const float x, const float y) noexcept
+: n{x, y} {}
 
-inline vec2::vec2(const float d)
-{ n[VX] = n[VY] = d; }
+inline constexpr vec2::vec2(const float d) noexcept
+: n{d, d} {}
 
-inline vec2::vec2(const vec2& v)
-{ n[VX] = v.n[VX]; n[VY] = v.n[VY]; }
+inline constexpr vec2::vec2(const vec2& v) noexcept
+: n{v.n[VX], v.n[VY]} {}
 
-inline vec2::vec2(const vec3& v) // it is up to caller to avoid divide-by-zero
-{ n[VX] = v.n[VX]/v.n[VZ]; n[VY] = v.n[VY]/v.n[VZ]; };
+inline constexpr vec2::vec2(const vec3& v) noexcept // it is up to caller to avoid divide-by-zero
+: n{v.n[VX]/v.n[VZ], v.n[VY]/v.n[VZ]} {}
 
-inline vec2::vec2(const vec3& v, int dropAxis) {
-    switch (dropAxis) {
-	case VX: n[VX] = v.n[VY]; n[VY] = v.n[VZ]; break;
-	case VY: n[VX] = v.n[VX]; n[VY] = v.n[VZ]; break;
-	default: n[VX] = v.n[VX]; n[VY] = v.n[VY]; break;
-    }
-}
+inline constexpr vec2::vec2(const vec3& v, int dropAxis) noexcept
+: n{dropAxis == VX ? v.n[VY] : v.n[VX],
+    dropAxis == VX || dropAxis == VY ? v.n[VZ] : v.n[VY]} {}
 
 
 // ASSIGNMENT OPERATORS
 
-inline vec2& vec2::operator = (const vec2& v)
+inline vec2& vec2::operator = (const vec2& v) noexcept
 { n[VX] = v.n[VX]; n[VY] = v.n[VY]; return *this; }
 
-inline vec2& vec2::operator += ( const vec2& v )
+inline vec2& vec2::operator += ( const vec2& v ) noexcept
 { n[VX] += v.n[VX]; n[VY] += v.n[VY]; return *this; }
 
-inline vec2& vec2::operator -= ( const vec2& v )
+inline vec2& vec2::operator -= ( const vec2& v ) noexcept
 { n[VX] -= v.n[VX]; n[VY] -= v.n[VY]; return *this; }
 
-inline vec2& vec2::operator *= ( const float d )
+inline vec2& vec2::operator *= ( const float d ) noexcept
 { n[VX] *= d; n[VY] *= d; return *this; }
 
-inline vec2& vec2::operator /= ( const float d )
+inline vec2& vec2::operator /= ( const float d ) noexcept
 { float d_inv = 1./d; n[VX] *= d_inv; n[VY] *= d_inv; return *this; }
 
-inline float& vec2::operator [] ( int i) {
+inline float& vec2::operator [] ( int i) noexcept {
     assert(!(i < VX || i > VY));		// subscript check
     return n[i];
 }
 
-inline float vec2::operator [] ( int i) const {
-    assert(!(i < VX || i > VY));
-    return n[i];
-}
+inline constexpr float vec2::operator [] ( int i) const noexcept
+{ return ALGEBRA_ASSERT(!(i < VX || i > VY)), n[i]; }
 
 
 // SPECIAL FUNCTIONS
 
-inline float vec2::length() const
+inline float vec2::length() const noexcept
 { return sqrt(length2()); }
 
-inline float vec2::length2() const
+inline constexpr float vec2::length2() const noexcept
 { return n[VX]*n[VX] + n[VY]*n[VY]; }
 
-inline vec2& vec2::normalize() // it is up to caller to avoid divide-by-zero
+inline vec2& vec2::normalize() noexcept // it is up to caller to avoid divide-by-zero
 { *this /= length(); return *this; }
 
+inline vec2 vec2::normalized() const noexcept // the same as normalize, on a copy
+{ vec2 v(*this); return v.normalize(); }
+
 inline vec2& vec2::apply(V_FCT_PTR fct)
 { n[VX] = (*fct)(n[VX]); n[VY] = (*fct)(n[VY]); return *this; }
 
 
 // FRIENDS
 
-inline vec2 operator - (const vec2& a)
+inline constexpr vec2 operator - (const vec2& a) noexcept
 { return vec2(-a.n[VX],-a.n[VY]); }
 
-inline vec2 operator + (const vec2& a, const vec2& b)
+inline constexpr vec2 operator + (const vec2& a, const vec2& b) noexcept
 { return vec2(a.n[VX]+ b.n[VX], a.n[VY] + b.n[VY]); }
 
-inline vec2 operator - (const vec2& a, const vec2& b)
+inline constexpr vec2 operator - (const vec2& a, const vec2& b) noexcept
 { return vec2(a.n[VX]-b.n[VX], a.n[VY]-b.n[VY]); }
 
-inline vec2 operator * (const vec2& a, const float d)
+inline constexpr vec2 operator * (const vec2& a, const float d) noexcept
 { return vec2(d*a.n[VX], d*a.n[VY]); }
 
-inline vec2 operator * (const float d, const vec2& a)
+inline constexpr vec2 operator * (const float d, const vec2& a) noexcept
 { return a*d; }
 
-inline vec2 operator * (const mat3& a, const vec2& v) {
+inline vec2 operator * (const mat3& a, const vec2& v) noexcept {
     vec3 av;
 
     av.n[VX] = a.v[0].n[VX]*v.n[VX] + a.v[0].n[VY]*v.n[VY] + a.v[0].n[VZ];
@@ -535,22 +603,22 @@ inline vec2 operator * (const mat3& a, const vec2& v) {
     return av;
 }
 
-inline vec2 operator * (const vec2& v, const mat3& a)
+inline vec2 operator * (const vec2& v, const mat3& a) noexcept
 { return a.transpose() * v; }
 
-inline float operator * (const vec2& a, const vec2& b)
+inline constexpr float operator * (const vec2& a, const vec2& b) noexcept
 { return (a.n[VX]*b.n[VX] + a.n[VY]*b.n[VY]); }
 
-inline vec2 operator / (const vec2& a, const float d)
-{ float d_inv = 1./d; return vec2(a.n[VX]*d_inv, a.n[VY]*d_inv); }
+inline constexpr vec2 operator / (const vec2& a, const float d) noexcept
+{ return a * (float)(1./d); }
 
-inline vec3 operator ^ (const vec2& a, const vec2& b)
+inline constexpr vec3 operator ^ (const vec2& a, const vec2& b) noexcept
 { return vec3(0.0, 0.0, a.n[VX] * b.n[VY] - b.n[VX] * a.n[VY]); }
 
-inline int operator == (const vec2& a, const vec2& b)
+inline constexpr int operator == (const vec2& a, const vec2& b) noexcept
 { return (a.n[VX] == b.n[VX]) && (a.n[VY] == b.n[VY]); }
 
-inline int operator != (const vec2& a, const vec2& b)
+inline constexpr int operator != (const vec2& a, const vec2& b) noexcept
 { return !(a == b); }
 
 #ifdef ALGEBRA3IOSTREAMS
@@ -579,16 +647,16 @@ inline istream& operator >> (istream& s, vec2& v) {
 }
 #endif // ALGEBRA3IOSTREAMS
 
-inline void swap(vec2& a, vec2& b)
+inline void swap(vec2& a, vec2& b) noexcept
 { vec2 tmp(a); a = b; b = tmp; }
 
-inline vec2 min(const vec2& a, const vec2& b)
+inline constexpr vec2 min(const vec2& a, const vec2& b) noexcept
 { return vec2(MIN(a.n[VX], b.n[VX]), MIN(a.n[VY], b.n[VY])); }
 
-inline vec2 max(const vec2& a, const vec2& b)
+inline constexpr vec2 max(const vec2& a, const vec2& b) noexcept
 { return vec2(MAX(a.n[VX], b.n[VX]), MAX(a.n[VY], b.n[VY])); }
 
-inline vec2 prod(const vec2& a, const vec2& b)
+inline constexpr vec2 prod(const vec2& a, const vec2& b) noexcept
 { return vec2(a.n[VX] * b.n[VX], a.n[VY] * b.n[VY]); }
 
 /****************************************************************
@@ -599,76 +667,77 @@ inline vec2 prod(const vec2& a, const vec2& b)
 
 // CONSTRUCTORS
 
-inline vec3::vec3() {}
+inline vec3::vec3() noexcept {}
 
-inline vec3::vec3(const float x, const float y, const float z)
-{ n[VX] = x; n[VY] = y; n[VZ] = z; }
+inline constexpr vec3::vec3(const float x, const float y, const float z) noexcept
+: n{x, y, z} {}
 
-inline vec3::vec3(const float d)
-{ n[VX] = n[VY] = n[VZ] = d; }
+inline constexpr vec3::vec3(const float d) noexcept
+: n{d, d, d} {}
 
-inline vec3::vec3(const vec3& v)
-{ n[VX] = v.n[VX]; n[VY] = v.n[VY]; n[VZ] = v.n[VZ]; }
+inline constexpr vec3::vec3(const vec3& v) noexcept
+: n{v.n[VX], v.n[VY], v.n[VZ]} {}
 
-inline vec3::vec3(const vec2& v)
-{ n[VX] = v.n[VX]; n[VY] = v.n[VY]; n[VZ] = 1.0; }
+inline constexpr vec3::vec3(const vec2& v) noexcept
+: n{v.n[VX], v.n[VY], 1.0f} {}
 
-inline vec3::vec3(const vec2& v, float d)
-{ n[VX] = v.n[VX]; n[VY] = v.n[VY]; n[VZ] = d; }
+inline constexpr vec3::vec3(const vec2& v, float d) noexcept
+: n{v.n[VX], v.n[VY], d} {}
 
-inline vec3::vec3(const vec4& v) // it is up to caller to avoid divide-by-zero
-{ n[VX] = v.n[VX] / v.n[VW]; n[VY] = v.n[VY] / v.n[VW];
-  n[VZ] = v.n[VZ] / v.n[VW]; }
+inline constexpr vec3::vec3(const vec4& v) noexcept // it is up to caller to avoid divide-by-zero
+: n{v.n[VX] / v.n[VW], v.n[VY] / v.n[VW],
+    v.n[VZ] / v.n[VW]} {}
 
-inline vec3::vec3(const vec4& v, int dropAxis) {
-    switch (dropAxis) {
-	case VX: n[VX] = v.n[VY]; n[VY] = v.n[VZ]; n[VZ] = v.n[VW]; break;
-	case VY: n[VX] = v.n[VX]; n[VY] = v.n[VZ]; n[VZ] = v.n[VW]; break;
-	case VZ: n[VX] = v.n[VX]; n[VY] = v.n[VY]; n[VZ] = v.n[VW]; break;
-	default: n[VX] = v.n[VX]; n[VY] = v.n[VY]; n[VZ] = v.n[VZ]; break;
-    }
-}
+inline constexpr vec3::vec3(const vec4& v, int dropAxis) noexcept
+: n{dropAxis == VX ? v.n[VY] : v.n[VX],
+    dropAxis == VX || dropAxis == VY ? v.n[VZ] : v.n[VY],
+    dropAxis == VX || dropAxis == VY || dropAxis == VZ ? v.n[VW] : v.n[VZ]} {}
 
 
 // ASSIGNMENT OPERATORS
 
-inline vec3& vec3::operator = (const vec3& v)
+inline vec3& vec3::operator = (const vec3& v) noexcept
 { n[VX] = v.n[VX]; n[VY] = v.n[VY]; n[VZ] = v.n[VZ]; return *this; }
 
-inline vec3& vec3::operator += ( const vec3& v )
+inline vec3& vec3::operator += ( const vec3& v ) noexcept
 { n[VX] += v.n[VX]; n[VY] += v.n[VY]; n[VZ] += v.n[VZ]; return *this; }
 
-inline vec3& vec3::operator -= ( const vec3& v )
+inline vec3& vec3::operator -= ( const vec3& v ) noexcept
 { n[VX] -= v.n[VX]; n[VY] -= v.n[VY]; n[VZ] -= v.n[VZ]; return *this; }
 
-inline vec3& vec3::operator *= ( const float d )
+inline vec3& vec3::operator *= ( const float d ) noexcept
 { n[VX] *= d; n[VY] *= d; n[VZ] *= d; return *this; }
 
-inline vec3& vec3::operator /= ( const float d )
+inline vec3& vec3::operator /= ( const float d ) noexcept
 { float d_inv = 1./d; n[VX] *= d_inv; n[VY] *= d_inv; n[VZ] *= d_inv;
   return *this; }
 
-inline float& vec3::operator [] ( int i) {
+inline float& vec3::operator [] ( int i) noexcept {
     assert(! (i < VX || i > VZ));
     return n[i];
 }
 
-inline float vec3::operator [] ( int i) const {
-    assert(! (i < VX || i > VZ));
-    return n[i];
-}
+inline constexpr float vec3::operator [] ( int i) const noexcept
+{ return ALGEBRA_ASSERT(! (i < VX || i > VZ)), n[i]; }
 
 
 // SPECIAL FUNCTIONS
 
-inline float vec3::length() const
+inline float vec3::length() const noexcept
 {  return sqrt(length2()); }
 
-inline float vec3::length2() const
+inline constexpr float vec3::length2() const noexcept
 {  return n[VX]*n[VX] + n[VY]*n[VY] + n[VZ]*n[VZ]; }
 
-inline vec3& vec3::normalize() // it is up to caller to avoid divide-by-zero
+inline vec3& vec3::normalize() noexcept // it is up to caller to avoid divide-by-zero
+#ifdef ALGEBRA3FASTNORMALIZE
+{ return fastNormalize(); }
+#else
 { *this /= length(); return *this; }
+#endif
+
+inline vec3 vec3::normalized() const noexcept // the same as normalize, on a copy
+{ vec3 v(*this); return v.normalize(); }
 
 inline vec3& vec3::apply(V_FCT_PTR fct)
 { n[VX] = (*fct)(n[VX]); n[VY] = (*fct)(n[VY]); n[VZ] = (*fct)(n[VZ]);
@@ -677,52 +746,141 @@ return *this; }
 
 // FRIENDS
 
-inline vec3 operator - (const vec3& a)
-{  return vec3(-a.n[VX],-a.n[VY],-a.n[VZ]); }
+// expression nodes; operands are held by value, so a node never refers
+// to a temporary that is gone by the time it is evaluated
 
-inline vec3 operator + (const vec3& a, const vec3& b)
-{ return vec3(a.n[VX]+ b.n[VX], a.n[VY] + b.n[VY], a.n[VZ] + b.n[VZ]); }
+template <class A, class B>
+class vec3sum : public vec3expr<vec3sum<A, B> >
+{
+    const A a; const B b;
+public:
+    constexpr vec3sum(const A& a, const B& b) noexcept : a(a), b(b) {}
+    constexpr float operator [] (int i) const noexcept { return a[i] + b[i]; }
+};
 
-inline vec3 operator - (const vec3& a, const vec3& b)
-{ return vec3(a.n[VX]-b.n[VX], a.n[VY]-b.n[VY], a.n[VZ]-b.n[VZ]); }
+template <class A, class B>
+class vec3difference : public vec3expr<vec3difference<A, B> >
+{
+    const A a; const B b;
+public:
+    constexpr vec3difference(const A& a, const B& b) noexcept : a(a), b(b) {}
+    constexpr float operator [] (int i) const noexcept { return a[i] - b[i]; }
+};
 
-inline vec3 operator * (const vec3& a, const float d)
-{ return vec3(d*a.n[VX], d*a.n[VY], d*a.n[VZ]); }
+template <class A>
+class vec3negation : public vec3expr<vec3negation<A> >
+{
+    const A a;
+public:
+    constexpr vec3negation(const A& a) noexcept : a(a) {}
+    constexpr float operator [] (int i) const noexcept { return -a[i]; }
+};
 
-inline vec3 operator * (const float d, const vec3& a)
-{ return a*d; }
+template <class A>
+class vec3scaled : public vec3expr<vec3scaled<A> >
+{
+    const A a; const float d;
+public:
+    constexpr vec3scaled(const A& a, const float d) noexcept : a(a), d(d) {}
+    constexpr float operator [] (int i) const noexcept { return d*a[i]; }
+};
 
-inline vec3 operator * (const mat3& a, const vec3& v) {
+template <class A, class B>
+class vec3product : public vec3expr<vec3product<A, B> >
+{
+    const A a; const B b;
+public:
+    constexpr vec3product(const A& a, const B& b) noexcept : a(a), b(b) {}
+    constexpr float operator [] (int i) const noexcept { return a[i] * b[i]; }
+};
+
+template <class E>
+inline constexpr vec3::vec3(const vec3expr<E>& e) noexcept
+: n{e[VX], e[VY], e[VZ]} {}
+
+template <class E>
+inline float vec3expr<E>::length() const noexcept
+{ return vec3(*this).length(); }
+
+template <class E>
+inline constexpr float vec3expr<E>::length2() const noexcept
+{ return vec3(*this).length2(); }
+
+template <class E>
+inline vec3 vec3expr<E>::normalized() const noexcept
+{ return vec3(*this).normalized(); }
+
+template <class E>
+inline vec3 vec3expr<E>::normalize() const noexcept
+{ return vec3(*this).normalize(); }
+
+template <class E>
+inline vec3 vec3expr<E>::apply(V_FCT_PTR fct) const
+{ return vec3(*this).apply(fct); }
+
+template <class A>
+inline constexpr vec3negation<A> operator - (const vec3expr<A>& a) noexcept
+{ return vec3negation<A>(a.self()); }
+
+template <class A, class B>
+inline constexpr vec3sum<A, B> operator + (const vec3expr<A>& a, const vec3expr<B>& b) noexcept
+{ return vec3sum<A, B>(a.self(), b.self()); }
+
+template <class A, class B>
+inline constexpr vec3difference<A, B> operator - (const vec3expr<A>& a, const vec3expr<B>& b) noexcept
+{ return vec3difference<A, B>(a.self(), b.self()); }
+
+template <class A>
+inline constexpr vec3scaled<A> operator * (const vec3expr<A>& a, const float d) noexcept
+{ return vec3scaled<A>(a.self(), d); }
+
+template <class A>
+inline constexpr vec3scaled<A> operator * (const float d, const vec3expr<A>& a) noexcept
+{ return vec3scaled<A>(a.self(), d); }
+
+// exact matches for a plain vec3, which the templates above only reach
+// through a conversion to its base, as ambiguous as float to vec3 for
+// the dot product
+inline constexpr vec3scaled<vec3> operator * (const vec3& a, const float d) noexcept
+{ return vec3scaled<vec3>(a, d); }
+
+inline constexpr vec3scaled<vec3> operator * (const float d, const vec3& a) noexcept
+{ return vec3scaled<vec3>(a, d); }
+
+template <class A>
+inline constexpr vec3scaled<A> operator / (const vec3expr<A>& a, const float d) noexcept
+{ return a * (float)(1./d); }
+
+template <class A, class B>
+inline constexpr vec3product<A, B> prod(const vec3expr<A>& a, const vec3expr<B>& b) noexcept
+{ return vec3product<A, B>(a.self(), b.self()); }
+
+inline constexpr vec3 operator * (const mat3& a, const vec3& v) noexcept {
 #define ROWCOL(i) a.v[i].n[0]*v.n[VX] + a.v[i].n[1]*v.n[VY] \
     + a.v[i].n[2]*v.n[VZ]
     return vec3(ROWCOL(0), ROWCOL(1), ROWCOL(2));
 #undef ROWCOL // (i)
 }
 
-inline vec3 operator * (const mat4& a, const vec3& v)
+inline constexpr vec3 operator * (const mat4& a, const vec3& v) noexcept
 { return a * vec4(v); }
 
-inline vec3 operator * (const vec3& v, const mat4& a)
+inline constexpr vec3 operator * (const vec3& v, const mat4& a) noexcept
 { return a.transpose() * v; }
 
-inline float operator * (const vec3& a, const vec3& b)
+inline constexpr float operator * (const vec3& a, const vec3& b) noexcept
 { return (a.n[VX]*b.n[VX] + a.n[VY]*b.n[VY] + a.n[VZ]*b.n[VZ]); }
 
-inline vec3 operator / (const vec3& a, const float d)
-{ float d_inv = 1./d; return vec3(a.n[VX]*d_inv, a.n[VY]*d_inv,
-  a.n[VZ]*d_inv); }
+inline constexpr vec3 operator ^ (const vec3& a, const vec3& b) noexcept
+{ return vec3(a.n[VY]*b.n[VZ] - a.n[VZ]*b.n[VY],
+	      a.n[VZ]*b.n[VX] - a.n[VX]*b.n[VZ],
+	      a.n[VX]*b.n[VY] - a.n[VY]*b.n[VX]); }
 
-inline vec3 operator ^ (const vec3& a, const vec3& b) {
-    return vec3(a.n[VY]*b.n[VZ] - a.n[VZ]*b.n[VY],
-		a.n[VZ]*b.n[VX] - a.n[VX]*b.n[VZ],
-		a.n[VX]*b.n[VY] - a.n[VY]*b.n[VX]);
-}
-
-inline int operator == (const vec3& a, const vec3& b)
+inline constexpr int operator == (const vec3& a, const vec3& b) noexcept
 { return (a.n[VX] == b.n[VX]) && (a.n[VY] == b.n[VY]) && (a.n[VZ] == b.n[VZ]);
 }
 
-inline int operator != (const vec3& a, const vec3& b)
+inline constexpr int operator != (const vec3& a, const vec3& b) noexcept
 { return !(a == b); }
 
 #ifdef ALGEBRA3IOSTREAMS
@@ -752,19 +910,17 @@ inline istream& operator >> (istream& s, vec3& v) {
 }
 #endif // ALGEBRA3IOSTREAMS
 
-inline void swap(vec3& a, vec3& b)
+inline void swap(vec3& a, vec3& b) noexcept
 { vec3 tmp(a); a = b; b = tmp; }
 
-inline vec3 min(const vec3& a, const vec3& b)
+inline constexpr vec3 min(const vec3& a, const vec3& b) noexcept
 { return vec3(MIN(a.n[VX], b.n[VX]), MIN(a.n[VY], b.n[VY]), MIN(a.n[VZ],
   b.n[VZ])); }
 
-inline vec3 max(const vec3& a, const vec3& b)
+inline constexpr vec3 max(const vec3& a, const vec3& b) noexcept
 { return vec3(MAX(a.n[VX], b.n[VX]), MAX(a.n[VY], b.n[VY]), MAX(a.n[VZ],
   b.n[VZ])); }
 
-inline vec3 prod(const vec3& a, const vec3& b)
-{ return vec3(a.n[VX] * b.n[VX], a.n[VY] * b.n[VY], a.n[VZ] * b.n[VZ]); }
 
 
 /****************************************************************
@@ -775,66 +931,67 @@ inline vec3 prod(const vec3& a, const vec3& b)
 
 // CONSTRUCTORS
 
-inline vec4::vec4() {}
+inline vec4::vec4() noexcept {}
 
-inline vec4::vec4(const float x, const float y, const float z, const float w)
-{ n[VX] = x; n[VY] = y; n[VZ] = z; n[VW] = w; }
+inline constexpr vec4::vec4(const float x, const float y, const float z, const float w) noexcept
+: n{x, y, z, w} {}
 
-inline vec4::vec4(const float d)
-{  n[VX] = n[VY] = n[VZ] = n[VW] = d; }
+inline constexpr vec4::vec4(const float d) noexcept
+: n{d, d, d, d} {}
 
-inline vec4::vec4(const vec4& v)
-{ n[VX] = v.n[VX]; n[VY] = v.n[VY]; n[VZ] = v.n[VZ]; n[VW] = v.n[VW]; }
+inline constexpr vec4::vec4(const vec4& v) noexcept
+: n{v.n[VX], v.n[VY], v.n[VZ], v.n[VW]} {}
 
-inline vec4::vec4(const vec3& v)
-{ n[VX] = v.n[VX]; n[VY] = v.n[VY]; n[VZ] = v.n[VZ]; n[VW] = 1.0; }
+inline constexpr vec4::vec4(const vec3& v) noexcept
+: n{v.n[VX], v.n[VY], v.n[VZ], 1.0f} {}
 
-inline vec4::vec4(const vec3& v, const float d)
-{ n[VX] = v.n[VX]; n[VY] = v.n[VY]; n[VZ] = v.n[VZ];  n[VW] = d; }
+inline constexpr vec4::vec4(const vec3& v, const float d) noexcept
+: n{v.n[VX], v.n[VY], v.n[VZ], d} {}
 
 
 // ASSIGNMENT OPERATORS
 
-inline vec4& vec4::operator = (const vec4& v)
+inline vec4& vec4::operator = (const vec4& v) noexcept
 { n[VX] = v.n[VX]; n[VY] = v.n[VY]; n[VZ] = v.n[VZ]; n[VW] = v.n[VW];
 return *this; }
 
-inline vec4& vec4::operator += ( const vec4& v )
+inline vec4& vec4::operator += ( const vec4& v ) noexcept
 { n[VX] += v.n[VX]; n[VY] += v.n[VY]; n[VZ] += v.n[VZ]; n[VW] += v.n[VW];
 return *this; }
 
-inline vec4& vec4::operator -= ( const vec4& v )
+inline vec4& vec4::operator -= ( const vec4& v ) noexcept
 { n[VX] -= v.n[VX]; n[VY] -= v.n[VY]; n[VZ] -= v.n[VZ]; n[VW] -= v.n[VW];
 return *this; }
 
-inline vec4& vec4::operator *= ( const float d )
+inline vec4& vec4::operator *= ( const float d ) noexcept
 { n[VX] *= d; n[VY] *= d; n[VZ] *= d; n[VW] *= d; return *this; }
 
-inline vec4& vec4::operator /= ( const float d )
+inline vec4& vec4::operator /= ( const float d ) noexcept
 { float d_inv = 1./d; n[VX] *= d_inv; n[VY] *= d_inv; n[VZ] *= d_inv;
   n[VW] *= d_inv; return *this; }
 
-inline float& vec4::operator [] ( int i) {
+inline float& vec4::operator [] ( int i) noexcept {
     assert(! (i < VX || i > VW));
     return n[i];
 }
 
-inline float vec4::operator [] ( int i) const {
-    assert(! (i < VX || i > VW));
-    return n[i];
-}
+inline constexpr float vec4::operator [] ( int i) const noexcept
+{ return ALGEBRA_ASSERT(! (i < VX || i > VW)), n[i]; }
 
 // SPECIAL FUNCTIONS
 
-inline float vec4::length() const
+inline float vec4::length() const noexcept
 { return sqrt(length2()); }
 
-inline float vec4::length2() const
+inline constexpr float vec4::length2() const noexcept
 { return n[VX]*n[VX] + n[VY]*n[VY] + n[VZ]*n[VZ] + n[VW]*n[VW]; }
 
-inline vec4& vec4::normalize() // it is up to caller to avoid divide-by-zero
+inline vec4& vec4::normalize() noexcept // it is up to caller to avoid divide-by-zero
 { *this /= length(); return *this; }
 
+inline vec4 vec4::normalized() const noexcept // the same as normalize, on a copy
+{ vec4 v(*this); return v.normalize(); }
+
 inline vec4& vec4::apply(V_FCT_PTR fct)
 { n[VX] = (*fct)(n[VX]); n[VY] = (*fct)(n[VY]); n[VZ] = (*fct)(n[VZ]);
 n[VW] = (*fct)(n[VW]); return *this; }
@@ -842,46 +999,45 @@ n[VW] = (*fct)(n[VW]); return *this; }
 
 // FRIENDS
 
-inline vec4 operator - (const vec4& a)
+inline constexpr vec4 operator - (const vec4& a) noexcept
 { return vec4(-a.n[VX],-a.n[VY],-a.n[VZ],-a.n[VW]); }
 
-inline vec4 operator + (const vec4& a, const vec4& b)
+inline constexpr vec4 operator + (const vec4& a, const vec4& b) noexcept
 { return vec4(a.n[VX] + b.n[VX], a.n[VY] + b.n[VY], a.n[VZ] + b.n[VZ],
   a.n[VW] + b.n[VW]); }
 
-inline vec4 operator - (const vec4& a, const vec4& b)
+inline constexpr vec4 operator - (const vec4& a, const vec4& b) noexcept
 {  return vec4(a.n[VX] - b.n[VX], a.n[VY] - b.n[VY], a.n[VZ] - b.n[VZ],
    a.n[VW] - b.n[VW]); }
 
-inline vec4 operator * (const vec4& a, const float d)
+inline constexpr vec4 operator * (const vec4& a, const float d) noexcept
 { return vec4(d*a.n[VX], d*a.n[VY], d*a.n[VZ], d*a.n[VW] ); }
 
-inline vec4 operator * (const float d, const vec4& a)
+inline constexpr vec4 operator * (const float d, const vec4& a) noexcept
 { return a*d; }
 
-inline vec4 operator * (const mat4& a, const vec4& v) {
+inline constexpr vec4 operator * (const mat4& a, const vec4& v) noexcept {
 #define ROWCOL(i) a.v[i].n[0]*v.n[VX] + a.v[i].n[1]*v.n[VY] \
     + a.v[i].n[2]*v.n[VZ] + a.v[i].n[3]*v.n[VW]
     return vec4(ROWCOL(0), ROWCOL(1), ROWCOL(2), ROWCOL(3));
 #undef ROWCOL // (i)
 }
 
-inline vec4 operator * (const vec4& v, const mat4& a)
+inline constexpr vec4 operator * (const vec4& v, const mat4& a) noexcept
 { return a.transpose() * v; }
 
-inline float operator * (const vec4& a, const vec4& b)
+inline constexpr float operator * (const vec4& a, const vec4& b) noexcept
 { return (a.n[VX]*b.n[VX] + a.n[VY]*b.n[VY] + a.n[VZ]*b.n[VZ] +
   a.n[VW]*b.n[VW]); }
 
-inline vec4 operator / (const vec4& a, const float d)
-{ float d_inv = 1./d; return vec4(a.n[VX]*d_inv, a.n[VY]*d_inv, a.n[VZ]*d_inv,
-  a.n[VW]*d_inv); }
+inline constexpr vec4 operator / (const vec4& a, const float d) noexcept
+{ return a * (float)(1./d); }
 
-inline int operator == (const vec4& a, const vec4& b)
+inline constexpr int operator == (const vec4& a, const vec4& b) noexcept
 { return (a.n[VX] == b.n[VX]) && (a.n[VY] == b.n[VY]) && (a.n[VZ] == b.n[VZ])
   && (a.n[VW] == b.n[VW]); }
 
-inline int operator != (const vec4& a, const vec4& b)
+inline constexpr int operator != (const vec4& a, const vec4& b) noexcept
 { return !(a == b); }
 
 #ifdef ALGEBRA3IOSTREAMS
@@ -912,18 +1068,18 @@ inline istream& operator >> (istream& s, vec4& v) {
 }
 #endif // ALGEBRA3IOSTREAMS
 
-inline void swap(vec4& a, vec4& b)
+inline void swap(vec4& a, vec4& b) noexcept
 { vec4 tmp(a); a = b; b = tmp; }
 
-inline vec4 min(const vec4& a, const vec4& b)
+inline constexpr vec4 min(const vec4& a, const vec4& b) noexcept
 { return vec4(MIN(a.n[VX], b.n[VX]), MIN(a.n[VY], b.n[VY]), MIN(a.n[VZ],
   b.n[VZ]), MIN(a.n[VW], b.n[VW])); }
 
-inline vec4 max(const vec4& a, const vec4& b)
+inline constexpr vec4 max(const vec4& a, const vec4& b) noexcept
 { return vec4(MAX(a.n[VX], b.n[VX]), MAX(a.n[VY], b.n[VY]), MAX(a.n[VZ],
   b.n[VZ]), MAX(a.n[VW], b.n[VW])); }
 
-inline vec4 prod(const vec4& a, const vec4& b)
+inline constexpr vec4 prod(const vec4& a, const vec4& b) noexcept
 { return vec4(a.n[VX] * b.n[VX], a.n[VY] * b.n[VY], a.n[VZ] * b.n[VZ],
   a.n[VW] * b.n[VW]); }
 
@@ -936,54 +1092,51 @@ inline vec4 prod(const vec4& a, const vec4& b)
 
 // CONSTRUCTORS
 
-inline mat3::mat3() {}
+inline mat3::mat3() noexcept {}
 
-inline mat3::mat3(const vec3& v0, const vec3& v1, const vec3& v2)
-{ v[0] = v0; v[1] = v1; v[2] = v2; }
+inline constexpr mat3::mat3(const vec3& v0, const vec3& v1, const vec3& v2) noexcept
+: v{v0, v1, v2} {}
 
-inline mat3::mat3(const float d)
-{ v[0] = v[1] = v[2] = vec3(d); }
+inline constexpr mat3::mat3(const float d) noexcept
+: v{vec3(d), vec3(d), vec3(d)} {}
 
-inline mat3::mat3(const mat3& m)
-{ v[0] = m.v[0]; v[1] = m.v[1]; v[2] = m.v[2]; }
+inline constexpr mat3::mat3(const mat3& m) noexcept
+: v{m.v[0], m.v[1], m.v[2]} {}
 
 
 // ASSIGNMENT OPERATORS
 
-inline mat3& mat3::operator = ( const mat3& m )
+inline mat3& mat3::operator = ( const mat3& m ) noexcept
 { v[0] = m.v[0]; v[1] = m.v[1]; v[2] = m.v[2]; return *this; }
 
-inline mat3& mat3::operator += ( const mat3& m )
+inline mat3& mat3::operator += ( const mat3& m ) noexcept
 { v[0] += m.v[0]; v[1] += m.v[1]; v[2] += m.v[2]; return *this; }
 
-inline mat3& mat3::operator -= ( const mat3& m )
+inline mat3& mat3::operator -= ( const mat3& m ) noexcept
 { v[0] -= m.v[0]; v[1] -= m.v[1]; v[2] -= m.v[2]; return *this; }
 
-inline mat3& mat3::operator *= ( const float d )
+inline mat3& mat3::operator *= ( const float d ) noexcept
 { v[0] *= d; v[1] *= d; v[2] *= d; return *this; }
 
-inline mat3& mat3::operator /= ( const float d )
+inline mat3& mat3::operator /= ( const float d ) noexcept
 { v[0] /= d; v[1] /= d; v[2] /= d; return *this; }
 
-inline vec3& mat3::operator [] ( int i) {
+inline vec3& mat3::operator [] ( int i) noexcept {
     assert(! (i < VX || i > VZ));
     return v[i];
 }
 
-inline const vec3& mat3::operator [] ( int i) const {
-    assert(!(i < VX || i > VZ));
-    return v[i];
-}
+inline constexpr const vec3& mat3::operator [] ( int i) const noexcept
+{ return ALGEBRA_ASSERT(!(i < VX || i > VZ)), v[i]; }
 
 // SPECIAL FUNCTIONS
 
-inline mat3 mat3::transpose() const {
-    return mat3(vec3(v[0][0], v[1][0], v[2][0]),
-		vec3(v[0][1], v[1][1], v[2][1]),
-		vec3(v[0][2], v[1][2], v[2][2]));
-}
+inline constexpr mat3 mat3::transpose() const noexcept
+{ return mat3(vec3(v[0][0], v[1][0], v[2][0]),
+	      vec3(v[0][1], v[1][1], v[2][1]),
+	      vec3(v[0][2], v[1][2], v[2][2])); }
 
-inline mat3 mat3::inverse()	const    // Gauss-Jordan elimination with partial pivoting
+inline mat3 mat3::inverse()	const noexcept    // Gauss-Jordan elimination with partial pivoting
     {
     mat3 a(*this),	    // As a evolves from original mat into identity
 	 b(identity2D());   // b evolves from identity into inverse(a)
@@ -1026,16 +1179,16 @@ inline mat3& mat3::apply(V_FCT_PTR fct) {
 
 // FRIENDS
 
-inline mat3 operator - (const mat3& a)
+inline constexpr mat3 operator - (const mat3& a) noexcept
 { return mat3(-a.v[0], -a.v[1], -a.v[2]); }
 
-inline mat3 operator + (const mat3& a, const mat3& b)
+inline constexpr mat3 operator + (const mat3& a, const mat3& b) noexcept
 { return mat3(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2]); }
 
-inline mat3 operator - (const mat3& a, const mat3& b)
+inline constexpr mat3 operator - (const mat3& a, const mat3& b) noexcept
 { return mat3(a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2]); }
 
-inline mat3 operator * (const mat3& a, const mat3& b) {
+inline constexpr mat3 operator * (const mat3& a, const mat3& b) noexcept {
     #define ROWCOL(i, j) \
     a.v[i].n[0]*b.v[0][j] + a.v[i].n[1]*b.v[1][j] + a.v[i].n[2]*b.v[2][j]
     return mat3(vec3(ROWCOL(0,0), ROWCOL(0,1), ROWCOL(0,2)),
@@ -1044,19 +1197,19 @@ inline mat3 operator * (const mat3& a, const mat3& b) {
     #undef ROWCOL // (i, j)
 }
 
-inline mat3 operator * (const mat3& a, const float d)
+inline constexpr mat3 operator * (const mat3& a, const float d) noexcept
 { return mat3(a.v[0] * d, a.v[1] * d, a.v[2] * d); }
 
-inline mat3 operator * (const float d, const mat3& a)
+inline constexpr mat3 operator * (const float d, const mat3& a) noexcept
 { return a*d; }
 
-inline mat3 operator / (const mat3& a, const float d)
+inline constexpr mat3 operator / (const mat3& a, const float d) noexcept
 { return mat3(a.v[0] / d, a.v[1] / d, a.v[2] / d); }
 
-inline int operator == (const mat3& a, const mat3& b)
+inline constexpr int operator == (const mat3& a, const mat3& b) noexcept
 { return (a.v[0] == b.v[0]) && (a.v[1] == b.v[1]) && (a.v[2] == b.v[2]); }
 
-inline int operator != (const mat3& a, const mat3& b)
+inline constexpr int operator != (const mat3& a, const mat3& b) noexcept
 { return !(a == b); }
 
 #ifdef ALGEBRA3IOSTREAMS
@@ -1073,7 +1226,7 @@ inline istream& operator >> (istream& s, mat3& m) {
 }
 #endif // ALGEBRA3IOSTREAMS
 
-inline void swap(mat3& a, mat3& b)
+inline void swap(mat3& a, mat3& b) noexcept
 { mat3 tmp(a); a = b; b = tmp; }
 
 
@@ -1085,58 +1238,55 @@ inline void swap(mat3& a, mat3& b)
 
 // CONSTRUCTORS
 
-inline mat4::mat4() {}
+inline mat4::mat4() noexcept {}
 
-inline mat4::mat4(const vec4& v0, const vec4& v1, const vec4& v2, const vec4& v3)
-{ v[0] = v0; v[1] = v1; v[2] = v2; v[3] = v3; }
+inline constexpr mat4::mat4(const vec4& v0, const vec4& v1, const vec4& v2, const vec4& v3) noexcept
+: v{v0, v1, v2, v3} {}
 
-inline mat4::mat4(const float d)
-{ v[0] = v[1] = v[2] = v[3] = vec4(d); }
+inline constexpr mat4::mat4(const float d) noexcept
+: v{vec4(d), vec4(d), vec4(d), vec4(d)} {}
 
-inline mat4::mat4(const mat4& m)
-{ v[0] = m.v[0]; v[1] = m.v[1]; v[2] = m.v[2]; v[3] = m.v[3]; }
+inline constexpr mat4::mat4(const mat4& m) noexcept
+: v{m.v[0], m.v[1], m.v[2], m.v[3]} {}
 
 
 // ASSIGNMENT OPERATORS
 
-inline mat4& mat4::operator = ( const mat4& m )
+inline mat4& mat4::operator = ( const mat4& m ) noexcept
 { v[0] = m.v[0]; v[1] = m.v[1]; v[2] = m.v[2]; v[3] = m.v[3];
 return *this; }
 
-inline mat4& mat4::operator += ( const mat4& m )
+inline mat4& mat4::operator += ( const mat4& m ) noexcept
 { v[0] += m.v[0]; v[1] += m.v[1]; v[2] += m.v[2]; v[3] += m.v[3];
 return *this; }
 
-inline mat4& mat4::operator -= ( const mat4& m )
+inline mat4& mat4::operator -= ( const mat4& m ) noexcept
 { v[0] -= m.v[0]; v[1] -= m.v[1]; v[2] -= m.v[2]; v[3] -= m.v[3];
 return *this; }
 
-inline mat4& mat4::operator *= ( const float d )
+inline mat4& mat4::operator *= ( const float d ) noexcept
 { v[0] *= d; v[1] *= d; v[2] *= d; v[3] *= d; return *this; }
 
-inline mat4& mat4::operator /= ( const float d )
+inline mat4& mat4::operator /= ( const float d ) noexcept
 { v[0] /= d; v[1] /= d; v[2] /= d; v[3] /= d; return *this; }
 
-inline vec4& mat4::operator [] ( int i) {
+inline vec4& mat4::operator [] ( int i) noexcept {
     assert(! (i < VX || i > VW));
     return v[i];
 }
 
-inline const vec4& mat4::operator [] ( int i) const {
-    assert(! (i < VX || i > VW));
-    return v[i];
-}
+inline constexpr const vec4& mat4::operator [] ( int i) const noexcept
+{ return ALGEBRA_ASSERT(! (i < VX || i > VW)), v[i]; }
 
 // SPECIAL FUNCTIONS;
 
-inline mat4 mat4::transpose() const{
-    return mat4(vec4(v[0][0], v[1][0], v[2][0], v[3][0]),
-		vec4(v[0][1], v[1][1], v[2][1], v[3][1]),
-		vec4(v[0][2], v[1][2], v[2][2], v[3][2]),
-		vec4(v[0][3], v[1][3], v[2][3], v[3][3]));
-}
+inline constexpr mat4 mat4::transpose() const noexcept
+{ return mat4(vec4(v[0][0], v[1][0], v[2][0], v[3][0]),
+	      vec4(v[0][1], v[1][1], v[2][1], v[3][1]),
+	      vec4(v[0][2], v[1][2], v[2][2], v[3][2]),
+	      vec4(v[0][3], v[1][3], v[2][3], v[3][3])); }
 
-inline mat4 mat4::inverse()	const    // Gauss-Jordan elimination with partial pivoting
+inline mat4 mat4::inverse()	const noexcept    // Gauss-Jordan elimination with partial pivoting
 {
     mat4 a(*this),	    // As a evolves from original mat into identity
 	 b(identity3D());   // b evolves from identity into inverse(a)
@@ -1176,18 +1326,18 @@ return *this; }
 
 // FRIENDS
 
-inline mat4 operator - (const mat4& a)
+inline constexpr mat4 operator - (const mat4& a) noexcept
 { return mat4(-a.v[0], -a.v[1], -a.v[2], -a.v[3]); }
 
-inline mat4 operator + (const mat4& a, const mat4& b)
+inline constexpr mat4 operator + (const mat4& a, const mat4& b) noexcept
 { return mat4(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2],
   a.v[3] + b.v[3]);
 }
 
-inline mat4 operator - (const mat4& a, const mat4& b)
+inline constexpr mat4 operator - (const mat4& a, const mat4& b) noexcept
 { return mat4(a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]); }
 
-inline mat4 operator * (const mat4& a, const mat4& b) {
+inline constexpr mat4 operator * (const mat4& a, const mat4& b) noexcept {
     #define ROWCOL(i, j) a.v[i].n[0]*b.v[0][j] + a.v[i].n[1]*b.v[1][j] + \
     a.v[i].n[2]*b.v[2][j] + a.v[i].n[3]*b.v[3][j]
     return mat4(
@@ -1199,20 +1349,20 @@ inline mat4 operator * (const mat4& a, const mat4& b) {
 	#undef ROWCOL
 }
 
-inline mat4 operator * (const mat4& a, const float d)
+inline constexpr mat4 operator * (const mat4& a, const float d) noexcept
 { return mat4(a.v[0] * d, a.v[1] * d, a.v[2] * d, a.v[3] * d); }
 
-inline mat4 operator * (const float d, const mat4& a)
+inline constexpr mat4 operator * (const float d, const mat4& a) noexcept
 { return a*d; }
 
-inline mat4 operator / (const mat4& a, const float d)
+inline constexpr mat4 operator / (const mat4& a, const float d) noexcept
 { return mat4(a.v[0] / d, a.v[1] / d, a.v[2] / d, a.v[3] / d); }
 
-inline int operator == (const mat4& a, const mat4& b)
+inline constexpr int operator == (const mat4& a, const mat4& b) noexcept
 { return ((a.v[0] == b.v[0]) && (a.v[1] == b.v[1]) && (a.v[2] == b.v[2]) &&
   (a.v[3] == b.v[3])); }
 
-inline int operator != (const mat4& a, const mat4& b)
+inline constexpr int operator != (const mat4& a, const mat4& b) noexcept
 { return !(a == b); }
 
 #ifdef ALGEBRA3IOSTREAMS
@@ -1230,27 +1380,56 @@ inline istream& operator >> (istream& s, mat4& m)
 }
 #endif // ALGEBRA3IOSTREAMS
 
-inline void swap(mat4& a, mat4& b)
+inline void swap(mat4& a, mat4& b) noexcept
 { mat4 tmp(a); a = b; b = tmp; }
 
 
+/****************************************************************
+*																*
+*		    affine3 member functions							*
+*																*
+****************************************************************/
+
+inline constexpr affine3::affine3(const mat3& m) noexcept
+: m(m), t(0.0f) {}
+
+inline constexpr affine3::affine3(const mat3& m, const vec3& t) noexcept
+: m(m), t(t) {}
+
+inline constexpr mat4 affine3::matrix() const noexcept
+{ return mat4(vec4(m[VX], t[VX]), vec4(m[VY], t[VY]), vec4(m[VZ], t[VZ]),
+	      vec4(0.0, 0.0, 0.0, 1.0)); }
+
+inline mat3 affine3::normalMatrix() const noexcept // the inverse transpose of m
+{ return m.inverse().transpose(); }
+
+inline affine3 affine3::inverse() const noexcept
+{ mat3 m_inv = m.inverse(); return affine3(m_inv, -(m_inv * t)); }
+
+inline constexpr vec3 operator * (const affine3& a, const vec3& p) noexcept
+{ return a.m * p + a.t; }
+
+inline constexpr affine3 operator * (const affine3& a, const affine3& b) noexcept
+{ return affine3(a.m * b.m, a.m * b.t + a.t); }
+
+
 /****************************************************************
 *																*
 *	       2D functions and 3D functions						*
 *																*
 ****************************************************************/
 
-inline mat3 identity2D()
+inline constexpr mat3 identity2D() noexcept
 {   return mat3(vec3(1.0, 0.0, 0.0),
 		vec3(0.0, 1.0, 0.0),
 		vec3(0.0, 0.0, 1.0)); }
 
-inline mat3 translation2D(const vec2& v)
+inline constexpr mat3 translation2D(const vec2& v) noexcept
 {   return mat3(vec3(1.0, 0.0, v[VX]),
 		vec3(0.0, 1.0, v[VY]),
 		vec3(0.0, 0.0, 1.0)); }
 
-inline mat3 rotation2D(const vec2& Center, const float angleDeg) {
+inline mat3 rotation2D(const vec2& Center, const float angleDeg) noexcept {
     float  angleRad = angleDeg * M_PI / 180.0,
 	    c = cos(angleRad),
 	    s = sin(angleRad);
@@ -1260,24 +1439,24 @@ inline mat3 rotation2D(const vec2& Center, const float angleDeg) {
 		vec3(0.0, 0.0, 1.0));
 }
 
-inline mat3 scaling2D(const vec2& scaleVector)
+inline constexpr mat3 scaling2D(const vec2& scaleVector) noexcept
 {   return mat3(vec3(scaleVector[VX], 0.0, 0.0),
 		vec3(0.0, scaleVector[VY], 0.0),
 		vec3(0.0, 0.0, 1.0)); }
 
-inline mat4 identity3D()
+inline constexpr mat4 identity3D() noexcept
 {   return mat4(vec4(1.0, 0.0, 0.0, 0.0),
 		vec4(0.0, 1.0, 0.0, 0.0),
 		vec4(0.0, 0.0, 1.0, 0.0),
 		vec4(0.0, 0.0, 0.0, 1.0)); }
 
-inline mat4 translation3D(const vec3& v)
+inline constexpr mat4 translation3D(const vec3& v) noexcept
 {   return mat4(vec4(1.0, 0.0, 0.0, v[VX]),
 		vec4(0.0, 1.0, 0.0, v[VY]),
 		vec4(0.0, 0.0, 1.0, v[VZ]),
 		vec4(0.0, 0.0, 0.0, 1.0)); }
 
-inline mat4 rotation3D(vec3 Axis, const float angleDeg) {
+inline mat4 rotation3D(vec3 Axis, const float angleDeg) noexcept {
     float  angleRad = angleDeg * M_PI / 180.0,
 	    c = cos(angleRad),
 	    s = sin(angleRad),
@@ -1299,18 +1478,1097 @@ inline mat4 rotation3D(vec3 Axis, const float angleDeg) {
 		vec4(0.0, 0.0, 0.0, 1.0));
 }
 
-inline mat4 scaling3D(const vec3& scaleVector)
+inline constexpr mat4 scaling3D(const vec3& scaleVector) noexcept
 {   return mat4(vec4(scaleVector[VX], 0.0, 0.0, 0.0),
 		vec4(0.0, scaleVector[VY], 0.0, 0.0),
 		vec4(0.0, 0.0, scaleVector[VZ], 0.0),
 		vec4(0.0, 0.0, 0.0, 1.0)); }
 
-inline mat4 perspective3D(const float d)
+inline constexpr mat4 perspective3D(const float d) noexcept
 {   return mat4(vec4(1.0, 0.0, 0.0, 0.0),
 		vec4(0.0, 1.0, 0.0, 0.0),
 		vec4(0.0, 0.0, 1.0, 0.0),
 		vec4(0.0, 0.0, 1.0/d, 0.0)); }
 
 
+/****************************************************************
+*																*
+*		    SIMD vectors and packets							*
+*																*
+****************************************************************/
+//
+//	vec3a and vec4a hold their components in one 16 byte aligned
+//	SSE register, vec3a with a fourth padding lane that is kept at 0.
+//	The packets vec3x4 and vec3x8 hold 4 or 8 vectors as structures
+//	of arrays: all the x in one register, all the y in another, and
+//	so on, so every operator works on all the vectors at once.
+//	floatx4 and floatx8 are the lanes of a packet, as its dot product
+//	and length return them. The operators compute in the same order
+//	as the ones of vec3, so a packet gives the same results as a loop
+//	over vec3.
+//
+//	Without SSE (or AVX, for floatx8) the types are plain arrays of
+//	floats; define ALGEBRA3NOSIMD to get those anyway. The aligned
+//	types belong in local variables, not in containers that may not
+//	align them.
+//
+//	rsqrt is 1/sqrt from the hardware estimate and one Newton-Raphson
+//	step, within 4 ulp of it (the estimate alone has 12 bits), with
+//	no divide; without SSE it is the exact 1/sqrt. fastNormalize of
+//	vec3 and the packets uses it. Define ALGEBRA3FASTNORMALIZE to
+//	make normalize use it too, everywhere.
+//
+#if !defined(ALGEBRA3NOSIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define ALGEBRA3SSE
+#include <xmmintrin.h>
+#endif
+#if !defined(ALGEBRA3NOSIMD) && defined(__AVX__)
+#define ALGEBRA3AVX
+#include <immintrin.h>
+#endif
+
+class floatx4
+{
+public:
+
+#ifdef ALGEBRA3SSE
+	__m128 v;
+#else
+	float v[4];
+#endif
+
+	enum { LANES = 4 };
+
+// Constructors
+
+floatx4() {}
+floatx4(const float d);							// d in every lane
+floatx4(const float a, const float b, const float c, const float d);
+#ifdef ALGEBRA3SSE
+floatx4(const __m128 m) : v(m) {}
+#endif
+
+// special functions
+
+static floatx4 load(const float* p);			// p[0] to p[3]
+void store(float* p) const;
+static void load3(const float* p, floatx4& x, floatx4& y, floatx4& z);	// 4 x, y, z triples at p
+static void store3(float* p, const floatx4& x, const floatx4& y, const floatx4& z);
+float operator [] (int i) const;				// read-only indexing
+
+// friends
+
+friend floatx4 operator - (const floatx4& a);
+friend floatx4 operator + (const floatx4& a, const floatx4& b);
+friend floatx4 operator - (const floatx4& a, const floatx4& b);
+friend floatx4 operator * (const floatx4& a, const floatx4& b);
+friend floatx4 operator / (const floatx4& a, const floatx4& b);
+friend floatx4 operator > (const floatx4& a, const floatx4& b);	// all bits set in the lanes where a > b
+friend floatx4 select(const floatx4& mask, const floatx4& a, const floatx4& b); // a where mask is set, else b
+friend floatx4 min(const floatx4& a, const floatx4& b);
+friend floatx4 max(const floatx4& a, const floatx4& b);
+friend floatx4 sqrt(const floatx4& a);
+friend floatx4 rsqrt(const floatx4& a);
+};
+
+class floatx8
+{
+public:
+
+#ifdef ALGEBRA3AVX
+	__m256 v;
+#else
+	floatx4 lo, hi;									// lanes 0 to 3, 4 to 7
+#endif
+
+	enum { LANES = 8 };
+
+// Constructors
+
+floatx8() {}
+floatx8(const float d);							// d in every lane
+#ifdef ALGEBRA3AVX
+floatx8(const __m256 m) : v(m) {}
+#else
+floatx8(const floatx4& l, const floatx4& h) : lo(l), hi(h) {}
+#endif
+
+// special functions
+
+static floatx8 load(const float* p);			// p[0] to p[7]
+void store(float* p) const;
+static void load3(const float* p, floatx8& x, floatx8& y, floatx8& z);	// 8 x, y, z triples at p
+static void store3(float* p, const floatx8& x, const floatx8& y, const floatx8& z);
+float operator [] (int i) const;				// read-only indexing
+
+// friends
+
+friend floatx8 operator - (const floatx8& a);
+friend floatx8 operator + (const floatx8& a, const floatx8& b);
+friend floatx8 operator - (const floatx8& a, const floatx8& b);
+friend floatx8 operator * (const floatx8& a, const floatx8& b);
+friend floatx8 operator / (const floatx8& a, const floatx8& b);
+friend floatx8 operator > (const floatx8& a, const floatx8& b);	// all bits set in the lanes where a > b
+friend floatx8 select(const floatx8& mask, const floatx8& a, const floatx8& b); // a where mask is set, else b
+friend floatx8 min(const floatx8& a, const floatx8& b);
+friend floatx8 max(const floatx8& a, const floatx8& b);
+friend floatx8 sqrt(const floatx8& a);
+friend floatx8 rsqrt(const floatx8& a);
+};
+
+float rsqrt(const float x);						// 1 / sqrt(x)
+
+class alignas(16) vec3a
+{
+public:
+
+	floatx4 v;										// x, y, z and 0
+
+// Constructors
+
+vec3a() {}
+vec3a(const float x, const float y, const float z);
+vec3a(const float d);
+vec3a(const vec3& v);							// cast vec3 to vec3a
+vec3a(const floatx4& f) : v(f) {}				// the fourth lane must be 0
+
+// special functions
+
+operator vec3() const;							// cast vec3a to vec3
+float operator [] (int i) const;				// read-only indexing
+float length() const;							// length of a vec3a
+float length2() const;							// squared length of a vec3a
+vec3a& normalize();								// normalize a vec3a in place
+
+// friends
+
+friend vec3a operator - (const vec3a& a);						// -v1
+friend vec3a operator + (const vec3a& a, const vec3a& b);	    // v1 + v2
+friend vec3a operator - (const vec3a& a, const vec3a& b);	    // v1 - v2
+friend vec3a operator * (const vec3a& a, const float d);	    // v1 * 3.0
+friend vec3a operator * (const float d, const vec3a& a);	    // 3.0 * v1
+friend float operator * (const vec3a& a, const vec3a& b);		// dot product
+friend vec3a operator / (const vec3a& a, const float d);	    // v1 / 3.0
+friend vec3a operator ^ (const vec3a& a, const vec3a& b);	    // cross product
+friend vec3a min(const vec3a& a, const vec3a& b);			    // min(v1, v2)
+friend vec3a max(const vec3a& a, const vec3a& b);			    // max(v1, v2)
+friend vec3a prod(const vec3a& a, const vec3a& b);			    // term by term *
+};
+
+class alignas(16) vec4a
+{
+public:
+
+	floatx4 v;
+
+// Constructors
+
+vec4a() {}
+vec4a(const float x, const float y, const float z, const float w);
+vec4a(const float d);
+vec4a(const vec4& v);							// cast vec4 to vec4a
+vec4a(const floatx4& f) : v(f) {}
+
+// special functions
+
+operator vec4() const;							// cast vec4a to vec4
+float operator [] (int i) const;				// read-only indexing
+float length() const;							// length of a vec4a
+float length2() const;							// squared length of a vec4a
+vec4a& normalize();								// normalize a vec4a in place
+
+// friends
+
+friend vec4a operator - (const vec4a& a);						// -v1
+friend vec4a operator + (const vec4a& a, const vec4a& b);	    // v1 + v2
+friend vec4a operator - (const vec4a& a, const vec4a& b);	    // v1 - v2
+friend vec4a operator * (const vec4a& a, const float d);	    // v1 * 3.0
+friend vec4a operator * (const float d, const vec4a& a);	    // 3.0 * v1
+friend float operator * (const vec4a& a, const vec4a& b);		// dot product
+friend vec4a operator / (const vec4a& a, const float d);	    // v1 / 3.0
+friend vec4a min(const vec4a& a, const vec4a& b);			    // min(v1, v2)
+friend vec4a max(const vec4a& a, const vec4a& b);			    // max(v1, v2)
+friend vec4a prod(const vec4a& a, const vec4a& b);			    // term by term *
+};
+
+// A packet of FLOATS::LANES vec3, one register of FLOATS per axis
+template <class FLOATS>
+class vec3packet
+{
+public:
+
+	FLOATS x, y, z;
+
+	enum { LANES = FLOATS::LANES };
+
+// Constructors
+
+vec3packet() {}
+vec3packet(const FLOATS& px, const FLOATS& py, const FLOATS& pz) : x(px), y(py), z(pz) {}
+vec3packet(const vec3& v) : x(v[VX]), y(v[VY]), z(v[VZ]) {}	// v in every lane
+vec3packet(const vec3* v);						// v[0] to v[LANES - 1]
+
+// special functions
+
+void store(vec3* v) const;						// into v[0] to v[LANES - 1]
+vec3 operator [] (int i) const;					// read-only indexing of a lane
+FLOATS length() const;							// lengths of the vectors
+FLOATS length2() const;							// squared lengths of the vectors
+vec3packet& normalize();						// normalize the vectors in place
+vec3packet& fastNormalize();					// the same with rsqrt
+
+// Assignment operators
+
+vec3packet& operator += (const vec3packet& v) { return *this = *this + v; }
+vec3packet& operator -= (const vec3packet& v) { return *this = *this - v; }
+
+// friends
+
+friend vec3packet operator - (const vec3packet& a)
+{ return vec3packet(-a.x, -a.y, -a.z); }
+friend vec3packet operator + (const vec3packet& a, const vec3packet& b)
+{ return vec3packet(a.x + b.x, a.y + b.y, a.z + b.z); }
+friend vec3packet operator - (const vec3packet& a, const vec3packet& b)
+{ return vec3packet(a.x - b.x, a.y - b.y, a.z - b.z); }
+friend vec3packet operator * (const vec3packet& a, const FLOATS& d)	// each vector by its lane of d
+{ return vec3packet(d * a.x, d * a.y, d * a.z); }
+friend vec3packet operator * (const FLOATS& d, const vec3packet& a)
+{ return a * d; }
+friend FLOATS operator * (const vec3packet& a, const vec3packet& b)	// dot products
+{ return a.x * b.x + a.y * b.y + a.z * b.z; }
+friend vec3packet operator / (const vec3packet& a, const FLOATS& d)
+{ FLOATS d_inv = FLOATS(1.0f) / d; return a * d_inv; }
+friend vec3packet operator ^ (const vec3packet& a, const vec3packet& b)	// cross products
+{ return vec3packet(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x); }
+friend vec3packet select(const FLOATS& mask, const vec3packet& a, const vec3packet& b)
+{ return vec3packet(select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z)); }
+friend vec3packet min(const vec3packet& a, const vec3packet& b)
+{ return vec3packet(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z)); }
+friend vec3packet max(const vec3packet& a, const vec3packet& b)
+{ return vec3packet(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z)); }
+friend vec3packet prod(const vec3packet& a, const vec3packet& b)	// term by term *
+{ return vec3packet(a.x * b.x, a.y * b.y, a.z * b.z); }
+};
+
+typedef vec3packet<floatx4> vec3x4;
+typedef vec3packet<floatx8> vec3x8;
+#ifdef ALGEBRA3AVX
+typedef vec3x8 vec3xn;		// the widest packet this target has registers for
+#else
+typedef vec3x4 vec3xn;
+#endif
+
+/****************************************************************
+*																*
+*		    floatx4 and floatx8 member functions				*
+*																*
+****************************************************************/
+
+#ifdef ALGEBRA3SSE
+
+inline floatx4::floatx4(const float d) : v(_mm_set1_ps(d)) {}
+
+inline floatx4::floatx4(const float a, const float b, const float c, const float d)
+: v(_mm_setr_ps(a, b, c, d)) {}
+
+inline floatx4 floatx4::load(const float* p)
+{ return floatx4(_mm_loadu_ps(p)); }
+
+inline void floatx4::store(float* p) const
+{ _mm_storeu_ps(p, v); }
+
+inline void floatx4::load3(const float* p, floatx4& x, floatx4& y, floatx4& z) {
+    __m128 m0 = _mm_loadu_ps(p), m1 = _mm_loadu_ps(p + 4), m2 = _mm_loadu_ps(p + 8);
+    __m128 x2y2x3y3 = _mm_shuffle_ps(m1, m2, _MM_SHUFFLE(2, 1, 3, 2));
+    __m128 y0z0y1z1 = _mm_shuffle_ps(m0, m1, _MM_SHUFFLE(1, 0, 2, 1));
+    x.v = _mm_shuffle_ps(m0, x2y2x3y3, _MM_SHUFFLE(2, 0, 3, 0));
+    y.v = _mm_shuffle_ps(y0z0y1z1, x2y2x3y3, _MM_SHUFFLE(3, 1, 2, 0));
+    z.v = _mm_shuffle_ps(y0z0y1z1, m2, _MM_SHUFFLE(3, 0, 3, 1));
+}
+
+inline void floatx4::store3(float* p, const floatx4& x, const floatx4& y, const floatx4& z) {
+    __m128 x0y0x1y1 = _mm_unpacklo_ps(x.v, y.v), x2y2x3y3 = _mm_unpackhi_ps(x.v, y.v);
+    __m128 z0z0x1x1 = _mm_shuffle_ps(z.v, x0y0x1y1, _MM_SHUFFLE(2, 2, 0, 0));
+    __m128 y1y1z1z1 = _mm_shuffle_ps(x0y0x1y1, z.v, _MM_SHUFFLE(1, 1, 3, 3));
+    __m128 z2z2x3x3 = _mm_shuffle_ps(z.v, x2y2x3y3, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 y3y3z3z3 = _mm_shuffle_ps(x2y2x3y3, z.v, _MM_SHUFFLE(3, 3, 3, 3));
+    _mm_storeu_ps(p, _mm_shuffle_ps(x0y0x1y1, z0z0x1x1, _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storeu_ps(p + 4, _mm_shuffle_ps(y1y1z1z1, x2y2x3y3, _MM_SHUFFLE(1, 0, 2, 0)));
+    _mm_storeu_ps(p + 8, _mm_shuffle_ps(z2z2x3x3, y3y3z3z3, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+inline floatx4 operator - (const floatx4& a)
+{ return floatx4(_mm_xor_ps(a.v, _mm_set1_ps(-0.0f))); }
+
+inline floatx4 operator + (const floatx4& a, const floatx4& b)
+{ return floatx4(_mm_add_ps(a.v, b.v)); }
+
+inline floatx4 operator - (const floatx4& a, const floatx4& b)
+{ return floatx4(_mm_sub_ps(a.v, b.v)); }
+
+inline floatx4 operator * (const floatx4& a, const floatx4& b)
+{ return floatx4(_mm_mul_ps(a.v, b.v)); }
+
+inline floatx4 operator / (const floatx4& a, const floatx4& b)
+{ return floatx4(_mm_div_ps(a.v, b.v)); }
+
+inline floatx4 operator > (const floatx4& a, const floatx4& b)
+{ return floatx4(_mm_cmpgt_ps(a.v, b.v)); }
+
+inline floatx4 select(const floatx4& mask, const floatx4& a, const floatx4& b)
+{ return floatx4(_mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v))); }
+
+inline floatx4 min(const floatx4& a, const floatx4& b)
+{ return floatx4(_mm_min_ps(a.v, b.v)); }
+
+inline floatx4 max(const floatx4& a, const floatx4& b)
+{ return floatx4(_mm_max_ps(a.v, b.v)); }
+
+inline floatx4 sqrt(const floatx4& a)
+{ return floatx4(_mm_sqrt_ps(a.v)); }
+
+inline floatx4 rsqrt(const floatx4& a) {
+    __m128 y = _mm_rsqrt_ps(a.v);
+    __m128 ayy = _mm_mul_ps(_mm_mul_ps(a.v, y), y);
+    return floatx4(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), y), _mm_sub_ps(_mm_set1_ps(3.0f), ayy)));
+}
+
+inline float rsqrt(const float x) {
+    __m128 a = _mm_set_ss(x), y = _mm_rsqrt_ss(a);
+    __m128 ayy = _mm_mul_ss(_mm_mul_ss(a, y), y);
+    return _mm_cvtss_f32(_mm_mul_ss(_mm_mul_ss(_mm_set_ss(0.5f), y), _mm_sub_ss(_mm_set_ss(3.0f), ayy)));
+}
+
+#else // ALGEBRA3SSE
+
+#define LANEWISE(E) floatx4 r; for(int i = 0; i < 4; i++) r.v[i] = (E); return r;
+
+inline floatx4::floatx4(const float d)
+{ v[0] = v[1] = v[2] = v[3] = d; }
+
+inline floatx4::floatx4(const float a, const float b, const float c, const float d)
+{ v[0] = a; v[1] = b; v[2] = c; v[3] = d; }
+
+inline floatx4 floatx4::load(const float* p)
+{ LANEWISE(p[i]) }
+
+inline void floatx4::store(float* p) const
+{ for(int i = 0; i < 4; i++) p[i] = v[i]; }
+
+inline void floatx4::load3(const float* p, floatx4& x, floatx4& y, floatx4& z)
+{ for(int i = 0; i < 4; i++) { x.v[i] = p[3*i]; y.v[i] = p[3*i + 1]; z.v[i] = p[3*i + 2]; } }
+
+inline void floatx4::store3(float* p, const floatx4& x, const floatx4& y, const floatx4& z)
+{ for(int i = 0; i < 4; i++) { p[3*i] = x.v[i]; p[3*i + 1] = y.v[i]; p[3*i + 2] = z.v[i]; } }
+
+inline floatx4 operator - (const floatx4& a)
+{ LANEWISE(-a.v[i]) }
+
+inline floatx4 operator + (const floatx4& a, const floatx4& b)
+{ LANEWISE(a.v[i] + b.v[i]) }
+
+inline floatx4 operator - (const floatx4& a, const floatx4& b)
+{ LANEWISE(a.v[i] - b.v[i]) }
+
+inline floatx4 operator * (const floatx4& a, const floatx4& b)
+{ LANEWISE(a.v[i] * b.v[i]) }
+
+inline floatx4 operator / (const floatx4& a, const floatx4& b)
+{ LANEWISE(a.v[i] / b.v[i]) }
+
+// a NaN mask, which select tells from 0 like the all bits set mask of SSE
+inline floatx4 operator > (const floatx4& a, const floatx4& b)
+{ LANEWISE(a.v[i] > b.v[i] ? sqrtf(-1.0f) : 0.0f) }
+
+inline floatx4 select(const floatx4& mask, const floatx4& a, const floatx4& b)
+{ LANEWISE(mask.v[i] != 0 ? a.v[i] : b.v[i]) }
+
+inline floatx4 min(const floatx4& a, const floatx4& b)
+{ LANEWISE(a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+
+inline floatx4 max(const floatx4& a, const floatx4& b)
+{ LANEWISE(a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+
+inline floatx4 sqrt(const floatx4& a)
+{ LANEWISE(sqrtf(a.v[i])) }
+
+inline floatx4 rsqrt(const floatx4& a)
+{ LANEWISE(1.0f / sqrtf(a.v[i])) }
+
+inline float rsqrt(const float x)
+{ return 1.0f / sqrtf(x); }
+
+#undef LANEWISE
+
+#endif // ALGEBRA3SSE
+
+inline float floatx4::operator [] (int i) const {
+    assert(! (i < 0 || i > 3));
+    float lanes[4];
+    store(lanes);
+    return lanes[i];
+}
+
+#ifdef ALGEBRA3AVX
+
+inline floatx8::floatx8(const float d) : v(_mm256_set1_ps(d)) {}
+
+inline floatx8 floatx8::load(const float* p)
+{ return floatx8(_mm256_loadu_ps(p)); }
+
+inline void floatx8::store(float* p) const
+{ _mm256_storeu_ps(p, v); }
+
+inline void floatx8::load3(const float* p, floatx8& x, floatx8& y, floatx8& z) {
+    floatx4 xl, yl, zl, xh, yh, zh;
+    floatx4::load3(p, xl, yl, zl);
+    floatx4::load3(p + 12, xh, yh, zh);
+    x.v = _mm256_insertf128_ps(_mm256_castps128_ps256(xl.v), xh.v, 1);
+    y.v = _mm256_insertf128_ps(_mm256_castps128_ps256(yl.v), yh.v, 1);
+    z.v = _mm256_insertf128_ps(_mm256_castps128_ps256(zl.v), zh.v, 1);
+}
+
+inline void floatx8::store3(float* p, const floatx8& x, const floatx8& y, const floatx8& z) {
+    floatx4::store3(p, _mm256_castps256_ps128(x.v), _mm256_castps256_ps128(y.v), _mm256_castps256_ps128(z.v));
+    floatx4::store3(p + 12, _mm256_extractf128_ps(x.v, 1), _mm256_extractf128_ps(y.v, 1), _mm256_extractf128_ps(z.v, 1));
+}
+
+inline floatx8 operator - (const floatx8& a)
+{ return floatx8(_mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f))); }
+
+inline floatx8 operator + (const floatx8& a, const floatx8& b)
+{ return floatx8(_mm256_add_ps(a.v, b.v)); }
+
+inline floatx8 operator - (const floatx8& a, const floatx8& b)
+{ return floatx8(_mm256_sub_ps(a.v, b.v)); }
+
+inline floatx8 operator * (const floatx8& a, const floatx8& b)
+{ return floatx8(_mm256_mul_ps(a.v, b.v)); }
+
+inline floatx8 operator / (const floatx8& a, const floatx8& b)
+{ return floatx8(_mm256_div_ps(a.v, b.v)); }
+
+inline floatx8 operator > (const floatx8& a, const floatx8& b)
+{ return floatx8(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+
+inline floatx8 select(const floatx8& mask, const floatx8& a, const floatx8& b)
+{ return floatx8(_mm256_blendv_ps(b.v, a.v, mask.v)); }
+
+inline floatx8 min(const floatx8& a, const floatx8& b)
+{ return floatx8(_mm256_min_ps(a.v, b.v)); }
+
+inline floatx8 max(const floatx8& a, const floatx8& b)
+{ return floatx8(_mm256_max_ps(a.v, b.v)); }
+
+inline floatx8 sqrt(const floatx8& a)
+{ return floatx8(_mm256_sqrt_ps(a.v)); }
+
+inline floatx8 rsqrt(const floatx8& a) {
+    __m256 y = _mm256_rsqrt_ps(a.v);
+    __m256 ayy = _mm256_mul_ps(_mm256_mul_ps(a.v, y), y);
+    return floatx8(_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), y), _mm256_sub_ps(_mm256_set1_ps(3.0f), ayy)));
+}
+
+#else // ALGEBRA3AVX
+
+inline floatx8::floatx8(const float d) : lo(d), hi(d) {}
+
+inline floatx8 floatx8::load(const float* p)
+{ return floatx8(floatx4::load(p), floatx4::load(p + 4)); }
+
+inline void floatx8::store(float* p) const
+{ lo.store(p); hi.store(p + 4); }
+
+inline void floatx8::load3(const float* p, floatx8& x, floatx8& y, floatx8& z)
+{ floatx4::load3(p, x.lo, y.lo, z.lo); floatx4::load3(p + 12, x.hi, y.hi, z.hi); }
+
+inline void floatx8::store3(float* p, const floatx8& x, const floatx8& y, const floatx8& z)
+{ floatx4::store3(p, x.lo, y.lo, z.lo); floatx4::store3(p + 12, x.hi, y.hi, z.hi); }
+
+inline floatx8 operator - (const floatx8& a)
+{ return floatx8(-a.lo, -a.hi); }
+
+inline floatx8 operator + (const floatx8& a, const floatx8& b)
+{ return floatx8(a.lo + b.lo, a.hi + b.hi); }
+
+inline floatx8 operator - (const floatx8& a, const floatx8& b)
+{ return floatx8(a.lo - b.lo, a.hi - b.hi); }
+
+inline floatx8 operator * (const floatx8& a, const floatx8& b)
+{ return floatx8(a.lo * b.lo, a.hi * b.hi); }
+
+inline floatx8 operator / (const floatx8& a, const floatx8& b)
+{ return floatx8(a.lo / b.lo, a.hi / b.hi); }
+
+inline floatx8 operator > (const floatx8& a, const floatx8& b)
+{ return floatx8(a.lo > b.lo, a.hi > b.hi); }
+
+inline floatx8 select(const floatx8& mask, const floatx8& a, const floatx8& b)
+{ return floatx8(select(mask.lo, a.lo, b.lo), select(mask.hi, a.hi, b.hi)); }
+
+inline floatx8 min(const floatx8& a, const floatx8& b)
+{ return floatx8(min(a.lo, b.lo), min(a.hi, b.hi)); }
+
+inline floatx8 max(const floatx8& a, const floatx8& b)
+{ return floatx8(max(a.lo, b.lo), max(a.hi, b.hi)); }
+
+inline floatx8 sqrt(const floatx8& a)
+{ return floatx8(sqrt(a.lo), sqrt(a.hi)); }
+
+inline floatx8 rsqrt(const floatx8& a)
+{ return floatx8(rsqrt(a.lo), rsqrt(a.hi)); }
+
+#endif // ALGEBRA3AVX
+
+inline float floatx8::operator [] (int i) const {
+    assert(! (i < 0 || i > 7));
+    float lanes[8];
+    store(lanes);
+    return lanes[i];
+}
+
+/****************************************************************
+*																*
+*		    vec3a and vec4a member functions					*
+*																*
+****************************************************************/
+
+// horizontal sums, in the order of the scalar dot products
+inline float sum3(const floatx4& f)
+{ float l[4]; f.store(l); return l[0] + l[1] + l[2]; }
+
+inline float sum4(const floatx4& f)
+{ float l[4]; f.store(l); return l[0] + l[1] + l[2] + l[3]; }
+
+inline vec3a::vec3a(const float x, const float y, const float z) : v(x, y, z, 0.0f) {}
+
+inline vec3a::vec3a(const float d) : v(d, d, d, 0.0f) {}
+
+inline vec3a::vec3a(const vec3& a) : v(a[VX], a[VY], a[VZ], 0.0f) {}
+
+inline vec3a::operator vec3() const
+{ float l[4]; v.store(l); return vec3(l[0], l[1], l[2]); }
+
+inline float vec3a::operator [] (int i) const {
+    assert(! (i < VX || i > VZ));
+    return v[i];
+}
+
+inline float vec3a::length() const
+{ return sqrt(length2()); }
+
+inline float vec3a::length2() const
+{ return sum3(v * v); }
+
+inline vec3a& vec3a::normalize() // it is up to caller to avoid divide-by-zero
+{ *this = *this / length(); return *this; }
+
+inline vec3a operator - (const vec3a& a)
+{ return vec3a(-a.v); }
+
+inline vec3a operator + (const vec3a& a, const vec3a& b)
+{ return vec3a(a.v + b.v); }
+
+inline vec3a operator - (const vec3a& a, const vec3a& b)
+{ return vec3a(a.v - b.v); }
+
+inline vec3a operator * (const vec3a& a, const float d)
+{ return vec3a(a.v * floatx4(d)); }
+
+inline vec3a operator * (const float d, const vec3a& a)
+{ return a * d; }
+
+inline float operator * (const vec3a& a, const vec3a& b)
+{ return sum3(a.v * b.v); }
+
+inline vec3a operator / (const vec3a& a, const float d)
+{ float d_inv = 1.0f/d; return a * d_inv; }
+
+inline vec3a operator ^ (const vec3a& a, const vec3a& b) {
+#ifdef ALGEBRA3SSE
+    // a * b.yzx - a.yzx * b is the cross product in the order zxy
+    __m128 a_yzx = _mm_shuffle_ps(a.v.v, a.v.v, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(b.v.v, b.v.v, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a.v.v, b_yzx), _mm_mul_ps(a_yzx, b.v.v));
+    return vec3a(floatx4(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1))));
+#else
+    return vec3a(a[VY] * b[VZ] - a[VZ] * b[VY],
+		 a[VZ] * b[VX] - a[VX] * b[VZ],
+		 a[VX] * b[VY] - a[VY] * b[VX]);
+#endif
+}
+
+inline vec3a min(const vec3a& a, const vec3a& b)
+{ return vec3a(min(a.v, b.v)); }
+
+inline vec3a max(const vec3a& a, const vec3a& b)
+{ return vec3a(max(a.v, b.v)); }
+
+inline vec3a prod(const vec3a& a, const vec3a& b)
+{ return vec3a(a.v * b.v); }
+
+inline vec4a::vec4a(const float x, const float y, const float z, const float w) : v(x, y, z, w) {}
+
+inline vec4a::vec4a(const float d) : v(d) {}
+
+inline vec4a::vec4a(const vec4& a) : v(a[VX], a[VY], a[VZ], a[VW]) {}
+
+inline vec4a::operator vec4() const
+{ float l[4]; v.store(l); return vec4(l[0], l[1], l[2], l[3]); }
+
+inline float vec4a::operator [] (int i) const {
+    assert(! (i < VX || i > VW));
+    return v[i];
+}
+
+inline float vec4a::length() const
+{ return sqrt(length2()); }
+
+inline float vec4a::length2() const
+{ return sum4(v * v); }
+
+inline vec4a& vec4a::normalize() // it is up to caller to avoid divide-by-zero
+{ *this = *this / length(); return *this; }
+
+inline vec4a operator - (const vec4a& a)
+{ return vec4a(-a.v); }
+
+inline vec4a operator + (const vec4a& a, const vec4a& b)
+{ return vec4a(a.v + b.v); }
+
+inline vec4a operator - (const vec4a& a, const vec4a& b)
+{ return vec4a(a.v - b.v); }
+
+inline vec4a operator * (const vec4a& a, const float d)
+{ return vec4a(a.v * floatx4(d)); }
+
+inline vec4a operator * (const float d, const vec4a& a)
+{ return a * d; }
+
+inline float operator * (const vec4a& a, const vec4a& b)
+{ return sum4(a.v * b.v); }
+
+inline vec4a operator / (const vec4a& a, const float d)
+{ float d_inv = 1.0f/d; return a * d_inv; }
+
+inline vec4a min(const vec4a& a, const vec4a& b)
+{ return vec4a(min(a.v, b.v)); }
+
+inline vec4a max(const vec4a& a, const vec4a& b)
+{ return vec4a(max(a.v, b.v)); }
+
+inline vec4a prod(const vec4a& a, const vec4a& b)
+{ return vec4a(a.v * b.v); }
+
+// vec3::fastNormalize needs rsqrt, so it is defined here
+inline vec3& vec3::fastNormalize() noexcept // it is up to caller to avoid divide-by-zero
+{ *this *= rsqrt(length2()); return *this; }
+
+/****************************************************************
+*																*
+*		    vec3x4 and vec3x8 member functions					*
+*																*
+****************************************************************/
+
+// an array of vec3 is read and written as the floats it is made of
+static_assert(sizeof(vec3) == 3 * sizeof(float), "vec3 is not 3 packed floats");
+
+template <class FLOATS>
+inline vec3packet<FLOATS>::vec3packet(const vec3* v)
+{ FLOATS::load3(v->n, x, y, z); }
+
+template <class FLOATS>
+inline void vec3packet<FLOATS>::store(vec3* v) const
+{ FLOATS::store3(v->n, x, y, z); }
+
+template <class FLOATS>
+inline vec3 vec3packet<FLOATS>::operator [] (int i) const
+{ return vec3(x[i], y[i], z[i]); }
+
+template <class FLOATS>
+inline FLOATS vec3packet<FLOATS>::length() const
+{ return sqrt(length2()); }
+
+template <class FLOATS>
+inline FLOATS vec3packet<FLOATS>::length2() const
+{ return x * x + y * y + z * z; }
+
+template <class FLOATS>
+inline vec3packet<FLOATS>& vec3packet<FLOATS>::normalize() // it is up to caller to avoid divide-by-zero
+#ifdef ALGEBRA3FASTNORMALIZE
+{ return fastNormalize(); }
+#else
+{ *this = *this / length(); return *this; }
+#endif
+
+template <class FLOATS>
+inline vec3packet<FLOATS>& vec3packet<FLOATS>::fastNormalize()
+{ *this = *this * rsqrt(length2()); return *this; }
+
+/****************************************************************
+*																*
+*		    Batched transforms									*
+*																*
+****************************************************************/
+//
+//	transformPoints(m, in, out, count) sets out[i] = m * in[i] for
+//	count vectors, m being a mat3, an affine3 or a mat4 (which divides
+//	by w); out may be in itself. The vectors go through in packets,
+//	with the operations of m * v in the same order, so the results
+//	are the same as one vector at a time. From TRANSFORM_PARALLEL_MIN
+//	vectors per thread on, the array is split over the hardware
+//	threads, unless ALGEBRA3NOTHREADS is defined.
+//
+#ifndef ALGEBRA3NOTHREADS
+#include <thread>
+#include <vector>
+#endif
+
+const size_t TRANSFORM_PARALLEL_MIN = 1 << 16;
+
+template <class FLOATS>
+inline vec3packet<FLOATS> operator * (const mat3& a, const vec3packet<FLOATS>& v) {
+#define ROWCOL(i) FLOATS(a[i][0])*v.x + FLOATS(a[i][1])*v.y + FLOATS(a[i][2])*v.z
+    return vec3packet<FLOATS>(ROWCOL(0), ROWCOL(1), ROWCOL(2));
+#undef ROWCOL // (i)
+}
+
+template <class FLOATS>
+inline vec3packet<FLOATS> operator * (const mat4& a, const vec3packet<FLOATS>& v) {
+#define ROWCOL(i) FLOATS(a[i][0])*v.x + FLOATS(a[i][1])*v.y + FLOATS(a[i][2])*v.z \
+    + FLOATS(a[i][3])
+    FLOATS w = ROWCOL(3);
+    return vec3packet<FLOATS>((ROWCOL(0)) / w, (ROWCOL(1)) / w, (ROWCOL(2)) / w);
+#undef ROWCOL // (i)
+}
+
+template <class FLOATS>
+inline vec3packet<FLOATS> operator * (const affine3& a, const vec3packet<FLOATS>& p)
+{ return a.m * p + vec3packet<FLOATS>(a.t); }
+
+template <class M>
+inline void transformRange(const M& m, const vec3* in, vec3* out, size_t begin, size_t end) {
+    size_t i = begin;
+    for(; i + vec3xn::LANES <= end; i += vec3xn::LANES)
+	(m * vec3xn(in + i)).store(out + i);
+    for(; i < end; i++)
+	out[i] = m * in[i];
+}
+
+template <class M>
+inline void transformBatch(const M& m, const vec3* in, vec3* out, size_t count) {
+#ifndef ALGEBRA3NOTHREADS
+    size_t threads = count / TRANSFORM_PARALLEL_MIN;
+    if (threads > 1 && threads > std::thread::hardware_concurrency())
+	threads = std::thread::hardware_concurrency();
+    if (threads > 1) {
+	// whole packets per thread, the calling thread taking the first
+	size_t chunk = (count / threads + vec3xn::LANES - 1) / vec3xn::LANES * vec3xn::LANES;
+	std::vector<std::thread> workers;
+	for (size_t begin = chunk; begin < count; begin += chunk)
+	    workers.push_back(std::thread(transformRange<M>, m, in, out, begin, MIN(begin + chunk, count)));
+	transformRange(m, in, out, 0, chunk);
+	for (size_t i = 0; i < workers.size(); i++)
+	    workers[i].join();
+	return;
+    }
+#endif
+    transformRange(m, in, out, 0, count);
+}
+
+inline void transformPoints(const mat3& m, const vec3* in, vec3* out, size_t count)
+{ transformBatch(m, in, out, count); }
+
+inline void transformPoints(const affine3& a, const vec3* in, vec3* out, size_t count)
+{ transformBatch(a, in, out, count); }
+
+inline void transformPoints(const mat4& m, const vec3* in, vec3* out, size_t count)
+{ transformBatch(m, in, out, count); }
+
+inline void transformNormals(const affine3& a, const vec3* in, vec3* out, size_t count) // not renormalized
+{ transformBatch(a.normalMatrix(), in, out, count); }
+
+/****************************************************************
+*																*
+*		    Precision-templated vectors and matrices			*
+*																*
+****************************************************************/
+//
+//	vec3t<T> and mat3t<T> are vec3 and mat3 over another scalar:
+//	vec3d and mat3d in double, for reference results, and vec3h in
+//	half, to keep large arrays of vectors in half the memory. half is
+//	IEEE binary16 for storage only: it converts to and from float,
+//	rounding to nearest even (with the F16C instructions where the
+//	target has them), and vec3t<half> computes in float and rounds
+//	the results back. vec3 and mat3 themselves stay the float types,
+//	with the packets and expression templates above; vec3_of<T> and
+//	mat3_of<T> name the vector and matrix of a scalar, vec3 and mat3
+//	for float, so that code templated on the scalar gets those.
+//
+//	convertVectors(in, out, count) converts an array of vectors to
+//	another precision.
+//
+#if !defined(ALGEBRA3NOSIMD) && defined(__F16C__)
+#define ALGEBRA3F16C
+#include <immintrin.h>
+#endif
+
+template <class T> class vec3t;
+template <class T> class mat3t;
+
+class half
+{
+public:
+
+	unsigned short bits;
+
+// Constructors
+
+half() noexcept {}
+half(const float f) noexcept : bits(fromFloat(f)) {}		// rounded to nearest even
+
+// special functions
+
+operator float() const noexcept { return toFloat(bits); }
+static unsigned short fromFloat(const float f) noexcept;
+static float toFloat(const unsigned short h) noexcept;
+static void fromFloats(const float* in, half* out, size_t count) noexcept;
+static void toFloats(const half* in, float* out, size_t count) noexcept;
+};
+
+template <class T> struct algebra_real { typedef T type; };	// the scalar T computes in
+template <> struct algebra_real<half> { typedef float type; };
+
+template <class T>
+class vec3t
+{
+public:
+
+	T n[3];
+
+	typedef T value_type;
+	typedef typename algebra_real<T>::type real_type;
+
+// Constructors
+
+vec3t() noexcept {}
+constexpr vec3t(const T x, const T y, const T z) noexcept : n{x, y, z} {}
+constexpr explicit vec3t(const T d) noexcept : n{d, d, d} {}
+constexpr explicit vec3t(const vec3& v) noexcept			// cast vec3 to vec3t
+: n{T(v[VX]), T(v[VY]), T(v[VZ])} {}
+template <class U>
+constexpr explicit vec3t(const vec3t<U>& v) noexcept		// from another precision
+: n{T(v[VX]), T(v[VY]), T(v[VZ])} {}
+
+// Assignment operators
+
+vec3t& operator += ( const vec3t& v ) noexcept { return *this = *this + v; }
+vec3t& operator -= ( const vec3t& v ) noexcept { return *this = *this - v; }
+vec3t& operator *= ( const real_type d ) noexcept { return *this = *this * d; }
+vec3t& operator /= ( const real_type d ) noexcept { return *this = *this / d; }
+T& operator [] ( int i) noexcept { assert(! (i < VX || i > VZ)); return n[i]; }
+constexpr T operator [] ( int i) const noexcept
+{ return ALGEBRA_ASSERT(! (i < VX || i > VZ)), n[i]; }
+
+// special functions
+
+explicit operator vec3() const noexcept				// cast vec3t to vec3
+{ return vec3(float(n[VX]), float(n[VY]), float(n[VZ])); }
+real_type length() const noexcept { return sqrt(length2()); }
+constexpr real_type length2() const noexcept { return *this * *this; }
+vec3t& normalize() noexcept { return *this /= length(); }	// it is up to caller to avoid divide-by-zero
+vec3t normalized() const noexcept { return vec3t(*this).normalize(); }
+
+// friends
+
+friend constexpr vec3t operator - (const vec3t& a) noexcept
+{ return vec3t(-real_type(a.n[VX]), -real_type(a.n[VY]), -real_type(a.n[VZ])); }
+friend constexpr vec3t operator + (const vec3t& a, const vec3t& b) noexcept
+{ return vec3t(real_type(a.n[VX]) + real_type(b.n[VX]), real_type(a.n[VY]) + real_type(b.n[VY]),
+	       real_type(a.n[VZ]) + real_type(b.n[VZ])); }
+friend constexpr vec3t operator - (const vec3t& a, const vec3t& b) noexcept
+{ return vec3t(real_type(a.n[VX]) - real_type(b.n[VX]), real_type(a.n[VY]) - real_type(b.n[VY]),
+	       real_type(a.n[VZ]) - real_type(b.n[VZ])); }
+friend constexpr vec3t operator * (const vec3t& a, const real_type d) noexcept
+{ return vec3t(real_type(a.n[VX]) * d, real_type(a.n[VY]) * d, real_type(a.n[VZ]) * d); }
+friend constexpr vec3t operator * (const real_type d, const vec3t& a) noexcept
+{ return a * d; }
+friend constexpr vec3t operator / (const vec3t& a, const real_type d) noexcept
+{ return a * (real_type(1) / d); }
+friend constexpr real_type operator * (const vec3t& a, const vec3t& b) noexcept	// dot product
+{ return real_type(a.n[VX]) * real_type(b.n[VX]) + real_type(a.n[VY]) * real_type(b.n[VY]) +
+	 real_type(a.n[VZ]) * real_type(b.n[VZ]); }
+friend constexpr vec3t operator ^ (const vec3t& a, const vec3t& b) noexcept	// cross product
+{ return vec3t(real_type(a.n[VY]) * real_type(b.n[VZ]) - real_type(a.n[VZ]) * real_type(b.n[VY]),
+	       real_type(a.n[VZ]) * real_type(b.n[VX]) - real_type(a.n[VX]) * real_type(b.n[VZ]),
+	       real_type(a.n[VX]) * real_type(b.n[VY]) - real_type(a.n[VY]) * real_type(b.n[VX])); }
+friend constexpr vec3t prod(const vec3t& a, const vec3t& b) noexcept		// term by term *
+{ return vec3t(real_type(a.n[VX]) * real_type(b.n[VX]), real_type(a.n[VY]) * real_type(b.n[VY]),
+	       real_type(a.n[VZ]) * real_type(b.n[VZ])); }
+friend constexpr vec3t min(const vec3t& a, const vec3t& b) noexcept
+{ return vec3t(MIN(a.n[VX], b.n[VX]), MIN(a.n[VY], b.n[VY]), MIN(a.n[VZ], b.n[VZ])); }
+friend constexpr vec3t max(const vec3t& a, const vec3t& b) noexcept
+{ return vec3t(MAX(a.n[VX], b.n[VX]), MAX(a.n[VY], b.n[VY]), MAX(a.n[VZ], b.n[VZ])); }
+friend constexpr int operator == (const vec3t& a, const vec3t& b) noexcept
+{ return real_type(a.n[VX]) == real_type(b.n[VX]) && real_type(a.n[VY]) == real_type(b.n[VY]) &&
+	 real_type(a.n[VZ]) == real_type(b.n[VZ]); }
+friend constexpr int operator != (const vec3t& a, const vec3t& b) noexcept
+{ return !(a == b); }
+};
+
+template <class T>
+class mat3t
+{
+protected:
+
+ vec3t<T> v[3];
+
+public:
+
+	typedef T value_type;
+	typedef typename algebra_real<T>::type real_type;
+
+// Constructors
+
+mat3t() noexcept {}
+constexpr mat3t(const vec3t<T>& v0, const vec3t<T>& v1, const vec3t<T>& v2) noexcept : v{v0, v1, v2} {}
+constexpr explicit mat3t(const mat3& m) noexcept			// cast mat3 to mat3t
+: v{vec3t<T>(m[0]), vec3t<T>(m[1]), vec3t<T>(m[2])} {}
+template <class U>
+constexpr explicit mat3t(const mat3t<U>& m) noexcept		// from another precision
+: v{vec3t<T>(m[0]), vec3t<T>(m[1]), vec3t<T>(m[2])} {}
+
+// Assignment operators
+
+vec3t<T>& operator [] ( int i) noexcept { assert(! (i < VX || i > VZ)); return v[i]; }
+constexpr const vec3t<T>& operator [] ( int i) const noexcept
+{ return ALGEBRA_ASSERT(! (i < VX || i > VZ)), v[i]; }
+
+// special functions
+
+explicit operator mat3() const noexcept			// cast mat3t to mat3
+{ return mat3(vec3(v[0]), vec3(v[1]), vec3(v[2])); }
+constexpr mat3t transpose() const noexcept
+{ return mat3t(vec3t<T>(v[0][0], v[1][0], v[2][0]), vec3t<T>(v[0][1], v[1][1], v[2][1]),
+	       vec3t<T>(v[0][2], v[1][2], v[2][2])); }
+
+// friends
+
+friend constexpr vec3t<T> operator * (const mat3t& a, const vec3t<T>& b) noexcept	// linear transform
+{ return vec3t<T>(a.v[0] * b, a.v[1] * b, a.v[2] * b); }
+friend constexpr mat3t operator * (const mat3t& a, const mat3t& b) noexcept		// m1 * m2
+{ return rowsTimesColumns(a, b.transpose()); }
+
+private:
+
+static constexpr mat3t rowsTimesColumns(const mat3t& a, const mat3t& bt) noexcept
+{ return mat3t(vec3t<T>(a.v[0] * bt.v[0], a.v[0] * bt.v[1], a.v[0] * bt.v[2]),
+	       vec3t<T>(a.v[1] * bt.v[0], a.v[1] * bt.v[1], a.v[1] * bt.v[2]),
+	       vec3t<T>(a.v[2] * bt.v[0], a.v[2] * bt.v[1], a.v[2] * bt.v[2])); }
+};
+
+typedef vec3t<half> vec3h;
+typedef vec3t<double> vec3d;
+typedef mat3t<half> mat3h;
+typedef mat3t<double> mat3d;
+
+template <class T> struct vec3_of { typedef vec3t<T> type; };
+template <> struct vec3_of<float> { typedef vec3 type; };
+template <class T> struct mat3_of { typedef mat3t<T> type; };
+template <> struct mat3_of<float> { typedef mat3 type; };
+
+// an array of vec3h is converted as the halves it is made of
+static_assert(sizeof(vec3h) == 3 * sizeof(half), "vec3h is not 3 packed halves");
+
+/****************************************************************
+*																*
+*		    half member functions								*
+*																*
+****************************************************************/
+
+// with float arithmetic, which rounds to nearest even like the
+// conversion should
+inline unsigned short half::fromFloat(const float f) noexcept {
+    union { float f; unsigned u; } bits, magic;
+    bits.f = f;
+    unsigned sign = (bits.u >> 16) & 0x8000;
+    bits.u &= 0x7FFFFFFF;
+    if (bits.u >= 0x47800000)				// 65536 or more: infinity, or NaN
+	return sign | (bits.u > 0x7F800000 ? 0x7E00 : 0x7C00);
+    if (bits.u < 0x38800000) {				// below 2^-14: denormal or 0
+	magic.u = 0x3F000000;				// 0.5, which puts the ulp of the half at bit 0
+	bits.f += magic.f;
+	return sign | (bits.u - magic.u);
+    }
+    unsigned odd = (bits.u >> 13) & 1;
+    bits.u += 0xC8000FFF + odd;				// rebias the exponent, round the mantissa
+    return sign | (bits.u >> 13);
+}
+
+inline float half::toFloat(const unsigned short h) noexcept {
+    union { float f; unsigned u; } bits, magic;
+    bits.u = (h & 0x7FFF) << 13;
+    unsigned exponent = bits.u & 0x0F800000;
+    bits.u += 0x38000000;					// rebias the exponent
+    if (exponent == 0x0F800000)				// infinity or NaN
+	bits.u += 0x38000000;
+    else if (exponent == 0) {				// denormal or 0
+	magic.u = 0x38800000;				// 2^-14
+	bits.u += 1 << 23;
+	bits.f -= magic.f;
+    }
+    bits.u |= (unsigned)(h & 0x8000) << 16;
+    return bits.f;
+}
+
+inline void half::fromFloats(const float* in, half* out, size_t count) noexcept {
+    size_t i = 0;
+#ifdef ALGEBRA3F16C
+    for (; i + 4 <= count; i += 4)
+	_mm_storel_epi64((__m128i*)(out + i), _mm_cvtps_ph(_mm_loadu_ps(in + i), 0));
+#endif
+    for (; i < count; i++)
+	out[i] = half(in[i]);
+}
+
+inline void half::toFloats(const half* in, float* out, size_t count) noexcept {
+    size_t i = 0;
+#ifdef ALGEBRA3F16C
+    for (; i + 4 <= count; i += 4)
+	_mm_storeu_ps(out + i, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)(in + i))));
+#endif
+    for (; i < count; i++)
+	out[i] = in[i];
+}
+
+/****************************************************************
+*																*
+*		    Conversions and transforms of other precisions		*
+*																*
+****************************************************************/
+
+template <class V>
+inline void convertVectors(const V* in, V* out, size_t count) noexcept	// the same precision
+{ for (size_t i = 0; i < count; i++) out[i] = in[i]; }
+
+template <class T>
+inline void convertVectors(const vec3* in, vec3t<T>* out, size_t count) noexcept
+{ for (size_t i = 0; i < count; i++) out[i] = vec3t<T>(in[i]); }
+
+template <class T>
+inline void convertVectors(const vec3t<T>* in, vec3* out, size_t count) noexcept
+{ for (size_t i = 0; i < count; i++) out[i] = vec3(in[i]); }
+
+inline void convertVectors(const vec3* in, vec3h* out, size_t count) noexcept
+{ half::fromFloats(in->n, out->n, 3 * count); }
+
+inline void convertVectors(const vec3h* in, vec3* out, size_t count) noexcept
+{ half::toFloats(in->n, out->n, 3 * count); }
+
+// one vector at a time; the packets are float only
+template <class T>
+inline void transformPoints(const mat3t<T>& m, const vec3t<T>* in, vec3t<T>* out, size_t count)
+{ for (size_t i = 0; i < count; i++) out[i] = m * in[i]; }
+
 #endif // ALGEBRA3H
 
@@ -0,0 +1,390 @@
+// Accuracy of the approximate shading: built by the "Accuracy" target.
+//
+// accuracy [-size n] [-json] [-heatmaps directory] [-heat-scale n]
+//          [-max-error n] [-max-band-flips percent] [-min-psnr db] [-min-ssim s]
+//
+// Renders the scenes of render_bench (both shapes, toon shading on and off, 1 and 4
+// lights of either type) with the exact shading, and again with each approximation
+// of -approx on its own and with all of them. For every scene and approximation it
+// prints a CSV line (or JSON object) with the largest and the mean absolute error of
+// a channel, the PSNR, and the mean SSIM of the luma in 8x8 windows.
+//
+// The float and half precisions of -precision are measured the same way, with the
+// exact shading, against the double precision render of the scene. Their status is
+// only "info": float turns a few pixels on the rim of the sphere black, where
+// 1 - x*x - y*y rounds below 0 and in double it doesn't, so they would fail the max
+// error anyway.
+//
+// With -heatmaps, a png of the error of every pixel is written to the directory. It
+// is black where there is no error, up to white for -heat-scale or more.
+//
+// An approximation fails its case when it is off by more than -max-error somewhere,
+// or is below -min-psnr or -min-ssim; the exit code is then 2. Toon shading rounds to
+// bands 51 apart, so the smallest change can move a pixel on the edge of a band to the
+// next one. In toon scenes such pixels are counted as band flips, which may be up to
+// -max-band-flips percent of the pixels, and the max error is taken over the others.
+// The defaults (4, 0.5%, 40 dB, 0.99) pass every approximation with a margin.
+
+#include <string>
+
+// The renderer core, without the viewer; the target links its library
+#include "../renderer.h"
+#include "bench_scene.h"
+
+using namespace std;
+
+struct AccuracyCase
+{
+    GlobalConfig::SHAPE shape;
+    bool toon;
+    int num_lights;
+    Light::LIGHT_TYPE light_type;
+};
+
+struct AccuracyResult
+{
+    int max_error;              // largest absolute error of a channel, of the pixels that kept their toon band
+    int band_flips;             // pixels that moved to another toon band, 0 without toon shading
+    double mean_error;          // mean absolute error of a channel
+    double psnr;                // in dB, 100 for identical images
+    double ssim;                // mean SSIM of the luma, 1 for identical images
+};
+
+static int accuracy_size = 400;
+static bool accuracy_json = false;
+static const char* accuracy_heatmaps = NULL;
+static int accuracy_heat_scale = 32;
+static int accuracy_max_error = 4;
+static double accuracy_max_band_flips = 0.5;    // percent of the pixels
+static double accuracy_min_psnr = 40;
+static double accuracy_min_ssim = 0.99;
+
+// The difference between the toon bands of toonShade, 5 over [0, 1]
+static const int TOON_BAND_STEP = 255 / 5;
+
+static const char* shapeName(GlobalConfig::SHAPE shape)
+{
+    return shape == GlobalConfig::CUBE ? "cube" : "sphere";
+}
+
+static const char* lightTypeName(Light::LIGHT_TYPE type)
+{
+    return type == Light::DIRECTIONAL_LIGHT ? "directional" : "point";
+}
+
+// The scene of render_bench for the case
+static void setupScene(const AccuracyCase &c, RenderContext &context)
+{
+    setupBenchScene(context, c.shape, c.toon, c.num_lights, c.light_type, accuracy_size, accuracy_size);
+}
+
+static void render(RenderContext &context, unsigned approx, GlobalConfig::PRECISION precision,
+                   vector<unsigned char> &frame_buffer)
+{
+    context.shading.approx = approx;
+    context.shading.precision = precision;
+    prepareShading(context);
+    renderImageToBuffer(context);
+    frame_buffer = context.frame_buffer;
+}
+
+//****************************************************
+// Error kernels: plain loops over contiguous bytes and floats without branches, so the
+// compiler vectorizes them
+//****************************************************
+static void absoluteDifference(const unsigned char* a, const unsigned char* b, unsigned char* out, size_t size)
+{
+    for(size_t i = 0; i < size; i++)
+    {
+        int d = (int)a[i] - (int)b[i];
+        out[i] = (unsigned char)(d < 0 ? -d : d);
+    }
+}
+
+// Sum, sum of squares and maximum of the differences; in blocks small enough for 32 bit sums
+static void sumDifferences(const unsigned char* diff, size_t size, unsigned long long &sum,
+                           unsigned long long &squares, int &maximum)
+{
+    const size_t BLOCK = 4096;
+    sum = 0;
+    squares = 0;
+    maximum = 0;
+    for(size_t start = 0; start < size; start += BLOCK)
+    {
+        size_t end = min(size, start + BLOCK);
+        unsigned block_sum = 0, block_squares = 0;
+        unsigned char block_max = 0;
+        for(size_t i = start; i < end; i++)
+        {
+            unsigned d = diff[i];
+            block_sum += d;
+            block_squares += d * d;
+            block_max = diff[i] > block_max ? diff[i] : block_max;
+        }
+        sum += block_sum;
+        squares += block_squares;
+        if(block_max > maximum) maximum = block_max;
+    }
+}
+
+// Pixels whose largest error of a channel is over half a toon band moved to another band: counts
+// them, and the largest error of the other pixels
+static void toonDifferences(const unsigned char* diff, size_t pixels, int &band_flips, int &maximum)
+{
+    band_flips = 0;
+    maximum = 0;
+    for(size_t i = 0; i < pixels; i++)
+    {
+        int d = max(diff[i * 3], max(diff[i * 3 + 1], diff[i * 3 + 2]));
+        if(d > TOON_BAND_STEP / 2) band_flips++;
+        else if(d > maximum) maximum = d;
+    }
+}
+
+static void toLuma(const unsigned char* rgb, float* luma, size_t pixels)
+{
+    for(size_t i = 0; i < pixels; i++)
+    {
+        luma[i] = 0.299f * rgb[i * 3] + 0.587f * rgb[i * 3 + 1] + 0.114f * rgb[i * 3 + 2];
+    }
+}
+
+// Mean SSIM over 8x8 windows, every 4 pixels
+static double meanSSIM(const float* a, const float* b, int w, int h)
+{
+    const int WINDOW = 8, STEP = 4;
+    const double C1 = (0.01 * 255) * (0.01 * 255), C2 = (0.03 * 255) * (0.03 * 255);
+    double total = 0;
+    int windows = 0;
+    for(int y = 0; y + WINDOW <= h; y += STEP)
+    for(int x = 0; x + WINDOW <= w; x += STEP)
+    {
+        float sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+        for(int wy = 0; wy < WINDOW; wy++)
+        {
+            const float* ra = a + (size_t)(y + wy) * w + x;
+            const float* rb = b + (size_t)(y + wy) * w + x;
+            for(int wx = 0; wx < WINDOW; wx++)
+            {
+                sa += ra[wx];
+                sb += rb[wx];
+                saa += ra[wx] * ra[wx];
+                sbb += rb[wx] * rb[wx];
+                sab += ra[wx] * rb[wx];
+            }
+        }
+        const double n = WINDOW * WINDOW;
+        double ma = sa / n, mb = sb / n;
+        double va = saa / n - ma * ma, vb = sbb / n - mb * mb, cov = sab / n - ma * mb;
+        total += ((2 * ma * mb + C1) * (2 * cov + C2)) / ((ma * ma + mb * mb + C1) * (va + vb + C2));
+        windows++;
+    }
+    return windows ? total / windows : 1;
+}
+
+static AccuracyResult compareImages(const vector<unsigned char> &reference, const vector<unsigned char> &image,
+                                    vector<unsigned char> &diff, int w, int h, bool toon)
+{
+    AccuracyResult result;
+    size_t size = reference.size();
+    diff.resize(size);
+    absoluteDifference(&reference[0], &image[0], &diff[0], size);
+
+    unsigned long long sum, squares;
+    sumDifferences(&diff[0], size, sum, squares, result.max_error);
+    result.band_flips = 0;
+    if(toon) toonDifferences(&diff[0], (size_t)w * h, result.band_flips, result.max_error);
+    result.mean_error = (double)sum / size;
+    double mse = (double)squares / size;
+    result.psnr = mse == 0 ? 100 : min(100.0, 10 * log10(255.0 * 255.0 / mse));
+
+    vector<float> luma_reference((size_t)w * h), luma_image((size_t)w * h);
+    toLuma(&reference[0], &luma_reference[0], (size_t)w * h);
+    toLuma(&image[0], &luma_image[0], (size_t)w * h);
+    result.ssim = meanSSIM(&luma_reference[0], &luma_image[0], w, h);
+    return result;
+}
+
+// The largest error of the channels of each pixel, from black through red and yellow to white
+static void writeHeatmap(const vector<unsigned char> &diff, int w, int h, const string &filepath)
+{
+    vector<unsigned char> heatmap((size_t)w * h * 3);
+    for(size_t i = 0; i < (size_t)w * h; i++)
+    {
+        int d = max(diff[i * 3], max(diff[i * 3 + 1], diff[i * 3 + 2]));
+        float heat = min(1.0f, (float)d / accuracy_heat_scale) * 3;
+        heatmap[i * 3 + 0] = (unsigned char)(255 * min(1.0f, heat));
+        heatmap[i * 3 + 1] = (unsigned char)(255 * max(0.0f, min(1.0f, heat - 1)));
+        heatmap[i * 3 + 2] = (unsigned char)(255 * max(0.0f, min(1.0f, heat - 2)));
+    }
+    unsigned error = lodepng_encode24_file(filepath.c_str(), &heatmap[0], w, h);
+    if(error) fprintf(stderr, "can't write heatmap %s: %s\n", filepath.c_str(), lodepng_error_text(error));
+}
+
+static string approxName(unsigned approx)
+{
+    if(approx == (1u << APPROX_NAME_COUNT) - 1) return "all";
+    for(int k = 0; k < APPROX_NAME_COUNT; k++)
+    {
+        if(approx == 1u << k) return approx_names[k];
+    }
+    return "exact";
+}
+
+// Compares an image with the reference of its scene and prints the line of the case; false if it fails,
+// which only a judged case can
+static bool reportCase(const AccuracyCase &c, unsigned approx, GlobalConfig::PRECISION precision, bool judged,
+                       const vector<unsigned char> &reference, const vector<unsigned char> &image,
+                       vector<unsigned char> &diff, bool first)
+{
+    AccuracyResult result = compareImages(reference, image, diff, accuracy_size, accuracy_size, c.toon);
+    double band_flips_percent = 100.0 * result.band_flips / ((double)accuracy_size * accuracy_size);
+    bool ok = !judged || (result.max_error <= accuracy_max_error && band_flips_percent <= accuracy_max_band_flips &&
+                          result.psnr >= accuracy_min_psnr && result.ssim >= accuracy_min_ssim);
+    const char* status = !judged ? "info" : ok ? "ok" : "fail";
+
+    char key[128];
+    sprintf(key, "%s_%s_%d_%s_%s_%s", shapeName(c.shape), c.toon ? "toon" : "phong", c.num_lights,
+            lightTypeName(c.light_type), precision_names[precision], approxName(approx).c_str());
+    if(accuracy_heatmaps) writeHeatmap(diff, accuracy_size, accuracy_size,
+                                       string(accuracy_heatmaps) + "/" + key + ".png");
+
+    if(accuracy_json)
+    {
+        printf("%s  {\"shape\": \"%s\", \"toon\": %s, \"lights\": %d, \"light_type\": \"%s\", \"size\": %d, "
+               "\"precision\": \"%s\", \"approx\": \"%s\", \"max_error\": %d, \"band_flips\": %d, \"mean_error\": %.4f, "
+               "\"psnr\": %.2f, \"ssim\": %.5f, \"status\": \"%s\"}",
+               first ? "" : ",\n", shapeName(c.shape), c.toon ? "true" : "false", c.num_lights,
+               lightTypeName(c.light_type), accuracy_size, precision_names[precision], approxName(approx).c_str(),
+               result.max_error, result.band_flips, result.mean_error, result.psnr, result.ssim, status);
+    }
+    else
+    {
+        printf("%s,%d,%d,%s,%d,%s,%s,%d,%d,%.4f,%.2f,%.5f,%s\n", shapeName(c.shape), c.toon ? 1 : 0,
+               c.num_lights, lightTypeName(c.light_type), accuracy_size, precision_names[precision],
+               approxName(approx).c_str(), result.max_error, result.band_flips, result.mean_error, result.psnr,
+               result.ssim, status);
+    }
+    fflush(stdout);
+    return ok;
+}
+
+//****************************************************
+// all scenes, approximations and precisions
+//****************************************************
+static int measureAccuracy()
+{
+    const GlobalConfig::SHAPE shapes[] = {GlobalConfig::SPHERE, GlobalConfig::CUBE};
+    const Light::LIGHT_TYPE light_types[] = {Light::POINT_LIGHT, Light::DIRECTIONAL_LIGHT};
+    const int num_lights[] = {1, 4};
+    vector<unsigned> approxes;
+    for(int k = 0; k < APPROX_NAME_COUNT; k++) approxes.push_back(1u << k);
+    approxes.push_back((1u << APPROX_NAME_COUNT) - 1);
+
+    const GlobalConfig::PRECISION precisions[] = {GlobalConfig::PRECISION_FLOAT, GlobalConfig::PRECISION_HALF};
+
+    RenderContext context;
+    vector<unsigned char> reference, image, diff;
+    int failures = 0;
+    bool first = true;
+
+    if(accuracy_json) printf("[\n");
+    else printf("shape,toon,lights,light_type,size,precision,approx,max_error,band_flips,mean_error,psnr,ssim,status\n");
+    for(int s = 0; s < 2; s++)
+    for(int toon = 0; toon < 2; toon++)
+    for(int l = 0; l < 2; l++)
+    for(int lt = 0; lt < 2; lt++)
+    {
+        AccuracyCase c = {shapes[s], toon != 0, num_lights[l], light_types[lt]};
+        setupScene(c, context);
+        render(context, 0, GlobalConfig::PRECISION_FLOAT, reference);
+        for(size_t a = 0; a < approxes.size(); a++)
+        {
+            render(context, approxes[a], GlobalConfig::PRECISION_FLOAT, image);
+            if(!reportCase(c, approxes[a], GlobalConfig::PRECISION_FLOAT, true, reference, image, diff, first)) failures++;
+            first = false;
+        }
+        render(context, 0, GlobalConfig::PRECISION_DOUBLE, reference);
+        for(int p = 0; p < 2; p++)
+        {
+            render(context, 0, precisions[p], image);
+            reportCase(c, 0, precisions[p], false, reference, image, diff, first);
+        }
+    }
+    if(accuracy_json) printf("\n]\n");
+
+    if(failures)
+    {
+        fprintf(stderr, "%d case(s) outside the thresholds (max error %d, band flips %.2f%%, PSNR %.1f dB, SSIM %.3f)\n",
+                failures, accuracy_max_error, accuracy_max_band_flips, accuracy_min_psnr, accuracy_min_ssim);
+        return 2;
+    }
+    return 0;
+}
+
+void parseAccuracyArguments(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-size") && i + 1 < argc)
+        {
+            accuracy_size = atoi(argv[i + 1]);
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-json"))
+        {
+            accuracy_json = true;
+        }
+        else if(!strcmp(argv[i], "-heatmaps") && i + 1 < argc)
+        {
+            accuracy_heatmaps = argv[i + 1];
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-heat-scale") && i + 1 < argc)
+        {
+            accuracy_heat_scale = atoi(argv[i + 1]);
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-max-error") && i + 1 < argc)
+        {
+            accuracy_max_error = atoi(argv[i + 1]);
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-max-band-flips") && i + 1 < argc)
+        {
+            accuracy_max_band_flips = atof(argv[i + 1]);
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-min-psnr") && i + 1 < argc)
+        {
+            accuracy_min_psnr = atof(argv[i + 1]);
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-min-ssim") && i + 1 < argc)
+        {
+            accuracy_min_ssim = atof(argv[i + 1]);
+            i += 1;
+        }
+        else
+        {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    if(accuracy_size <= 0)
+    {
+        fprintf(stderr, "the size must be positive\n");
+        exit(1);
+    }
+    if(accuracy_heat_scale <= 0)
+    {
+        fprintf(stderr, "the heat scale must be positive\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parseAccuracyArguments(argc, argv);
+    return measureAccuracy();
+}
@@ -0,0 +1,37 @@
+// The scene the benchmarks render: the material of the Debug target, and lights
+// around the object. Shared by render_bench, accuracy and lodepng_bench, so that
+// their numbers are of the same images.
+
+#ifndef BENCH_SCENE_H
+#define BENCH_SCENE_H
+
+#include "../renderer.h"
+
+// Sets up context for a w x h image; the precision and prepareShading are left to
+// the caller
+inline void setupBenchScene(RenderContext &context, GlobalConfig::SHAPE shape, bool toon,
+                            int num_lights, Light::LIGHT_TYPE light_type, int w, int h)
+{
+    Material &material = context.material;
+    material.ka = vec3(0.2f, 0.3f, 0.3f);
+    material.kd = vec3(1, 1, 0.5f);
+    material.ks = vec3(1, 1, 1);
+    material.sp = 30;
+
+    context.lights.clear();
+    for(int i = 0; i < num_lights; i++)
+    {
+        Light light;
+        float angle = 2 * PI * i / num_lights;
+        light.posDir = vec3(5 * cos(angle), 5 * sin(angle), 5);
+        light.color = vec3(0.5f / num_lights + 0.1f, 0.3f, 0.6f / num_lights);
+        light.type = light_type;
+        context.lights.push_back(light);
+    }
+
+    context.shading.toon = toon;
+    context.shape = shape;
+    reshape_viewport(w, h, context.viewport);
+}
+
+#endif
@@ -0,0 +1,423 @@
+// Benchmarks for lodepng, timed apart from the renderer: built by the "Bench" target.
+//
+// lodepng_bench [-size w h] [-repeat n] [-codec [-file name.png]...]
+//
+// Prints CSV lines: the time of lodepng_convert for every pair of raw color modes or,
+// with -codec, encode and decode speed, compression ratio and peak memory for every
+// filter strategy and compression setting, over a corpus of images. The corpus has
+// renders of the renderer (the sphere, toon shaded or not, and the cube at 400x400,
+// and the sphere at -size), and a gradient, noise and a flat image at -size. Images
+// saved by the renderer with -save can be added to the corpus with -file.
+//
+// The peak memory is counted by the allocators below, for which the Bench target
+// builds lodepng.cpp with LODEPNG_NO_COMPILE_ALLOCATORS. That object comes before the
+// renderer library in the link, so the copy of lodepng in the library isn't used.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../lodepng.h"
+
+// The renderer core, for the renders of the corpus; the target links its library
+#include "../renderer.h"
+#include "bench_scene.h"
+
+using namespace std;
+
+struct BenchMode
+{
+    LodePNGColorType colortype;
+    unsigned bitdepth;
+    const char* name;
+};
+
+// every valid combination of PNG color type and bit depth
+static const BenchMode bench_modes[] = {
+    {LCT_GREY, 1, "grey1"}, {LCT_GREY, 2, "grey2"}, {LCT_GREY, 4, "grey4"},
+    {LCT_GREY, 8, "grey8"}, {LCT_GREY, 16, "grey16"},
+    {LCT_RGB, 8, "rgb8"}, {LCT_RGB, 16, "rgb16"},
+    {LCT_PALETTE, 1, "palette1"}, {LCT_PALETTE, 2, "palette2"},
+    {LCT_PALETTE, 4, "palette4"}, {LCT_PALETTE, 8, "palette8"},
+    {LCT_GREY_ALPHA, 8, "grey_alpha8"}, {LCT_GREY_ALPHA, 16, "grey_alpha16"},
+    {LCT_RGBA, 8, "rgba8"}, {LCT_RGBA, 16, "rgba16"}
+};
+static const int num_bench_modes = sizeof(bench_modes) / sizeof(bench_modes[0]);
+
+static int bench_w = 1024, bench_h = 1024, bench_repeat = 5;
+static bool bench_codec = false;
+static vector<const char*> bench_files;
+
+#ifdef LODEPNG_NO_COMPILE_ALLOCATORS
+//****************************************************
+// Allocators for lodepng that keep track of the peak memory use
+//****************************************************
+static size_t allocated_bytes = 0, peak_bytes = 0, peak_base = 0;
+
+// every block starts with its size, padded to keep the alignment of malloc
+union AllocHeader
+{
+    size_t size;
+    double align;
+};
+
+void* lodepng_malloc(size_t size)
+{
+    AllocHeader* header = (AllocHeader*)malloc(sizeof(AllocHeader) + size);
+    if(!header) return NULL;
+    header->size = size;
+    allocated_bytes += size;
+    if(allocated_bytes > peak_bytes) peak_bytes = allocated_bytes;
+    return header + 1;
+}
+
+void* lodepng_realloc(void* ptr, size_t new_size)
+{
+    if(!ptr) return lodepng_malloc(new_size);
+    AllocHeader* header = (AllocHeader*)ptr - 1;
+    size_t old_size = header->size;
+    header = (AllocHeader*)realloc(header, sizeof(AllocHeader) + new_size);
+    if(!header) return NULL;
+    header->size = new_size;
+    allocated_bytes += new_size - old_size;
+    if(allocated_bytes > peak_bytes) peak_bytes = allocated_bytes;
+    return header + 1;
+}
+
+void lodepng_free(void* ptr)
+{
+    if(!ptr) return;
+    AllocHeader* header = (AllocHeader*)ptr - 1;
+    allocated_bytes -= header->size;
+    free(header);
+}
+
+// starts counting the peak from what is allocated now
+static void resetPeakMemory()
+{
+    peak_bytes = peak_base = allocated_bytes;
+}
+
+static size_t peakMemory()
+{
+    return peak_bytes - peak_base;
+}
+#else
+static void lodepng_free(void* ptr)
+{
+    free(ptr);
+}
+
+static void resetPeakMemory()
+{
+}
+
+static size_t peakMemory()
+{
+    return 0; // not counted with the allocators of lodepng.cpp
+}
+#endif
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Color mode with a grey ramp palette, so every palette index has a color and
+// palettes of the same size convert to each other
+static void initBenchMode(LodePNGColorMode &mode, const BenchMode &bench_mode)
+{
+    lodepng_color_mode_init(&mode);
+    mode.colortype = bench_mode.colortype;
+    mode.bitdepth = bench_mode.bitdepth;
+    if(mode.colortype == LCT_PALETTE)
+    {
+        unsigned n = 1u << mode.bitdepth;
+        for(unsigned i = 0; i < n; i++)
+        {
+            unsigned char v = (unsigned char)(i * 255 / (n - 1));
+            lodepng_palette_add(&mode, v, v, v, 255);
+        }
+    }
+}
+
+//****************************************************
+// lodepng_convert of every pair of color modes
+//****************************************************
+static void benchConvert()
+{
+    size_t numpixels = (size_t)bench_w * bench_h;
+    printf("bench,from,to,width,height,seconds,mpixels_per_second\n");
+    for(int i = 0; i < num_bench_modes; i++)
+    {
+        LodePNGColorMode mode_in;
+        initBenchMode(mode_in, bench_modes[i]);
+        vector<unsigned char> in(lodepng_get_raw_size(bench_w, bench_h, &mode_in));
+        // a gradient in every byte, palette indices stay within the palette
+        for(size_t k = 0; k < in.size(); k++) in[k] = (unsigned char)(k * 7 + k / 4099);
+
+        for(int j = 0; j < num_bench_modes; j++)
+        {
+            LodePNGColorMode mode_out;
+            initBenchMode(mode_out, bench_modes[j]);
+            vector<unsigned char> out(lodepng_get_raw_size(bench_w, bench_h, &mode_out));
+
+            double best = 1e30;
+            unsigned error = 0;
+            for(int r = 0; r < bench_repeat && !error; r++)
+            {
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                error = lodepng_convert(&out[0], &in[0], &mode_out, &mode_in, bench_w, bench_h);
+                double t = secondsSince(start);
+                if(t < best) best = t;
+            }
+            // converting to a palette needs every color in it, which the other modes don't give
+            if(error) printf("convert,%s,%s,%d,%d,,error %u\n", bench_modes[i].name, bench_modes[j].name,
+                             bench_w, bench_h, error);
+            else printf("convert,%s,%s,%d,%d,%.6f,%.1f\n", bench_modes[i].name, bench_modes[j].name,
+                        bench_w, bench_h, best, numpixels / best / 1e6);
+            lodepng_color_mode_cleanup(&mode_out);
+        }
+        lodepng_color_mode_cleanup(&mode_in);
+    }
+}
+
+//****************************************************
+// The corpus of the codec benchmark: RGB images
+//****************************************************
+struct CorpusImage
+{
+    string name;
+    unsigned w, h;
+    vector<unsigned char> pixels;
+};
+
+// A scene of the benchmarks rendered by the renderer itself, with 4 point lights
+static CorpusImage makeRenderImage(GlobalConfig::SHAPE shape, unsigned w, unsigned h, bool toon)
+{
+    RenderContext context;
+    setupBenchScene(context, shape, toon, 4, Light::POINT_LIGHT, w, h);
+    prepareShading(context);
+    renderImageToBuffer(context);
+
+    CorpusImage image;
+    char name[64];
+    sprintf(name, "render_%s%s_%ux%u", shape == GlobalConfig::CUBE ? "cube" : "sphere", toon ? "_toon" : "", w, h);
+    image.name = name;
+    image.w = w;
+    image.h = h;
+    image.pixels.swap(context.frame_buffer);
+    return image;
+}
+
+static CorpusImage makePatternImage(const char* name, unsigned w, unsigned h)
+{
+    CorpusImage image;
+    image.name = name;
+    image.w = w;
+    image.h = h;
+    image.pixels.resize((size_t)w * h * 3);
+    unsigned random = 1;
+    for(unsigned y = 0; y < h; y++)
+    {
+        for(unsigned x = 0; x < w; x++)
+        {
+            unsigned char* p = &image.pixels[((size_t)y * w + x) * 3];
+            if(!strcmp(name, "gradient"))
+            {
+                p[0] = (unsigned char)(x * 255 / w);
+                p[1] = (unsigned char)(y * 255 / h);
+                p[2] = (unsigned char)((x + y) * 255 / (w + h));
+            }
+            else if(!strcmp(name, "noise"))
+            {
+                for(int c = 0; c < 3; c++)
+                {
+                    random = random * 1103515245 + 12345;
+                    p[c] = (unsigned char)(random >> 16);
+                }
+            }
+            else
+            {
+                p[0] = 40;
+                p[1] = 80;
+                p[2] = 120;
+            }
+        }
+    }
+    return image;
+}
+
+static vector<CorpusImage> makeCorpus()
+{
+    vector<CorpusImage> corpus;
+    corpus.push_back(makeRenderImage(GlobalConfig::SPHERE, 400, 400, false)); // the size the renderer saves
+    corpus.push_back(makeRenderImage(GlobalConfig::SPHERE, 400, 400, true));
+    corpus.push_back(makeRenderImage(GlobalConfig::CUBE, 400, 400, false));
+    corpus.push_back(makeRenderImage(GlobalConfig::SPHERE, bench_w, bench_h, false));
+    corpus.push_back(makePatternImage("gradient", bench_w, bench_h));
+    corpus.push_back(makePatternImage("noise", bench_w, bench_h));
+    corpus.push_back(makePatternImage("flat", bench_w, bench_h));
+    for(size_t i = 0; i < bench_files.size(); i++)
+    {
+        CorpusImage image;
+        unsigned char* pixels = NULL;
+        unsigned error = lodepng_decode24_file(&pixels, &image.w, &image.h, bench_files[i]);
+        if(error)
+        {
+            fprintf(stderr, "can't read %s: %s\n", bench_files[i], lodepng_error_text(error));
+            exit(1);
+        }
+        image.name = bench_files[i];
+        image.pixels.assign(pixels, pixels + (size_t)image.w * image.h * 3);
+        lodepng_free(pixels);
+        corpus.push_back(image);
+    }
+    return corpus;
+}
+
+struct BenchFilter
+{
+    LodePNGFilterStrategy strategy;
+    const char* name;
+};
+
+static const BenchFilter bench_filters[] = {
+    {LFS_ZERO, "zero"}, {LFS_MINSUM, "minsum"}, {LFS_ENTROPY, "entropy"},
+    {LFS_BRUTE_FORCE, "brute_force"}, {LFS_PREDEFINED, "predefined_paeth"}
+};
+static const int num_bench_filters = sizeof(bench_filters) / sizeof(bench_filters[0]);
+
+static const char* bench_compressions[] = {"store", "fixed", "rle", "default", "best"};
+static const int num_bench_compressions = sizeof(bench_compressions) / sizeof(bench_compressions[0]);
+
+static void initCompression(LodePNGCompressSettings &settings, const char* name)
+{
+    lodepng_compress_settings_init(&settings);
+    if(!strcmp(name, "store")) settings.btype = 0;
+    else if(!strcmp(name, "fixed")) settings.btype = 1;
+    else if(!strcmp(name, "rle")) settings.rle = 1;
+    else if(!strcmp(name, "best"))
+    {
+        settings.windowsize = 32768;
+        settings.nicematch = 258;
+    }
+}
+
+//****************************************************
+// encode and decode of the corpus, with every filter strategy and compression setting
+//****************************************************
+static void benchCodec()
+{
+    vector<CorpusImage> corpus = makeCorpus();
+    printf("bench,image,width,height,filter,compression,png_bytes,ratio,"
+           "encode_seconds,encode_mb_per_second,encode_peak_bytes,"
+           "decode_seconds,decode_mb_per_second,decode_peak_bytes\n");
+    for(size_t i = 0; i < corpus.size(); i++)
+    {
+        const CorpusImage &image = corpus[i];
+        double rawmb = image.pixels.size() / 1e6;
+        vector<unsigned char> paeth(image.h, 4);
+        for(int f = 0; f < num_bench_filters; f++)
+        {
+            for(int c = 0; c < num_bench_compressions; c++)
+            {
+                LodePNGState state;
+                lodepng_state_init(&state);
+                state.info_raw.colortype = LCT_RGB;
+                state.encoder.filter_strategy = bench_filters[f].strategy;
+                state.encoder.predefined_filters = &paeth[0];
+                initCompression(state.encoder.zlibsettings, bench_compressions[c]);
+
+                unsigned char* png = NULL;
+                size_t pngsize = 0;
+                double encode_time = 1e30, decode_time = 1e30;
+                size_t encode_peak = 0, decode_peak = 0;
+                unsigned error = 0;
+                // the brute force strategy is too slow to repeat
+                int repeat = bench_filters[f].strategy == LFS_BRUTE_FORCE ? 1 : bench_repeat;
+                for(int r = 0; r < repeat && !error; r++)
+                {
+                    lodepng_free(png);
+                    png = NULL;
+                    resetPeakMemory();
+                    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                    error = lodepng_encode(&png, &pngsize, &image.pixels[0], image.w, image.h, &state);
+                    double t = secondsSince(start);
+                    if(t < encode_time) encode_time = t;
+                    encode_peak = peakMemory();
+                }
+                for(int r = 0; r < repeat && !error; r++)
+                {
+                    unsigned char* decoded = NULL;
+                    unsigned w, h;
+                    resetPeakMemory();
+                    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                    error = lodepng_decode24(&decoded, &w, &h, png, pngsize);
+                    double t = secondsSince(start);
+                    if(t < decode_time) decode_time = t;
+                    decode_peak = peakMemory();
+                    if(!error && memcmp(decoded, &image.pixels[0], image.pixels.size())) error = 1000;
+                    lodepng_free(decoded);
+                }
+                if(error) printf("codec,%s,%u,%u,%s,%s,,,,,,,,error %u\n", image.name.c_str(), image.w, image.h,
+                                 bench_filters[f].name, bench_compressions[c], error);
+                else printf("codec,%s,%u,%u,%s,%s,%lu,%.3f,%.6f,%.1f,%lu,%.6f,%.1f,%lu\n",
+                            image.name.c_str(), image.w, image.h, bench_filters[f].name, bench_compressions[c],
+                            (unsigned long)pngsize, (double)image.pixels.size() / pngsize,
+                            encode_time, rawmb / encode_time, (unsigned long)encode_peak,
+                            decode_time, rawmb / decode_time, (unsigned long)decode_peak);
+                fflush(stdout);
+                lodepng_free(png);
+                lodepng_state_cleanup(&state);
+            }
+        }
+    }
+}
+
+void parseBenchArguments(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-size") && i + 2 < argc)
+        {
+            bench_w = atoi(argv[i + 1]);
+            bench_h = atoi(argv[i + 2]);
+            i += 2;
+        }
+        else if(!strcmp(argv[i], "-repeat") && i + 1 < argc)
+        {
+            bench_repeat = atoi(argv[i + 1]);
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-codec"))
+        {
+            bench_codec = true;
+        }
+        else if(!strcmp(argv[i], "-file") && i + 1 < argc)
+        {
+            bench_files.push_back(argv[i + 1]);
+            i += 1;
+        }
+        else
+        {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    if(bench_w <= 0 || bench_h <= 0 || bench_repeat <= 0)
+    {
+        fprintf(stderr, "size and repeat must be positive\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parseBenchArguments(argc, argv);
+    if(bench_codec) benchCodec();
+    else benchConvert();
+    return 0;
+}
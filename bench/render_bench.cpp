@@ -0,0 +1,378 @@
+// Benchmarks for the renderer: built by the "RenderBench" target.
+//
+// render_bench [-size n]... [-lights n]... [-precision name]... [-threads n] [-repeat n]
+//              [-json] [-baseline file.csv] [-threshold percent] [-trace file.json]
+//
+// Renders the sphere and the cube headlessly with renderImageToBuffer, over every
+// combination of image size, number and type of lights, toon shading on and off,
+// and precision (half, float and double unless -precision picks some), and prints a
+// CSV line (or JSON object) per case. How far the precisions are off is measured by
+// the Accuracy target, not here. Each case is run with 1, 2, 4, ... up to -threads
+// threads, every thread rendering a frame of its own, which gives the scaling of the
+// frame throughput. With -baseline the results are compared to an earlier CSV
+// output, and cases that got slower by more than -threshold percent are flagged; the
+// exit code is then 2. -trace records the spans of all threads as a Chrome trace,
+// like the renderer does.
+
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <string>
+
+// The renderer core, without the viewer; the target links its library
+#include "../renderer.h"
+#include "bench_scene.h"
+
+using namespace std;
+
+struct RenderBenchCase
+{
+    GlobalConfig::SHAPE shape;
+    bool toon;
+    int num_lights;
+    Light::LIGHT_TYPE light_type;
+    int size;
+    int threads;
+    GlobalConfig::PRECISION precision;
+};
+
+struct RenderBenchResult
+{
+    double seconds;             // best time of a frame, per thread
+    double mpixels_per_second;  // image pixels of all threads together
+    double ns_per_shaded_pixel; // per call of computeShadedColor, of all threads together
+    double speedup;             // throughput compared to 1 thread
+};
+
+static vector<int> bench_sizes;
+static vector<int> bench_num_lights;
+static vector<GlobalConfig::PRECISION> bench_precisions;
+static int bench_max_threads = 1, bench_repeat = 3;
+static bool bench_json = false;
+static const char* bench_baseline = NULL;
+static double bench_threshold = 10;
+static TraceRecorder* bench_trace = NULL;    // shared by the contexts of all threads, with -trace
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static const char* shapeName(GlobalConfig::SHAPE shape)
+{
+    return shape == GlobalConfig::CUBE ? "cube" : "sphere";
+}
+
+static const char* lightTypeName(Light::LIGHT_TYPE type)
+{
+    return type == Light::DIRECTIONAL_LIGHT ? "directional" : "point";
+}
+
+// The number of times renderImageToBuffer calls computeShadedColor for a size x size image
+static size_t countShadedPixels(GlobalConfig::SHAPE shape, int size)
+{
+    size_t count = 0;
+    if(shape == GlobalConfig::SPHERE)
+    {
+        int drawRadius = size/2 - 10;
+        for (int i = -drawRadius; i <= drawRadius; i++)
+        {
+            int width = floor(sqrt((float)(drawRadius*drawRadius-i*i)));
+            count += 2*width + 1;
+        }
+    }
+    else
+    {
+        int drawRadius = size/4 - 10;
+        if(drawRadius > 0) count = 3 * (size_t)(2*drawRadius + 1) * (2*drawRadius + 1);
+    }
+    return count;
+}
+
+// The scene of the case, on a context of one thread
+static void setupScene(const RenderBenchCase &c, RenderContext &context)
+{
+    context.trace = bench_trace;
+    setupBenchScene(context, c.shape, c.toon, c.num_lights, c.light_type, c.size, c.size);
+    context.shading.precision = c.precision;
+    prepareShading(context);
+}
+
+// Every thread renders its own frame, with a render context of its own
+static RenderBenchResult runCase(const RenderBenchCase &c)
+{
+    vector<RenderContext> contexts(c.threads);
+    for(int t = 0; t < c.threads; t++) setupScene(c, contexts[t]);
+    double best = 1e30;
+    for(int r = 0; r < bench_repeat; r++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<thread> workers;
+        for(int t = 1; t < c.threads; t++)
+        {
+            workers.push_back(thread(renderImageToBuffer, ref(contexts[t])));
+        }
+        renderImageToBuffer(contexts[0]);
+        for(size_t t = 0; t < workers.size(); t++) workers[t].join();
+        double time = secondsSince(start);
+        if(time < best) best = time;
+    }
+
+    RenderBenchResult result;
+    result.seconds = best;
+    result.mpixels_per_second = (double)c.size * c.size * c.threads / best / 1e6;
+    // an image too small for the shape has no shaded pixels
+    size_t shaded = countShadedPixels(c.shape, c.size);
+    result.ns_per_shaded_pixel = shaded ? best * 1e9 / (shaded * c.threads) : 0;
+    result.speedup = 1;
+    return result;
+}
+
+static string caseKey(const RenderBenchCase &c)
+{
+    char key[128];
+    sprintf(key, "%s,%d,%d,%s,%d,%d,%s", shapeName(c.shape), c.toon ? 1 : 0, c.num_lights,
+            lightTypeName(c.light_type), c.size, c.threads, precision_names[c.precision]);
+    return key;
+}
+
+//****************************************************
+// Baseline: an earlier CSV output, ns_per_shaded_pixel per case
+//****************************************************
+struct BaselineEntry
+{
+    string key;
+    double ns_per_shaded_pixel;
+};
+
+static vector<BaselineEntry> readBaseline(const char* filepath)
+{
+    vector<BaselineEntry> entries;
+    ifstream file(filepath);
+    if(!file)
+    {
+        fprintf(stderr, "can't read baseline %s\n", filepath);
+        exit(1);
+    }
+    string line;
+    while(getline(file, line))
+    {
+        if(!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        // the key is the first 7 fields, ns_per_shaded_pixel the 10th
+        vector<string> fields;
+        size_t start = 0;
+        for(;;)
+        {
+            size_t comma = line.find(',', start);
+            fields.push_back(line.substr(start, comma - start));
+            if(comma == string::npos) break;
+            start = comma + 1;
+        }
+        if(fields.size() < 10 || fields[0] == "shape") continue;
+        BaselineEntry entry;
+        entry.key = fields[0];
+        for(int i = 1; i < 7; i++) entry.key += "," + fields[i];
+        entry.ns_per_shaded_pixel = atof(fields[9].c_str());
+        entries.push_back(entry);
+    }
+    return entries;
+}
+
+static const BaselineEntry* findBaseline(const vector<BaselineEntry> &entries, const string &key)
+{
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        if(entries[i].key == key) return &entries[i];
+    }
+    return NULL;
+}
+
+//****************************************************
+// all cases of the matrix
+//****************************************************
+static int benchRender()
+{
+    vector<BaselineEntry> baseline;
+    if(bench_baseline) baseline = readBaseline(bench_baseline);
+
+    vector<int> thread_counts;
+    for(int t = 1; t < bench_max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(bench_max_threads);
+
+    const GlobalConfig::SHAPE shapes[] = {GlobalConfig::SPHERE, GlobalConfig::CUBE};
+    const Light::LIGHT_TYPE light_types[] = {Light::POINT_LIGHT, Light::DIRECTIONAL_LIGHT};
+    int regressions = 0;
+    bool first = true;
+
+    if(bench_json) printf("[\n");
+    else printf("shape,toon,lights,light_type,size,threads,precision,seconds,mpixels_per_second,ns_per_shaded_pixel,speedup%s\n",
+                bench_baseline ? ",baseline_ns_per_shaded_pixel,change_percent,status" : "");
+    for(int s = 0; s < 2; s++)
+    for(int toon = 0; toon < 2; toon++)
+    for(size_t l = 0; l < bench_num_lights.size(); l++)
+    for(int lt = 0; lt < 2; lt++)
+    for(size_t z = 0; z < bench_sizes.size(); z++)
+    for(size_t p = 0; p < bench_precisions.size(); p++)
+    {
+        double single_thread = 0;
+        for(size_t t = 0; t < thread_counts.size(); t++)
+        {
+            RenderBenchCase c = {shapes[s], toon != 0, bench_num_lights[l], light_types[lt], bench_sizes[z], thread_counts[t],
+                                 bench_precisions[p]};
+            RenderBenchResult result = runCase(c);
+            if(t == 0) single_thread = result.mpixels_per_second;
+            result.speedup = result.mpixels_per_second / single_thread;
+
+            const BaselineEntry* base = bench_baseline ? findBaseline(baseline, caseKey(c)) : NULL;
+            double change = base && base->ns_per_shaded_pixel > 0 ? (result.ns_per_shaded_pixel / base->ns_per_shaded_pixel - 1) * 100 : 0;
+            const char* status = !base ? "new" : change > bench_threshold ? "regression" : "ok";
+            if(base && change > bench_threshold) regressions++;
+
+            if(bench_json)
+            {
+                printf("%s  {\"shape\": \"%s\", \"toon\": %s, \"lights\": %d, \"light_type\": \"%s\", \"size\": %d, "
+                       "\"threads\": %d, \"precision\": \"%s\", \"seconds\": %.6f, \"mpixels_per_second\": %.3f, "
+                       "\"ns_per_shaded_pixel\": %.2f, \"speedup\": %.2f",
+                       first ? "" : ",\n", shapeName(c.shape), c.toon ? "true" : "false", c.num_lights,
+                       lightTypeName(c.light_type), c.size, c.threads, precision_names[c.precision], result.seconds,
+                       result.mpixels_per_second, result.ns_per_shaded_pixel, result.speedup);
+                if(base) printf(", \"baseline_ns_per_shaded_pixel\": %.2f, \"change_percent\": %.1f",
+                                base->ns_per_shaded_pixel, change);
+                if(bench_baseline) printf(", \"status\": \"%s\"", status);
+                printf("}");
+            }
+            else
+            {
+                printf("%s,%.6f,%.3f,%.2f,%.2f", caseKey(c).c_str(), result.seconds,
+                       result.mpixels_per_second, result.ns_per_shaded_pixel, result.speedup);
+                if(base) printf(",%.2f,%.1f,%s", base->ns_per_shaded_pixel, change, status);
+                else if(bench_baseline) printf(",,,%s", status);
+                printf("\n");
+            }
+            first = false;
+            fflush(stdout);
+        }
+    }
+    if(bench_json) printf("\n]\n");
+
+    if(regressions)
+    {
+        fprintf(stderr, "%d case(s) more than %.1f%% slower than the baseline\n", regressions, bench_threshold);
+        return 2;
+    }
+    return 0;
+}
+
+void parseBenchArguments(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-size") && i + 1 < argc)
+        {
+            bench_sizes.push_back(atoi(argv[i + 1]));
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-lights") && i + 1 < argc)
+        {
+            bench_num_lights.push_back(atoi(argv[i + 1]));
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-precision") && i + 1 < argc)
+        {
+            int k = 0;
+            while(k < 3 && strcmp(argv[i + 1], precision_names[k])) k++;
+            if(k == 3)
+            {
+                fprintf(stderr, "unknown precision %s\n", argv[i + 1]);
+                exit(1);
+            }
+            bench_precisions.push_back((GlobalConfig::PRECISION)k);
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-threads") && i + 1 < argc)
+        {
+            bench_max_threads = atoi(argv[i + 1]);
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-repeat") && i + 1 < argc)
+        {
+            bench_repeat = atoi(argv[i + 1]);
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-json"))
+        {
+            bench_json = true;
+        }
+        else if(!strcmp(argv[i], "-baseline") && i + 1 < argc)
+        {
+            bench_baseline = argv[i + 1];
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-threshold") && i + 1 < argc)
+        {
+            bench_threshold = atof(argv[i + 1]);
+            i += 1;
+        }
+        else if(!strcmp(argv[i], "-trace") && i + 1 < argc)
+        {
+            globalConfig.trace.filepath = argv[i + 1];
+            i += 1;
+        }
+        else
+        {
+            fprintf(stderr, "unknown argument %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    if(bench_sizes.empty())
+    {
+        bench_sizes.push_back(200);
+        bench_sizes.push_back(400);
+        bench_sizes.push_back(800);
+    }
+    if(bench_num_lights.empty())
+    {
+        bench_num_lights.push_back(1);
+        bench_num_lights.push_back(4);
+    }
+    if(bench_precisions.empty())
+    {
+        bench_precisions.push_back(GlobalConfig::PRECISION_HALF);
+        bench_precisions.push_back(GlobalConfig::PRECISION_FLOAT);
+        bench_precisions.push_back(GlobalConfig::PRECISION_DOUBLE);
+    }
+    for(size_t i = 0; i < bench_sizes.size(); i++)
+    {
+        if(bench_sizes[i] <= 0)
+        {
+            fprintf(stderr, "sizes must be positive\n");
+            exit(1);
+        }
+    }
+    for(size_t i = 0; i < bench_num_lights.size(); i++)
+    {
+        if(bench_num_lights[i] <= 0)
+        {
+            fprintf(stderr, "the number of lights must be positive\n");
+            exit(1);
+        }
+    }
+    if(bench_max_threads <= 0 || bench_repeat <= 0)
+    {
+        fprintf(stderr, "threads and repeat must be positive\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parseBenchArguments(argc, argv);
+    if(globalConfig.trace.filepath) bench_trace = newTrace();
+    int status = benchRender();
+    if(bench_trace)
+    {
+        writeTrace(bench_trace, globalConfig.trace.filepath);
+        deleteTrace(bench_trace);
+    }
+    return status;
+}
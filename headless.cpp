@@ -0,0 +1,26 @@
+// The renderer without a window: built by the "Headless" target, which links the renderer core
+// (renderer.h, the "Core" target) and not GL, GLU, GLUT or GLUI, so it starts without loading them.
+//
+// render [arguments of the viewer]
+//
+// Takes the arguments of the viewer (main.cpp), renders the scene once, saves it with -save and
+// runs the checks of -compare and -budget, as the viewer does with -no-display; -no-display is
+// taken and changes nothing. The exit code is 1 if a check fails.
+
+#include "renderer.h"
+
+int main(int argc, char *argv[])
+{
+    RenderContext context;
+    parseArguments(argc, argv, context);
+    prepareShading(context);
+    initStats(context);
+    initTrace(context);
+
+    reshape_viewport(400, 400, context.viewport);
+
+    int failed = renderOnce(context);
+    finishStats(context);
+    finishTrace(context);
+    return failed;
+}
@@ -34,6 +34,44 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdio.h>
 #include <stdlib.h>
 
+/*memory mapped reading of PNG files, used by the decode from file functions when the platform has it*/
+#if defined(LODEPNG_COMPILE_DISK) && defined(LODEPNG_COMPILE_DECODER) && !defined(LODEPNG_NO_COMPILE_MMAP)
+#if defined(_WIN32)
+#define LODEPNG_MMAP_WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#define LODEPNG_MMAP_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif
+
+/*the saved PNG is written to a new temporary file that replaces an existing file in one step, see
+lodepng_encode_file_state*/
+#if defined(LODEPNG_COMPILE_DISK) && defined(LODEPNG_COMPILE_ENCODER)
+#if defined(_WIN32)
+#define LODEPNG_REPLACE_WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <sys/stat.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#define LODEPNG_REPLACE_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <errno.h>
+#endif
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -207,6 +245,9 @@ typedef struct ucvector
   unsigned char* data;
   size_t size; /*used size*/
   size_t allocsize; /*allocated size*/
+  /*if true, data is a buffer of the user of allocsize bytes: it is never reallocated, growing past it fails*/
+  unsigned fixed;
+  unsigned overflow; /*set when growing a fixed vector failed, so that it can't go unnoticed*/
 } ucvector;
 
 /*returns 1 if success, 0 if failure ==> nothing done*/
@@ -214,8 +255,15 @@ static unsigned ucvector_reserve(ucvector* p, size_t allocsize)
 {
   if(allocsize > p->allocsize)
   {
-    size_t newsize = (allocsize > p->allocsize * 2) ? allocsize : (allocsize * 3 / 2);
-    void* data = lodepng_realloc(p->data, newsize);
+    size_t newsize;
+    void* data;
+    if(p->fixed)
+    {
+      p->overflow = 1;
+      return 0; /*error: the user's buffer is too small*/
+    }
+    newsize = (allocsize > p->allocsize * 2) ? allocsize : (allocsize * 3 / 2);
+    data = lodepng_realloc(p->data, newsize);
     if(data)
     {
       p->allocsize = newsize;
@@ -247,6 +295,7 @@ static void ucvector_init(ucvector* p)
 {
   p->data = NULL;
   p->size = p->allocsize = 0;
+  p->fixed = p->overflow = 0;
 }
 #endif /*LODEPNG_COMPILE_PNG*/
 
@@ -257,6 +306,7 @@ static void ucvector_init_buffer(ucvector* p, unsigned char* buffer, size_t size
 {
   p->data = buffer;
   p->allocsize = p->size = size;
+  p->fixed = p->overflow = 0;
 }
 #endif /*LODEPNG_COMPILE_ZLIB*/
 
@@ -336,7 +386,8 @@ static void lodepng_set32bitInt(unsigned char* buffer, unsigned value)
 #ifdef LODEPNG_COMPILE_ENCODER
 static void lodepng_add32bitInt(ucvector* buffer, unsigned value)
 {
-  ucvector_resize(buffer, buffer->size + 4); /*todo: give error if resize failed*/
+  /*todo: give error if resize failed. A failure on a fixed buffer is still seen through its overflow flag*/
+  if(!ucvector_resize(buffer, buffer->size + 4)) return;
   lodepng_set32bitInt(&buffer->data[buffer->size - 4], value);
 }
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -396,6 +447,96 @@ unsigned lodepng_load_file(unsigned char** out, size_t* outsize, const char* fil
   return lodepng_buffer_file(*out, (size_t)size, filename);
 }
 
+#ifdef LODEPNG_COMPILE_DECODER
+/*Read-only view of a whole file. data points into a memory mapping of the file when mapping
+worked, else into a buffer filled by lodepng_load_file, which is then also set as loaded.*/
+typedef struct FileView
+{
+  const unsigned char* data;
+  size_t size;
+  unsigned char* loaded;
+} FileView;
+
+/*Maps the file at filename into memory, returns 0 if this platform or this file can't be mapped*/
+static unsigned file_view_map(FileView* view, const char* filename)
+{
+#if defined(LODEPNG_MMAP_POSIX)
+  struct stat st;
+  void* data;
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) return 0;
+  /*empty files and non regular files such as pipes can't be mapped, they use the fallback*/
+  if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0
+     || (off_t)(size_t)st.st_size != st.st_size)
+  {
+    close(fd);
+    return 0;
+  }
+  data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); /*the mapping stays valid after closing the descriptor*/
+  if(data == MAP_FAILED) return 0;
+#ifdef MADV_SEQUENTIAL
+  madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL); /*only a hint, the result doesn't matter*/
+#endif
+  view->data = (const unsigned char*)data;
+  view->size = (size_t)st.st_size;
+  return 1;
+#elif defined(LODEPNG_MMAP_WIN32)
+  LARGE_INTEGER filesize;
+  HANDLE mapping;
+  void* data;
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+  if(file == INVALID_HANDLE_VALUE) return 0;
+  if(!GetFileSizeEx(file, &filesize) || filesize.QuadPart <= 0
+     || (LONGLONG)(size_t)filesize.QuadPart != filesize.QuadPart)
+  {
+    CloseHandle(file);
+    return 0;
+  }
+  mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+  CloseHandle(file);
+  if(!mapping) return 0;
+  data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping); /*the view keeps the mapping alive*/
+  if(!data) return 0;
+  view->data = (const unsigned char*)data;
+  view->size = (size_t)filesize.QuadPart;
+  return 1;
+#else /*no memory mapping on this platform*/
+  (void)view;
+  (void)filename;
+  return 0;
+#endif
+}
+
+/*Opens the file for reading: memory mapped if possible, else loaded with lodepng_load_file. Returns error code.*/
+static unsigned file_view_open(FileView* view, const char* filename)
+{
+  unsigned error;
+  view->data = 0;
+  view->size = 0;
+  view->loaded = 0;
+  if(file_view_map(view, filename)) return 0;
+  error = lodepng_load_file(&view->loaded, &view->size, filename);
+  view->data = view->loaded;
+  return error;
+}
+
+static void file_view_close(FileView* view)
+{
+  if(view->loaded) lodepng_free(view->loaded);
+#if defined(LODEPNG_MMAP_POSIX)
+  else if(view->data) munmap((void*)view->data, view->size);
+#elif defined(LODEPNG_MMAP_WIN32)
+  else if(view->data) UnmapViewOfFile(view->data);
+#endif
+  view->data = 0;
+  view->loaded = 0;
+  view->size = 0;
+}
+#endif /*LODEPNG_COMPILE_DECODER*/
+
 /*write given buffer to the file, overwriting the file, it doesn't append to it.*/
 unsigned lodepng_save_file(const unsigned char* buffer, size_t buffersize, const char* filename)
 {
@@ -442,25 +583,120 @@ static void addBitsToStreamReversed(size_t* bitpointer, ucvector* bitstream, uns
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-#define READBIT(bitpointer, bitstream) ((bitstream[bitpointer >> 3] >> (bitpointer & 0x7)) & (unsigned char)1)
+/*
+Bit reader for the inflator. Instead of fetching one bit at a time, up to 8 bytes
+of the input are loaded at once into a 64-bit buffer, and the decoder peeks at and
+consumes bits from that buffer. Bits past the end of the input read as zero, the
+decoder detects this afterwards by checking bp against bitsize.
+*/
+typedef unsigned long long lodepng_bitbuf; /*must have at least 64 bits*/
+
+typedef struct LodePNGBitReader
+{
+  const unsigned char* data;
+  size_t size; /*size of data in bytes*/
+  size_t bitsize; /*size of data in bits, end of valid bp values, should be 8*size*/
+  size_t bp; /*bit pointer, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
+  lodepng_bitbuf buffer; /*the upcoming bits, the bit at bp is the lsb*/
+  /*for streamed input: if not 0, data is the stage buffer, which is refilled from read when it runs low.
+  read copies up to size bytes to out and returns how many, less than size only at the end of the input*/
+  size_t (*read)(unsigned char* out, size_t size, void* read_data);
+  void* read_data;
+  unsigned char* stage;
+} LodePNGBitReader;
+
+/*size of the stage buffer for streamed input*/
+#define INFLATE_STAGE_SIZE 16384
+
+/*returns error if the size in bits can't be represented by a size_t*/
+static unsigned LodePNGBitReader_init(LodePNGBitReader* reader, const unsigned char* data, size_t size)
+{
+  size_t temp;
+  reader->data = data;
+  reader->size = size;
+  /*size in bits, return error if overflow (if size_t is 32 bit this supports up to 500MB)*/
+  reader->bitsize = size * 8u;
+  temp = reader->bitsize / 8u;
+  if(temp != size) return 95;
+  reader->bp = 0;
+  reader->buffer = 0;
+  reader->read = 0;
+  reader->read_data = 0;
+  reader->stage = 0;
+  return 0;
+}
 
-static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char* bitstream)
+/*moves the unread bytes of the stage buffer to its front, and fills the rest from the input*/
+static void readerRefill(LodePNGBitReader* reader)
 {
-  unsigned char result = (unsigned char)(READBIT(*bitpointer, bitstream));
-  ++(*bitpointer);
-  return result;
+  size_t start = reader->bp >> 3u;
+  size_t keep, got;
+  if(start > reader->size) start = reader->size;
+  keep = reader->size - start;
+  if(keep != 0 && start != 0) memmove(reader->stage, reader->stage + start, keep);
+  got = reader->read(reader->stage + keep, INFLATE_STAGE_SIZE - keep, reader->read_data);
+  if(got < INFLATE_STAGE_SIZE - keep) reader->read = 0; /*that was the end of the input*/
+  reader->size = keep + got;
+  reader->bitsize = reader->size * 8u;
+  reader->bp -= start * 8u;
 }
 
-static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
+/*
+(Re)fill the buffer starting at bp. Afterwards at least 57 bits can be peeked, which
+is enough for a complete length/distance pair: 15 + 5 + 15 + 13 = 48 bits.
+*/
+static void ensureBits57(LodePNGBitReader* reader)
 {
-  unsigned result = 0, i;
-  for(i = 0; i != nbits; ++i)
+  size_t start = reader->bp >> 3u;
+  const unsigned char* p;
+  lodepng_bitbuf buffer = 0;
+  if(start + 8u > reader->size && reader->read)
+  {
+    readerRefill(reader);
+    start = reader->bp >> 3u;
+  }
+  p = reader->data + start;
+  if(start + 8u <= reader->size)
   {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    ++(*bitpointer);
+    buffer = (lodepng_bitbuf)p[0] | ((lodepng_bitbuf)p[1] << 8u) | ((lodepng_bitbuf)p[2] << 16u)
+           | ((lodepng_bitbuf)p[3] << 24u) | ((lodepng_bitbuf)p[4] << 32u) | ((lodepng_bitbuf)p[5] << 40u)
+           | ((lodepng_bitbuf)p[6] << 48u) | ((lodepng_bitbuf)p[7] << 56u);
+  }
+  else
+  {
+    size_t i;
+    for(i = 0; start + i < reader->size; ++i) buffer |= ((lodepng_bitbuf)p[i] << (8u * i));
   }
+  reader->buffer = buffer >> (reader->bp & 7u);
+}
+
+/*get bits without advancing the bit pointer. Must have enough bits available with ensureBits57*/
+static unsigned peekBits(LodePNGBitReader* reader, size_t nbits)
+{
+  return (unsigned)(reader->buffer & ((1u << nbits) - 1u));
+}
+
+/*must have enough bits available with ensureBits57*/
+static void advanceBits(LodePNGBitReader* reader, size_t nbits)
+{
+  reader->buffer >>= nbits;
+  reader->bp += nbits;
+}
+
+/*read bits without refilling, must have enough bits available with ensureBits57*/
+static unsigned readBitsNoRefill(LodePNGBitReader* reader, size_t nbits)
+{
+  unsigned result = peekBits(reader, nbits);
+  advanceBits(reader, nbits);
   return result;
 }
+
+/*read at most 32 bits, for the places outside the hot loop (block headers, code lengths)*/
+static unsigned readBits(LodePNGBitReader* reader, size_t nbits)
+{
+  ensureBits57(reader);
+  return readBitsNoRefill(reader, nbits);
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -475,6 +711,8 @@ static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bits
 #define NUM_DISTANCE_SYMBOLS 32
 /*the code length codes. 0-15: code lengths, 16: copy previous 3-6 times, 17: 3-10 zeros, 18: 11-138 zeros*/
 #define NUM_CODE_LENGTH_CODES 19
+/*the maximum length of a huffman code in bits*/
+#define MAX_HUFFMAN_BITLEN 15
 
 /*the base lengths represented by codes 257-285*/
 static const unsigned LENGTHBASE[29]
@@ -508,11 +746,13 @@ Huffman tree struct, containing multiple representations of the tree
 */
 typedef struct HuffmanTree
 {
-  unsigned* tree2d;
   unsigned* tree1d;
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  /*for decoding: lookup table indexed by the next (reversed) FIRSTBITS bits of the input*/
+  unsigned char* table_len; /*length of symbol from lookup table, or number of bits of the second level table*/
+  unsigned short* table_value; /*value of symbol from lookup table, or pointer to the second level table*/
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art with C++*/
@@ -530,122 +770,192 @@ static void HuffmanTree_draw(HuffmanTree* tree)
 
 static void HuffmanTree_init(HuffmanTree* tree)
 {
-  tree->tree2d = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->table_len = 0;
+  tree->table_value = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
 {
-  lodepng_free(tree->tree2d);
   lodepng_free(tree->tree1d);
   lodepng_free(tree->lengths);
+  lodepng_free(tree->table_len);
+  lodepng_free(tree->table_value);
 }
 
-/*the tree representation used by the decoder. return value is error*/
-static unsigned HuffmanTree_make2DTree(HuffmanTree* tree)
+#ifdef LODEPNG_COMPILE_DECODER
+
+/*amount of bits for first huffman table lookup (aka root bits), see HuffmanTree_makeTable and huffmanDecodeSymbol.*/
+#define FIRSTBITS 9u
+
+/*value in table_value for table entries that no code maps to (incomplete trees)*/
+#define INVALIDSYMBOL 65535u
+
+/*marks a table_len entry as not yet filled in while building the table*/
+#define UNFILLED 255u
+
+/*only used while building the tables, once per code, so a bit at a time is fast enough*/
+static unsigned reverseBits(unsigned bits, unsigned num)
 {
-  unsigned nodefilled = 0; /*up to which node it is filled*/
-  unsigned treepos = 0; /*position in the tree (1 of the numcodes columns)*/
-  unsigned n, i;
+  unsigned i, result = 0;
+  for(i = 0; i < num; i++) result |= ((bits >> (num - i - 1u)) & 1u) << i;
+  return result;
+}
 
-  tree->tree2d = (unsigned*)lodepng_malloc(tree->numcodes * 2 * sizeof(unsigned));
-  if(!tree->tree2d) return 83; /*alloc fail*/
+/*
+The tree representation used by the decoder: a lookup table indexed by the next
+FIRSTBITS bits of the input (in the order they appear in the stream, so reversed
+compared to the code). Codes that are not longer than FIRSTBITS occupy all entries
+that start with them, so one lookup gives symbol and length. Longer codes go through
+a second level table per FIRSTBITS prefix, sized for the longest code with that
+prefix. Return value is error.
+*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
+{
+  static const unsigned headsize = 1u << FIRSTBITS; /*size of the first table*/
+  static const unsigned mask = (1u << FIRSTBITS) /*headsize*/ - 1u;
+  size_t i, pointer, size; /*total table size*/
+  unsigned* maxlens = (unsigned*)lodepng_malloc(headsize * sizeof(unsigned));
+  if(!maxlens) return 83; /*alloc fail*/
 
-  /*
-  convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means
-  uninited, a value >= numcodes is an address to another bit, a value < numcodes
-  is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as
-  many columns as codes - 1.
-  A good huffman tree has N * 2 - 1 nodes, of which N - 1 are internal nodes.
-  Here, the internal nodes are stored (what their 0 and 1 option point to).
-  There is only memory for such good tree currently, if there are more nodes
-  (due to too long length codes), error 55 will happen
-  */
-  for(n = 0; n < tree->numcodes * 2; ++n)
+  /*compute maxlens: max total bit length of symbols sharing prefix in the first table*/
+  memset(maxlens, 0, headsize * sizeof(*maxlens));
+  for(i = 0; i < tree->numcodes; i++)
+  {
+    unsigned symbol = tree->tree1d[i];
+    unsigned l = tree->lengths[i];
+    unsigned index;
+    if(l <= FIRSTBITS) continue; /*symbols that fit in first table don't increase secondary table size*/
+    /*get the FIRSTBITS MSBs, the MSBs of the symbol are encoded first. See later comment about the reversing*/
+    index = reverseBits(symbol >> (l - FIRSTBITS), FIRSTBITS);
+    if(l > maxlens[index]) maxlens[index] = l;
+  }
+  /*compute total table size: size of first table plus all secondary tables for symbols longer than FIRSTBITS*/
+  size = headsize;
+  for(i = 0; i < headsize; ++i)
+  {
+    unsigned l = maxlens[i];
+    if(l > FIRSTBITS) size += (1u << (l - FIRSTBITS));
+  }
+  tree->table_len = (unsigned char*)lodepng_malloc(size * sizeof(*tree->table_len));
+  tree->table_value = (unsigned short*)lodepng_malloc(size * sizeof(*tree->table_value));
+  if(!tree->table_len || !tree->table_value)
   {
-    tree->tree2d[n] = 32767; /*32767 here means the tree2d isn't filled there yet*/
+    lodepng_free(maxlens);
+    /*freeing tree->table values is done at a higher scope*/
+    return 83; /*alloc fail*/
   }
+  /*initialize with an invalid length to indicate unused entries*/
+  for(i = 0; i < size; ++i) tree->table_len[i] = UNFILLED;
 
-  for(n = 0; n < tree->numcodes; ++n) /*the codes*/
+  /*fill in the first table for long symbols: max prefix size and pointer to secondary tables*/
+  pointer = headsize;
+  for(i = 0; i < headsize; ++i)
   {
-    for(i = 0; i != tree->lengths[n]; ++i) /*the bits for this code*/
+    unsigned l = maxlens[i];
+    if(l <= FIRSTBITS) continue;
+    tree->table_len[i] = l;
+    tree->table_value[i] = (unsigned short)pointer;
+    pointer += (1u << (l - FIRSTBITS));
+  }
+  lodepng_free(maxlens);
+
+  /*fill in the first table for short symbols, or secondary table for long symbols*/
+  for(i = 0; i < tree->numcodes; ++i)
+  {
+    unsigned l = tree->lengths[i];
+    unsigned symbol = tree->tree1d[i]; /*the huffman bit pattern. i itself is the value.*/
+    /*reverse bits, because the huffman bits are given in MSB first order but the bit reader reads LSB first*/
+    unsigned reverse;
+    if(l == 0) continue;
+    reverse = reverseBits(symbol, l);
+
+    if(l <= FIRSTBITS)
     {
-      unsigned char bit = (unsigned char)((tree->tree1d[n] >> (tree->lengths[n] - i - 1)) & 1);
-      /*oversubscribed, see comment in lodepng_error_text*/
-      if(treepos > 2147483647 || treepos + 2 > tree->numcodes) return 55;
-      if(tree->tree2d[2 * treepos + bit] == 32767) /*not yet filled in*/
+      /*short symbol, fully in first table, replicated num times if l < FIRSTBITS*/
+      unsigned num = 1u << (FIRSTBITS - l);
+      unsigned j;
+      for(j = 0; j < num; ++j)
       {
-        if(i + 1 == tree->lengths[n]) /*last bit*/
-        {
-          tree->tree2d[2 * treepos + bit] = n; /*put the current code in it*/
-          treepos = 0;
-        }
-        else
-        {
-          /*put address of the next step in here, first that address has to be found of course
-          (it's just nodefilled + 1)...*/
-          ++nodefilled;
-          /*addresses encoded with numcodes added to it*/
-          tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;
-          treepos = nodefilled;
-        }
+        /*bit reader will read the l bits of symbol first, the remaining FIRSTBITS - l bits go to the MSB's*/
+        unsigned index = reverse | (j << l);
+        if(tree->table_len[index] != UNFILLED) return 55; /*invalid tree: long symbol shares prefix with short symbol*/
+        tree->table_len[index] = (unsigned char)l;
+        tree->table_value[index] = (unsigned short)i;
+      }
+    }
+    else
+    {
+      /*long symbol, shares prefix with other long symbols in first lookup table, needs second lookup*/
+      /*the FIRSTBITS MSBs of the symbol are the first table index*/
+      unsigned index = reverse & mask;
+      unsigned maxlen = tree->table_len[index];
+      /*log2 of secondary table length, should be >= l - FIRSTBITS*/
+      unsigned tablelen = maxlen - FIRSTBITS;
+      unsigned start = tree->table_value[index]; /*starting index in secondary table*/
+      unsigned num = 1u << (tablelen - (l - FIRSTBITS)); /*amount of entries of this symbol in secondary table*/
+      unsigned j;
+      if(maxlen < l) return 55; /*invalid tree: long symbol shares prefix with short symbol*/
+      for(j = 0; j < num; ++j)
+      {
+        unsigned reverse2 = reverse >> FIRSTBITS; /* l - FIRSTBITS bits */
+        unsigned index2 = start + (reverse2 | (j << (l - FIRSTBITS)));
+        tree->table_len[index2] = (unsigned char)l;
+        tree->table_value[index2] = (unsigned short)i;
       }
-      else treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
     }
   }
 
-  for(n = 0; n < tree->numcodes * 2; ++n)
+  /*
+  Entries no code maps to only exist for incomplete trees (e.g. a distance tree with a
+  single code). They decode to INVALIDSYMBOL, which the inflator reports as error 11
+  if the data actually uses them. The length of such entries is never used, but must
+  keep second level lookups in range.
+  */
+  for(i = 0; i < size; ++i)
   {
-    if(tree->tree2d[n] == 32767) tree->tree2d[n] = 0; /*remove possible remaining 32767's*/
+    if(tree->table_len[i] == UNFILLED)
+    {
+      tree->table_len[i] = (i < headsize) ? 1 : (FIRSTBITS + 1);
+      tree->table_value[i] = INVALIDSYMBOL;
+    }
   }
 
   return 0;
 }
 
+#endif /*LODEPNG_COMPILE_DECODER*/
+
 /*
 Second step for the ...makeFromLengths and ...makeFromFrequencies functions.
-numcodes, lengths and maxbitlen must already be filled in correctly. return
-value is error.
+numcodes, lengths and maxbitlen must already be filled in correctly, and tree1d
+must be allocated for numcodes codes. return value is error.
 */
 static unsigned HuffmanTree_makeFromLengths2(HuffmanTree* tree)
 {
-  uivector blcount;
-  uivector nextcode;
-  unsigned error = 0;
+  /*deflate code lengths are at most 15 bits, so these are small enough for the stack*/
+  unsigned blcount[MAX_HUFFMAN_BITLEN + 1];
+  unsigned nextcode[MAX_HUFFMAN_BITLEN + 1];
   unsigned bits, n;
 
-  uivector_init(&blcount);
-  uivector_init(&nextcode);
-
-  tree->tree1d = (unsigned*)lodepng_malloc(tree->numcodes * sizeof(unsigned));
-  if(!tree->tree1d) error = 83; /*alloc fail*/
+  if(tree->maxbitlen > MAX_HUFFMAN_BITLEN) return 80; /*error: tree not supported by deflate*/
+  for(bits = 0; bits <= tree->maxbitlen; ++bits) blcount[bits] = nextcode[bits] = 0;
 
-  if(!uivector_resizev(&blcount, tree->maxbitlen + 1, 0)
-  || !uivector_resizev(&nextcode, tree->maxbitlen + 1, 0))
-    error = 83; /*alloc fail*/
-
-  if(!error)
+  /*step 1: count number of instances of each code length*/
+  for(bits = 0; bits != tree->numcodes; ++bits) ++blcount[tree->lengths[bits]];
+  /*step 2: generate the nextcode values*/
+  for(bits = 1; bits <= tree->maxbitlen; ++bits)
   {
-    /*step 1: count number of instances of each code length*/
-    for(bits = 0; bits != tree->numcodes; ++bits) ++blcount.data[tree->lengths[bits]];
-    /*step 2: generate the nextcode values*/
-    for(bits = 1; bits <= tree->maxbitlen; ++bits)
-    {
-      nextcode.data[bits] = (nextcode.data[bits - 1] + blcount.data[bits - 1]) << 1;
-    }
-    /*step 3: generate all the codes*/
-    for(n = 0; n != tree->numcodes; ++n)
-    {
-      if(tree->lengths[n] != 0) tree->tree1d[n] = nextcode.data[tree->lengths[n]]++;
-    }
+    nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
+  }
+  /*step 3: generate all the codes*/
+  for(n = 0; n != tree->numcodes; ++n)
+  {
+    if(tree->lengths[n] != 0) tree->tree1d[n] = nextcode[tree->lengths[n]]++;
   }
 
-  uivector_cleanup(&blcount);
-  uivector_cleanup(&nextcode);
-
-  if(!error) return HuffmanTree_make2DTree(tree);
-  else return error;
+  return 0;
 }
 
 /*
@@ -658,11 +968,17 @@ static unsigned HuffmanTree_makeFromLengths(HuffmanTree* tree, const unsigned* b
 {
   unsigned i;
   tree->lengths = (unsigned*)lodepng_malloc(numcodes * sizeof(unsigned));
-  if(!tree->lengths) return 83; /*alloc fail*/
+  tree->tree1d = (unsigned*)lodepng_malloc(numcodes * sizeof(unsigned));
+  if(!tree->lengths || !tree->tree1d) return 83; /*alloc fail*/
   for(i = 0; i != numcodes; ++i) tree->lengths[i] = bitlen[i];
   tree->numcodes = (unsigned)numcodes; /*number of symbols*/
   tree->maxbitlen = maxbitlen;
-  return HuffmanTree_makeFromLengths2(tree);
+  CERROR_TRY_RETURN(HuffmanTree_makeFromLengths2(tree));
+#ifdef LODEPNG_COMPILE_DECODER
+  return HuffmanTree_makeTable(tree);
+#else /*LODEPNG_COMPILE_DECODER*/
+  return 0;
+#endif /*LODEPNG_COMPILE_DECODER*/
 }
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -727,10 +1043,9 @@ static BPMNode* bpmnode_create(BPMLists* lists, int weight, unsigned index, BPMN
   return result;
 }
 
-/*sort the leaves with stable mergesort*/
-static void bpmnode_sort(BPMNode* leaves, size_t num)
+/*sort the leaves with stable mergesort, mem must have room for num nodes*/
+static void bpmnode_sort(BPMNode* leaves, BPMNode* mem, size_t num)
 {
-  BPMNode* mem = (BPMNode*)lodepng_malloc(sizeof(*leaves) * num);
   size_t width, counter = 0;
   for(width = 1; width < num; width *= 2)
   {
@@ -751,7 +1066,6 @@ static void bpmnode_sort(BPMNode* leaves, size_t num)
     counter++;
   }
   if(counter & 1) memcpy(leaves, mem, sizeof(*leaves) * num);
-  lodepng_free(mem);
 }
 
 /*Boundary Package Merge step, numpresent is the amount of leaves, and c is the current chain.*/
@@ -786,19 +1100,37 @@ static void boundaryPM(BPMLists* lists, BPMNode* leaves, size_t numpresent, int
   }
 }
 
-unsigned lodepng_huffman_code_lengths(unsigned* lengths, const unsigned* frequencies,
-                                      size_t numcodes, unsigned maxbitlen)
+/*
+Same as lodepng_huffman_code_lengths, with all memory it needs taken from scratch,
+which is resized if too small. The nodes come first in it and then the node
+pointers, both sizes are multiples of the pointer alignment.
+*/
+static unsigned huffman_code_lengths(unsigned* lengths, const unsigned* frequencies,
+                                     size_t numcodes, unsigned maxbitlen, ucvector* scratch)
 {
   unsigned error = 0;
   unsigned i;
   size_t numpresent = 0; /*number of symbols with non-zero frequency*/
   BPMNode* leaves; /*the symbols, only those with > 0 frequency*/
+  BPMNode* sortmem; /*temporary memory for sorting the leaves*/
+  BPMLists lists;
 
   if(numcodes == 0) return 80; /*error: a tree of 0 symbols is not supposed to be made*/
   if((1u << maxbitlen) < numcodes) return 80; /*error: represent all symbols*/
 
-  leaves = (BPMNode*)lodepng_malloc(numcodes * sizeof(*leaves));
-  if(!leaves) return 83; /*alloc fail*/
+  lists.listsize = maxbitlen;
+  lists.memsize = 2 * maxbitlen * (maxbitlen + 1);
+  if(!ucvector_resize(scratch, (2 * numcodes + lists.memsize) * sizeof(BPMNode)
+                               + (lists.memsize + 2 * lists.listsize) * sizeof(BPMNode*)))
+  {
+    return 83; /*alloc fail*/
+  }
+  leaves = (BPMNode*)scratch->data;
+  sortmem = leaves + numcodes;
+  lists.memory = sortmem + numcodes;
+  lists.freelist = (BPMNode**)(lists.memory + lists.memsize);
+  lists.chains0 = lists.freelist + lists.memsize;
+  lists.chains1 = lists.chains0 + lists.listsize;
 
   for(i = 0; i != numcodes; ++i)
   {
@@ -828,67 +1160,68 @@ unsigned lodepng_huffman_code_lengths(unsigned* lengths, const unsigned* frequen
   }
   else
   {
-    BPMLists lists;
     BPMNode* node;
 
-    bpmnode_sort(leaves, numpresent);
+    bpmnode_sort(leaves, sortmem, numpresent);
 
-    lists.listsize = maxbitlen;
-    lists.memsize = 2 * maxbitlen * (maxbitlen + 1);
     lists.nextfree = 0;
     lists.numfree = lists.memsize;
-    lists.memory = (BPMNode*)lodepng_malloc(lists.memsize * sizeof(*lists.memory));
-    lists.freelist = (BPMNode**)lodepng_malloc(lists.memsize * sizeof(BPMNode*));
-    lists.chains0 = (BPMNode**)lodepng_malloc(lists.listsize * sizeof(BPMNode*));
-    lists.chains1 = (BPMNode**)lodepng_malloc(lists.listsize * sizeof(BPMNode*));
-    if(!lists.memory || !lists.freelist || !lists.chains0 || !lists.chains1) error = 83; /*alloc fail*/
 
-    if(!error)
-    {
-      for(i = 0; i != lists.memsize; ++i) lists.freelist[i] = &lists.memory[i];
+    for(i = 0; i != lists.memsize; ++i) lists.freelist[i] = &lists.memory[i];
 
-      bpmnode_create(&lists, leaves[0].weight, 1, 0);
-      bpmnode_create(&lists, leaves[1].weight, 2, 0);
+    bpmnode_create(&lists, leaves[0].weight, 1, 0);
+    bpmnode_create(&lists, leaves[1].weight, 2, 0);
 
-      for(i = 0; i != lists.listsize; ++i)
-      {
-        lists.chains0[i] = &lists.memory[0];
-        lists.chains1[i] = &lists.memory[1];
-      }
+    for(i = 0; i != lists.listsize; ++i)
+    {
+      lists.chains0[i] = &lists.memory[0];
+      lists.chains1[i] = &lists.memory[1];
+    }
 
-      /*each boundaryPM call adds one chain to the last list, and we need 2 * numpresent - 2 chains.*/
-      for(i = 2; i != 2 * numpresent - 2; ++i) boundaryPM(&lists, leaves, numpresent, (int)maxbitlen - 1, (int)i);
+    /*each boundaryPM call adds one chain to the last list, and we need 2 * numpresent - 2 chains.*/
+    for(i = 2; i != 2 * numpresent - 2; ++i) boundaryPM(&lists, leaves, numpresent, (int)maxbitlen - 1, (int)i);
 
-      for(node = lists.chains1[maxbitlen - 1]; node; node = node->tail)
-      {
-        for(i = 0; i != node->index; ++i) ++lengths[leaves[i].index];
-      }
+    for(node = lists.chains1[maxbitlen - 1]; node; node = node->tail)
+    {
+      for(i = 0; i != node->index; ++i) ++lengths[leaves[i].index];
     }
-
-    lodepng_free(lists.memory);
-    lodepng_free(lists.freelist);
-    lodepng_free(lists.chains0);
-    lodepng_free(lists.chains1);
   }
 
-  lodepng_free(leaves);
   return error;
 }
 
-/*Create the Huffman tree given the symbol frequencies*/
+unsigned lodepng_huffman_code_lengths(unsigned* lengths, const unsigned* frequencies,
+                                      size_t numcodes, unsigned maxbitlen)
+{
+  unsigned error;
+  ucvector scratch;
+  ucvector_init_buffer(&scratch, 0, 0);
+  error = huffman_code_lengths(lengths, frequencies, numcodes, maxbitlen, &scratch);
+  lodepng_free(scratch.data);
+  return error;
+}
+
+/*
+Create the Huffman tree given the symbol frequencies. The tree is allocated for all
+NUM_DEFLATE_CODE_SYMBOLS symbols the first time, so that it can be made again from other
+frequencies without allocating. scratch is working memory for the code length calculation.
+*/
 static unsigned HuffmanTree_makeFromFrequencies(HuffmanTree* tree, const unsigned* frequencies,
-                                                size_t mincodes, size_t numcodes, unsigned maxbitlen)
+                                                size_t mincodes, size_t numcodes, unsigned maxbitlen,
+                                                ucvector* scratch)
 {
   unsigned error = 0;
+  if(numcodes > NUM_DEFLATE_CODE_SYMBOLS) return 80; /*error: more symbols than deflate has*/
   while(!frequencies[numcodes - 1] && numcodes > mincodes) --numcodes; /*trim zeroes*/
   tree->maxbitlen = maxbitlen;
   tree->numcodes = (unsigned)numcodes; /*number of symbols*/
-  tree->lengths = (unsigned*)lodepng_realloc(tree->lengths, numcodes * sizeof(unsigned));
-  if(!tree->lengths) return 83; /*alloc fail*/
+  if(!tree->lengths) tree->lengths = (unsigned*)lodepng_malloc(NUM_DEFLATE_CODE_SYMBOLS * sizeof(unsigned));
+  if(!tree->tree1d) tree->tree1d = (unsigned*)lodepng_malloc(NUM_DEFLATE_CODE_SYMBOLS * sizeof(unsigned));
+  if(!tree->lengths || !tree->tree1d) return 83; /*alloc fail*/
   /*initialize all lengths to 0*/
   memset(tree->lengths, 0, numcodes * sizeof(unsigned));
 
-  error = lodepng_huffman_code_lengths(tree->lengths, frequencies, numcodes, maxbitlen);
+  error = huffman_code_lengths(tree->lengths, frequencies, numcodes, maxbitlen, scratch);
   if(!error) error = HuffmanTree_makeFromLengths2(tree);
   return error;
 }
@@ -941,26 +1274,26 @@ static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 #ifdef LODEPNG_COMPILE_DECODER
 
 /*
-returns the code, or (unsigned)(-1) if error happened
-inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
+returns the symbol, or INVALIDSYMBOL if the bits don't form a code of the tree.
+Must have enough bits available with ensureBits57 (at most 15 are consumed).
 */
-static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
-                                    const HuffmanTree* codetree, size_t inbitlength)
+static unsigned huffmanDecodeSymbol(LodePNGBitReader* reader, const HuffmanTree* codetree)
 {
-  unsigned treepos = 0, ct;
-  for(;;)
+  unsigned short code = (unsigned short)peekBits(reader, FIRSTBITS);
+  unsigned short l = codetree->table_len[code];
+  unsigned short value = codetree->table_value[code];
+  if(l <= FIRSTBITS)
   {
-    if(*bp >= inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
-    /*
-    decode the symbol from the tree. The "readBitFromStream" code is inlined in
-    the expression below because this is the biggest bottleneck while decoding
-    */
-    ct = codetree->tree2d[(treepos << 1) + READBIT(*bp, in)];
-    ++(*bp);
-    if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
-    else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
-
-    if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
+    advanceBits(reader, l);
+    return value;
+  }
+  else
+  {
+    unsigned index2;
+    advanceBits(reader, FIRSTBITS);
+    index2 = value + peekBits(reader, l - FIRSTBITS);
+    advanceBits(reader, codetree->table_len[index2] - FIRSTBITS);
+    return codetree->table_value[index2];
   }
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
@@ -971,22 +1304,21 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
 /* / Inflator (Decompressor)                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-/*get the tree of a deflated block with fixed tree, as specified in the deflate specification*/
-static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
+/*get the tree of a deflated block with fixed tree, as specified in the deflate specification
+Returns error code.*/
+static unsigned getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
 {
-  /*TODO: check for out of memory errors*/
-  generateFixedLitLenTree(tree_ll);
-  generateFixedDistanceTree(tree_d);
+  CERROR_TRY_RETURN(generateFixedLitLenTree(tree_ll));
+  return generateFixedDistanceTree(tree_d);
 }
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
 static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      const unsigned char* in, size_t* bp, size_t inlength)
+                                      LodePNGBitReader* reader)
 {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
   unsigned n, HLIT, HDIST, HCLEN, i;
-  size_t inbitlength = inlength * 8;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
   unsigned* bitlen_ll = 0; /*lit,len code lengths*/
@@ -995,16 +1327,18 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   unsigned* bitlen_cl = 0;
   HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
 
-  if((*bp) + 14 > (inlength << 3)) return 49; /*error: the bit pointer is or will go past the memory*/
+  ensureBits57(reader); /*for streamed input, makes the bits available for the checks below*/
+  if(reader->bp + 14 > reader->bitsize) return 49; /*error: the bit pointer is or will go past the memory*/
 
   /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already*/
-  HLIT =  readBitsFromStream(bp, in, 5) + 257;
+  HLIT =  readBits(reader, 5) + 257;
   /*number of distance codes. Unlike the spec, the value 1 is added to it here already*/
-  HDIST = readBitsFromStream(bp, in, 5) + 1;
+  HDIST = readBits(reader, 5) + 1;
   /*number of code length codes. Unlike the spec, the value 4 is added to it here already*/
-  HCLEN = readBitsFromStream(bp, in, 4) + 4;
+  HCLEN = readBits(reader, 4) + 4;
 
-  if((*bp) + HCLEN * 3 > (inlength << 3)) return 50; /*error: the bit pointer is or will go past the memory*/
+  ensureBits57(reader);
+  if(reader->bp + HCLEN * 3 > reader->bitsize) return 50; /*error: the bit pointer is or will go past the memory*/
 
   HuffmanTree_init(&tree_cl);
 
@@ -1017,7 +1351,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
     for(i = 0; i != NUM_CODE_LENGTH_CODES; ++i)
     {
-      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBitsFromStream(bp, in, 3);
+      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBits(reader, 3);
       else bitlen_cl[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
     }
 
@@ -1035,7 +1369,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     i = 0;
     while(i < HLIT + HDIST)
     {
-      unsigned code = huffmanDecodeSymbol(in, bp, &tree_cl, inbitlength);
+      unsigned code;
+      ensureBits57(reader); /*up to 7 bits for the code and 7 extra bits*/
+      code = huffmanDecodeSymbol(reader, &tree_cl);
       if(code <= 15) /*a length code*/
       {
         if(i < HLIT) bitlen_ll[i] = code;
@@ -1049,8 +1385,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
         if(i == 0) ERROR_BREAK(54); /*can't repeat previous if i is 0*/
 
-        if((*bp + 2) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 2);
+        replength += readBitsNoRefill(reader, 2);
 
         if(i < HLIT + 1) value = bitlen_ll[i - 1];
         else value = bitlen_d[i - HLIT - 1];
@@ -1066,8 +1401,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 17) /*repeat "0" 3-10 times*/
       {
         unsigned replength = 3; /*read in the bits that indicate repeat length*/
-        if((*bp + 3) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 3);
+        replength += readBitsNoRefill(reader, 3);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1082,8 +1416,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 18) /*repeat "0" 11-138 times*/
       {
         unsigned replength = 11; /*read in the bits that indicate repeat length*/
-        if((*bp + 7) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 7);
+        replength += readBitsNoRefill(reader, 7);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1095,16 +1428,16 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
           ++i;
         }
       }
-      else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+      else /*if(code == INVALIDSYMBOL)*/
       {
-        if(code == (unsigned)(-1))
-        {
-          /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
-          (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inbitlength ? 10 : 11;
-        }
-        else error = 16; /*unexisting code, this can never happen*/
-        break;
+        ERROR_BREAK(16); /*unexisting code, this can never happen*/
+      }
+      /*check if any of the ensureBits above went out of bounds*/
+      if(reader->bp > reader->bitsize)
+      {
+        /*past the end of the input the reader gives zero bits, so the code lengths read above are not in
+        the input: the tree is cut off. Invalid codes already stopped at error 16 above*/
+        ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
       }
     }
     if(error) break;
@@ -1127,55 +1460,118 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
-/*inflate a block with dynamic of fixed Huffman tree*/
-static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
-                                    size_t* pos, size_t inlength, unsigned btype)
+/*
+Copies a length/distance match. The output must have at least 7 bytes of slack
+after pos + length: for distance >= 8 the copy goes in 8-byte words that never
+read bytes the same word writes, and may overshoot the end of the match.
+*/
+static void inflateCopyMatch(unsigned char* data, size_t pos, size_t distance, size_t length)
+{
+  unsigned char* dst = data + pos;
+  const unsigned char* src = dst - distance;
+  size_t i;
+  if(distance >= 8)
+  {
+    for(i = 0; i < length; i += 8) memcpy(dst + i, src + i, 8);
+  }
+  else if(distance == 1)
+  {
+    memset(dst, *src, length); /*run of a single byte value, common in filtered images*/
+  }
+  else
+  {
+    for(i = 0; i < length; ++i) dst[i] = src[i];
+  }
+}
+
+/*worst case output of one symbol: a match of 258 bytes plus the slack of inflateCopyMatch*/
+#define INFLATE_MAX_SYMBOL_OUTPUT (258 + 8)
+/*the furthest back a match can refer, and so all the output a streaming inflate has to keep*/
+#define INFLATE_WINDOW_SIZE 32768
+
+/*
+For streamed output: instead of growing the output buffer, the inflator hands what it
+has to write each time the buffer fills up, and then keeps only the last
+INFLATE_WINDOW_SIZE bytes of it for later matches.
+*/
+typedef struct InflateSink
+{
+  /*receives the decompressed data in order. A nonzero return value stops the inflator and is returned by it*/
+  unsigned (*write)(const unsigned char* data, size_t size, void* write_data);
+  void* write_data;
+  size_t written; /*the output buffer before this position was already given to write*/
+} InflateSink;
+
+/*hands the new output to the sink and moves the window to the front of the buffer*/
+static unsigned inflateDrain(ucvector* out, size_t* pos, InflateSink* sink)
+{
+  unsigned error = 0;
+  if(*pos > sink->written) error = sink->write(out->data + sink->written, *pos - sink->written, sink->write_data);
+  if(*pos > INFLATE_WINDOW_SIZE)
+  {
+    memmove(out->data, out->data + *pos - INFLATE_WINDOW_SIZE, INFLATE_WINDOW_SIZE);
+    *pos = INFLATE_WINDOW_SIZE;
+  }
+  sink->written = *pos;
+  return error;
+}
+
+/*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2. sink is 0 if the output isn't streamed.*/
+static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
+                                    size_t* pos, unsigned btype, InflateSink* sink)
 {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  size_t inbitlength = inlength * 8;
 
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
 
-  if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
-  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+  if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
+  else /*if(btype == 2)*/ error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
 
   while(!error) /*decode all symbols until end reached, breaks at end code*/
   {
     /*code_ll is literal, length or end code*/
-    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    unsigned code_ll;
+    /*the buffer is grown here once per symbol instead of resized per byte; out->size is set at the end*/
+    if(out->allocsize < (*pos) + INFLATE_MAX_SYMBOL_OUTPUT)
+    {
+      if(sink)
+      {
+        error = inflateDrain(out, pos, sink);
+        if(error) break;
+      }
+      else if(!ucvector_reserve(out, (*pos) + INFLATE_MAX_SYMBOL_OUTPUT)) ERROR_BREAK(83 /*alloc fail*/);
+    }
+    ensureBits57(reader); /*one refill covers code_ll, length extra bits, code_d and distance extra bits*/
+    code_ll = huffmanDecodeSymbol(reader, &tree_ll);
     if(code_ll <= 255) /*literal symbol*/
     {
-      /*ucvector_push_back would do the same, but for some reason the two lines below run 10% faster*/
-      if(!ucvector_resize(out, (*pos) + 1)) ERROR_BREAK(83 /*alloc fail*/);
-      out->data[*pos] = (unsigned char)code_ll;
-      ++(*pos);
+      out->data[(*pos)++] = (unsigned char)code_ll;
     }
     else if(code_ll >= FIRST_LENGTH_CODE_INDEX && code_ll <= LAST_LENGTH_CODE_INDEX) /*length code*/
     {
       unsigned code_d, distance;
       unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
-      size_t start, forward, backward, length;
+      size_t length;
 
       /*part 1: get length base*/
       length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
 
       /*part 2: get extra bits and add the value of that to length*/
       numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if((*bp + numextrabits_l) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      length += readBitsFromStream(bp, in, numextrabits_l);
+      if(numextrabits_l != 0) length += readBitsNoRefill(reader, numextrabits_l);
 
       /*part 3: get distance code*/
-      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+      code_d = huffmanDecodeSymbol(reader, &tree_d);
       if(code_d > 29)
       {
-        if(code_ll == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+        if(code_d == INVALIDSYMBOL) /*huffmanDecodeSymbol returns INVALIDSYMBOL in case of error*/
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inlength * 8 ? 10 : 11;
+          error = (reader->bp > reader->bitsize) ? 10 : 11;
         }
         else error = 18; /*error: invalid distance code (30-31 are never used)*/
         break;
@@ -1184,37 +1580,31 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 4: get extra bits from distance*/
       numextrabits_d = DISTANCEEXTRA[code_d];
-      if((*bp + numextrabits_d) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      distance += readBitsFromStream(bp, in, numextrabits_d);
+      if(numextrabits_d != 0) distance += readBitsNoRefill(reader, numextrabits_d);
 
-      /*part 5: fill in all the out[n] values based on the length and dist*/
-      start = (*pos);
-      if(distance > start) ERROR_BREAK(52); /*too long backward distance*/
-      backward = start - distance;
+      if(reader->bp > reader->bitsize) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
 
-      if(!ucvector_resize(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
-      if (distance < length) {
-        for(forward = 0; forward < length; ++forward)
-        {
-          out->data[(*pos)++] = out->data[backward++];
-        }
-      } else {
-        memcpy(out->data + *pos, out->data + backward, length);
-        *pos += length;
-      }
+      /*part 5: fill in all the out[n] values based on the length and dist*/
+      if(distance > (*pos)) ERROR_BREAK(52); /*too long backward distance*/
+      inflateCopyMatch(out->data, *pos, distance, length);
+      (*pos) += length;
     }
     else if(code_ll == 256)
     {
       break; /*end code, break the loop*/
     }
-    else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
+    else /*if(code_ll == INVALIDSYMBOL)*/ /*huffmanDecodeSymbol returns INVALIDSYMBOL in case of error*/
     {
       /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
       (10=no endcode, 11=wrong jump outside of tree)*/
-      error = ((*bp) > inlength * 8) ? 10 : 11;
+      error = (reader->bp > reader->bitsize) ? 10 : 11;
       break;
     }
+    /*literals read from past the end of the input (as zeroes) mean the end code is missing*/
+    if(reader->bp > reader->bitsize) ERROR_BREAK(10);
   }
+  if(reader->bp > reader->bitsize && !error) error = 10; /*the end code itself was read past the end*/
+  if(!sink) out->size = *pos;
 
   HuffmanTree_cleanup(&tree_ll);
   HuffmanTree_cleanup(&tree_d);
@@ -1222,57 +1612,83 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
   return error;
 }
 
-static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
+static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader, size_t* pos, InflateSink* sink)
 {
   size_t p;
-  unsigned LEN, NLEN, n, error = 0;
+  unsigned LEN, NLEN, error = 0;
 
   /*go to first boundary of byte*/
-  while(((*bp) & 0x7) != 0) ++(*bp);
-  p = (*bp) / 8; /*byte position*/
+  reader->bp = (reader->bp + 7u) & ~(size_t)7u;
+  ensureBits57(reader); /*for streamed input, makes LEN and NLEN available*/
+  p = reader->bp >> 3u; /*byte position*/
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
-  if(p + 4 >= inlength) return 52; /*error, bit pointer will jump past memory*/
-  LEN = in[p] + 256u * in[p + 1]; p += 2;
-  NLEN = in[p] + 256u * in[p + 1]; p += 2;
+  if(p + 4 >= reader->size) return 52; /*error, bit pointer will jump past memory*/
+  LEN = reader->data[p] + 256u * reader->data[p + 1]; p += 2;
+  NLEN = reader->data[p] + 256u * reader->data[p + 1]; p += 2;
 
   /*check if 16-bit NLEN is really the one's complement of LEN*/
   if(LEN + NLEN != 65535) return 21; /*error: NLEN is not one's complement of LEN*/
 
-  if(!ucvector_resize(out, (*pos) + LEN)) return 83; /*alloc fail*/
-
-  /*read the literal data: LEN bytes are now stored in the out buffer*/
-  if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
-  for(n = 0; n < LEN; ++n) out->data[(*pos)++] = in[p++];
+  if(!sink)
+  {
+    if(!ucvector_resize(out, (*pos) + LEN)) return 83; /*alloc fail*/
+    /*read the literal data: LEN bytes are now stored in the out buffer*/
+    if(p + LEN > reader->size) return 23; /*error: reading outside of in buffer*/
+    if(LEN != 0) memcpy(out->data + *pos, reader->data + p, LEN);
+    (*pos) += LEN;
+    p += LEN;
+  }
+  else
+  {
+    /*streamed, the literal data is copied in the pieces that the stage and the output buffer have room for*/
+    while(LEN != 0)
+    {
+      size_t n = LEN;
+      if(p == reader->size && reader->read)
+      {
+        reader->bp = p * 8u;
+        readerRefill(reader);
+        p = reader->bp >> 3u;
+      }
+      if(p == reader->size) return 23; /*error: reading outside of in buffer*/
+      if(out->allocsize <= (*pos) + INFLATE_MAX_SYMBOL_OUTPUT)
+      {
+        error = inflateDrain(out, pos, sink);
+        if(error) return error;
+      }
+      if(n > reader->size - p) n = reader->size - p;
+      if(n > out->allocsize - INFLATE_MAX_SYMBOL_OUTPUT - (*pos)) n = out->allocsize - INFLATE_MAX_SYMBOL_OUTPUT - (*pos);
+      memcpy(out->data + *pos, reader->data + p, n);
+      (*pos) += n;
+      p += n;
+      LEN -= (unsigned)n;
+    }
+  }
 
-  (*bp) = p * 8;
+  reader->bp = p * 8;
 
   return error;
 }
 
-static unsigned lodepng_inflatev(ucvector* out,
-                                 const unsigned char* in, size_t insize,
-                                 const LodePNGDecompressSettings* settings)
+/*inflates all blocks. For streamed output, the output buffer must have been reserved with room for
+more than the window and the output isn't given to the sink after the final block yet*/
+static unsigned inflateBlocks(ucvector* out, LodePNGBitReader* reader, size_t* pos, InflateSink* sink)
 {
-  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
-  size_t bp = 0;
   unsigned BFINAL = 0;
-  size_t pos = 0; /*byte position in the out buffer*/
   unsigned error = 0;
 
-  (void)settings;
-
   while(!BFINAL)
   {
     unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBitFromStream(&bp, in);
-    BTYPE = 1u * readBitFromStream(&bp, in);
-    BTYPE += 2u * readBitFromStream(&bp, in);
+    ensureBits57(reader);
+    if(reader->bp + 2 >= reader->bitsize) return 52; /*error, bit pointer will jump past memory*/
+    BFINAL = readBitsNoRefill(reader, 1);
+    BTYPE = readBitsNoRefill(reader, 2);
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+    else if(BTYPE == 0) error = inflateNoCompression(out, reader, pos, sink); /*no compression*/
+    else error = inflateHuffmanBlock(out, reader, pos, BTYPE, sink); /*compression, BTYPE 01 or 10*/
 
     if(error) return error;
   }
@@ -1280,6 +1696,21 @@ static unsigned lodepng_inflatev(ucvector* out,
   return error;
 }
 
+static unsigned lodepng_inflatev(ucvector* out,
+                                 const unsigned char* in, size_t insize,
+                                 const LodePNGDecompressSettings* settings)
+{
+  size_t pos = 0; /*byte position in the out buffer*/
+  LodePNGBitReader reader;
+  unsigned error = LodePNGBitReader_init(&reader, in, insize);
+
+  if(error) return error;
+
+  (void)settings;
+
+  return inflateBlocks(out, &reader, &pos, 0);
+}
+
 unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGDecompressSettings* settings)
@@ -1293,17 +1724,19 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
   return error;
 }
 
-static unsigned inflate(unsigned char** out, size_t* outsize,
-                        const unsigned char* in, size_t insize,
-                        const LodePNGDecompressSettings* settings)
+static unsigned inflatev(ucvector* out,
+                         const unsigned char* in, size_t insize,
+                         const LodePNGDecompressSettings* settings)
 {
   if(settings->custom_inflate)
   {
-    return settings->custom_inflate(out, outsize, in, insize, settings);
+    unsigned error = settings->custom_inflate(&out->data, &out->size, in, insize, settings);
+    out->allocsize = out->size;
+    return error;
   }
   else
   {
-    return lodepng_inflate(out, outsize, in, insize, settings);
+    return lodepng_inflatev(out, in, insize, settings);
   }
 }
 
@@ -1380,7 +1813,6 @@ typedef struct Hash
 
 static unsigned hash_init(Hash* hash, unsigned windowsize)
 {
-  unsigned i;
   hash->head = (int*)lodepng_malloc(sizeof(int) * HASH_NUM_VALUES);
   hash->val = (int*)lodepng_malloc(sizeof(int) * windowsize);
   hash->chain = (unsigned short*)lodepng_malloc(sizeof(unsigned short) * windowsize);
@@ -1394,6 +1826,14 @@ static unsigned hash_init(Hash* hash, unsigned windowsize)
     return 83; /*alloc fail*/
   }
 
+  return 0;
+}
+
+/*Forget all positions of previous input, so the hash can be used for new data without allocating it again.
+The zeros array does not need resetting, it is only read at positions that were written for the current data.*/
+static void hash_reset(Hash* hash, unsigned windowsize)
+{
+  unsigned i;
   /*initialize hash table*/
   for(i = 0; i != HASH_NUM_VALUES; ++i) hash->head[i] = -1;
   for(i = 0; i != windowsize; ++i) hash->val[i] = -1;
@@ -1401,8 +1841,6 @@ static unsigned hash_init(Hash* hash, unsigned windowsize)
 
   for(i = 0; i <= MAX_SUPPORTED_DEFLATE_LENGTH; ++i) hash->headz[i] = -1;
   for(i = 0; i != windowsize; ++i) hash->chainz[i] = i; /*same value as index indicates uninitialized*/
-
-  return 0;
 }
 
 static void hash_cleanup(Hash* hash)
@@ -1416,6 +1854,106 @@ static void hash_cleanup(Hash* hash)
   lodepng_free(hash->chainz);
 }
 
+/*
+Working memory of the deflate encoder. A LodePNGEncoderContext keeps one of these alive
+between images, so that encoding many images of the same size does not allocate the hash
+tables and the LZ77 and tree building vectors again. Everything in here is scratch memory:
+its content does not survive from one call to the next, only its allocation does.
+*/
+typedef struct DeflateBuffers
+{
+  Hash hash;
+  unsigned hash_windowsize; /*windowsize the hash was allocated for, 0 if not allocated yet*/
+  /*The lz77 encoded data, represented with integers since there will also be length and distance codes in it*/
+  uivector lz77_encoded;
+  uivector frequencies_ll; /*frequency of lit,len codes*/
+  uivector frequencies_d; /*frequency of dist codes*/
+  uivector frequencies_cl; /*frequency of code length codes*/
+  uivector bitlen_lld; /*lit,len,dist code lenghts (int bits), literally (without repeat codes).*/
+  uivector bitlen_lld_e; /*bitlen_lld encoded with repeat codes (this is a rudemtary run length compression)*/
+  uivector bitlen_cl; /*the code length code lengths ("clcl")*/
+  HuffmanTree tree_ll; /*dynamic tree for lit,len values, made again for every block*/
+  HuffmanTree tree_d; /*dynamic tree for distance codes*/
+  HuffmanTree tree_cl; /*tree for encoding the code lengths representing tree_ll and tree_d*/
+  ucvector huffman_scratch; /*working memory for computing the code lengths of the above trees*/
+  HuffmanTree fixed_ll; /*the fixed trees of btype 1, made only once*/
+  HuffmanTree fixed_d;
+  unsigned fixed_made; /*whether fixed_ll and fixed_d are made yet*/
+  /*if not NULL, called after each deflate block but the last, with the output so far. It may take away
+  all but the last byte of out, which can still be incomplete. Returns error code.*/
+  unsigned (*flush)(ucvector* out, void* flush_data);
+  void* flush_data;
+  /*if not NULL, called with begin 1 before and begin 0 after making each deflate block*/
+  void (*block)(unsigned begin, void* block_data);
+  void* block_data;
+  /*length of the scanlines of the data including filter byte, or 0 if unknown. Lets LZ77 find repeats
+  of the previous scanline further back than its window.*/
+  size_t linesize;
+} DeflateBuffers;
+
+static void deflate_buffers_init(DeflateBuffers* buffers)
+{
+  buffers->hash_windowsize = 0;
+  uivector_init(&buffers->lz77_encoded);
+  uivector_init(&buffers->frequencies_ll);
+  uivector_init(&buffers->frequencies_d);
+  uivector_init(&buffers->frequencies_cl);
+  uivector_init(&buffers->bitlen_lld);
+  uivector_init(&buffers->bitlen_lld_e);
+  uivector_init(&buffers->bitlen_cl);
+  HuffmanTree_init(&buffers->tree_ll);
+  HuffmanTree_init(&buffers->tree_d);
+  HuffmanTree_init(&buffers->tree_cl);
+  ucvector_init_buffer(&buffers->huffman_scratch, 0, 0);
+  HuffmanTree_init(&buffers->fixed_ll);
+  HuffmanTree_init(&buffers->fixed_d);
+  buffers->fixed_made = 0;
+  buffers->flush = 0;
+  buffers->flush_data = 0;
+  buffers->block = 0;
+  buffers->block_data = 0;
+  buffers->linesize = 0;
+}
+
+static void deflate_buffers_cleanup(DeflateBuffers* buffers)
+{
+  if(buffers->hash_windowsize) hash_cleanup(&buffers->hash);
+  buffers->hash_windowsize = 0;
+  uivector_cleanup(&buffers->lz77_encoded);
+  uivector_cleanup(&buffers->frequencies_ll);
+  uivector_cleanup(&buffers->frequencies_d);
+  uivector_cleanup(&buffers->frequencies_cl);
+  uivector_cleanup(&buffers->bitlen_lld);
+  uivector_cleanup(&buffers->bitlen_lld_e);
+  uivector_cleanup(&buffers->bitlen_cl);
+  HuffmanTree_cleanup(&buffers->tree_ll);
+  HuffmanTree_cleanup(&buffers->tree_d);
+  HuffmanTree_cleanup(&buffers->tree_cl);
+  lodepng_free(buffers->huffman_scratch.data);
+  HuffmanTree_cleanup(&buffers->fixed_ll);
+  HuffmanTree_cleanup(&buffers->fixed_d);
+}
+
+/*makes the hash usable for new input of this windowsize, allocating it only if the windowsize changed*/
+static unsigned deflate_buffers_prepare_hash(DeflateBuffers* buffers, unsigned windowsize)
+{
+  if(buffers->hash_windowsize != windowsize)
+  {
+    unsigned error;
+    if(buffers->hash_windowsize) hash_cleanup(&buffers->hash);
+    buffers->hash_windowsize = 0;
+    error = hash_init(&buffers->hash, windowsize);
+    if(error)
+    {
+      hash_cleanup(&buffers->hash);
+      return error;
+    }
+    buffers->hash_windowsize = windowsize;
+  }
+  hash_reset(&buffers->hash, windowsize);
+  return 0;
+}
+
 
 
 static unsigned getHash(const unsigned char* data, size_t size, size_t pos)
@@ -1462,6 +2000,58 @@ static void updateHashChain(Hash* hash, size_t wpos, unsigned hashval, unsigned
   hash->headz[numzeros] = wpos;
 }
 
+/*Adds pos to the hash chains. numzeros is the amount of zeros at pos - 1, returns the amount of zeros at pos.*/
+static unsigned hashPosition(Hash* hash, const unsigned char* in, size_t insize, size_t pos, unsigned windowsize,
+                             unsigned numzeros)
+{
+  unsigned hashval = getHash(in, insize, pos);
+  if(hashval == 0)
+  {
+    if(numzeros == 0) numzeros = countZeros(in, insize, pos);
+    else if(pos + numzeros > insize || in[pos + numzeros - 1] != 0) --numzeros;
+  }
+  else
+  {
+    numzeros = 0;
+  }
+  updateHashChain(hash, pos & (windowsize - 1), hashval, (unsigned short)numzeros);
+  return numzeros;
+}
+
+/*amount of positions at the end of a long run of the LZ77 fast path that are hashed*/
+#define RUN_HASHED_TAIL 32
+
+/*returns how many bytes from pos on repeat the bytes distance earlier, at most MAX_SUPPORTED_DEFLATE_LENGTH*/
+static unsigned countRepeat(const unsigned char* data, size_t size, size_t pos, size_t distance)
+{
+  const unsigned char* start = data + pos;
+  const unsigned char* end = start + MAX_SUPPORTED_DEFLATE_LENGTH;
+  const unsigned char* back = start - distance;
+  if(end > data + size) end = data + size;
+  data = start;
+  while(data != end && *data == *back)
+  {
+    ++data;
+    ++back;
+  }
+  return (unsigned)(data - start);
+}
+
+/*
+Marks the positions from begin to end as not in the hash, without hashing them. Used for the inside of long
+runs taken without chain search: later searches then skip them, and can't take a wrong zeros count from them.
+*/
+static void skipHashChain(Hash* hash, size_t begin, size_t end, unsigned windowsize)
+{
+  size_t pos;
+  for(pos = begin; pos < end; ++pos)
+  {
+    size_t wpos = pos & (windowsize - 1);
+    hash->val[wpos] = -1;
+    hash->zeros[wpos] = 0;
+  }
+}
+
 /*
 LZ77-encode the data. Return value is error code. The input are raw bytes, the output
 is in the form of unsigned integers with codes representing for example literal bytes, or
@@ -1473,7 +2063,7 @@ this hash technique is one out of several ways to speed this up.
 */
 static unsigned encodeLZ77(uivector* out, Hash* hash,
                            const unsigned char* in, size_t inpos, size_t insize, unsigned windowsize,
-                           unsigned minmatch, unsigned nicematch, unsigned lazymatching)
+                           unsigned minmatch, unsigned nicematch, unsigned lazymatching, size_t linesize)
 {
   size_t pos;
   unsigned i, error = 0;
@@ -1484,7 +2074,7 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
   unsigned usezeros = 1; /*not sure if setting it to false for windowsize < 8192 is better or worse*/
   unsigned numzeros = 0;
 
-  unsigned offset; /*the offset represents the distance in LZ77 terminology*/
+  unsigned offset = 0; /*the offset represents the distance in LZ77 terminology*/
   unsigned length;
   unsigned lazy = 0;
   unsigned lazylength = 0, lazyoffset = 0;
@@ -1518,6 +2108,40 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
     updateHashChain(hash, wpos, hashval, numzeros);
 
+    /*Fast path for the long runs in images with a plain background: zeros continuing a run of zeros, or a
+    repeat of the previous scanline (which can be further back than the window), are taken as match right
+    away when long enough. There's no chain search for them and their inner positions are not hashed.*/
+    if(!lazy && pos > 0)
+    {
+      length = 0;
+      offset = 0;
+      if(numzeros >= nicematch && in[pos - 1] == 0)
+      {
+        length = numzeros;
+        offset = 1;
+      }
+      else if(linesize && pos >= linesize)
+      {
+        length = countRepeat(in, insize, pos, linesize);
+        offset = (unsigned)linesize;
+      }
+      if(length >= nicematch && length >= minmatch)
+      {
+        size_t end = pos + length;
+        /*the last positions of the run are hashed after all, so that what follows can still refer back to it*/
+        size_t tail = length > RUN_HASHED_TAIL ? end - RUN_HASHED_TAIL : pos + 1;
+        addLengthDistance(out, length, offset);
+        skipHashChain(hash, pos + 1, tail, windowsize);
+        numzeros = 0;
+        for(pos = tail; pos != end; ++pos)
+        {
+          numzeros = hashPosition(hash, in, insize, pos, windowsize, numzeros);
+        }
+        --pos;
+        continue;
+      }
+    }
+
     /*the length and offset found for the current position*/
     length = 0;
     offset = 0;
@@ -1629,18 +2253,7 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
       for(i = 1; i < length; ++i)
       {
         ++pos;
-        wpos = pos & (windowsize - 1);
-        hashval = getHash(in, insize, pos);
-        if(usezeros && hashval == 0)
-        {
-          if(numzeros == 0) numzeros = countZeros(in, insize, pos);
-          else if(pos + numzeros > insize || in[pos + numzeros - 1] != 0) --numzeros;
-        }
-        else
-        {
-          numzeros = 0;
-        }
-        updateHashChain(hash, wpos, hashval, numzeros);
+        numzeros = hashPosition(hash, in, insize, pos, windowsize, numzeros);
       }
     }
   } /*end of the loop through each character of input*/
@@ -1648,9 +2261,63 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
   return error;
 }
 
+/*
+Run length encoding variant of encodeLZ77, like the Z_RLE strategy of zlib: the only matches
+it looks for are repeats of the previous byte and, if linesize isn't 0, of the previous
+scanline. It uses no hash table at all, which makes it much faster than encodeLZ77, at the
+cost of not finding any other repetitions.
+*/
+static unsigned encodeRLE(uivector* out, const unsigned char* in, size_t inpos, size_t insize,
+                          unsigned minmatch, size_t linesize)
+{
+  size_t pos;
+  if(minmatch < 3) minmatch = 3;
+
+  for(pos = inpos; pos < insize; ++pos)
+  {
+    unsigned length = 0, offset = 0;
+    if(pos > 0)
+    {
+      length = countRepeat(in, insize, pos, 1);
+      offset = 1;
+    }
+    if(linesize && pos >= linesize && length < MAX_SUPPORTED_DEFLATE_LENGTH)
+    {
+      unsigned linelength = countRepeat(in, insize, pos, linesize);
+      if(linelength > length)
+      {
+        length = linelength;
+        offset = (unsigned)linesize;
+      }
+    }
+
+    if(length < minmatch)
+    {
+      if(!uivector_push_back(out, in[pos])) return 83; /*alloc fail*/
+    }
+    else
+    {
+      addLengthDistance(out, length, offset);
+      pos += length - 1;
+    }
+  }
+
+  return 0;
+}
+
+/*LZ77-encodes the block from datapos to dataend into buffers->lz77_encoded, with the strategy of the settings*/
+static unsigned lz77EncodeBlock(DeflateBuffers* buffers, const unsigned char* data, size_t datapos, size_t dataend,
+                                const LodePNGCompressSettings* settings)
+{
+  size_t linesize = buffers->linesize > 32768 ? 0 : buffers->linesize; /*deflate distances go up to 32768*/
+  if(settings->rle) return encodeRLE(&buffers->lz77_encoded, data, datapos, dataend, settings->minmatch, linesize);
+  return encodeLZ77(&buffers->lz77_encoded, &buffers->hash, data, datapos, dataend, settings->windowsize,
+                    settings->minmatch, settings->nicematch, settings->lazymatching, linesize);
+}
+
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
+static unsigned deflateNoCompression(ucvector* out, DeflateBuffers* buffers, const unsigned char* data, size_t datasize)
 {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
@@ -1664,6 +2331,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
 
     BFINAL = (i == numdeflateblocks - 1);
     BTYPE = 0;
+    if(buffers->block) buffers->block(1, buffers->block_data);
 
     firstbyte = (unsigned char)(BFINAL + ((BTYPE & 1) << 1) + ((BTYPE & 2) << 1));
     ucvector_push_back(out, firstbyte);
@@ -1682,6 +2350,13 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     {
       ucvector_push_back(out, data[datapos++]);
     }
+    if(buffers->block) buffers->block(0, buffers->block_data);
+
+    if(!BFINAL && buffers->flush)
+    {
+      unsigned error = buffers->flush(out, buffers->flush_data);
+      if(error) return error;
+    }
   }
 
   return 0;
@@ -1721,7 +2396,7 @@ static void writeLZ77data(size_t* bp, ucvector* out, const uivector* lz77_encode
 }
 
 /*Deflate for a block of type "dynamic", that is, with freely, optimally, created huffman trees*/
-static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
+static unsigned deflateDynamic(ucvector* out, size_t* bp, DeflateBuffers* buffers,
                                const unsigned char* data, size_t datapos, size_t dataend,
                                const LodePNGCompressSettings* settings, unsigned final)
 {
@@ -1765,16 +2440,17 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   size_t numcodes_ll, numcodes_d, i;
   unsigned HLIT, HDIST, HCLEN;
 
-  uivector_init(&lz77_encoded);
-  HuffmanTree_init(&tree_ll);
-  HuffmanTree_init(&tree_d);
-  HuffmanTree_init(&tree_cl);
-  uivector_init(&frequencies_ll);
-  uivector_init(&frequencies_d);
-  uivector_init(&frequencies_cl);
-  uivector_init(&bitlen_lld);
-  uivector_init(&bitlen_lld_e);
-  uivector_init(&bitlen_cl);
+  /*the vectors are taken over from buffers empty and given back at the end, so their memory is reused*/
+  lz77_encoded = buffers->lz77_encoded; lz77_encoded.size = 0;
+  tree_ll = buffers->tree_ll;
+  tree_d = buffers->tree_d;
+  tree_cl = buffers->tree_cl;
+  frequencies_ll = buffers->frequencies_ll; frequencies_ll.size = 0;
+  frequencies_d = buffers->frequencies_d; frequencies_d.size = 0;
+  frequencies_cl = buffers->frequencies_cl; frequencies_cl.size = 0;
+  bitlen_lld = buffers->bitlen_lld; bitlen_lld.size = 0;
+  bitlen_lld_e = buffers->bitlen_lld_e; bitlen_lld_e.size = 0;
+  bitlen_cl = buffers->bitlen_cl; bitlen_cl.size = 0;
 
   /*This while loop never loops due to a break at the end, it is here to
   allow breaking out of it to the cleanup phase on error conditions.*/
@@ -1782,8 +2458,9 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   {
     if(settings->use_lz77)
     {
-      error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                         settings->minmatch, settings->nicematch, settings->lazymatching);
+      buffers->lz77_encoded = lz77_encoded;
+      error = lz77EncodeBlock(buffers, data, datapos, dataend, settings);
+      lz77_encoded = buffers->lz77_encoded;
       if(error) break;
     }
     else
@@ -1810,10 +2487,12 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
     frequencies_ll.data[256] = 1; /*there will be exactly 1 end code, at the end of the block*/
 
     /*Make both huffman trees, one for the lit and len codes, one for the dist codes*/
-    error = HuffmanTree_makeFromFrequencies(&tree_ll, frequencies_ll.data, 257, frequencies_ll.size, 15);
+    error = HuffmanTree_makeFromFrequencies(&tree_ll, frequencies_ll.data, 257, frequencies_ll.size, 15,
+                                            &buffers->huffman_scratch);
     if(error) break;
     /*2, not 1, is chosen for mincodes: some buggy PNG decoders require at least 2 symbols in the dist tree*/
-    error = HuffmanTree_makeFromFrequencies(&tree_d, frequencies_d.data, 2, frequencies_d.size, 15);
+    error = HuffmanTree_makeFromFrequencies(&tree_d, frequencies_d.data, 2, frequencies_d.size, 15,
+                                            &buffers->huffman_scratch);
     if(error) break;
 
     numcodes_ll = tree_ll.numcodes; if(numcodes_ll > 286) numcodes_ll = 286;
@@ -1881,7 +2560,7 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
     }
 
     error = HuffmanTree_makeFromFrequencies(&tree_cl, frequencies_cl.data,
-                                            frequencies_cl.size, frequencies_cl.size, 7);
+                                            frequencies_cl.size, frequencies_cl.size, 7, &buffers->huffman_scratch);
     if(error) break;
 
     if(!uivector_resize(&bitlen_cl, tree_cl.numcodes)) ERROR_BREAK(83 /*alloc fail*/);
@@ -1952,37 +2631,40 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
   }
 
   /*cleanup*/
-  uivector_cleanup(&lz77_encoded);
-  HuffmanTree_cleanup(&tree_ll);
-  HuffmanTree_cleanup(&tree_d);
-  HuffmanTree_cleanup(&tree_cl);
-  uivector_cleanup(&frequencies_ll);
-  uivector_cleanup(&frequencies_d);
-  uivector_cleanup(&frequencies_cl);
-  uivector_cleanup(&bitlen_lld_e);
-  uivector_cleanup(&bitlen_lld);
-  uivector_cleanup(&bitlen_cl);
+  buffers->lz77_encoded = lz77_encoded;
+  buffers->tree_ll = tree_ll;
+  buffers->tree_d = tree_d;
+  buffers->tree_cl = tree_cl;
+  buffers->frequencies_ll = frequencies_ll;
+  buffers->frequencies_d = frequencies_d;
+  buffers->frequencies_cl = frequencies_cl;
+  buffers->bitlen_lld_e = bitlen_lld_e;
+  buffers->bitlen_lld = bitlen_lld;
+  buffers->bitlen_cl = bitlen_cl;
 
   return error;
 }
 
-static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
+static unsigned deflateFixed(ucvector* out, size_t* bp, DeflateBuffers* buffers,
                              const unsigned char* data,
                              size_t datapos, size_t dataend,
                              const LodePNGCompressSettings* settings, unsigned final)
 {
-  HuffmanTree tree_ll; /*tree for literal values and length codes*/
-  HuffmanTree tree_d; /*tree for distance codes*/
+  HuffmanTree* tree_ll = &buffers->fixed_ll; /*tree for literal values and length codes*/
+  HuffmanTree* tree_d = &buffers->fixed_d; /*tree for distance codes*/
 
   unsigned BFINAL = final;
   unsigned error = 0;
   size_t i;
 
-  HuffmanTree_init(&tree_ll);
-  HuffmanTree_init(&tree_d);
-
-  generateFixedLitLenTree(&tree_ll);
-  generateFixedDistanceTree(&tree_d);
+  /*the fixed trees never change, so they are made only once per DeflateBuffers*/
+  if(!buffers->fixed_made)
+  {
+    error = generateFixedLitLenTree(tree_ll);
+    if(!error) error = generateFixedDistanceTree(tree_d);
+    if(error) return error;
+    buffers->fixed_made = 1;
+  }
 
   addBitToStream(bp, out, BFINAL);
   addBitToStream(bp, out, 1); /*first bit of BTYPE*/
@@ -1990,40 +2672,34 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
 
   if(settings->use_lz77) /*LZ77 encoded*/
   {
-    uivector lz77_encoded;
-    uivector_init(&lz77_encoded);
-    error = encodeLZ77(&lz77_encoded, hash, data, datapos, dataend, settings->windowsize,
-                       settings->minmatch, settings->nicematch, settings->lazymatching);
-    if(!error) writeLZ77data(bp, out, &lz77_encoded, &tree_ll, &tree_d);
-    uivector_cleanup(&lz77_encoded);
+    uivector* lz77_encoded = &buffers->lz77_encoded;
+    lz77_encoded->size = 0;
+    error = lz77EncodeBlock(buffers, data, datapos, dataend, settings);
+    if(!error) writeLZ77data(bp, out, lz77_encoded, tree_ll, tree_d);
   }
   else /*no LZ77, but still will be Huffman compressed*/
   {
     for(i = datapos; i < dataend; ++i)
     {
-      addHuffmanSymbol(bp, out, HuffmanTree_getCode(&tree_ll, data[i]), HuffmanTree_getLength(&tree_ll, data[i]));
+      addHuffmanSymbol(bp, out, HuffmanTree_getCode(tree_ll, data[i]), HuffmanTree_getLength(tree_ll, data[i]));
     }
   }
   /*add END code*/
-  if(!error) addHuffmanSymbol(bp, out, HuffmanTree_getCode(&tree_ll, 256), HuffmanTree_getLength(&tree_ll, 256));
-
-  /*cleanup*/
-  HuffmanTree_cleanup(&tree_ll);
-  HuffmanTree_cleanup(&tree_d);
+  if(!error) addHuffmanSymbol(bp, out, HuffmanTree_getCode(tree_ll, 256), HuffmanTree_getLength(tree_ll, 256));
 
   return error;
 }
 
+/*deflates in, appending to out. The working memory comes from buffers, which may be reused for the next call*/
 static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings)
+                                 const LodePNGCompressSettings* settings, DeflateBuffers* buffers)
 {
   unsigned error = 0;
   size_t i, blocksize, numdeflateblocks;
   size_t bp = 0; /*the bit pointer*/
-  Hash hash;
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
+  else if(settings->btype == 0) return deflateNoCompression(out, buffers, in, insize);
   else if(settings->btype == 1) blocksize = insize;
   else /*if(settings->btype == 2)*/
   {
@@ -2036,8 +2712,12 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
   numdeflateblocks = (insize + blocksize - 1) / blocksize;
   if(numdeflateblocks == 0) numdeflateblocks = 1;
 
-  error = hash_init(&hash, settings->windowsize);
-  if(error) return error;
+  if(settings->use_lz77 && !settings->rle)
+  {
+    if(settings->windowsize == 0 || settings->windowsize > 32768) return 60; /*error: windowsize smaller/larger than allowed*/
+    error = deflate_buffers_prepare_hash(buffers, settings->windowsize);
+    if(error) return error;
+  }
 
   for(i = 0; i != numdeflateblocks && !error; ++i)
   {
@@ -2046,12 +2726,13 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
     size_t end = start + blocksize;
     if(end > insize) end = insize;
 
-    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, end, settings, final);
-    else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final);
+    if(buffers->block) buffers->block(1, buffers->block_data);
+    if(settings->btype == 1) error = deflateFixed(out, &bp, buffers, in, start, end, settings, final);
+    else if(settings->btype == 2) error = deflateDynamic(out, &bp, buffers, in, start, end, settings, final);
+    if(buffers->block) buffers->block(0, buffers->block_data);
+    if(!error && !final && buffers->flush) error = buffers->flush(out, buffers->flush_data);
   }
 
-  hash_cleanup(&hash);
-
   return error;
 }
 
@@ -2061,27 +2742,16 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
 {
   unsigned error;
   ucvector v;
+  DeflateBuffers buffers;
+  deflate_buffers_init(&buffers);
   ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_deflatev(&v, in, insize, settings);
+  error = lodepng_deflatev(&v, in, insize, settings, &buffers);
+  deflate_buffers_cleanup(&buffers);
   *out = v.data;
   *outsize = v.size;
   return error;
 }
 
-static unsigned deflate(unsigned char** out, size_t* outsize,
-                        const unsigned char* in, size_t insize,
-                        const LodePNGCompressSettings* settings)
-{
-  if(settings->custom_deflate)
-  {
-    return settings->custom_deflate(out, outsize, in, insize, settings);
-  }
-  else
-  {
-    return lodepng_deflate(out, outsize, in, insize, settings);
-  }
-}
-
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -2123,13 +2793,11 @@ static unsigned adler32(const unsigned char* data, unsigned len)
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                 size_t insize, const LodePNGDecompressSettings* settings)
+/*checks the 2-byte zlib header*/
+static unsigned zlibCheckHeader(const unsigned char* in)
 {
-  unsigned error = 0;
   unsigned CM, CINFO, FDICT;
 
-  if(insize < 2) return 53; /*error, size of zlib data too small*/
   /*read information from zlib header*/
   if((in[0] * 256 + in[1]) % 31 != 0)
   {
@@ -2155,19 +2823,44 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
     return 26;
   }
 
-  error = inflate(out, outsize, in + 2, insize - 2, settings);
+  return 0;
+}
+
+/*the built in inflator uses the room that is already reserved in out, and only grows it if that's too little*/
+static unsigned lodepng_zlib_decompressv(ucvector* out, const unsigned char* in,
+                                         size_t insize, const LodePNGDecompressSettings* settings)
+{
+  unsigned error = 0;
+
+  if(insize < 2) return 53; /*error, size of zlib data too small*/
+  error = zlibCheckHeader(in);
+  if(error) return error;
+
+  error = inflatev(out, in + 2, insize - 2, settings);
   if(error) return error;
 
   if(!settings->ignore_adler32)
   {
     unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
-    unsigned checksum = adler32(*out, (unsigned)(*outsize));
+    unsigned checksum = adler32(out->data, (unsigned)(out->size));
     if(checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
   }
 
   return 0; /*no error*/
 }
 
+unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
+{
+  unsigned error;
+  ucvector v;
+  ucvector_init_buffer(&v, *out, *outsize);
+  error = lodepng_zlib_decompressv(&v, in, insize, settings);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
 static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
                                 size_t insize, const LodePNGDecompressSettings* settings)
 {
@@ -2181,20 +2874,111 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
   }
 }
 
+static unsigned zlib_decompressv(ucvector* out, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
+{
+  if(settings->custom_zlib)
+  {
+    unsigned error = settings->custom_zlib(&out->data, &out->size, in, insize, settings);
+    out->allocsize = out->size;
+    return error;
+  }
+  else
+  {
+    return lodepng_zlib_decompressv(out, in, insize, settings);
+  }
+}
+
+#ifdef LODEPNG_COMPILE_PNG
+typedef struct ZlibStream
+{
+  InflateSink* sink; /*the sink of the user of zlib_decompress_stream*/
+  unsigned adler; /*adler32 of the output so far*/
+} ZlibStream;
+
+static unsigned zlibStreamWrite(const unsigned char* data, size_t size, void* write_data)
+{
+  ZlibStream* stream = (ZlibStream*)write_data;
+  stream->adler = update_adler32(stream->adler, data, (unsigned)size);
+  return stream->sink->write(data, size, stream->sink->write_data);
+}
+
+/*
+Decompresses zlib data without having all of it, or all of its output, in memory at once:
+the input is pulled from read as needed, and the output goes to the sink in pieces, while
+only a window of 32K is kept for the matches. Uses INFLATE_STAGE_SIZE plus about twice
+INFLATE_WINDOW_SIZE bytes of memory. The custom_zlib and custom_inflate settings do not apply.
+*/
+static unsigned zlib_decompress_stream(size_t (*read)(unsigned char*, size_t, void*), void* read_data,
+                                       InflateSink* sink, const LodePNGDecompressSettings* settings)
+{
+  unsigned error = 0;
+  unsigned char header[2];
+  size_t pos = 0;
+  ucvector out;
+  LodePNGBitReader reader;
+  ZlibStream stream;
+  InflateSink zlibsink;
+
+  stream.sink = sink;
+  stream.adler = 1;
+  zlibsink.write = zlibStreamWrite;
+  zlibsink.write_data = &stream;
+  zlibsink.written = 0;
+
+  ucvector_init(&out);
+  LodePNGBitReader_init(&reader, 0, 0);
+  reader.stage = (unsigned char*)lodepng_malloc(INFLATE_STAGE_SIZE);
+  reader.data = reader.stage;
+  reader.read = read;
+  reader.read_data = read_data;
+
+  while(!error) /*not a real while loop, just a break-able block*/
+  {
+    unsigned i, ADLER32 = 0;
+    if(!reader.stage || !ucvector_reserve(&out, 2 * INFLATE_WINDOW_SIZE + INFLATE_MAX_SYMBOL_OUTPUT))
+    {
+      ERROR_BREAK(83); /*alloc fail*/
+    }
+
+    ensureBits57(&reader);
+    if(reader.size < 2) ERROR_BREAK(53); /*error, size of zlib data too small*/
+    header[0] = (unsigned char)readBitsNoRefill(&reader, 8);
+    header[1] = (unsigned char)readBitsNoRefill(&reader, 8);
+    error = zlibCheckHeader(header);
+    if(error) break;
+
+    error = inflateBlocks(&out, &reader, &pos, &zlibsink);
+    if(!error) error = inflateDrain(&out, &pos, &zlibsink);
+    if(error) break;
+
+    if(!settings->ignore_adler32)
+    {
+      /*the checksum follows the deflate data, starting at a byte boundary*/
+      reader.bp = (reader.bp + 7u) & ~(size_t)7u;
+      ensureBits57(&reader);
+      if(reader.bp + 32 > reader.bitsize) ERROR_BREAK(58); /*the checksum is missing*/
+      for(i = 0; i != 4; ++i) ADLER32 = (ADLER32 << 8u) | readBitsNoRefill(&reader, 8);
+      if(stream.adler != ADLER32) ERROR_BREAK(58); /*error, adler checksum not correct, data must be corrupted*/
+    }
+    break;
+  }
+
+  ucvector_cleanup(&out);
+  lodepng_free(reader.stage);
+  return error;
+}
+#endif /*LODEPNG_COMPILE_PNG*/
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
 
-unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                               size_t insize, const LodePNGCompressSettings* settings)
+/*the zlib compressor of lodepng_zlib_compress, appending to out and taking its working memory from buffers*/
+static unsigned zlib_compressv_default(ucvector* out, const unsigned char* in, size_t insize,
+                                       const LodePNGCompressSettings* settings, DeflateBuffers* buffers)
 {
-  /*initially, *out must be NULL and outsize 0, if you just give some random *out
-  that's pointing to a non allocated buffer, this'll crash*/
-  ucvector outv;
-  size_t i;
   unsigned error;
-  unsigned char* deflatedata = 0;
-  size_t deflatesize = 0;
 
   /*zlib data: 1 byte CMF (CM+CINFO), 1 byte FLG, deflate data, 4 byte ADLER32 checksum of the Decompressed data*/
   unsigned CMF = 120; /*0b01111000: CM 8, CINFO 7. With CINFO 7, any window size up to 32768 can be used.*/
@@ -2204,22 +2988,53 @@ unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsig
   unsigned FCHECK = 31 - CMFFLG % 31;
   CMFFLG += FCHECK;
 
-  /*ucvector-controlled version of the output buffer, for dynamic array*/
-  ucvector_init_buffer(&outv, *out, *outsize);
+  ucvector_push_back(out, (unsigned char)(CMFFLG >> 8));
+  ucvector_push_back(out, (unsigned char)(CMFFLG & 255));
 
-  ucvector_push_back(&outv, (unsigned char)(CMFFLG >> 8));
-  ucvector_push_back(&outv, (unsigned char)(CMFFLG & 255));
-
-  error = deflate(&deflatedata, &deflatesize, in, insize, settings);
+  if(settings->custom_deflate)
+  {
+    unsigned char* deflatedata = 0;
+    size_t deflatesize = 0;
+    error = settings->custom_deflate(&deflatedata, &deflatesize, in, insize, settings);
+    if(!error)
+    {
+      size_t pos = out->size;
+      if(!ucvector_resize(out, pos + deflatesize)) error = 83; /*alloc fail*/
+      else if(deflatesize) memcpy(&out->data[pos], deflatedata, deflatesize);
+    }
+    lodepng_free(deflatedata);
+  }
+  else
+  {
+    /*the deflate encoder appends directly to the zlib data, no copy needed*/
+    error = lodepng_deflatev(out, in, insize, settings, buffers);
+  }
 
   if(!error)
   {
     unsigned ADLER32 = adler32(in, (unsigned)insize);
-    for(i = 0; i != deflatesize; ++i) ucvector_push_back(&outv, deflatedata[i]);
-    lodepng_free(deflatedata);
-    lodepng_add32bitInt(&outv, ADLER32);
+    lodepng_add32bitInt(out, ADLER32);
   }
 
+  return error;
+}
+
+unsigned lodepng_zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                               size_t insize, const LodePNGCompressSettings* settings)
+{
+  /*initially, *out must be NULL and outsize 0, if you just give some random *out
+  that's pointing to a non allocated buffer, this'll crash*/
+  ucvector outv;
+  unsigned error;
+  DeflateBuffers buffers;
+
+  /*ucvector-controlled version of the output buffer, for dynamic array*/
+  ucvector_init_buffer(&outv, *out, *outsize);
+  deflate_buffers_init(&buffers);
+
+  error = zlib_compressv_default(&outv, in, insize, settings, &buffers);
+
+  deflate_buffers_cleanup(&buffers);
   *out = outv.data;
   *outsize = outv.size;
 
@@ -2240,6 +3055,30 @@ static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsign
   }
 }
 
+/*same as zlib_compress but appends to out, and the built in compressor takes its working memory from buffers*/
+static unsigned zlib_compressv(ucvector* out, const unsigned char* in, size_t insize,
+                               const LodePNGCompressSettings* settings, DeflateBuffers* buffers)
+{
+  if(settings->custom_zlib)
+  {
+    unsigned char* zlibdata = 0;
+    size_t zlibsize = 0;
+    unsigned error = settings->custom_zlib(&zlibdata, &zlibsize, in, insize, settings);
+    if(!error)
+    {
+      size_t pos = out->size;
+      if(!ucvector_resize(out, pos + zlibsize)) error = 83; /*alloc fail*/
+      else if(zlibsize) memcpy(&out->data[pos], zlibdata, zlibsize);
+    }
+    lodepng_free(zlibdata);
+    return error;
+  }
+  else
+  {
+    return zlib_compressv_default(out, in, insize, settings, buffers);
+  }
+}
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 #else /*no LODEPNG_COMPILE_ZLIB*/
@@ -2251,6 +3090,16 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
   if(!settings->custom_zlib) return 87; /*no custom zlib function provided */
   return settings->custom_zlib(out, outsize, in, insize, settings);
 }
+
+static unsigned zlib_decompressv(ucvector* out, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
+{
+  unsigned error;
+  if(!settings->custom_zlib) return 87; /*no custom zlib function provided */
+  error = settings->custom_zlib(&out->data, &out->size, in, insize, settings);
+  out->allocsize = out->size;
+  return error;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 #ifdef LODEPNG_COMPILE_ENCODER
 static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
@@ -2259,6 +3108,49 @@ static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsign
   if(!settings->custom_zlib) return 87; /*no custom zlib function provided */
   return settings->custom_zlib(out, outsize, in, insize, settings);
 }
+
+/*without the built in zlib there is no working memory to keep between calls*/
+typedef struct DeflateBuffers
+{
+  /*unused: custom_zlib gives the whole zlib stream at once*/
+  unsigned (*flush)(ucvector* out, void* flush_data);
+  void* flush_data;
+  void (*block)(unsigned begin, void* block_data);
+  void* block_data;
+  size_t linesize;
+} DeflateBuffers;
+
+static void deflate_buffers_init(DeflateBuffers* buffers)
+{
+  buffers->flush = 0;
+  buffers->flush_data = 0;
+  buffers->block = 0;
+  buffers->block_data = 0;
+  buffers->linesize = 0;
+}
+
+static void deflate_buffers_cleanup(DeflateBuffers* buffers)
+{
+  (void)buffers;
+}
+
+static unsigned zlib_compressv(ucvector* out, const unsigned char* in, size_t insize,
+                               const LodePNGCompressSettings* settings, DeflateBuffers* buffers)
+{
+  unsigned char* zlibdata = 0;
+  size_t zlibsize = 0;
+  unsigned error;
+  (void)buffers;
+  error = zlib_compress(&zlibdata, &zlibsize, in, insize, settings);
+  if(!error)
+  {
+    size_t pos = out->size;
+    if(!ucvector_resize(out, pos + zlibsize)) error = 83; /*alloc fail*/
+    else if(zlibsize) memcpy(&out->data[pos], zlibdata, zlibsize);
+  }
+  lodepng_free(zlibdata);
+  return error;
+}
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 #endif /*LODEPNG_COMPILE_ZLIB*/
@@ -2279,13 +3171,14 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings)
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->rle = 0;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0, 0};
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2760,8 +3653,10 @@ static unsigned LodePNGUnknownChunks_copy(LodePNGInfo* dest, const LodePNGInfo*
   {
     size_t j;
     dest->unknown_chunks_size[i] = src->unknown_chunks_size[i];
+    dest->unknown_chunks_data[i] = 0; /*nothing to allocate for the usual case of no unknown chunks*/
+    if(!src->unknown_chunks_size[i]) continue;
     dest->unknown_chunks_data[i] = (unsigned char*)lodepng_malloc(src->unknown_chunks_size[i]);
-    if(!dest->unknown_chunks_data[i] && dest->unknown_chunks_size[i]) return 83; /*alloc fail*/
+    if(!dest->unknown_chunks_data[i]) return 83; /*alloc fail*/
     for(j = 0; j < src->unknown_chunks_size[i]; ++j)
     {
       dest->unknown_chunks_data[i][j] = src->unknown_chunks_data[i][j];
@@ -2989,82 +3884,53 @@ static void addColorBits(unsigned char* out, size_t index, unsigned bits, unsign
   else out[index * bits / 8] |= in;
 }
 
-typedef struct ColorTree ColorTree;
+/*amount of slots of a ColorIndex, a power of two, 4 times more than the at most 256 colors of a palette*/
+#define COLOR_INDEX_SIZE 1024
 
 /*
-One node of a color tree
-This is the data structure used to count the number of unique colors and to get a palette
-index for a color. It's like an octree, but because the alpha channel is used too, each
-node has 16 instead of 8 children.
+Palette index of RGBA colors, to convert to a palette color type. It's an open addressing hash
+table on the stack, so a conversion makes no allocations, however many colors the palette has.
 */
-struct ColorTree
-{
-  ColorTree* children[16]; /*up to 16 pointers to ColorTree of next level*/
-  int index; /*the payload. Only has a meaningful value if this is in the last level*/
-};
-
-static void color_tree_init(ColorTree* tree)
+typedef struct ColorIndex
 {
-  int i;
-  for(i = 0; i != 16; ++i) tree->children[i] = 0;
-  tree->index = -1;
-}
+  unsigned colors[COLOR_INDEX_SIZE]; /*RGBA packed in 32 bits*/
+  short index[COLOR_INDEX_SIZE]; /*palette index of the color in the slot, -1 if the slot is empty*/
+} ColorIndex;
 
-static void color_tree_cleanup(ColorTree* tree)
+static void color_index_init(ColorIndex* table)
 {
-  int i;
-  for(i = 0; i != 16; ++i)
-  {
-    if(tree->children[i])
-    {
-      color_tree_cleanup(tree->children[i]);
-      lodepng_free(tree->children[i]);
-    }
-  }
+  unsigned i;
+  for(i = 0; i != COLOR_INDEX_SIZE; ++i) table->index[i] = -1;
 }
 
-/*returns -1 if color not present, its index otherwise*/
-static int color_tree_get(ColorTree* tree, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+/*the slot of the color, or the empty slot where it belongs*/
+static unsigned color_index_slot(const ColorIndex* table,
+                                 unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
-  int bit = 0;
-  for(bit = 0; bit < 8; ++bit)
-  {
-    int i = 8 * ((r >> bit) & 1) + 4 * ((g >> bit) & 1) + 2 * ((b >> bit) & 1) + 1 * ((a >> bit) & 1);
-    if(!tree->children[i]) return -1;
-    else tree = tree->children[i];
-  }
-  return tree ? tree->index : -1;
+  unsigned color = ((unsigned)r << 24u) | ((unsigned)g << 16u) | ((unsigned)b << 8u) | (unsigned)a;
+  unsigned i = ((color * 2654435761u) >> 16u) & (COLOR_INDEX_SIZE - 1u);
+  while(table->index[i] >= 0 && table->colors[i] != color) i = (i + 1u) & (COLOR_INDEX_SIZE - 1u);
+  return i;
 }
 
-#ifdef LODEPNG_COMPILE_ENCODER
-static int color_tree_has(ColorTree* tree, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+/*returns -1 if color not present, its index otherwise*/
+static int color_index_get(const ColorIndex* table, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
-  return color_tree_get(tree, r, g, b, a) >= 0;
+  return table->index[color_index_slot(table, r, g, b, a)];
 }
-#endif /*LODEPNG_COMPILE_ENCODER*/
 
-/*color is not allowed to already exist.
-Index should be >= 0 (it's signed to be compatible with using -1 for "doesn't exist")*/
-static void color_tree_add(ColorTree* tree,
-                           unsigned char r, unsigned char g, unsigned char b, unsigned char a, unsigned index)
+/*index must be below 256. If the color is already present, it gets the new index*/
+static void color_index_add(ColorIndex* table,
+                            unsigned char r, unsigned char g, unsigned char b, unsigned char a, unsigned index)
 {
-  int bit;
-  for(bit = 0; bit < 8; ++bit)
-  {
-    int i = 8 * ((r >> bit) & 1) + 4 * ((g >> bit) & 1) + 2 * ((b >> bit) & 1) + 1 * ((a >> bit) & 1);
-    if(!tree->children[i])
-    {
-      tree->children[i] = (ColorTree*)lodepng_malloc(sizeof(ColorTree));
-      color_tree_init(tree->children[i]);
-    }
-    tree = tree->children[i];
-  }
-  tree->index = (int)index;
+  unsigned i = color_index_slot(table, r, g, b, a);
+  table->colors[i] = ((unsigned)r << 24u) | ((unsigned)g << 16u) | ((unsigned)b << 8u) | (unsigned)a;
+  table->index[i] = (short)index;
 }
 
 /*put a pixel, given its RGBA color, into image of any color type*/
 static unsigned rgba8ToPixel(unsigned char* out, size_t i,
-                             const LodePNGColorMode* mode, ColorTree* tree /*for palette*/,
+                             const LodePNGColorMode* mode, const ColorIndex* palette /*for palette*/,
                              unsigned char r, unsigned char g, unsigned char b, unsigned char a)
 {
   if(mode->colortype == LCT_GREY)
@@ -3096,7 +3962,7 @@ static unsigned rgba8ToPixel(unsigned char* out, size_t i,
   }
   else if(mode->colortype == LCT_PALETTE)
   {
-    int index = color_tree_get(tree, r, g, b, a);
+    int index = color_index_get(palette, r, g, b, a);
     if(index < 0) return 82; /*color not in palette*/
     if(mode->bitdepth == 8) out[i] = index;
     else addColorBits(out, i, mode->bitdepth, (unsigned)index);
@@ -3456,12 +4322,120 @@ static void getPixelColorRGBA16(unsigned short* r, unsigned short* g, unsigned s
   }
 }
 
+/*
+Fast path of lodepng_convert for conversions between greyscale and RGB, with or without alpha, at 8 or 16
+bits per channel: those only keep, repeat or drop channels, and take the high byte or double the byte of
+each value. Gives the same result as the generic path. The loops for the most common pairs are kept
+simple so that the compiler can vectorize them. Returns 0 if the conversion isn't one it handles: palettes,
+bit depths below 8, and a color key of the input that would have to become alpha.
+*/
+static unsigned convertChannels(unsigned char* out, const unsigned char* in,
+                                const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
+                                size_t numpixels)
+{
+  size_t i;
+  unsigned c;
+  unsigned in_channels, out_channels, in_bytes, out_bytes;
+  int source[4]; /*for each output channel, the input channel it comes from, or -1 for opaque alpha*/
+  unsigned in_alpha = mode_in->colortype == LCT_GREY_ALPHA || mode_in->colortype == LCT_RGBA;
+  unsigned in_color = mode_in->colortype == LCT_RGB || mode_in->colortype == LCT_RGBA;
+  unsigned out_alpha = mode_out->colortype == LCT_GREY_ALPHA || mode_out->colortype == LCT_RGBA;
+  unsigned out_color = mode_out->colortype == LCT_RGB || mode_out->colortype == LCT_RGBA;
+
+  if(mode_in->colortype == LCT_PALETTE || mode_out->colortype == LCT_PALETTE) return 0;
+  if(mode_in->bitdepth < 8 || mode_out->bitdepth < 8) return 0;
+  if(mode_in->key_defined && !in_alpha && out_alpha) return 0;
+
+  in_channels = getNumColorChannels(mode_in->colortype);
+  out_channels = getNumColorChannels(mode_out->colortype);
+  in_bytes = mode_in->bitdepth / 8;
+  out_bytes = mode_out->bitdepth / 8;
+
+  /*the most common pairs, such as a decode of RGB to RGBA or the reverse when encoding*/
+  if(in_bytes == 1 && out_bytes == 1)
+  {
+    if(mode_in->colortype == LCT_RGB && mode_out->colortype == LCT_RGBA)
+    {
+      for(i = 0; i != numpixels; ++i)
+      {
+        out[i * 4 + 0] = in[i * 3 + 0];
+        out[i * 4 + 1] = in[i * 3 + 1];
+        out[i * 4 + 2] = in[i * 3 + 2];
+        out[i * 4 + 3] = 255;
+      }
+      return 1;
+    }
+    if(mode_in->colortype == LCT_RGBA && mode_out->colortype == LCT_RGB)
+    {
+      for(i = 0; i != numpixels; ++i)
+      {
+        out[i * 3 + 0] = in[i * 4 + 0];
+        out[i * 3 + 1] = in[i * 4 + 1];
+        out[i * 3 + 2] = in[i * 4 + 2];
+      }
+      return 1;
+    }
+    if(mode_in->colortype == LCT_GREY && out_color)
+    {
+      for(i = 0; i != numpixels; ++i)
+      {
+        out[i * out_channels + 0] = out[i * out_channels + 1] = out[i * out_channels + 2] = in[i];
+        if(out_alpha) out[i * 4 + 3] = 255;
+      }
+      return 1;
+    }
+    if(mode_out->colortype == LCT_GREY)
+    {
+      /*like the generic path, greyscale takes the red channel*/
+      for(i = 0; i != numpixels; ++i) out[i] = in[i * in_channels];
+      return 1;
+    }
+  }
+  else if(in_bytes == 2 && out_bytes == 1 && mode_in->colortype == mode_out->colortype)
+  {
+    /*16-bit to 8-bit of the same color type keeps the most significant byte of every value*/
+    size_t numvalues = numpixels * in_channels;
+    for(i = 0; i != numvalues; ++i) out[i] = in[i * 2];
+    return 1;
+  }
+
+  /*all other pairs: channel by channel*/
+  for(c = 0; c != out_channels; ++c)
+  {
+    if(out_alpha && c == out_channels - 1) source[c] = in_alpha ? (int)in_channels - 1 : -1;
+    else if(out_color && in_color) source[c] = (int)c;
+    else source[c] = 0; /*grey from red, or RGB from grey*/
+  }
+  for(i = 0; i != numpixels; ++i)
+  {
+    const unsigned char* pin = &in[i * in_channels * in_bytes];
+    unsigned char* pout = &out[i * out_channels * out_bytes];
+    for(c = 0; c != out_channels; ++c)
+    {
+      unsigned char high = 255, low = 255;
+      if(source[c] >= 0)
+      {
+        high = pin[source[c] * in_bytes];
+        low = pin[source[c] * in_bytes + in_bytes - 1];
+      }
+      if(out_bytes == 1) pout[c] = high;
+      else
+      {
+        pout[c * 2 + 0] = high;
+        pout[c * 2 + 1] = low;
+      }
+    }
+  }
+  return 1;
+}
+
 unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
                          const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in,
                          unsigned w, unsigned h)
 {
   size_t i;
-  ColorTree tree;
+  unsigned error = 0;
+  ColorIndex palette_index;
   size_t numpixels = w * h;
 
   if(lodepng_color_mode_equal(mode_out, mode_in))
@@ -3471,6 +4445,8 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
     return 0;
   }
 
+  if(convertChannels(out, in, mode_out, mode_in, numpixels)) return 0;
+
   if(mode_out->colortype == LCT_PALETTE)
   {
     size_t palettesize = mode_out->palettesize;
@@ -3485,11 +4461,11 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
       palette = mode_in->palette;
     }
     if(palettesize < palsize) palsize = palettesize;
-    color_tree_init(&tree);
+    color_index_init(&palette_index);
     for(i = 0; i != palsize; ++i)
     {
       const unsigned char* p = &palette[i * 4];
-      color_tree_add(&tree, p[0], p[1], p[2], p[3], i);
+      color_index_add(&palette_index, p[0], p[1], p[2], p[3], i);
     }
   }
 
@@ -3516,16 +4492,12 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
     for(i = 0; i != numpixels; ++i)
     {
       getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode_in);
-      CERROR_TRY_RETURN(rgba8ToPixel(out, i, mode_out, &tree, r, g, b, a));
+      error = rgba8ToPixel(out, i, mode_out, &palette_index, r, g, b, a);
+      if(error) break;
     }
   }
 
-  if(mode_out->colortype == LCT_PALETTE)
-  {
-    color_tree_cleanup(&tree);
-  }
-
-  return 0; /*no error*/
+  return error;
 }
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -3562,6 +4534,40 @@ static unsigned getValueRequiredBits(unsigned char value)
   return 8;
 }
 
+/*amount of slots of a ColorSet, a power of two, 4 times more than the at most 257 colors that get counted*/
+#define COLOR_SET_SIZE 1024
+
+/*
+Set of RGBA colors, to count the unique colors of an image. It's an open addressing hash table
+on the stack, like the ColorIndex of lodepng_convert: fast, and it needs no allocations. It is
+not made for more than a few hundred colors.
+*/
+typedef struct ColorSet
+{
+  unsigned colors[COLOR_SET_SIZE]; /*RGBA packed in 32 bits*/
+  unsigned char used[COLOR_SET_SIZE];
+} ColorSet;
+
+static void color_set_init(ColorSet* set)
+{
+  memset(set->used, 0, sizeof(set->used));
+}
+
+/*adds the color if it isn't in the set yet, returns whether it was added*/
+static unsigned color_set_add(ColorSet* set, unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+  unsigned color = ((unsigned)r << 24u) | ((unsigned)g << 16u) | ((unsigned)b << 8u) | (unsigned)a;
+  unsigned i = ((color * 2654435761u) >> 16u) & (COLOR_SET_SIZE - 1u);
+  while(set->used[i])
+  {
+    if(set->colors[i] == color) return 0;
+    i = (i + 1u) & (COLOR_SET_SIZE - 1u);
+  }
+  set->used[i] = 1;
+  set->colors[i] = color;
+  return 1;
+}
+
 /*profile must already have been inited with mode.
 It's ok to set some parameters of profile to done already.*/
 unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
@@ -3570,19 +4576,21 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
 {
   unsigned error = 0;
   size_t i;
-  ColorTree tree;
+  ColorSet colors;
   size_t numpixels = w * h;
 
   unsigned colored_done = lodepng_is_greyscale_type(mode) ? 1 : 0;
   unsigned alpha_done = lodepng_can_have_alpha(mode) ? 0 : 1;
   unsigned numcolors_done = 0;
   unsigned bpp = lodepng_get_bpp(mode);
+  /*profile->bits never gets above 8 for images below 16-bit, so with more bits per pixel 8 is the most*/
+  unsigned maxbits = bpp < 8 ? bpp : 8;
   unsigned bits_done = bpp == 1 ? 1 : 0;
   unsigned maxnumcolors = 257;
   unsigned sixteen = 0;
   if(bpp <= 8) maxnumcolors = bpp == 1 ? 2 : (bpp == 2 ? 4 : (bpp == 4 ? 16 : 256));
 
-  color_tree_init(&tree);
+  color_set_init(&colors);
 
   /*Check if the 16-bit input is truly 16-bit*/
   if(mode->bitdepth == 16)
@@ -3659,9 +4667,34 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
   else /* < 16-bit */
   {
     unsigned char r = 0, g = 0, b = 0, a = 0;
+    unsigned char pr = 0, pg = 0, pb = 0, pa = 0; /*the previous pixel*/
+    /*8-bit greyscale and RGB images are read directly instead of with getPixelColorRGBA8*/
+    unsigned channels = 0;
+    if(mode->bitdepth == 8 && mode->colortype != LCT_PALETTE) channels = getNumColorChannels(mode->colortype);
     for(i = 0; i != numpixels; ++i)
     {
-      getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode);
+      if(channels)
+      {
+        const unsigned char* p = &in[i * channels];
+        r = g = b = p[0];
+        a = 255;
+        if(channels >= 3)
+        {
+          g = p[1];
+          b = p[2];
+          if(channels == 4) a = p[3];
+        }
+        else if(channels == 2) a = p[1];
+      }
+      else getPixelColorRGBA8(&r, &g, &b, &a, in, i, mode);
+
+      /*a pixel of the same color as the previous one can't change the profile, skip it. Very common in
+      images with plain areas.*/
+      if(i != 0 && r == pr && g == pg && b == pb && a == pa) continue;
+      pr = r;
+      pg = g;
+      pb = b;
+      pa = a;
 
       if(!bits_done && profile->bits < 8)
       {
@@ -3669,7 +4702,7 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
         unsigned bits = getValueRequiredBits(r);
         if(bits > profile->bits) profile->bits = bits;
       }
-      bits_done = (profile->bits >= bpp);
+      bits_done = (profile->bits >= maxbits);
 
       if(!colored_done && (r != g || r != b))
       {
@@ -3705,9 +4738,8 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
 
       if(!numcolors_done)
       {
-        if(!color_tree_has(&tree, r, g, b, a))
+        if(color_set_add(&colors, r, g, b, a))
         {
-          color_tree_add(&tree, r, g, b, a, profile->numcolors);
           if(profile->numcolors < 256)
           {
             unsigned char* p = profile->palette;
@@ -3745,7 +4777,6 @@ unsigned lodepng_get_color_profile(LodePNGColorProfile* profile,
     profile->key_b += (profile->key_b << 8);
   }
 
-  color_tree_cleanup(&tree);
   return error;
 }
 
@@ -3782,7 +4813,7 @@ unsigned lodepng_auto_choose_color(LodePNGColorMode* mode_out,
   if(palette_ok)
   {
     unsigned char* p = prof.palette;
-    lodepng_palette_clear(mode_out); /*remove potential earlier palette*/
+    mode_out->palettesize = 0; /*remove potential earlier palette, its memory has room for the new one*/
     for(i = 0; i != prof.numcolors; ++i)
     {
       error = lodepng_palette_add(mode_out, p[i * 4 + 0], p[i * 4 + 1], p[i * 4 + 2], p[i * 4 + 3]);
@@ -4211,13 +5242,19 @@ static unsigned readChunk_PLTE(LodePNGColorMode* color, const unsigned char* dat
   unsigned pos = 0, i;
   if(color->palette) lodepng_free(color->palette);
   color->palettesize = chunkLength / 3;
-  color->palette = (unsigned char*)lodepng_malloc(4 * color->palettesize);
+  if(color->palettesize > 256)
+  {
+    color->palette = 0;
+    color->palettesize = 0;
+    return 38; /*error: palette too big*/
+  }
+  /*room for 256 colors, like every palette: see LodePNGColorMode::palette*/
+  color->palette = (unsigned char*)lodepng_malloc(1024);
   if(!color->palette && color->palettesize)
   {
     color->palettesize = 0;
     return 83; /*alloc fail*/
   }
-  if(color->palettesize > 256) return 38; /*error: palette too big*/
 
   for(i = 0; i != color->palettesize; ++i)
   {
@@ -4512,19 +5549,19 @@ static unsigned readChunk_pHYs(LodePNGInfo* info, const unsigned char* data, siz
 }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
-                          LodePNGState* state,
-                          const unsigned char* in, size_t insize)
+/*
+Reads the header and all chunks up to IEND into state->info_png. The data of the IDAT chunks is
+appended to idat, or if idat is 0 it is left where it is: then the image may be larger than what
+fits in memory at once. first_idat is set to the first IDAT chunk, or 0 if there is none.
+*/
+static void decodeChunks(unsigned* w, unsigned* h, LodePNGState* state,
+                         const unsigned char* in, size_t insize,
+                         ucvector* idat, const unsigned char** first_idat)
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
   size_t i;
-  ucvector idat; /*the data from idat chunks*/
-  ucvector scanlines;
-  size_t predict;
   size_t numpixels;
-  size_t outsize = 0;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -4532,21 +5569,22 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-  /*provide some proper output values if error will happen*/
-  *out = 0;
+  *first_idat = 0;
 
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
   if(state->error) return;
 
   numpixels = *w * *h;
 
-  /*multiplication overflow*/
-  if(*h != 0 && numpixels / *h != *w) CERROR_RETURN(state->error, 92);
-  /*multiplication overflow possible further below. Allows up to 2^31-1 pixel
-  bytes with 16-bit RGBA, the rest is room for filter bytes.*/
-  if(numpixels > 268435455) CERROR_RETURN(state->error, 92);
+  if(idat)
+  {
+    /*multiplication overflow*/
+    if(*h != 0 && numpixels / *h != *w) CERROR_RETURN(state->error, 92);
+    /*multiplication overflow possible further below. Allows up to 2^31-1 pixel
+    bytes with 16-bit RGBA, the rest is room for filter bytes.*/
+    if(numpixels > 268435455) CERROR_RETURN(state->error, 92);
+  }
 
-  ucvector_init(&idat);
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
@@ -4574,9 +5612,13 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     /*IDAT chunk, containing compressed image data*/
     if(lodepng_chunk_type_equals(chunk, "IDAT"))
     {
-      size_t oldsize = idat.size;
-      if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
-      for(i = 0; i != chunkLength; ++i) idat.data[oldsize + i] = data[i];
+      if(!*first_idat) *first_idat = chunk;
+      if(idat)
+      {
+        size_t oldsize = idat->size;
+        if(!ucvector_resize(idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
+        for(i = 0; i != chunkLength; ++i) idat->data[oldsize + i] = data[i];
+      }
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -4669,6 +5711,30 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
 
     if(!IEND) chunk = lodepng_chunk_next_const(chunk);
   }
+}
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
+                          LodePNGState* state,
+                          const unsigned char* in, size_t insize)
+{
+  size_t i;
+  ucvector idat; /*the data from idat chunks*/
+  ucvector scanlines;
+  const unsigned char* first_idat;
+  size_t predict;
+  size_t outsize = 0;
+
+  /*provide some proper output values if error will happen*/
+  *out = 0;
+
+  ucvector_init(&idat);
+  decodeChunks(w, h, state, in, insize, &idat, &first_idat);
+  if(state->error)
+  {
+    ucvector_cleanup(&idat);
+    return;
+  }
 
   ucvector_init(&scanlines);
   /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
@@ -4691,27 +5757,492 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     if(*w > 1) predict += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, color) + ((*h + 1) >> 1);
     predict += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, color) + ((*h + 0) >> 1);
   }
-  if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
-  if(!state->error)
+#ifdef LODEPNG_COMPILE_ZLIB
+  /*with the slack the inflator needs past the end, it fills this exactly and never reallocates*/
+  if(!state->error && !ucvector_reserve(&scanlines, predict + INFLATE_MAX_SYMBOL_OUTPUT)) state->error = 83;
+#else /*LODEPNG_COMPILE_ZLIB*/
+  if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  if(!state->error)
+  {
+    state->error = zlib_decompressv(&scanlines, idat.data, idat.size, &state->decoder.zlibsettings);
+    if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+  }
+  ucvector_cleanup(&idat);
+
+  if(!state->error)
+  {
+    outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
+    *out = (unsigned char*)lodepng_malloc(outsize);
+    if(!*out) state->error = 83; /*alloc fail*/
+  }
+  if(!state->error)
+  {
+    for(i = 0; i < outsize; i++) (*out)[i] = 0;
+    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+  }
+  ucvector_cleanup(&scanlines);
+}
+
+/*reads the data of the IDAT chunks one after the other, for zlib_decompress_stream*/
+typedef struct IDATReader
+{
+  const unsigned char* chunk; /*the IDAT chunk being read, 0 after the last one*/
+  size_t pos; /*position in the data of that chunk*/
+} IDATReader;
+
+static size_t readIDAT(unsigned char* out, size_t size, void* read_data)
+{
+  IDATReader* reader = (IDATReader*)read_data;
+  size_t done = 0;
+  while(reader->chunk && done < size)
+  {
+    size_t length = lodepng_chunk_length(reader->chunk);
+    size_t n = length - reader->pos;
+    if(n > size - done) n = size - done;
+    memcpy(out + done, lodepng_chunk_data_const(reader->chunk) + reader->pos, n);
+    done += n;
+    reader->pos += n;
+    if(reader->pos == length)
+    {
+      /*the chunks were all checked by decodeChunks, so this finds IEND at the latest*/
+      do reader->chunk = lodepng_chunk_next_const(reader->chunk);
+      while(!lodepng_chunk_type_equals(reader->chunk, "IDAT") && !lodepng_chunk_type_equals(reader->chunk, "IEND"));
+      if(lodepng_chunk_type_equals(reader->chunk, "IEND")) reader->chunk = 0;
+      reader->pos = 0;
+    }
+  }
+  return done;
+}
+
+/*the crop of the decoder settings, checked against the image, and the size of the result after scaling*/
+static unsigned getDecodeRegion(unsigned* crop_x, unsigned* crop_y, unsigned* crop_w, unsigned* crop_h,
+                                unsigned* outw, unsigned* outh,
+                                const LodePNGDecoderSettings* settings, unsigned w, unsigned h)
+{
+  unsigned shift = settings->scale_shift;
+  if(shift > 3) return 100; /*error: unsupported scale*/
+  if(settings->crop_w == 0 || settings->crop_h == 0)
+  {
+    *crop_x = *crop_y = 0;
+    *crop_w = w;
+    *crop_h = h;
+  }
+  else
+  {
+    if(settings->crop_x >= w || settings->crop_w > w - settings->crop_x) return 99;
+    if(settings->crop_y >= h || settings->crop_h > h - settings->crop_y) return 99;
+    *crop_x = settings->crop_x;
+    *crop_y = settings->crop_y;
+    *crop_w = settings->crop_w;
+    *crop_h = settings->crop_h;
+  }
+  /*blocks at the right and bottom edge can be partial*/
+  *outw = (*crop_w >> shift) + ((*crop_w & ((1u << shift) - 1u)) != 0);
+  *outh = (*crop_h >> shift) + ((*crop_h & ((1u << shift) - 1u)) != 0);
+  return 0;
+}
+
+typedef struct RowDecoder
+{
+  unsigned w, h;
+  unsigned y; /*the next row of the PNG to come*/
+  size_t linebytes; /*bytes per row in the color mode of the PNG*/
+  size_t bytewidth; /*for unfilterScanline*/
+  unsigned bpp; /*bits per pixel of the PNG*/
+  unsigned char* line; /*the scanline being filled, its filter type byte first*/
+  unsigned char* prevline; /*the previous scanline, unfiltered, also with the filter type byte first*/
+  size_t fill; /*bytes of line filled so far*/
+  /*the part of the image that is kept, the output size, and the next output row*/
+  unsigned crop_x, crop_y, crop_w, crop_h;
+  unsigned outw, outh, outy;
+  unsigned shift; /*output pixels are the average of blocks of 1 << shift by 1 << shift pixels*/
+  unsigned char* cropped; /*room for the cropped part of a row, when its pixels are smaller than a byte*/
+  unsigned convert; /*whether the rows are converted from the color mode of the PNG to that of info_raw*/
+  unsigned char* converted; /*room for a converted row, if there is no target or it gets scaled*/
+  unsigned* sums; /*sums per channel of the blocks being averaged, when scaling*/
+  unsigned char* scaled; /*room for a scaled row, if there is no target*/
+  unsigned char* target; /*if not 0, the rows go here, in the color mode of info_raw, stride bytes apart*/
+  size_t stride;
+  const LodePNGColorMode* mode_raw;
+  const LodePNGColorMode* mode_png;
+  LodePNGRowCallback callback; /*may be 0 if there is a target*/
+  void* user;
+  unsigned stopped; /*set when the callback asked to stop, or the rows of the crop are done*/
+} RowDecoder;
+
+/*returns the crop_w pixels of the row from crop_x on, at the start of a byte*/
+static const unsigned char* rowDecoderCrop(RowDecoder* rows, const unsigned char* row)
+{
+  if(rows->bpp % 8 == 0) return row + (size_t)rows->crop_x * (rows->bpp / 8);
+  if(rows->crop_x == 0) return row;
+  else
+  {
+    size_t i, ibp = (size_t)rows->crop_x * rows->bpp, obp = 0;
+    size_t bits = (size_t)rows->crop_w * rows->bpp;
+    rows->cropped[(bits + 7) / 8 - 1] = 0; /*the padding bits*/
+    for(i = 0; i != bits; ++i) setBitOfReversedStream(&obp, rows->cropped, readBitFromReversedStream(&ibp, row));
+    return rows->cropped;
+  }
+}
+
+/*adds the channels of a row of the crop, in the color mode of info_raw, to the sums of the blocks*/
+static void rowDecoderAccumulate(RowDecoder* rows, const unsigned char* row)
+{
+  unsigned x, c;
+  unsigned channels = getNumColorChannels(rows->mode_raw->colortype);
+  size_t i = 0;
+  for(x = 0; x != rows->crop_w; ++x)
+  {
+    unsigned* sum = &rows->sums[(size_t)(x >> rows->shift) * channels];
+    if(rows->mode_raw->bitdepth == 16)
+    {
+      for(c = 0; c != channels; ++c, i += 2) sum[c] += 256u * row[i] + row[i + 1];
+    }
+    else
+    {
+      for(c = 0; c != channels; ++c, ++i) sum[c] += row[i];
+    }
+  }
+}
+
+/*writes the rounded averages of the blocks, which are blockh rows high, to out and clears the sums*/
+static void rowDecoderAverage(RowDecoder* rows, unsigned char* out, unsigned blockh)
+{
+  unsigned x, c;
+  unsigned channels = getNumColorChannels(rows->mode_raw->colortype);
+  unsigned size = 1u << rows->shift;
+  size_t i = 0;
+  for(x = 0; x != rows->outw; ++x)
+  {
+    unsigned* sum = &rows->sums[(size_t)x * channels];
+    unsigned blockw = rows->crop_w - x * size < size ? rows->crop_w - x * size : size;
+    unsigned count = blockw * blockh;
+    for(c = 0; c != channels; ++c)
+    {
+      unsigned value = (sum[c] + count / 2) / count;
+      sum[c] = 0;
+      if(rows->mode_raw->bitdepth == 16)
+      {
+        out[i++] = (unsigned char)(value >> 8);
+        out[i++] = (unsigned char)value;
+      }
+      else out[i++] = (unsigned char)value;
+    }
+  }
+}
+
+/*takes the next row of the PNG, in its color mode: crops, converts and scales it for the target and the callback*/
+static unsigned rowDecoderDeliver(RowDecoder* rows, const unsigned char* row)
+{
+  unsigned last = rows->crop_y + rows->crop_h - 1; /*the last row of the crop*/
+  if(rows->y >= rows->crop_y)
+  {
+    unsigned char* dest = rows->target ? rows->target + rows->outy * rows->stride : rows->converted;
+    unsigned done = 1; /*whether an output row is complete*/
+    row = rowDecoderCrop(rows, row);
+    if(rows->shift)
+    {
+      unsigned blockh = (rows->y - rows->crop_y) % (1u << rows->shift) + 1;
+      if(rows->convert)
+      {
+        CERROR_TRY_RETURN(lodepng_convert(rows->converted, row, rows->mode_raw, rows->mode_png, rows->crop_w, 1));
+        row = rows->converted;
+      }
+      rowDecoderAccumulate(rows, row);
+      done = blockh == (1u << rows->shift) || rows->y == last;
+      if(done)
+      {
+        if(!rows->target) dest = rows->scaled;
+        rowDecoderAverage(rows, dest, blockh);
+        row = dest;
+      }
+    }
+    else if(rows->convert)
+    {
+      CERROR_TRY_RETURN(lodepng_convert(dest, row, rows->mode_raw, rows->mode_png, rows->crop_w, 1));
+      row = dest;
+    }
+    else if(rows->target && row != dest)
+    {
+      memcpy(dest, row, ((size_t)rows->crop_w * rows->bpp + 7) / 8);
+      row = dest;
+    }
+    if(done)
+    {
+      if(rows->callback && rows->callback(row, rows->outy, rows->outw, rows->user))
+      {
+        rows->stopped = 1;
+        return 1; /*not an error, but stops the inflator*/
+      }
+      ++rows->outy;
+    }
+  }
+  ++rows->y;
+  if(rows->y > last && rows->y != rows->h)
+  {
+    rows->stopped = 1; /*the rest of the image isn't needed*/
+    return 1;
+  }
+  return 0;
+}
+
+/*the sink of the inflator: cuts its output into scanlines and unfilters each as soon as it is complete*/
+static unsigned rowDecoderWrite(const unsigned char* data, size_t size, void* write_data)
+{
+  RowDecoder* rows = (RowDecoder*)write_data;
+  while(size != 0)
+  {
+    size_t n = rows->linebytes + 1 - rows->fill;
+    if(rows->y == rows->h) return 91; /*decompressed size doesn't match prediction*/
+    if(n > size) n = size;
+    memcpy(rows->line + rows->fill, data, n);
+    rows->fill += n;
+    data += n;
+    size -= n;
+    if(rows->fill == rows->linebytes + 1)
+    {
+      unsigned char* recon = rows->line + 1;
+      const unsigned char* precon = rows->y ? rows->prevline + 1 : 0;
+      /*for the whole image without conversion, the scanline is unfiltered right into the target,
+      against the previous row there*/
+      unsigned direct = rows->target && !rows->convert && !rows->shift && rows->crop_w == rows->w
+                     && rows->crop_h == rows->h;
+      if(direct)
+      {
+        recon = rows->target + rows->y * rows->stride;
+        precon = rows->y ? recon - rows->stride : 0;
+      }
+      CERROR_TRY_RETURN(unfilterScanline(recon, rows->line + 1, precon,
+                                         rows->bytewidth, rows->line[0], rows->linebytes));
+      CERROR_TRY_RETURN(rowDecoderDeliver(rows, recon));
+      if(!direct)
+      {
+        unsigned char* temp = rows->prevline;
+        rows->prevline = rows->line;
+        rows->line = temp;
+      }
+      rows->fill = 0;
+    }
+  }
+  return 0;
+}
+
+/*gives the rows of a fully decoded image, in the color mode of the PNG, to rowDecoderDeliver*/
+static unsigned rowDecoderImage(RowDecoder* rows, const unsigned char* image)
+{
+  unsigned y;
+  size_t linebits = (size_t)rows->w * rows->bpp;
+  for(y = 0; y != rows->h; ++y)
+  {
+    const unsigned char* row = &image[y * rows->linebytes];
+    unsigned error;
+    if(linebits % 8 != 0)
+    {
+      /*in the image the rows aren't byte aligned*/
+      size_t i, ibp = y * linebits, obp = 0;
+      rows->line[rows->linebytes - 1] = 0; /*the padding bits*/
+      for(i = 0; i != linebits; ++i) setBitOfReversedStream(&obp, rows->line, readBitFromReversedStream(&ibp, image));
+      row = rows->line;
+    }
+    error = rowDecoderDeliver(rows, row);
+    if(error) return rows->stopped ? 0 : error;
+  }
+  return 0;
+}
+
+/*
+The decoder behind lodepng_decode_rows, lodepng_decode_into, and lodepng_decode with a crop or
+scale: the rows go to the callback, and into target if that's not 0. w and h are set to the size
+of the result.
+*/
+static unsigned decodeRows(unsigned* w, unsigned* h, LodePNGState* state,
+                           const unsigned char* in, size_t insize,
+                           LodePNGRowCallback callback, void* user,
+                           unsigned char* target, size_t targetsize, size_t stride)
+{
+  const unsigned char* first_idat;
+  RowDecoder rows;
+  unsigned streamed;
+  size_t outrowsize;
+
+  decodeChunks(w, h, state, in, insize, 0, &first_idat);
+  if(state->error) return state->error;
+
+  rows.bpp = lodepng_get_bpp(&state->info_png.color);
+  /*a row must fit in a size_t*/
+  if(*w > ((size_t)(-1) - 7) / rows.bpp) CERROR_RETURN_ERROR(state->error, 92);
+
+  rows.w = *w;
+  rows.h = *h;
+  rows.y = 0;
+  rows.linebytes = ((size_t)*w * rows.bpp + 7) / 8;
+  rows.bytewidth = (rows.bpp + 7) / 8;
+  rows.fill = 0;
+  rows.outy = 0;
+  rows.shift = state->decoder.scale_shift;
+  rows.convert = 0;
+  rows.line = rows.prevline = rows.cropped = rows.converted = rows.scaled = 0;
+  rows.sums = 0;
+  rows.target = target;
+  rows.stride = stride;
+  rows.mode_raw = &state->info_raw;
+  rows.mode_png = &state->info_png.color;
+  rows.callback = callback;
+  rows.user = user;
+  rows.stopped = 0;
+
+  state->error = getDecodeRegion(&rows.crop_x, &rows.crop_y, &rows.crop_w, &rows.crop_h, &rows.outw, &rows.outh,
+                                 &state->decoder, *w, *h);
+  if(state->error) return state->error;
+
+  if(!state->decoder.color_convert)
+  {
+    state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
+    if(state->error) return state->error;
+  }
+  else if(!lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+  {
+    /*the same color modes as lodepng_decode supports*/
+    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+       && !(state->info_raw.bitdepth == 8))
+    {
+      return 56; /*unsupported color mode conversion*/
+    }
+    rows.convert = 1;
+  }
+  if(rows.shift && (state->info_raw.bitdepth < 8 || state->info_raw.colortype == LCT_PALETTE))
+  {
+    CERROR_RETURN_ERROR(state->error, 100); /*can't average these*/
+  }
+
+  outrowsize = lodepng_get_raw_size(rows.outw, 1, &state->info_raw);
+  if(target)
+  {
+    /*every row, the last one included, must fit*/
+    if(stride < outrowsize || targetsize < outrowsize || (rows.outh - 1) > (targetsize - outrowsize) / stride)
+    {
+      CERROR_RETURN_ERROR(state->error, 98);
+    }
+  }
+
+  rows.line = (unsigned char*)lodepng_malloc(rows.linebytes + 1);
+  rows.prevline = (unsigned char*)lodepng_malloc(rows.linebytes + 1);
+  if(!rows.line || !rows.prevline) state->error = 83; /*alloc fail*/
+  if(rows.bpp % 8 != 0 && rows.crop_x != 0)
+  {
+    rows.cropped = (unsigned char*)lodepng_malloc(((size_t)rows.crop_w * rows.bpp + 7) / 8);
+    if(!rows.cropped) state->error = 83; /*alloc fail*/
+  }
+  if((rows.convert && (rows.shift || !target)))
+  {
+    rows.converted = (unsigned char*)lodepng_malloc(lodepng_get_raw_size(rows.crop_w, 1, &state->info_raw));
+    if(!rows.converted) state->error = 83; /*alloc fail*/
+  }
+  if(rows.shift)
   {
-    state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
-                                   idat.size, &state->decoder.zlibsettings);
-    if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+    size_t numsums = (size_t)rows.outw * getNumColorChannels(state->info_raw.colortype);
+    rows.sums = (unsigned*)lodepng_malloc(numsums * sizeof(unsigned));
+    if(!rows.sums) state->error = 83; /*alloc fail*/
+    else memset(rows.sums, 0, numsums * sizeof(unsigned));
+    if(!target)
+    {
+      rows.scaled = (unsigned char*)lodepng_malloc(outrowsize);
+      if(!rows.scaled) state->error = 83; /*alloc fail*/
+    }
   }
-  ucvector_cleanup(&idat);
 
-  if(!state->error)
+  /*interlaced images, and the ones for a custom zlib decoder, are decoded as a whole first*/
+  streamed = state->info_png.interlace_method == 0
+          && !state->decoder.zlibsettings.custom_zlib && !state->decoder.zlibsettings.custom_inflate;
+#ifndef LODEPNG_COMPILE_ZLIB
+  streamed = 0;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
+  if(!state->error && streamed)
   {
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
-    *out = (unsigned char*)lodepng_malloc(outsize);
-    if(!*out) state->error = 83; /*alloc fail*/
+#ifdef LODEPNG_COMPILE_ZLIB
+    IDATReader idat;
+    InflateSink sink;
+    idat.chunk = first_idat;
+    idat.pos = 0;
+    sink.write = rowDecoderWrite;
+    sink.write_data = &rows;
+    sink.written = 0;
+    state->error = zlib_decompress_stream(readIDAT, &idat, &sink, &state->decoder.zlibsettings);
+    if(rows.stopped) state->error = 0;
+    else if(!state->error && rows.y != rows.h) state->error = 91; /*decompressed size doesn't match prediction*/
+#endif /*LODEPNG_COMPILE_ZLIB*/
   }
-  if(!state->error)
+  else if(!state->error)
   {
-    for(i = 0; i < outsize; i++) (*out)[i] = 0;
-    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+    unsigned char* image = 0;
+    decodeGeneric(&image, w, h, state, in, insize);
+    if(!state->error) state->error = rowDecoderImage(&rows, image);
+    lodepng_free(image);
   }
-  ucvector_cleanup(&scanlines);
+
+  *w = rows.outw;
+  *h = rows.outh;
+
+  lodepng_free(rows.line);
+  lodepng_free(rows.prevline);
+  lodepng_free(rows.cropped);
+  lodepng_free(rows.converted);
+  lodepng_free(rows.sums);
+  lodepng_free(rows.scaled);
+  return state->error;
+}
+
+/*for lodepng_decode with a crop or scale: the image to put the rows in*/
+typedef struct RegionImage
+{
+  unsigned char* data;
+  unsigned bpp;
+} RegionImage;
+
+static unsigned regionImageRow(const unsigned char* row, unsigned y, unsigned w, void* user)
+{
+  RegionImage* image = (RegionImage*)user;
+  size_t linebits = (size_t)w * image->bpp;
+  if(linebits % 8 == 0) memcpy(image->data + y * (linebits / 8), row, linebits / 8);
+  else
+  {
+    /*in the image the rows aren't byte aligned*/
+    size_t i, ibp = 0, obp = y * linebits;
+    for(i = 0; i != linebits; ++i) setBitOfReversedStream(&obp, image->data, readBitFromReversedStream(&ibp, row));
+  }
+  return 0;
+}
+
+/*lodepng_decode when the decoder settings ask for a crop or scale: only the result is allocated*/
+static unsigned decodeRegion(unsigned char** out, unsigned* w, unsigned* h,
+                             LodePNGState* state,
+                             const unsigned char* in, size_t insize)
+{
+  unsigned crop_x, crop_y, crop_w, crop_h, outw, outh;
+  RegionImage image;
+  const LodePNGColorMode* mode;
+  size_t size;
+
+  state->error = lodepng_inspect(w, h, state, in, insize);
+  if(state->error) return state->error;
+  state->error = getDecodeRegion(&crop_x, &crop_y, &crop_w, &crop_h, &outw, &outh, &state->decoder, *w, *h);
+  if(state->error) return state->error;
+  /*multiplication overflow, as in decodeGeneric*/
+  if((size_t)outw * outh / outh != outw || (size_t)outw * outh > 268435455) CERROR_RETURN_ERROR(state->error, 92);
+
+  mode = state->decoder.color_convert ? &state->info_raw : &state->info_png.color;
+  image.bpp = lodepng_get_bpp(mode);
+  size = lodepng_get_raw_size(outw, outh, mode);
+  image.data = (unsigned char*)lodepng_malloc(size);
+  if(!image.data) CERROR_RETURN_ERROR(state->error, 83); /*alloc fail*/
+  image.data[size - 1] = 0; /*the padding bits*/
+
+  state->error = decodeRows(w, h, state, in, insize, regionImageRow, &image, 0, 0, 0);
+  if(state->error) lodepng_free(image.data);
+  else *out = image.data;
+  return state->error;
 }
 
 unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
@@ -4719,6 +6250,10 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         const unsigned char* in, size_t insize)
 {
   *out = 0;
+  if((state->decoder.crop_w != 0 && state->decoder.crop_h != 0) || state->decoder.scale_shift != 0)
+  {
+    return decodeRegion(out, w, h, state, in, insize);
+  }
   decodeGeneric(out, w, h, state, in, insize);
   if(state->error) return state->error;
   if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
@@ -4782,16 +6317,38 @@ unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h, const u
   return lodepng_decode_memory(out, w, h, in, insize, LCT_RGB, 8);
 }
 
+unsigned lodepng_decode_rows(unsigned* w, unsigned* h, LodePNGState* state,
+                             const unsigned char* in, size_t insize,
+                             LodePNGRowCallback callback, void* user)
+{
+  return decodeRows(w, h, state, in, insize, callback, user, 0, 0, 0);
+}
+
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, size_t stride,
+                             unsigned* w, unsigned* h, LodePNGState* state,
+                             const unsigned char* in, size_t insize)
+{
+  return decodeRows(w, h, state, in, insize, 0, 0, out, outsize, stride);
+}
+
 #ifdef LODEPNG_COMPILE_DISK
 unsigned lodepng_decode_file(unsigned char** out, unsigned* w, unsigned* h, const char* filename,
                              LodePNGColorType colortype, unsigned bitdepth)
 {
-  unsigned char* buffer = 0;
-  size_t buffersize;
-  unsigned error;
-  error = lodepng_load_file(&buffer, &buffersize, filename);
-  if(!error) error = lodepng_decode_memory(out, w, h, buffer, buffersize, colortype, bitdepth);
-  lodepng_free(buffer);
+  FileView view;
+  unsigned error = file_view_open(&view, filename);
+  if(!error) error = lodepng_decode_memory(out, w, h, view.data, view.size, colortype, bitdepth);
+  file_view_close(&view);
+  return error;
+}
+
+unsigned lodepng_decode_file_state(unsigned char** out, unsigned* w, unsigned* h,
+                                   LodePNGState* state, const char* filename)
+{
+  FileView view;
+  unsigned error = file_view_open(&view, filename);
+  if(!error) error = lodepng_decode(out, w, h, state, view.data, view.size);
+  file_view_close(&view);
   return error;
 }
 
@@ -4809,6 +6366,8 @@ unsigned lodepng_decode24_file(unsigned char** out, unsigned* w, unsigned* h, co
 void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings)
 {
   settings->color_convert = 1;
+  settings->crop_x = settings->crop_y = settings->crop_w = settings->crop_h = 0;
+  settings->scale_shift = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->read_text_chunks = 1;
   settings->remember_unknown_chunks = 0;
@@ -4858,11 +6417,110 @@ void lodepng_state_copy(LodePNGState* dest, const LodePNGState* source)
 /* / PNG Encoder                                                            / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+/*
+All the memory the encoder needs whose size depends on the image. lodepng_encode uses one
+for a single image, a LodePNGEncoderContext keeps one between images so that encoding a
+stream of same sized frames does not allocate it again.
+*/
+struct LodePNGEncoderBuffers
+{
+  ucvector png; /*the PNG file being built*/
+  ucvector converted; /*the image converted from info_raw to the PNG color type, if they differ*/
+  ucvector scanlines; /*filtered scanlines: the uncompressed IDAT data*/
+  ucvector padded; /*scanlines with padding bits added, for bitdepths below 8*/
+  ucvector adam7; /*the image split up in the 7 Adam7 passes*/
+  ucvector attempt; /*5 scanlines, to try each filter type with the adaptive filter strategies*/
+  DeflateBuffers deflate; /*LZ77 hash tables and other working memory of the zlib encoder*/
+  unsigned char* palette; /*1024 bytes for the palette that auto_convert chooses, or NULL*/
+#ifdef LODEPNG_COMPILE_DISK
+  FILE* file; /*if not NULL, the PNG is written to this file while it's made, and png only holds what's not written yet*/
+  const LodePNGEncoderSettings* settings; /*of the PNG being written to file, for its stage_callback*/
+#endif /*LODEPNG_COMPILE_DISK*/
+};
+
+static void encoder_buffers_init(LodePNGEncoderBuffers* buffers)
+{
+  ucvector_init(&buffers->png);
+  ucvector_init(&buffers->converted);
+  ucvector_init(&buffers->scanlines);
+  ucvector_init(&buffers->padded);
+  ucvector_init(&buffers->adam7);
+  ucvector_init(&buffers->attempt);
+  deflate_buffers_init(&buffers->deflate);
+  buffers->palette = 0;
+#ifdef LODEPNG_COMPILE_DISK
+  buffers->file = 0;
+  buffers->settings = 0;
+#endif /*LODEPNG_COMPILE_DISK*/
+}
+
+/*tells the stage_callback of the settings, if any, that a stage begins or ends*/
+static void encoderStage(const LodePNGEncoderSettings* settings, LodePNGEncodeStage stage, unsigned begin)
+{
+  if(settings->stage_callback) settings->stage_callback(stage, begin, settings->stage_user);
+}
+
+/*the block function of the deflate encoder while it makes the IDAT chunks, block_data is the encoder settings*/
+static void encoderDeflateBlock(unsigned begin, void* block_data)
+{
+  encoderStage((const LodePNGEncoderSettings*)block_data, LES_DEFLATE_BLOCK, begin);
+}
+
+static void encoder_buffers_cleanup(LodePNGEncoderBuffers* buffers)
+{
+  ucvector_cleanup(&buffers->png);
+  ucvector_cleanup(&buffers->converted);
+  ucvector_cleanup(&buffers->scanlines);
+  ucvector_cleanup(&buffers->padded);
+  ucvector_cleanup(&buffers->adam7);
+  ucvector_cleanup(&buffers->attempt);
+  deflate_buffers_cleanup(&buffers->deflate);
+  lodepng_free(buffers->palette);
+}
+
+/*cleans up the info of an encoded PNG, keeping the memory of its palette in the buffers for the next*/
+static unsigned encoder_info_cleanup(LodePNGInfo* info, LodePNGEncoderBuffers* buffers, unsigned error)
+{
+  if(!buffers->palette)
+  {
+    buffers->palette = info->color.palette;
+    info->color.palette = 0;
+  }
+  lodepng_info_cleanup(info);
+  return error;
+}
+
+/*Writes chunk length and name, leaving room for length bytes of data. Returns pointer to the chunk, or NULL if
+the length overflows or allocation fails. Call lodepng_chunk_generate_crc once the data is filled in.*/
+static unsigned char* addChunkHeader(ucvector* out, const char* chunkName, size_t length)
+{
+  unsigned char* chunk;
+  size_t pos = out->size;
+  size_t new_length = pos + length + 12;
+  if(length > 2147483647 || new_length < length + 12) return 0; /*integer overflow happened*/
+  if(!ucvector_resize(out, new_length)) return 0; /*alloc fail*/
+  chunk = &out->data[pos];
+
+  /*1: length*/
+  lodepng_set32bitInt(chunk, (unsigned)length);
+
+  /*2: chunk name (4 letters)*/
+  chunk[4] = (unsigned char)chunkName[0];
+  chunk[5] = (unsigned char)chunkName[1];
+  chunk[6] = (unsigned char)chunkName[2];
+  chunk[7] = (unsigned char)chunkName[3];
+
+  return chunk;
+}
+
 /*chunkName must be string of 4 characters*/
 static unsigned addChunk(ucvector* out, const char* chunkName, const unsigned char* data, size_t length)
 {
-  CERROR_TRY_RETURN(lodepng_chunk_create(&out->data, &out->size, (unsigned)length, chunkName, data));
-  out->allocsize = out->size; /*fix the allocsize again*/
+  /*grows out with ucvector_reserve's amortized doubling, rather than a realloc to the exact size per chunk*/
+  unsigned char* chunk = addChunkHeader(out, chunkName, length);
+  if(!chunk) return length > 2147483647 ? 77 : 83;
+  if(length) memcpy(&chunk[8], data, length);
+  lodepng_chunk_generate_crc(chunk);
   return 0;
 }
 
@@ -4882,47 +6540,44 @@ static void writeSignature(ucvector* out)
 static unsigned addChunk_IHDR(ucvector* out, unsigned w, unsigned h,
                               LodePNGColorType colortype, unsigned bitdepth, unsigned interlace_method)
 {
-  unsigned error = 0;
-  ucvector header;
-  ucvector_init(&header);
-
-  lodepng_add32bitInt(&header, w); /*width*/
-  lodepng_add32bitInt(&header, h); /*height*/
-  ucvector_push_back(&header, (unsigned char)bitdepth); /*bit depth*/
-  ucvector_push_back(&header, (unsigned char)colortype); /*color type*/
-  ucvector_push_back(&header, 0); /*compression method*/
-  ucvector_push_back(&header, 0); /*filter method*/
-  ucvector_push_back(&header, interlace_method); /*interlace method*/
-
-  error = addChunk(out, "IHDR", header.data, header.size);
-  ucvector_cleanup(&header);
+  /*the header has a fixed size, so it's written in place*/
+  unsigned char* chunk = addChunkHeader(out, "IHDR", 13);
+  if(!chunk) return 83; /*alloc fail*/
+
+  lodepng_set32bitInt(&chunk[8], w); /*width*/
+  lodepng_set32bitInt(&chunk[12], h); /*height*/
+  chunk[16] = (unsigned char)bitdepth; /*bit depth*/
+  chunk[17] = (unsigned char)colortype; /*color type*/
+  chunk[18] = 0; /*compression method*/
+  chunk[19] = 0; /*filter method*/
+  chunk[20] = (unsigned char)interlace_method; /*interlace method*/
+  lodepng_chunk_generate_crc(chunk);
 
-  return error;
+  return 0;
 }
 
 static unsigned addChunk_PLTE(ucvector* out, const LodePNGColorMode* info)
 {
-  unsigned error = 0;
   size_t i;
-  ucvector PLTE;
-  ucvector_init(&PLTE);
-  for(i = 0; i != info->palettesize * 4; ++i)
+  /*all channels except the alpha channel, written in place*/
+  unsigned char* chunk = addChunkHeader(out, "PLTE", info->palettesize * 3);
+  if(!chunk) return 83; /*alloc fail*/
+  for(i = 0; i != info->palettesize; ++i)
   {
-    /*add all channels except alpha channel*/
-    if(i % 4 != 3) ucvector_push_back(&PLTE, info->palette[i]);
+    chunk[8 + i * 3 + 0] = info->palette[i * 4 + 0];
+    chunk[8 + i * 3 + 1] = info->palette[i * 4 + 1];
+    chunk[8 + i * 3 + 2] = info->palette[i * 4 + 2];
   }
-  error = addChunk(out, "PLTE", PLTE.data, PLTE.size);
-  ucvector_cleanup(&PLTE);
+  lodepng_chunk_generate_crc(chunk);
 
-  return error;
+  return 0;
 }
 
 static unsigned addChunk_tRNS(ucvector* out, const LodePNGColorMode* info)
 {
-  unsigned error = 0;
   size_t i;
-  ucvector tRNS;
-  ucvector_init(&tRNS);
+  unsigned char tRNS[256]; /*at most an alpha value per palette color*/
+  size_t size = 0;
   if(info->colortype == LCT_PALETTE)
   {
     size_t amount = info->palettesize;
@@ -4933,50 +6588,95 @@ static unsigned addChunk_tRNS(ucvector* out, const LodePNGColorMode* info)
       else break;
     }
     /*add only alpha channel*/
-    for(i = 0; i != amount; ++i) ucvector_push_back(&tRNS, info->palette[4 * i + 3]);
+    for(i = 0; i != amount; ++i) tRNS[size++] = info->palette[4 * i + 3];
   }
   else if(info->colortype == LCT_GREY)
   {
     if(info->key_defined)
     {
-      ucvector_push_back(&tRNS, (unsigned char)(info->key_r >> 8));
-      ucvector_push_back(&tRNS, (unsigned char)(info->key_r & 255));
+      tRNS[size++] = (unsigned char)(info->key_r >> 8);
+      tRNS[size++] = (unsigned char)(info->key_r & 255);
     }
   }
   else if(info->colortype == LCT_RGB)
   {
     if(info->key_defined)
     {
-      ucvector_push_back(&tRNS, (unsigned char)(info->key_r >> 8));
-      ucvector_push_back(&tRNS, (unsigned char)(info->key_r & 255));
-      ucvector_push_back(&tRNS, (unsigned char)(info->key_g >> 8));
-      ucvector_push_back(&tRNS, (unsigned char)(info->key_g & 255));
-      ucvector_push_back(&tRNS, (unsigned char)(info->key_b >> 8));
-      ucvector_push_back(&tRNS, (unsigned char)(info->key_b & 255));
+      tRNS[size++] = (unsigned char)(info->key_r >> 8);
+      tRNS[size++] = (unsigned char)(info->key_r & 255);
+      tRNS[size++] = (unsigned char)(info->key_g >> 8);
+      tRNS[size++] = (unsigned char)(info->key_g & 255);
+      tRNS[size++] = (unsigned char)(info->key_b >> 8);
+      tRNS[size++] = (unsigned char)(info->key_b & 255);
     }
   }
 
-  error = addChunk(out, "tRNS", tRNS.data, tRNS.size);
-  ucvector_cleanup(&tRNS);
-
-  return error;
+  return addChunk(out, "tRNS", tRNS, size);
 }
 
 static unsigned addChunk_IDAT(ucvector* out, const unsigned char* data, size_t datasize,
-                              LodePNGCompressSettings* zlibsettings)
+                              LodePNGCompressSettings* zlibsettings, DeflateBuffers* buffers)
 {
-  ucvector zlibdata;
   unsigned error = 0;
+  size_t chunkpos = out->size, length;
+
+  /*compress with the Zlib compressor straight behind an empty chunk header, the length is known afterwards*/
+  if(!addChunkHeader(out, "IDAT", 0)) return 83; /*alloc fail*/
+  out->size -= 4; /*the CRC goes after the data*/
+  error = zlib_compressv(out, data, datasize, zlibsettings, buffers);
+  if(error) return error;
+
+  length = out->size - chunkpos - 8;
+  if(length > 2147483647) return 77; /*integer overflow happened*/
+  if(!ucvector_resize(out, out->size + 4)) return 83; /*alloc fail*/
+  lodepng_set32bitInt(&out->data[chunkpos], (unsigned)length);
+  lodepng_chunk_generate_crc(&out->data[chunkpos]);
+
+  return error;
+}
 
-  /*compress with the Zlib compressor*/
-  ucvector_init(&zlibdata);
-  error = zlib_compress(&zlibdata.data, &zlibdata.size, data, datasize, zlibsettings);
-  if(!error) error = addChunk(out, "IDAT", zlibdata.data, zlibdata.size);
-  ucvector_cleanup(&zlibdata);
+#ifdef LODEPNG_COMPILE_DISK
+/*IDAT data is only written away once at least this many bytes of it are ready, to not make many tiny chunks*/
+#define IDAT_FLUSH_SIZE 65536
 
+/*writes the chunks in out to the file and empties out. Returns error code.*/
+static unsigned writeChunks(ucvector* out, LodePNGEncoderBuffers* buffers)
+{
+  unsigned error = 0;
+  encoderStage(buffers->settings, LES_WRITE, 1);
+  if(out->size && fwrite(out->data, 1, out->size, buffers->file) != out->size) error = 97;
+  encoderStage(buffers->settings, LES_WRITE, 0);
+  out->size = 0;
   return error;
 }
 
+/*Flush function for the deflate encoder when streaming to a file: out holds only the IDAT chunk under
+construction, its complete data bytes are written as an IDAT chunk of their own. The write is synchronous,
+deflate continues once fwrite returns: the file I/O is chunked, it doesn't overlap compression.*/
+static unsigned flushIDAT(ucvector* out, void* flush_data)
+{
+  LodePNGEncoderBuffers* buffers = (LodePNGEncoderBuffers*)flush_data;
+  size_t length;
+  unsigned char crc[4];
+  unsigned error = 0;
+  if(out->size < 9 + IDAT_FLUSH_SIZE) return 0;
+
+  length = out->size - 9; /*the last byte may still get bits added to it, keep it*/
+  if(length > 2147483647) return 77; /*integer overflow happened*/
+  lodepng_set32bitInt(&out->data[0], (unsigned)length);
+  lodepng_set32bitInt(crc, lodepng_crc32(&out->data[4], length + 4));
+  encoderStage(buffers->settings, LES_WRITE, 1);
+  if(fwrite(out->data, 1, 8 + length, buffers->file) != 8 + length) error = 97;
+  else if(fwrite(crc, 1, 4, buffers->file) != 4) error = 97;
+  encoderStage(buffers->settings, LES_WRITE, 0);
+  if(error) return error;
+
+  out->data[8] = out->data[out->size - 1];
+  out->size = 9;
+  return 0;
+}
+#endif /*LODEPNG_COMPILE_DISK*/
+
 static unsigned addChunk_IEND(ucvector* out)
 {
   unsigned error = 0;
@@ -5200,8 +6900,10 @@ static float flog2(float f)
   return result + 1.442695f * (f * f * f / 3 - 3 * f * f / 2 + 3 * f - 1.83333f);
 }
 
+/*attempts is scratch memory for the adaptive strategies, it gets resized to hold 5 scanlines*/
 static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
-                       const LodePNGColorMode* info, const LodePNGEncoderSettings* settings)
+                       const LodePNGColorMode* info, const LodePNGEncoderSettings* settings,
+                       ucvector* attempts)
 {
   /*
   For PNG filter method 0
@@ -5256,11 +6958,8 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     size_t smallest = 0;
     unsigned char type, bestType = 0;
 
-    for(type = 0; type != 5; ++type)
-    {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) return 83; /*alloc fail*/
-    }
+    if(!ucvector_resize(attempts, linebytes * 5)) return 83; /*alloc fail*/
+    for(type = 0; type != 5; ++type) attempt[type] = &attempts->data[linebytes * type];
 
     if(!error)
     {
@@ -5305,7 +7004,6 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       }
     }
 
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
   }
   else if(strategy == LFS_ENTROPY)
   {
@@ -5315,11 +7013,8 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     unsigned type, bestType = 0;
     unsigned count[256];
 
-    for(type = 0; type != 5; ++type)
-    {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) return 83; /*alloc fail*/
-    }
+    if(!ucvector_resize(attempts, linebytes * 5)) return 83; /*alloc fail*/
+    for(type = 0; type != 5; ++type) attempt[type] = &attempts->data[linebytes * type];
 
     for(y = 0; y != h; ++y)
     {
@@ -5351,7 +7046,6 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
     }
 
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
   }
   else if(strategy == LFS_PREDEFINED)
   {
@@ -5385,11 +7079,8 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     images only, so disable it*/
     zlibsettings.custom_zlib = 0;
     zlibsettings.custom_deflate = 0;
-    for(type = 0; type != 5; ++type)
-    {
-      attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
-      if(!attempt[type]) return 83; /*alloc fail*/
-    }
+    if(!ucvector_resize(attempts, linebytes * 5)) return 83; /*alloc fail*/
+    for(type = 0; type != 5; ++type) attempt[type] = &attempts->data[linebytes * type];
     for(y = 0; y != h; ++y) /*try the 5 filter types*/
     {
       for(type = 0; type != 5; ++type)
@@ -5413,7 +7104,6 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
       out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
       for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
     }
-    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
   }
   else return 88; /* unknown filter strategy */
 
@@ -5502,11 +7192,12 @@ static void Adam7_interlace(unsigned char* out, const unsigned char* in, unsigne
   }
 }
 
-/*out must be buffer big enough to contain uncompressed IDAT chunk data, and in must contain the full image.
-return value is error**/
-static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const unsigned char* in,
+/*out is resized to the size of the uncompressed IDAT chunk data, and in must contain the full image.
+The padded, adam7 and attempt buffers of buffers are used as scratch memory. return value is error*/
+static unsigned preProcessScanlines(ucvector* out, const unsigned char* in,
                                     unsigned w, unsigned h,
-                                    const LodePNGInfo* info_png, const LodePNGEncoderSettings* settings)
+                                    const LodePNGInfo* info_png, const LodePNGEncoderSettings* settings,
+                                    LodePNGEncoderBuffers* buffers)
 {
   /*
   This function converts the pure 2D image with the PNG's colortype, into filtered-padded-interlaced data. Steps:
@@ -5518,28 +7209,25 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
 
   if(info_png->interlace_method == 0)
   {
-    *outsize = h + (h * ((w * bpp + 7) / 8)); /*image size plus an extra byte per scanline + possible padding bits*/
-    *out = (unsigned char*)lodepng_malloc(*outsize);
-    if(!(*out) && (*outsize)) error = 83; /*alloc fail*/
+    /*image size plus an extra byte per scanline + possible padding bits*/
+    if(!ucvector_resize(out, h + (h * ((w * bpp + 7) / 8)))) error = 83; /*alloc fail*/
 
     if(!error)
     {
       /*non multiple of 8 bits per scanline, padding bits needed per scanline*/
       if(bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8)
       {
-        unsigned char* padded = (unsigned char*)lodepng_malloc(h * ((w * bpp + 7) / 8));
-        if(!padded) error = 83; /*alloc fail*/
+        if(!ucvector_resize(&buffers->padded, h * ((w * bpp + 7) / 8))) error = 83; /*alloc fail*/
         if(!error)
         {
-          addPaddingBits(padded, in, ((w * bpp + 7) / 8) * 8, w * bpp, h);
-          error = filter(*out, padded, w, h, &info_png->color, settings);
+          addPaddingBits(buffers->padded.data, in, ((w * bpp + 7) / 8) * 8, w * bpp, h);
+          error = filter(out->data, buffers->padded.data, w, h, &info_png->color, settings, &buffers->attempt);
         }
-        lodepng_free(padded);
       }
       else
       {
         /*we can immediately filter into the out buffer, no other steps needed*/
-        error = filter(*out, in, w, h, &info_png->color, settings);
+        error = filter(out->data, in, w, h, &info_png->color, settings, &buffers->attempt);
       }
     }
   }
@@ -5551,12 +7239,11 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
 
     Adam7_getpassvalues(passw, passh, filter_passstart, padded_passstart, passstart, w, h, bpp);
 
-    *outsize = filter_passstart[7]; /*image size plus an extra byte per scanline + possible padding bits*/
-    *out = (unsigned char*)lodepng_malloc(*outsize);
-    if(!(*out)) error = 83; /*alloc fail*/
+    /*image size plus an extra byte per scanline + possible padding bits*/
+    if(!ucvector_resize(out, filter_passstart[7])) error = 83; /*alloc fail*/
 
-    adam7 = (unsigned char*)lodepng_malloc(passstart[7]);
-    if(!adam7 && passstart[7]) error = 83; /*alloc fail*/
+    if(!ucvector_resize(&buffers->adam7, passstart[7])) error = 83; /*alloc fail*/
+    adam7 = buffers->adam7.data;
 
     if(!error)
     {
@@ -5567,25 +7254,23 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
       {
         if(bpp < 8)
         {
-          unsigned char* padded = (unsigned char*)lodepng_malloc(padded_passstart[i + 1] - padded_passstart[i]);
-          if(!padded) ERROR_BREAK(83); /*alloc fail*/
+          unsigned char* padded;
+          if(!ucvector_resize(&buffers->padded, padded_passstart[i + 1] - padded_passstart[i])) ERROR_BREAK(83);
+          padded = buffers->padded.data;
           addPaddingBits(padded, &adam7[passstart[i]],
                          ((passw[i] * bpp + 7) / 8) * 8, passw[i] * bpp, passh[i]);
-          error = filter(&(*out)[filter_passstart[i]], padded,
-                         passw[i], passh[i], &info_png->color, settings);
-          lodepng_free(padded);
+          error = filter(&out->data[filter_passstart[i]], padded,
+                         passw[i], passh[i], &info_png->color, settings, &buffers->attempt);
         }
         else
         {
-          error = filter(&(*out)[filter_passstart[i]], &adam7[padded_passstart[i]],
-                         passw[i], passh[i], &info_png->color, settings);
+          error = filter(&out->data[filter_passstart[i]], &adam7[padded_passstart[i]],
+                         passw[i], passh[i], &info_png->color, settings, &buffers->attempt);
         }
 
         if(error) break;
       }
     }
-
-    lodepng_free(adam7);
   }
 
   return error;
@@ -5623,129 +7308,173 @@ static unsigned addUnknownChunks(ucvector* out, unsigned char* data, size_t data
   unsigned char* inchunk = data;
   while((size_t)(inchunk - data) < datasize)
   {
-    CERROR_TRY_RETURN(lodepng_chunk_append(&out->data, &out->size, inchunk));
-    out->allocsize = out->size; /*fix the allocsize again*/
+    /*appended through the vector rather than lodepng_chunk_append, out may be a fixed buffer*/
+    size_t chunksize = (size_t)lodepng_chunk_length(inchunk) + 12;
+    size_t pos = out->size;
+    if(pos + chunksize < chunksize) return 77; /*integer overflow happened*/
+    if(!ucvector_resize(out, pos + chunksize)) return 83; /*alloc fail*/
+    memcpy(&out->data[pos], inchunk, chunksize);
     inchunk = lodepng_chunk_next(inchunk);
   }
   return 0;
 }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-unsigned lodepng_encode(unsigned char** out, size_t* outsize,
-                        const unsigned char* image, unsigned w, unsigned h,
-                        LodePNGState* state)
+/*encodes the PNG into buffers->png, using the other buffers as working memory*/
+static unsigned encodeWithBuffers(const unsigned char* image, unsigned w, unsigned h,
+                                  LodePNGState* state, LodePNGEncoderBuffers* buffers)
 {
   LodePNGInfo info;
-  ucvector outv;
-  unsigned char* data = 0; /*uncompressed version of the IDAT chunk data*/
-  size_t datasize = 0;
+  ucvector* outv = &buffers->png;
+  ucvector* data = &buffers->scanlines; /*uncompressed version of the IDAT chunk data*/
 
-  /*provide some proper output values if error will happen*/
-  *out = 0;
-  *outsize = 0;
+  outv->size = 0;
   state->error = 0;
 
   lodepng_info_init(&info);
   lodepng_info_copy(&info, &state->info_png);
+  if(!info.color.palette)
+  {
+    /*a palette that auto_convert chooses goes into the memory kept in the buffers*/
+    info.color.palette = buffers->palette;
+    buffers->palette = 0;
+  }
 
   if((info.color.colortype == LCT_PALETTE || state->encoder.force_palette)
       && (info.color.palettesize == 0 || info.color.palettesize > 256))
   {
     state->error = 68; /*invalid palette size, it is only allowed to be 1-256*/
-    return state->error;
+    return encoder_info_cleanup(&info, buffers, state->error);
   }
 
-  if(state->encoder.auto_convert)
+  if(state->encoder.auto_convert && state->encoder.known_opaque_rgb
+     && (state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA))
+  {
+    /*the user guarantees what the color profile would find, so it's not made*/
+    info.color.palettesize = 0;
+    info.color.colortype = LCT_RGB;
+    info.color.bitdepth = state->info_raw.bitdepth;
+    info.color.key_defined = 0;
+  }
+  else if(state->encoder.auto_convert)
   {
     state->error = lodepng_auto_choose_color(&info.color, image, w, h, &state->info_raw);
   }
-  if(state->error) return state->error;
+  if(state->error) return encoder_info_cleanup(&info, buffers, state->error);
 
   if(state->encoder.zlibsettings.btype > 2)
   {
-    CERROR_RETURN_ERROR(state->error, 61); /*error: unexisting btype*/
+    state->error = 61; /*error: unexisting btype*/
+    return encoder_info_cleanup(&info, buffers, state->error);
   }
   if(state->info_png.interlace_method > 1)
   {
-    CERROR_RETURN_ERROR(state->error, 71); /*error: unexisting interlace mode*/
+    state->error = 71; /*error: unexisting interlace mode*/
+    return encoder_info_cleanup(&info, buffers, state->error);
   }
 
   state->error = checkColorValidity(info.color.colortype, info.color.bitdepth);
-  if(state->error) return state->error; /*error: unexisting color type given*/
+  if(state->error) return encoder_info_cleanup(&info, buffers, state->error); /*error: unexisting color type*/
   state->error = checkColorValidity(state->info_raw.colortype, state->info_raw.bitdepth);
-  if(state->error) return state->error; /*error: unexisting color type given*/
+  if(state->error) return encoder_info_cleanup(&info, buffers, state->error); /*error: unexisting color type*/
 
+  encoderStage(&state->encoder, LES_FILTER, 1);
   if(!lodepng_color_mode_equal(&state->info_raw, &info.color))
   {
-    unsigned char* converted;
     size_t size = (w * h * (size_t)lodepng_get_bpp(&info.color) + 7) / 8;
 
-    converted = (unsigned char*)lodepng_malloc(size);
-    if(!converted && size) state->error = 83; /*alloc fail*/
+    if(!ucvector_resize(&buffers->converted, size)) state->error = 83; /*alloc fail*/
+    if(!state->error)
+    {
+      state->error = lodepng_convert(buffers->converted.data, image, &info.color, &state->info_raw, w, h);
+    }
     if(!state->error)
     {
-      state->error = lodepng_convert(converted, image, &info.color, &state->info_raw, w, h);
+      state->error = preProcessScanlines(data, buffers->converted.data, w, h, &info, &state->encoder, buffers);
     }
-    if(!state->error) preProcessScanlines(&data, &datasize, converted, w, h, &info, &state->encoder);
-    lodepng_free(converted);
   }
-  else preProcessScanlines(&data, &datasize, image, w, h, &info, &state->encoder);
+  else state->error = preProcessScanlines(data, image, w, h, &info, &state->encoder, buffers);
+  encoderStage(&state->encoder, LES_FILTER, 0);
 
-  ucvector_init(&outv);
   while(!state->error) /*while only executed once, to break on error*/
   {
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
     size_t i;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     /*write signature and chunks*/
-    writeSignature(&outv);
+    writeSignature(outv);
     /*IHDR*/
-    addChunk_IHDR(&outv, w, h, info.color.colortype, info.color.bitdepth, info.interlace_method);
+    addChunk_IHDR(outv, w, h, info.color.colortype, info.color.bitdepth, info.interlace_method);
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
     /*unknown chunks between IHDR and PLTE*/
     if(info.unknown_chunks_data[0])
     {
-      state->error = addUnknownChunks(&outv, info.unknown_chunks_data[0], info.unknown_chunks_size[0]);
+      state->error = addUnknownChunks(outv, info.unknown_chunks_data[0], info.unknown_chunks_size[0]);
       if(state->error) break;
     }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     /*PLTE*/
     if(info.color.colortype == LCT_PALETTE)
     {
-      addChunk_PLTE(&outv, &info.color);
+      addChunk_PLTE(outv, &info.color);
     }
     if(state->encoder.force_palette && (info.color.colortype == LCT_RGB || info.color.colortype == LCT_RGBA))
     {
-      addChunk_PLTE(&outv, &info.color);
+      addChunk_PLTE(outv, &info.color);
     }
     /*tRNS*/
     if(info.color.colortype == LCT_PALETTE && getPaletteTranslucency(info.color.palette, info.color.palettesize) != 0)
     {
-      addChunk_tRNS(&outv, &info.color);
+      addChunk_tRNS(outv, &info.color);
     }
     if((info.color.colortype == LCT_GREY || info.color.colortype == LCT_RGB) && info.color.key_defined)
     {
-      addChunk_tRNS(&outv, &info.color);
+      addChunk_tRNS(outv, &info.color);
     }
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
     /*bKGD (must come between PLTE and the IDAt chunks*/
-    if(info.background_defined) addChunk_bKGD(&outv, &info);
+    if(info.background_defined) addChunk_bKGD(outv, &info);
     /*pHYs (must come before the IDAT chunks)*/
-    if(info.phys_defined) addChunk_pHYs(&outv, &info);
+    if(info.phys_defined) addChunk_pHYs(outv, &info);
 
     /*unknown chunks between PLTE and IDAT*/
     if(info.unknown_chunks_data[1])
     {
-      state->error = addUnknownChunks(&outv, info.unknown_chunks_data[1], info.unknown_chunks_size[1]);
+      state->error = addUnknownChunks(outv, info.unknown_chunks_data[1], info.unknown_chunks_size[1]);
       if(state->error) break;
     }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     /*IDAT (multiple IDAT chunks must be consecutive)*/
-    state->error = addChunk_IDAT(&outv, data, datasize, &state->encoder.zlibsettings);
+#ifdef LODEPNG_COMPILE_DISK
+    if(buffers->file)
+    {
+      /*write everything before the IDAT chunks, so that the deflate encoder can write out IDAT chunks itself*/
+      buffers->settings = &state->encoder;
+      state->error = writeChunks(outv, buffers);
+      if(state->error) break;
+      buffers->deflate.flush = flushIDAT;
+      buffers->deflate.flush_data = buffers;
+    }
+#endif /*LODEPNG_COMPILE_DISK*/
+    if(info.interlace_method == 0)
+    {
+      buffers->deflate.linesize = 1 + ((size_t)w * lodepng_get_bpp(&info.color) + 7) / 8;
+    }
+    if(state->encoder.stage_callback)
+    {
+      buffers->deflate.block = encoderDeflateBlock;
+      buffers->deflate.block_data = &state->encoder;
+    }
+    encoderStage(&state->encoder, LES_DEFLATE, 1);
+    state->error = addChunk_IDAT(outv, data->data, data->size, &state->encoder.zlibsettings, &buffers->deflate);
+    encoderStage(&state->encoder, LES_DEFLATE, 0);
+    buffers->deflate.block = 0;
+    buffers->deflate.flush = 0;
+    buffers->deflate.linesize = 0;
     if(state->error) break;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
     /*tIME*/
-    if(info.time_defined) addChunk_tIME(&outv, &info.time);
+    if(info.time_defined) addChunk_tIME(outv, &info.time);
     /*tEXt and/or zTXt*/
     for(i = 0; i != info.text_num; ++i)
     {
@@ -5761,11 +7490,11 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
       }
       if(state->encoder.text_compression)
       {
-        addChunk_zTXt(&outv, info.text_keys[i], info.text_strings[i], &state->encoder.zlibsettings);
+        addChunk_zTXt(outv, info.text_keys[i], info.text_strings[i], &state->encoder.zlibsettings);
       }
       else
       {
-        addChunk_tEXt(&outv, info.text_keys[i], info.text_strings[i]);
+        addChunk_tEXt(outv, info.text_keys[i], info.text_strings[i]);
       }
     }
     /*LodePNG version id in text chunk*/
@@ -5782,7 +7511,7 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
       }
       if(alread_added_id_text == 0)
       {
-        addChunk_tEXt(&outv, "LodePNG", LODEPNG_VERSION_STRING); /*it's shorter as tEXt than as zTXt chunk*/
+        addChunk_tEXt(outv, "LodePNG", LODEPNG_VERSION_STRING); /*it's shorter as tEXt than as zTXt chunk*/
       }
     }
     /*iTXt*/
@@ -5798,7 +7527,7 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
         state->error = 67; /*text chunk too small*/
         break;
       }
-      addChunk_iTXt(&outv, state->encoder.text_compression,
+      addChunk_iTXt(outv, state->encoder.text_compression,
                     info.itext_keys[i], info.itext_langtags[i], info.itext_transkeys[i], info.itext_strings[i],
                     &state->encoder.zlibsettings);
     }
@@ -5806,24 +7535,159 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
     /*unknown chunks between IDAT and IEND*/
     if(info.unknown_chunks_data[2])
     {
-      state->error = addUnknownChunks(&outv, info.unknown_chunks_data[2], info.unknown_chunks_size[2]);
+      state->error = addUnknownChunks(outv, info.unknown_chunks_data[2], info.unknown_chunks_size[2]);
       if(state->error) break;
     }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
-    addChunk_IEND(&outv);
+    addChunk_IEND(outv);
+#ifdef LODEPNG_COMPILE_DISK
+    if(buffers->file) state->error = writeChunks(outv, buffers);
+#endif /*LODEPNG_COMPILE_DISK*/
 
     break; /*this isn't really a while loop; no error happened so break out now!*/
   }
 
-  lodepng_info_cleanup(&info);
-  lodepng_free(data);
-  /*instead of cleaning the vector up, give it to the output*/
-  *out = outv.data;
-  *outsize = outv.size;
+  return encoder_info_cleanup(&info, buffers, state->error);
+}
+
+unsigned lodepng_encode(unsigned char** out, size_t* outsize,
+                        const unsigned char* image, unsigned w, unsigned h,
+                        LodePNGState* state)
+{
+  LodePNGEncoderBuffers buffers;
+  encoder_buffers_init(&buffers);
+
+  encodeWithBuffers(image, w, h, state, &buffers);
+
+  /*instead of cleaning the png vector up, give it to the output*/
+  *out = buffers.png.data;
+  *outsize = buffers.png.size;
+  ucvector_init(&buffers.png);
+  encoder_buffers_cleanup(&buffers);
+
+  return state->error;
+}
+
+/*encodes with buffers, but into the fixed buffer of the user instead of into buffers->png*/
+static unsigned encodeInto(unsigned char* out, size_t outcapacity, size_t* outsize,
+                           const unsigned char* image, unsigned w, unsigned h,
+                           LodePNGState* state, LodePNGEncoderBuffers* buffers)
+{
+  ucvector png = buffers->png; /*put the buffers' own png vector aside*/
+
+  ucvector_init(&buffers->png);
+  buffers->png.data = out;
+  buffers->png.allocsize = outcapacity;
+  buffers->png.fixed = 1;
+
+  encodeWithBuffers(image, w, h, state, buffers);
+  /*any failure to grow must be reported as too small buffer, even if some code path ignored it*/
+  if(buffers->png.overflow) state->error = 96;
+  *outsize = state->error ? 0 : buffers->png.size;
+
+  buffers->png = png;
+  return state->error;
+}
 
+unsigned lodepng_encode_into(unsigned char* out, size_t outcapacity, size_t* outsize,
+                             const unsigned char* image, unsigned w, unsigned h,
+                             LodePNGState* state)
+{
+  LodePNGEncoderBuffers buffers;
+  encoder_buffers_init(&buffers);
+  encodeInto(out, outcapacity, outsize, image, w, h, state, &buffers);
+  encoder_buffers_cleanup(&buffers);
   return state->error;
 }
 
+size_t lodepng_encode_bound(unsigned w, unsigned h, LodePNGColorType colortype, unsigned bitdepth)
+{
+  size_t bpp = lodepng_get_bpp_lct(colortype, bitdepth);
+  size_t datasize, numblocks;
+
+  /*auto_convert never chooses more bits per pixel, except that a palette can become RGBA, and for
+  images of at most 16 pixels a color key becomes an alpha channel*/
+  if(colortype == LCT_PALETTE && bpp < 32) bpp = 32;
+  if((size_t)w * h <= 16) bpp = 64;
+
+  /*filtered scanlines with their filter type byte. Adam7 adds at most a filter type byte and a
+  padding byte for every row of each of the 7 passes, that is less than 4 * h + 14 bytes*/
+  datasize = (size_t)h * (1 + ((size_t)w * bpp + 7) / 8) + 4 * (size_t)h + 14;
+
+  /*The huffman codes of the built in deflate encoder take at most 9 bits per input byte. Dynamic
+  codes are optimal for their block, so never worse than giving every lit/len symbol 9 bits and
+  every distance 5. With such codes a literal takes 9 bits, and so does each byte of the worst
+  length/distance pair: a match of length 3 at a distance over 16384 is 9 + 5 + 13 extra bits = 27
+  bits for 3 bytes. Longer matches take less per byte, and the fixed codes are no longer. There's
+  no fallback to stored blocks when compression doesn't pay off, so the 9 bits are needed: don't
+  tighten datasize / 8. Each block of at least 65536 bytes adds less than 300 bytes of tree
+  description, stored blocks only 5.*/
+  numblocks = datasize / 65535 + 1;
+
+  return 8 /*signature*/ + 25 /*IHDR*/ + (12 + 768) /*PLTE*/ + (12 + 256) /*tRNS*/
+       + 12 + 2 + datasize + datasize / 8 + numblocks * 300 + 4 /*IDAT with zlib header and checksum*/
+       + 12 /*IEND*/;
+}
+
+/*allocates the buffers of the context on first use*/
+static unsigned encoder_context_buffers(LodePNGEncoderContext* context)
+{
+  if(!context->buffers)
+  {
+    context->buffers = (LodePNGEncoderBuffers*)lodepng_malloc(sizeof(LodePNGEncoderBuffers));
+    if(!context->buffers) CERROR_RETURN_ERROR(context->state.error, 83); /*alloc fail*/
+    encoder_buffers_init(context->buffers);
+  }
+  return 0;
+}
+
+void lodepng_encoder_context_init(LodePNGEncoderContext* context)
+{
+  lodepng_state_init(&context->state);
+  context->buffers = 0;
+}
+
+void lodepng_encoder_context_cleanup(LodePNGEncoderContext* context)
+{
+  if(context->buffers)
+  {
+    encoder_buffers_cleanup(context->buffers);
+    lodepng_free(context->buffers);
+    context->buffers = 0;
+  }
+  lodepng_state_cleanup(&context->state);
+}
+
+unsigned lodepng_encode_context(const unsigned char** out, size_t* outsize,
+                                const unsigned char* image, unsigned w, unsigned h,
+                                LodePNGEncoderContext* context)
+{
+  /*provide some proper output values if error will happen*/
+  *out = 0;
+  *outsize = 0;
+
+  CERROR_TRY_RETURN(encoder_context_buffers(context));
+
+  if(!encodeWithBuffers(image, w, h, &context->state, context->buffers))
+  {
+    *out = context->buffers->png.data;
+    *outsize = context->buffers->png.size;
+  }
+
+  return context->state.error;
+}
+
+unsigned lodepng_encode_context_into(unsigned char* out, size_t outcapacity, size_t* outsize,
+                                     const unsigned char* image, unsigned w, unsigned h,
+                                     LodePNGEncoderContext* context)
+{
+  *outsize = 0;
+
+  CERROR_TRY_RETURN(encoder_context_buffers(context));
+
+  return encodeInto(out, outcapacity, outsize, image, w, h, &context->state, context->buffers);
+}
+
 unsigned lodepng_encode_memory(unsigned char** out, size_t* outsize, const unsigned char* image,
                                unsigned w, unsigned h, LodePNGColorType colortype, unsigned bitdepth)
 {
@@ -5851,14 +7715,107 @@ unsigned lodepng_encode24(unsigned char** out, size_t* outsize, const unsigned c
 }
 
 #ifdef LODEPNG_COMPILE_DISK
+/*moves the complete file tmpname to filename, replacing an existing one without ever deleting it first,
+so that filename is either the old file or the new one. Returns 0 on success*/
+static int replaceFile(const char* tmpname, const char* filename)
+{
+#ifdef LODEPNG_REPLACE_WIN32
+  /*rename of the C library doesn't replace existing files on Windows*/
+  return MoveFileExA(tmpname, filename, MOVEFILE_REPLACE_EXISTING) ? 0 : 1;
+#else
+  return rename(tmpname, filename); /*POSIX rename replaces an existing file atomically*/
+#endif
+}
+
+/*room for what createTempFile appends to the file name: 3 numbers of at most 20 digits and 7 characters*/
+#define TMPNAME_EXTRA 72
+
+/*
+Creates a new file next to filename, named filename.P-T-N.tmp: P is the process, T the thread (the
+address of a variable on the stack of this call, it differs between the threads saving at the same time)
+and N goes up while the name is taken, e.g. by a file left behind by a crash. The name is only taken if
+no file has it yet, so the file is never shared with another save or an existing file of the user.
+tmpname must have room for the length of filename + TMPNAME_EXTRA. Returns NULL if it can't be created.
+*/
+static FILE* createTempFile(char* tmpname, const char* filename)
+{
+  unsigned attempt;
+  unsigned long thread = (unsigned long)(size_t)&attempt;
+  for(attempt = 0; attempt != 100; ++attempt)
+  {
+#if defined(LODEPNG_REPLACE_WIN32) || defined(LODEPNG_REPLACE_POSIX)
+    int fd;
+#if defined(LODEPNG_REPLACE_WIN32)
+    sprintf(tmpname, "%s.%lu-%lx-%u.tmp", filename, (unsigned long)_getpid(), thread, attempt);
+    fd = _open(tmpname, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+    if(fd >= 0) _close(fd);
+#else
+    sprintf(tmpname, "%s.%lu-%lx-%u.tmp", filename, (unsigned long)getpid(), thread, attempt);
+    /*the permissions fopen gives a new file, unlike the 0600 of mkstemp*/
+    fd = open(tmpname, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if(fd >= 0) close(fd);
+#endif
+    if(fd < 0)
+    {
+      if(errno == EEXIST) continue;
+      return 0;
+    }
+    else
+    {
+      /*the name is ours now: open the file with stdio, which has no exclusive create in C89*/
+      FILE* file = fopen(tmpname, "wb");
+      if(!file) remove(tmpname);
+      return file;
+    }
+#else
+    /*without exclusive create, checking that the name is free and creating the file are two steps*/
+    FILE* file;
+    sprintf(tmpname, "%s.%lx-%u.tmp", filename, thread, attempt);
+    file = fopen(tmpname, "rb");
+    if(!file) return fopen(tmpname, "wb");
+    fclose(file);
+#endif
+  }
+  return 0;
+}
+
+unsigned lodepng_encode_file_state(const char* filename, const unsigned char* image, unsigned w, unsigned h,
+                                   LodePNGState* state)
+{
+  LodePNGEncoderBuffers buffers;
+  /*the PNG is written to a temporary file next to the final one, which is renamed once it's complete*/
+  char* tmpname = (char*)lodepng_malloc(strlen(filename) + TMPNAME_EXTRA);
+  if(!tmpname) CERROR_RETURN_ERROR(state->error, 83); /*alloc fail*/
+
+  encoder_buffers_init(&buffers);
+  buffers.file = createTempFile(tmpname, filename);
+  if(!buffers.file) state->error = 79;
+  else
+  {
+    encodeWithBuffers(image, w, h, state, &buffers);
+    if(fclose(buffers.file) != 0 && !state->error) state->error = 97;
+    if(!state->error && replaceFile(tmpname, filename) != 0) state->error = 97;
+    if(state->error) remove(tmpname); /*only the temporary file, an existing file at filename is kept*/
+  }
+
+  encoder_buffers_cleanup(&buffers);
+  lodepng_free(tmpname);
+  return state->error;
+}
+
 unsigned lodepng_encode_file(const char* filename, const unsigned char* image, unsigned w, unsigned h,
                              LodePNGColorType colortype, unsigned bitdepth)
 {
-  unsigned char* buffer;
-  size_t buffersize;
-  unsigned error = lodepng_encode_memory(&buffer, &buffersize, image, w, h, colortype, bitdepth);
-  if(!error) error = lodepng_save_file(buffer, buffersize, filename);
-  lodepng_free(buffer);
+  unsigned error;
+  LodePNGState state;
+  lodepng_state_init(&state);
+  state.info_raw.colortype = colortype;
+  state.info_raw.bitdepth = bitdepth;
+  state.info_png.color.colortype = colortype;
+  state.info_png.color.bitdepth = bitdepth;
+  lodepng_encode_file_state(filename, image, w, h, &state);
+  error = state.error;
+  lodepng_state_cleanup(&state);
   return error;
 }
 
@@ -5879,8 +7836,11 @@ void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings)
   settings->filter_palette_zero = 1;
   settings->filter_strategy = LFS_MINSUM;
   settings->auto_convert = 1;
+  settings->known_opaque_rgb = 0;
   settings->force_palette = 0;
   settings->predefined_filters = 0;
+  settings->stage_callback = 0;
+  settings->stage_user = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->add_id = 0;
   settings->text_compression = 1;
@@ -5992,6 +7952,12 @@ const char* lodepng_error_text(unsigned code)
     case 92: return "too many pixels, not supported";
     case 93: return "zero width or height is invalid";
     case 94: return "header chunk must have a size of 13 bytes";
+    case 95: return "integer overflow with combined idat chunk size or zlib bit size";
+    case 96: return "the output buffer given to the encoder is too small for the PNG";
+    case 97: return "failed to write the PNG file, or to rename it to its final name";
+    case 98: return "the output buffer given to the decoder is too small for the image, or its stride for a row";
+    case 99: return "the crop rectangle of the decoder settings is not inside the image";
+    case 100: return "decoding scaled down needs a scale_shift of at most 3 and 8 or 16 bits per channel without palette";
   }
   return "unknown error code";
 }
@@ -6145,10 +8111,11 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h, const std::string& filename,
                 LodePNGColorType colortype, unsigned bitdepth)
 {
-  std::vector<unsigned char> buffer;
-  unsigned error = load_file(buffer, filename);
-  if(error) return error;
-  return decode(out, w, h, buffer, colortype, bitdepth);
+  FileView view;
+  unsigned error = file_view_open(&view, filename.c_str());
+  if(!error) error = decode(out, w, h, view.data, view.size, colortype, bitdepth);
+  file_view_close(&view);
+  return error;
 }
 #endif /* LODEPNG_COMPILE_DECODER */
 #endif /* LODEPNG_COMPILE_DISK */
@@ -6204,10 +8171,7 @@ unsigned encode(const std::string& filename,
                 const unsigned char* in, unsigned w, unsigned h,
                 LodePNGColorType colortype, unsigned bitdepth)
 {
-  std::vector<unsigned char> buffer;
-  unsigned error = encode(buffer, in, w, h, colortype, bitdepth);
-  if(!error) error = save_file(buffer, filename);
-  return error;
+  return lodepng_encode_file(filename.c_str(), in, w, h, colortype, bitdepth);
 }
 
 unsigned encode(const std::string& filename,
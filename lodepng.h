@@ -37,7 +37,9 @@ The "NO_COMPILE" defines are designed to be used to pass as defines to the
 compiler command to disable them without modifying this header, e.g.
 -DLODEPNG_NO_COMPILE_ZLIB for gcc.
 In addition to those below, you can also define LODEPNG_NO_COMPILE_CRC to
-allow implementing a custom lodepng_crc32.
+allow implementing a custom lodepng_crc32, and LODEPNG_NO_COMPILE_MMAP to make
+the decode from file functions always read the file with lodepng_load_file
+instead of memory mapping it.
 */
 /*deflate & zlib. If disabled, you must specify alternative zlib functions in
 the custom_zlib field of the compress and decompress settings*/
@@ -129,6 +131,8 @@ unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h,
 /*
 Load PNG from disk, from file with given name.
 Same as the other decode functions, but instead takes a filename as input.
+Where the platform supports it, the file is memory mapped and decoded from the
+mapping, see lodepng_decode_file_state.
 */
 unsigned lodepng_decode_file(unsigned char** out, unsigned* w, unsigned* h,
                              const char* filename,
@@ -178,6 +182,7 @@ unsigned lodepng_encode24(unsigned char** out, size_t* outsize,
 /*
 Converts raw pixel data into a PNG file on disk.
 Same as the other encode functions, but instead takes a filename as output.
+The PNG is written while it is encoded, see lodepng_encode_file_state.
 NOTE: This overwrites existing files without warning!
 */
 unsigned lodepng_encode_file(const char* filename,
@@ -290,6 +295,10 @@ struct LodePNGCompressSettings /*deflate = compress*/
   unsigned minmatch; /*mininum lz77 length. 3 is normally best, 6 can be better for some PNGs. Default: 0*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
+  /*only look for repeats of the previous byte and of the previous scanline, without hash table, like the
+  Z_RLE strategy of zlib. Much faster, but compresses less, except for images that are mostly plain.
+  Default: false*/
+  unsigned rle;
 
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -524,6 +533,19 @@ typedef struct LodePNGDecoderSettings
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*
+  Decode only a part of the image, and/or a smaller version of it. The crop is the
+  rectangle of crop_w * crop_h pixels with its top left corner at crop_x, crop_y, if
+  crop_w and crop_h are both not 0. scale_shift 1, 2 or 3 makes each output pixel the
+  average of a block of 2x2, 4x4 or 8x8 pixels of that, which needs an output color
+  mode with 8 or 16 bits per channel and no palette. The w and h given back by the
+  decode functions are then the size of the result, and memory is only allocated for
+  the result and a few scanlines. Decoding stops after the last row of the crop.
+  Default: 0, the whole image.
+  */
+  unsigned crop_x, crop_y, crop_w, crop_h;
+  unsigned scale_shift;
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
   /*store all bytes from unknown chunks in the LodePNGInfo (off by default, useful for a png editor)*/
@@ -582,11 +604,28 @@ unsigned lodepng_auto_choose_color(LodePNGColorMode* mode_out,
                                    const LodePNGColorMode* mode_in);
 
 /*Settings for the encoder.*/
+/*The stages of encoding a PNG, as told to a LodePNGStageCallback*/
+typedef enum LodePNGEncodeStage
+{
+  LES_FILTER, /*converting the image to the PNG color type, interlacing and filtering it*/
+  LES_DEFLATE, /*compressing the filtered scanlines into the IDAT chunks*/
+  LES_WRITE, /*writing chunks to the file, with lodepng_encode_file_state. Happens during LES_DEFLATE too*/
+  LES_DEFLATE_BLOCK /*making one block of the deflate stream, during LES_DEFLATE*/
+} LodePNGEncodeStage;
+
+/*Called with begin 1 when the encoder starts a stage, and with begin 0 when it ends it, e.g. to time them*/
+typedef void (*LodePNGStageCallback)(LodePNGEncodeStage stage, unsigned begin, void* user);
+
 typedef struct LodePNGEncoderSettings
 {
   LodePNGCompressSettings zlibsettings; /*settings for the zlib encoder, such as window size, ...*/
 
   unsigned auto_convert; /*automatically choose output PNG color type. Default: true*/
+  /*Hint for auto_convert, for RGB or RGBA raw images such as renders: the image is known to have more than
+  256 colors, not all grey, and to be fully opaque. auto_convert then chooses RGB with the bit depth of the
+  raw image right away, without making a color profile of all pixels. Any alpha channel of the raw image is
+  dropped, so only set this when it's true. Default: false*/
+  unsigned known_opaque_rgb;
 
   /*If true, follows the official PNG heuristic: if the PNG uses a palette or lower than
   8 bit depth, set all filters to zero. Otherwise use the filter_strategy. Note that to
@@ -605,6 +644,10 @@ typedef struct LodePNGEncoderSettings
   /*force creating a PLTE chunk if colortype is 2 or 6 (= a suggested palette).
   If colortype is 3, PLTE is _always_ created.*/
   unsigned force_palette;
+
+  /*if not null, told when each stage of encoding begins and ends, with stage_user as user. Default: null*/
+  LodePNGStageCallback stage_callback;
+  void* stage_user;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   /*add LodePNG identifier and version as a text chunk, for debugging*/
   unsigned add_id;
@@ -651,6 +694,55 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         LodePNGState* state,
                         const unsigned char* in, size_t insize);
 
+#ifdef LODEPNG_COMPILE_DISK
+/*
+Same as lodepng_decode, but reads the PNG from the file with given name.
+Like lodepng_decode_file, on Windows and POSIX systems the file is memory mapped
+read-only and decoded straight from the mapping, without a copy of the file in
+memory. If the file can't be mapped, it is loaded with lodepng_load_file instead.
+The file should not be truncated by another process while it is decoded.
+*/
+unsigned lodepng_decode_file_state(unsigned char** out, unsigned* w, unsigned* h,
+                                   LodePNGState* state, const char* filename);
+#endif /*LODEPNG_COMPILE_DISK*/
+
+/*
+Called by lodepng_decode_rows with each row of the image, from top to bottom: y is
+the index of the row, w its width in pixels. The row has the color mode of
+state->info_raw and always starts at a whole byte, also if the pixels are smaller
+than a byte. It is only valid during the call. Return 0 to continue, or anything
+else to stop decoding.
+*/
+typedef unsigned (*LodePNGRowCallback)(const unsigned char* row, unsigned y, unsigned w, void* user);
+
+/*
+Decodes the PNG row by row instead of into a full image buffer: each row is given
+to callback as soon as it is decompressed and unfiltered. For PNGs that are not
+interlaced this needs memory for only two scanlines and the 32K window of the
+decompressor, so it works for images larger than what fits in memory at once.
+Interlaced images, and PNGs for a custom_zlib or custom_inflate, are decoded in
+full first and then given row by row. Color conversion works like in
+lodepng_decode, and so do the crop and scale_shift of the decoder settings: then the
+rows are those of the result, and w and h are set to its size. Returns 0 also if the
+callback stopped decoding early.
+*/
+unsigned lodepng_decode_rows(unsigned* w, unsigned* h, LodePNGState* state,
+                             const unsigned char* in, size_t insize,
+                             LodePNGRowCallback callback, void* user);
+
+/*
+Same as lodepng_decode, but decodes into out, memory of outsize bytes owned by you (e.g.
+a region of a texture atlas), instead of allocating the image. Row y of the image goes
+to out + y * stride, in the color mode of state->info_raw, and always starts at a whole
+byte. Get w and h with lodepng_inspect first: out must have room for h - 1 times stride
+plus one row, else error 98 is returned; with a crop or scale_shift in the decoder
+settings, w and h of the result count instead. Without color conversion, crop or scale
+the scanlines are unfiltered right into out, using the row decoder of lodepng_decode_rows.
+*/
+unsigned lodepng_decode_into(unsigned char* out, size_t outsize, size_t stride,
+                             unsigned* w, unsigned* h, LodePNGState* state,
+                             const unsigned char* in, size_t insize);
+
 /*
 Read the PNG header, but not the actual data. This returns only the information
 that is in the header chunk of the PNG, such as width, height and color type. The
@@ -667,6 +759,79 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h,
 unsigned lodepng_encode(unsigned char** out, size_t* outsize,
                         const unsigned char* image, unsigned w, unsigned h,
                         LodePNGState* state);
+
+#ifdef LODEPNG_COMPILE_DISK
+/*
+Same as lodepng_encode_file, but uses a LodePNGState to allow custom settings.
+The chunks are written to the file as soon as they are made, and the IDAT data is
+written in chunks of its own while the deflate encoder still works on the rest, so
+the whole PNG is never in memory. The writes are synchronous: deflate waits for each
+one, the file I/O does not overlap compression. The PNG is written to a new file
+next to filename, filename.P-T-N.tmp with numbers that make the name unique to this
+process, thread and call, so saves of the same file at the same time and existing
+files of yours are never written to. That file then replaces filename in one step
+(rename on POSIX, MoveFileEx on Windows), so filename is never partially written.
+On error, only the temporary file is removed and an existing file at filename is
+left as it was.
+*/
+unsigned lodepng_encode_file_state(const char* filename,
+                                   const unsigned char* image, unsigned w, unsigned h,
+                                   LodePNGState* state);
+#endif /*LODEPNG_COMPILE_DISK*/
+
+/*internal working memory of the encoder, see LodePNGEncoderContext*/
+typedef struct LodePNGEncoderBuffers LodePNGEncoderBuffers;
+
+/*
+A long-lived encoder, for encoding many images such as the frames of an animation. It
+keeps the LZ77 hash tables, filter scanlines, LZ77 output, uncompressed image data, the
+palette chosen by auto_convert and the PNG output buffer alive between calls instead of
+allocating and freeing them for every image. Only what the output depends on is reset, so
+once a frame of a given size has been encoded, encoding further frames of that size makes
+no allocations, also when auto_convert chooses a palette. What is in the info of the state
+is still copied for every image: a palette, texts or unknown chunks set there by you.
+*/
+typedef struct LodePNGEncoderContext
+{
+  LodePNGState state; /*settings and info, used exactly like the state of lodepng_encode*/
+  LodePNGEncoderBuffers* buffers; /*allocated on first use, freed by the cleanup function*/
+} LodePNGEncoderContext;
+
+/*init and cleanup functions to use with this struct*/
+void lodepng_encoder_context_init(LodePNGEncoderContext* context);
+void lodepng_encoder_context_cleanup(LodePNGEncoderContext* context);
+
+/*
+Same as lodepng_encode, but the PNG is stored in memory owned by the context: *out stays
+valid until the next encode with this context or its cleanup, and must not be freed.
+*/
+unsigned lodepng_encode_context(const unsigned char** out, size_t* outsize,
+                                const unsigned char* image, unsigned w, unsigned h,
+                                LodePNGEncoderContext* context);
+
+/*
+Worst case size in bytes of the PNG the encoder makes from a w * h image with this color
+type and bit depth, also with auto_convert and Adam7 interlacing, using the built in zlib
+compressor. Not included are ancillary chunks added through the info (text, time, unknown
+chunks, ...) or the add_id setting.
+*/
+size_t lodepng_encode_bound(unsigned w, unsigned h, LodePNGColorType colortype, unsigned bitdepth);
+
+/*
+Same as lodepng_encode, but writes the PNG into out, a buffer of outcapacity bytes owned by
+you (e.g. from a pool, shared memory or a mapped file), without allocating a result buffer or
+copying. *outsize is set to the amount of bytes used. Returns error 96 if the PNG doesn't
+fit, which cannot happen if outcapacity is at least lodepng_encode_bound, within the
+limits mentioned there.
+*/
+unsigned lodepng_encode_into(unsigned char* out, size_t outcapacity, size_t* outsize,
+                             const unsigned char* image, unsigned w, unsigned h,
+                             LodePNGState* state);
+
+/*Same as lodepng_encode_into, and reuses the working memory of the context like lodepng_encode_context.*/
+unsigned lodepng_encode_context_into(unsigned char* out, size_t outcapacity, size_t* outsize,
+                                     const unsigned char* image, unsigned w, unsigned h,
+                                     LodePNGEncoderContext* context);
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 /*
@@ -1583,8 +1748,10 @@ state.encoder.zlibsettings.windowsize: tweak LZ77 windowsize
 state.encoder.zlibsettings.minmatch: tweak min LZ77 length to match
 state.encoder.zlibsettings.nicematch: tweak LZ77 match where to stop searching
 state.encoder.zlibsettings.lazymatching: try one more LZ77 matching
+state.encoder.zlibsettings.rle: only encode runs, fast for images with plain backgrounds
 state.encoder.zlibsettings.custom_...: use custom deflate function
 state.encoder.auto_convert: choose optimal PNG color type, if 0 uses info_png
+state.encoder.known_opaque_rgb: tell auto_convert the image is opaque RGB, skips color analysis
 state.encoder.filter_palette_zero: PNG filter strategy for palette
 state.encoder.filter_strategy: PNG filter strategy to encode with
 state.encoder.force_palette: add palette even if not encoding to one
@@ -1608,6 +1775,37 @@ yyyymmdd.
 Some changes aren't backwards compatible. Those are indicated with a (!)
 symbol.
 
+*) 19 okt 2026: Added stage_callback to the encoder settings, to time the filter, deflate
+   and file write stages of encoding, and each deflate block.
+*) 19 okt 2026: Added the crop and scale_shift decoder settings, to decode a part of
+   the image and/or a 1/2, 1/4 or 1/8 scale version of it.
+*) 19 okt 2026: Added lodepng_decode_into, to decode into memory of your own with
+   any row stride. The decoder no longer reallocates its buffer for the decompressed data.
+*) 19 okt 2026: Added lodepng_decode_rows, a decoder that gives the image row by row
+   to a callback and streams the decompression, to decode huge images in little memory.
+*) 19 okt 2026: Faster lodepng_convert between grey and RGB types with or without alpha,
+   and from 16 to 8 bit, without going through a pixel at a time.
+*) 19 okt 2026: Faster color profile: colors are counted with a hash table, pixels
+   equal to the previous one are skipped, and it stops once nothing can change
+   anymore. Added the known_opaque_rgb encoder setting to skip it entirely.
+*) 19 okt 2026: Faster LZ77 for images with plain backgrounds: long runs of zeros and
+   repeats of the previous scanline are taken without hash chain search. Added the
+   rle compression setting, a run length only strategy like zlib's Z_RLE.
+*) 19 okt 2026: lodepng_encode_file writes the PNG chunks to the file while encoding,
+   through a temporary file that is renamed when done. Added lodepng_encode_file_state.
+*) 19 okt 2026: The decode from file functions memory map the file where possible
+   instead of reading it into a buffer first. Added lodepng_decode_file_state.
+*) 19 okt 2026: Added lodepng_encode_bound and lodepng_encode_into, to encode into
+   a buffer of the user.
+*) 19 okt 2026: Added LodePNGEncoderContext and lodepng_encode_context, to encode
+   many images while reusing the encoder's buffers. The PNG output buffer now grows
+   amortized instead of being reallocated to the exact size for every chunk.
+   lodepng_convert finds palette indices with a hash table on the stack instead of
+   a color tree, so converting to a palette no longer allocates. The decoder gives
+   every palette room for 256 colors, as LodePNGColorMode::palette asks.
+*) 19 okt 2026: Faster inflate: huffman symbols are decoded with a two level
+   lookup table instead of walking a tree bit by bit, bits are read from a
+   64-bit buffer refilled once per symbol, and matches are copied in words.
 *) 18 apr 2016: Changed qsort to custom stable sort (for platforms w/o qsort).
 *) 09 apr 2016: Fixed colorkey usage detection, and better file loading (within
    the limits of pure C90).
@@ -0,0 +1,1221 @@
+// Simple OpenGL example for CS184 F06 by Nuttapong Chentanez, modified from sample code for CS184 on Sp06
+// Modified for Realtime-CG class
+//
+// The renderer without the viewer, see renderer.h
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#ifdef __linux__
+#	include <linux/perf_event.h>
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#	include <errno.h>
+#endif
+
+#include "renderer.h"
+
+using namespace std;
+
+template <class V> RenderBuffers<V>& renderBuffers(RenderContext &context);
+template <> RenderBuffers<vec3h>& renderBuffers<vec3h>(RenderContext &context) { return context.half_buffers; }
+template <> RenderBuffers<vec3>& renderBuffers<vec3>(RenderContext &context) { return context.float_buffers; }
+template <> RenderBuffers<vec3d>& renderBuffers<vec3d>(RenderContext &context) { return context.double_buffers; }
+
+template <class V> void getCubePixel(RenderContext &context, RenderBuffers<V> &buffers);
+
+//****************************************************
+// Global Variables
+//****************************************************
+
+GlobalConfig globalConfig =
+{
+    .display=true,              // will display preview by default,
+    .imageSave={
+        .save=false,            // will NOT save preview by default
+        .filepath=NULL
+    },
+    .stats={
+        .enabled=false,         // no frame statistics by default
+        .jsonpath=NULL,
+        .counters=false
+    },
+    .trace={
+        .filepath=NULL          // no tracing by default
+    },
+    .check={
+        .reference=NULL,        // no comparison by default
+        .tolerance=0,
+        .budget=0
+    }
+};
+
+// Names of the stages, in the summary, the JSON lines and the overlay of the viewer
+const char* stage_names[STAGE_COUNT] = {"geometry", "shading", "quantization", "presentation",
+                                        "png_filter", "png_deflate", "png_write", "frame", "frame_interval"};
+
+//****************************************************
+// Hardware performance counters (-counters), Linux only
+//****************************************************
+const char* counter_names[COUNTER_COUNT] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+
+// Opens the counters that this system and its perf_event_paranoid setting allow, for this thread
+void initCounters(PerfCounters &counters)
+{
+#ifdef __linux__
+    const unsigned types[COUNTER_COUNT] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+                                           PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE};
+    const unsigned long long configs[COUNTER_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    int error = 0;
+    for(int i = 0; i < COUNTER_COUNT; i++)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[i];
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;   // allowed with the default perf_event_paranoid
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = counters.leader < 0 ? 1 : 0;    // the leader starts the whole group
+        int fd = syscall(__NR_perf_event_open, &attr, 0, -1, counters.leader, 0);
+        if(fd < 0)
+        {
+            error = errno;
+            continue;
+        }
+        if(counters.leader < 0) counters.leader = fd;
+        counters.fds[counters.count] = fd;
+        counters.index[i] = counters.count++;
+    }
+    if(counters.leader >= 0)
+    {
+        counters.open = true;
+        ioctl(counters.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(counters.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    if(counters.count == 0)
+    {
+        printf("Hardware counters are not available here (%s), -counters is ignored\n", strerror(error));
+    }
+    else if(counters.count < COUNTER_COUNT)
+    {
+        printf("%d of %d hardware counters are not available (%s), they are left out\n",
+               COUNTER_COUNT - counters.count, COUNTER_COUNT, strerror(error));
+    }
+#else
+    printf("Hardware counters are only available on Linux, -counters is ignored\n");
+#endif
+}
+
+// Closes the counters that initCounters opened; they are left as none of them being available
+void closeCounters(PerfCounters &counters)
+{
+#ifdef __linux__
+    for(int i = 0; i < counters.count; i++) close(counters.fds[i]);
+#endif
+    counters.open = false;
+    counters.leader = -1;
+    counters.count = 0;
+    for(int c = 0; c < COUNTER_COUNT; c++) counters.index[c] = -1;
+}
+
+// Current values of the counters, 0 for the ones that aren't available
+void readCounters(const PerfCounters &counters, long long values[COUNTER_COUNT])
+{
+    for(int i = 0; i < COUNTER_COUNT; i++) values[i] = 0;
+#ifdef __linux__
+    unsigned long long group[1 + COUNTER_COUNT];    // the number of counters, then their values
+    if(read(counters.leader, group, sizeof(group)) < (ssize_t)sizeof(group[0])) return;
+    for(int i = 0; i < COUNTER_COUNT; i++)
+    {
+        if(counters.index[i] >= 0) values[i] = group[1 + counters.index[i]];
+    }
+#endif
+}
+
+//****************************************************
+// Frame statistics (-stats): time spent per stage of each frame
+//****************************************************
+
+FrameStats::FrameStats() : enabled(false), pixels(0), frames(0), json(NULL)
+{
+    perf.open = false;
+    perf.leader = -1;
+    perf.count = 0;
+    for(int c = 0; c < COUNTER_COUNT; c++) perf.index[c] = -1;
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        seconds[i] = last_seconds[i] = 0;
+        used[i] = last_used[i] = false;
+        for(int c = 0; c < COUNTER_COUNT; c++) counters[i][c] = counter_totals[i][c] = 0;
+    }
+    frame_start.seconds = png_stage_start.seconds = 0;
+}
+
+// Seconds on a monotonic clock, or 0 if the statistics are disabled
+double statsClock(const FrameStats &stats)
+{
+    if(!stats.enabled) return 0;
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A point in time and the counters then, or an empty one if the statistics are disabled
+StatsMark statsMark(const FrameStats &stats)
+{
+    StatsMark mark;
+    mark.seconds = statsClock(stats);
+    if(stats.enabled && stats.perf.open) readCounters(stats.perf, mark.counters);
+    return mark;
+}
+
+// Adds what happened between two marks to a stage of the frame
+void statsAdd(FrameStats &stats, FRAME_STAGE stage, const StatsMark &start, const StatsMark &end)
+{
+    stats.seconds[stage] += end.seconds - start.seconds;
+    if(stats.perf.open)
+    {
+        for(int i = 0; i < COUNTER_COUNT; i++) stats.counters[stage][i] += end.counters[i] - start.counters[i];
+    }
+    stats.used[stage] = true;
+}
+
+// Adds what happened since start to a stage of the frame, if the statistics are enabled, and returns
+// the mark to start the next from
+StatsMark statsStage(FrameStats &stats, FRAME_STAGE stage, const StatsMark &start)
+{
+    if(!stats.enabled) return start;
+    StatsMark now = statsMark(stats);
+    statsAdd(stats, stage, start, now);
+    return now;
+}
+
+// Called by lodepng when an encoding stage begins or ends. The stages nest (file writes happen
+// during deflate), so time is counted for the innermost one only
+void statsPngStage(FrameStats &stats, LodePNGEncodeStage stage, unsigned begin)
+{
+    const FRAME_STAGE stages[] = {STAGE_PNG_FILTER, STAGE_PNG_DEFLATE, STAGE_PNG_WRITE, STAGE_PNG_DEFLATE};
+    StatsMark now = statsMark(stats);
+    if(!stats.png_stages.empty())
+    {
+        statsAdd(stats, (FRAME_STAGE)stats.png_stages.back(), stats.png_stage_start, now);
+    }
+    if(begin) stats.png_stages.push_back(stages[stage]);
+    else stats.png_stages.pop_back();
+    stats.png_stage_start = now;
+}
+
+void statsBeginFrame(FrameStats &stats)
+{
+    stats.frame_start = statsMark(stats);
+}
+
+void statsEndFrame(FrameStats &stats, const Viewport &viewport)
+{
+    if(!stats.enabled) return;
+    statsStage(stats, STAGE_FRAME, stats.frame_start);
+    double pixels = (double)viewport.w * viewport.h;
+    stats.pixels += pixels;
+    if(stats.json) fprintf(stats.json, "{\"frame\": %d", stats.frames);
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        if(stats.used[i])
+        {
+            stats.samples[i].push_back(stats.seconds[i]);
+            if(stats.json) fprintf(stats.json, ", \"%s_ms\": %.4f", stage_names[i], stats.seconds[i] * 1000);
+            for(int c = 0; c < COUNTER_COUNT; c++)
+            {
+                if(stats.perf.index[c] < 0) continue;
+                stats.counter_totals[i][c] += stats.counters[i][c];
+                if(stats.json) fprintf(stats.json, ", \"%s_%s\": %lld", stage_names[i], counter_names[c],
+                                       stats.counters[i][c]);
+            }
+        }
+        stats.last_seconds[i] = stats.seconds[i];
+        stats.last_used[i] = stats.used[i];
+        stats.seconds[i] = 0;
+        for(int c = 0; c < COUNTER_COUNT; c++) stats.counters[i][c] = 0;
+        stats.used[i] = false;
+    }
+    if(stats.json) fprintf(stats.json, ", \"pixels\": %.0f}\n", pixels);
+    stats.frames++;
+}
+
+// Instructions per cycle and counts per pixel of every stage, over all frames
+void statsPrintCounters(const FrameStats &stats)
+{
+    printf("\n%-16s %10s", "stage", "ipc");
+    for(int c = COUNTER_L1D_MISSES; c < COUNTER_COUNT; c++) printf(" %16s", counter_names[c]);
+    printf("   (misses per pixel)\n");
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        if(stats.samples[i].empty() || i == STAGE_FRAME_INTERVAL) continue;
+        const long long* totals = stats.counter_totals[i];
+        printf("%-16s", stage_names[i]);
+        if(stats.perf.index[COUNTER_CYCLES] >= 0 && stats.perf.index[COUNTER_INSTRUCTIONS] >= 0 && totals[COUNTER_CYCLES])
+        {
+            printf(" %10.2f", (double)totals[COUNTER_INSTRUCTIONS] / totals[COUNTER_CYCLES]);
+        }
+        else printf(" %10s", "n/a");
+        for(int c = COUNTER_L1D_MISSES; c < COUNTER_COUNT; c++)
+        {
+            if(stats.perf.index[c] >= 0) printf(" %16.4f", totals[c] / stats.pixels);
+            else printf(" %16s", "n/a");
+        }
+        printf("\n");
+    }
+}
+
+// Mean, median and 99th percentile of every stage
+void statsPrintSummary(const FrameStats &stats)
+{
+    printf("\n%d frame(s)\n%-16s %10s %10s %10s\n", stats.frames, "stage (ms)", "mean", "p50", "p99");
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        vector<double> samples = stats.samples[i];
+        if(samples.empty()) continue;
+        sort(samples.begin(), samples.end());
+        double sum = 0;
+        for(size_t k = 0; k < samples.size(); k++) sum += samples[k];
+        printf("%-16s %10.3f %10.3f %10.3f\n", stage_names[i], sum / samples.size() * 1000,
+               samples[(samples.size() - 1) * 50 / 100] * 1000, samples[(samples.size() - 1) * 99 / 100] * 1000);
+    }
+    if(stats.perf.open && stats.pixels > 0) statsPrintCounters(stats);
+}
+
+// Closes the counters and the JSON file of the statistics and disables them; FrameStats has no
+// destructor, as copies of a context (checkRender's) share them
+static void releaseStats(FrameStats &stats)
+{
+    closeCounters(stats.perf);
+    if(stats.json) fclose(stats.json);
+    stats.json = NULL;
+    stats.enabled = false;
+}
+
+// Enables the statistics of the context as the options of the program (-stats, -stats-json,
+// -counters) ask; the counters are of the calling thread, which should be the one that renders
+void initStats(RenderContext &context)
+{
+    FrameStats &stats = context.stats;
+    releaseStats(stats);
+    stats = FrameStats();
+    if(!globalConfig.stats.enabled) return;
+    stats.enabled = true;
+    if(globalConfig.stats.jsonpath)
+    {
+        stats.json = fopen(globalConfig.stats.jsonpath, "w");
+        if(!stats.json) printf("Can't write frame statistics to %s\n", globalConfig.stats.jsonpath);
+    }
+    if(globalConfig.stats.counters) initCounters(stats.perf);
+}
+
+// Prints the summary of the statistics of the context, if they are enabled, and closes their counters
+// and JSON file
+void finishStats(RenderContext &context)
+{
+    FrameStats &stats = context.stats;
+    if(stats.enabled) statsPrintSummary(stats);
+    releaseStats(stats);
+}
+
+//****************************************************
+// Tracing (-trace): spans of the render and encode stages, written as a Chrome trace
+// (chrome://tracing or ui.perfetto.dev)
+//****************************************************
+struct TraceEvent
+{
+    const char* name;
+    double start;       // microseconds since tracing began
+    double duration;
+};
+
+// Every thread records into a ring of its own, so no lock is taken per span
+struct TraceThread
+{
+    int id;
+    thread::id owner;
+    vector<TraceEvent> ring;
+    size_t count;               // spans recorded so far, the ring keeps the last TRACE_RING_SIZE
+    vector<TraceEvent> open;    // spans begun and not ended yet, innermost last
+};
+
+const size_t TRACE_RING_SIZE = 1 << 16;
+const int TRACE_ROW_BAND = 16;  // rows of the sphere per span
+
+class TraceRecorder
+{
+public:
+    unsigned long long serial;  // tells the recorders apart, addresses can be reused
+    chrono::steady_clock::time_point start;
+    mutex threads_mutex;
+    vector<TraceThread*> threads;
+};
+
+// The ring of this thread in the recorder it last recorded into
+thread_local TraceThread* trace_thread = NULL;
+thread_local unsigned long long trace_thread_serial = 0;
+
+TraceRecorder* newTrace()
+{
+    static atomic<unsigned long long> serials(0);
+    TraceRecorder* trace = new TraceRecorder;
+    trace->serial = ++serials;
+    trace->start = chrono::steady_clock::now();
+    return trace;
+}
+
+void deleteTrace(TraceRecorder* trace)
+{
+    if(!trace) return;
+    for(size_t i = 0; i < trace->threads.size(); i++) delete trace->threads[i];
+    delete trace;
+}
+
+TraceThread* traceThread(TraceRecorder* trace)
+{
+    if(trace_thread && trace_thread_serial == trace->serial) return trace_thread;
+    lock_guard<mutex> lock(trace->threads_mutex);
+    trace_thread = NULL;
+    for(size_t i = 0; i < trace->threads.size() && !trace_thread; i++)
+    {
+        if(trace->threads[i]->owner == this_thread::get_id()) trace_thread = trace->threads[i];
+    }
+    if(!trace_thread)
+    {
+        trace_thread = new TraceThread;
+        trace_thread->owner = this_thread::get_id();
+        trace_thread->ring.resize(TRACE_RING_SIZE);
+        trace_thread->count = 0;
+        trace_thread->id = trace->threads.size();
+        trace->threads.push_back(trace_thread);
+    }
+    trace_thread_serial = trace->serial;
+    return trace_thread;
+}
+
+double traceNow(const TraceRecorder* trace)
+{
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - trace->start).count();
+}
+
+// name must stay valid until the trace is written; does nothing without a recorder
+void traceBegin(TraceRecorder* trace, const char* name)
+{
+    if(!trace) return;
+    TraceEvent event = {name, traceNow(trace), 0};
+    traceThread(trace)->open.push_back(event);
+}
+
+void traceEnd(TraceRecorder* trace)
+{
+    if(!trace) return;
+    TraceThread* t = traceThread(trace);
+    TraceEvent event = t->open.back();
+    t->open.pop_back();
+    event.duration = traceNow(trace) - event.start;
+    t->ring[t->count++ % TRACE_RING_SIZE] = event;
+}
+
+void writeTrace(TraceRecorder* trace, const char* filepath)
+{
+    FILE* file = fopen(filepath, "w");
+    if(!file)
+    {
+        printf("Can't write the trace to %s\n", filepath);
+        return;
+    }
+    lock_guard<mutex> lock(trace->threads_mutex);
+    fprintf(file, "{\"traceEvents\": [\n");
+    for(size_t i = 0; i < trace->threads.size(); i++)
+    {
+        TraceThread* t = trace->threads[i];
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                "\"args\": {\"name\": \"%s %d\"}}", i ? ",\n" : "", t->id, t->id ? "worker" : "main", t->id);
+        size_t first = t->count > TRACE_RING_SIZE ? t->count - TRACE_RING_SIZE : 0;
+        for(size_t k = first; k < t->count; k++)
+        {
+            const TraceEvent &event = t->ring[k % TRACE_RING_SIZE];
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    event.name, t->id, event.start, event.duration);
+        }
+    }
+    fprintf(file, "\n], \"displayTimeUnit\": \"ms\"}\n");
+    fclose(file);
+}
+
+// Gives the context a recorder of its own if the program was given -trace
+void initTrace(RenderContext &context)
+{
+    context.trace = globalConfig.trace.filepath ? newTrace() : NULL;
+}
+
+// Writes the trace of the context to the file of -trace, if it has one, and deletes its recorder
+void finishTrace(RenderContext &context)
+{
+    if(!context.trace) return;
+    writeTrace(context.trace, globalConfig.trace.filepath);
+    deleteTrace(context.trace);
+    context.trace = NULL;
+}
+
+// Called by lodepng when an encoding stage begins or ends, with the context being saved as user
+void pngStageCallback(LodePNGEncodeStage stage, unsigned begin, void* user)
+{
+    const char* names[] = {"png filter", "png deflate", "png write", "deflate block"};
+    RenderContext &context = *(RenderContext*)user;
+    if(context.stats.enabled) statsPngStage(context.stats, stage, begin);
+    if(begin) traceBegin(context.trace, names[stage]);
+    else traceEnd(context.trace);
+}
+
+void reshape_viewport(int w, int h, Viewport &viewport)
+{
+    viewport.w = w;
+    viewport.h = h;
+    viewport.drawX = (int)(viewport.w*0.5f);
+    viewport.drawY = (int)(viewport.h*0.5f);
+}
+
+//****************************************************
+// Approximate shading (-approx), see bench/accuracy.cpp for how far it is off
+//****************************************************
+const char* approx_names[] = {"fast_pow", "specular_table", "fast_normalize"};
+const char* precision_names[] = {"half", "float", "double"};   // in the order of GlobalConfig::PRECISION
+
+// x to the power p from the exponent and mantissa bits of x, for x >= 0 and p > 0
+float fastPow(float x, float p)
+{
+    if(x != x) return x;                        // NaN, like pow
+    if(x <= 0) return 0;
+    union { float f; int i; } bits;
+    bits.f = x;
+    float exponent = (float)(((bits.i >> 23) & 255) - 127);
+    bits.i = (bits.i & 0x007FFFFF) | 0x3F800000;    // the mantissa, in [1, 2)
+    float t = bits.f - 1;
+    float y = p * (exponent + t * (1.4208645f + t * (-0.5772507f + t * 0.1563861f)));
+    if(y < -126) return 0;
+    if(y >= 128) return HUGE_VALF;              // like pow, which overflows too
+    float whole = floorf(y);
+    float f = y - whole;
+    bits.i = (int)(whole + 127) << 23;
+    return bits.f * (1 + f * (0.6959285f + f * (0.2249463f + f * 0.0791252f)));
+}
+
+// Fills the specular table of the context for its material; call it before rendering, it isn't
+// filled on demand so that the shading only reads the context
+void prepareShading(RenderContext &context)
+{
+    SpecularTable &table = context.specularTable;
+    if(!(context.shading.approx & GlobalConfig::APPROX_SPECULAR_TABLE) || table.sp == context.material.sp) return;
+    for(int i = 0; i <= SPECULAR_TABLE_SIZE; i++)
+    {
+        table.values[i] = pow((float)i / SPECULAR_TABLE_SIZE, context.material.sp);
+    }
+    table.sp = context.material.sp;
+}
+
+float specularPow(const RenderContext &context, float x)
+{
+    const SpecularTable &table = context.specularTable;
+    float sp = context.material.sp;
+    if((context.shading.approx & GlobalConfig::APPROX_SPECULAR_TABLE) && table.sp == sp && x >= 0 && x < 1)
+    {
+        float position = x * SPECULAR_TABLE_SIZE;
+        int i = (int)position;
+        float f = position - i;
+        return table.values[i] + f * (table.values[i + 1] - table.values[i]);
+    }
+    if(context.shading.approx & GlobalConfig::APPROX_FAST_POW) return fastPow(x, sp);
+    return pow(x, sp);
+}
+
+// Normalizes a vec3 or a packet of them, with rsqrt instead of sqrt and a divide under fast_normalize
+template <class V> void shadingNormalize(const RenderContext &context, V &v)
+{
+    if(context.shading.approx & GlobalConfig::APPROX_FAST_NORMALIZE) v.fastNormalize();
+    else v.normalize();
+}
+
+void toonShade(vec3 &result)
+{
+    const float toon = 5;
+    // result.g = floor(result.g * toon) / toon;
+    // result.r = floor(result.r * toon) / toon;
+    // result.b = floor(result.b * toon) / toon;
+
+    float mean_luminance = (result.r + result.g + result.b)/3;
+    float sub = mean_luminance - floor(mean_luminance * toon) / toon;
+    result -= sub;
+}
+
+vec3 computeShadedColor(const RenderContext &context, vec3 pos,vec3 normal)
+{
+    const Material &material = context.material;
+    vec3 viewerPosition = vec3(0,0,1);
+    vec3 result = vec3(0,0,0);
+    shadingNormalize(context, normal);
+    for(auto l : context.lights)
+    {
+
+        // ambient
+        result.r+= material.ka.r * l.color.r;
+        result.g+= material.ka.g * l.color.g;
+        result.b+= material.ka.b * l.color.b;
+
+        // diffusion
+        vec3 lightDir = (l.type == Light::DIRECTIONAL_LIGHT? l.posDir : l.posDir - pos);
+        shadingNormalize(context, lightDir);
+        float dotProduct = normal * lightDir;
+        if(dotProduct > 0)
+        {
+            result.r += material.kd.r * l.color.r * dotProduct;
+            result.g += material.kd.g * l.color.g * dotProduct;
+            result.b += material.kd.b * l.color.b * dotProduct;
+        }
+
+        // specular
+        vec3 r = 2*dotProduct*normal - lightDir;
+        float specularComp = r*viewerPosition;
+        if(specularComp < 0) specularComp = 0;
+        specularComp = specularPow(context, specularComp);
+        result.r += material.ks.r * l.color.r * specularComp;
+        result.g += material.ks.g * l.color.g * specularComp;
+        result.b += material.ks.b * l.color.b * specularComp;
+
+    }
+
+    if(context.shading.toon) toonShade(result);
+
+    return result;
+}
+
+// The shading of computeShadedColor for a packet of pixels at once, with the same operations in
+// the same order, so the colors are the same as its
+#ifdef ALGEBRA3AVX
+typedef vec3x8 ShadingPacket;
+typedef floatx8 ShadingLanes;
+#else
+typedef vec3x4 ShadingPacket;
+typedef floatx4 ShadingLanes;
+#endif
+
+ShadingPacket computeShadedColorPacket(const RenderContext &context, const ShadingPacket &pos, ShadingPacket normal)
+{
+    const Material &material = context.material;
+    const ShadingPacket viewerPosition = ShadingPacket(vec3(0,0,1));
+    const ShadingLanes zero(0.0f);
+    ShadingPacket result = ShadingPacket(vec3(0,0,0));
+    shadingNormalize(context, normal);
+    for(size_t i = 0; i < context.lights.size(); i++)
+    {
+        const Light &l = context.lights[i];
+
+        // ambient
+        result += ShadingPacket(prod(material.ka, l.color));
+
+        // diffusion
+        ShadingPacket lightDir = (l.type == Light::DIRECTIONAL_LIGHT? ShadingPacket(l.posDir) : ShadingPacket(l.posDir) - pos);
+        shadingNormalize(context, lightDir);
+        ShadingLanes dotProduct = normal * lightDir;
+        result += select(dotProduct > zero, ShadingPacket(prod(material.kd, l.color)) * dotProduct, ShadingPacket(vec3(0,0,0)));
+
+        // specular, with the power taken lane by lane
+        ShadingPacket r = ((ShadingLanes(2.0f) * dotProduct) * normal) - lightDir;
+        float specularComp[ShadingLanes::LANES];
+        (r * viewerPosition).store(specularComp);
+        for(int k = 0; k < ShadingLanes::LANES; k++)
+        {
+            if(specularComp[k] < 0) specularComp[k] = 0;
+            specularComp[k] = specularPow(context, specularComp[k]);
+        }
+        result += ShadingPacket(prod(material.ks, l.color)) * ShadingLanes::load(specularComp);
+    }
+    return result;
+}
+
+// Shades count pixels, a packet at a time: normals advances by normal_step per pixel, 0 for one
+// normal for all of them
+void computeShadedColors(const RenderContext &context, const vec3* positions, const vec3* normals, size_t normal_step,
+                         vec3* colors, size_t count)
+{
+    size_t k = 0;
+    for(; k + ShadingPacket::LANES <= count; k += ShadingPacket::LANES)
+    {
+        ShadingPacket normal = normal_step ? ShadingPacket(normals + k * normal_step) : ShadingPacket(normals[0]);
+        computeShadedColorPacket(context, ShadingPacket(positions + k), normal).store(colors + k);
+        if(context.shading.toon)
+        {
+            for(int lane = 0; lane < ShadingPacket::LANES; lane++) toonShade(colors[k + lane]);
+        }
+    }
+    for(; k < count; k++)
+    {
+        colors[k] = computeShadedColor(context, positions[k], normals[k * normal_step]);
+    }
+}
+
+// Half precision: the positions, normals and colors are half floats, shaded in float a block at a time
+void computeShadedColors(const RenderContext &context, const vec3h* positions, const vec3h* normals, size_t normal_step,
+                         vec3h* colors, size_t count)
+{
+    const size_t BLOCK = 256;
+    vec3 block_positions[BLOCK], block_normals[BLOCK], block_colors[BLOCK];
+    for(size_t start = 0; start < count; start += BLOCK)
+    {
+        size_t n = min(BLOCK, count - start);
+        convertVectors(positions + start, block_positions, n);
+        const vec3* block_normal = block_positions;  // the sphere's normals are its positions
+        if(normals != positions || normal_step != 1)
+        {
+            for(size_t k = 0; k < (normal_step ? n : 1); k++)
+            {
+                convertVectors(normals + (start + k) * normal_step, block_normals + k, 1);
+            }
+            block_normal = block_normals;
+        }
+        computeShadedColors(context, block_positions, block_normal, normal_step ? 1 : 0, block_colors, n);
+        convertVectors(block_colors, colors + start, n);
+    }
+}
+
+// The exact shading of computeShadedColor in another precision than float, one pixel at a time; the
+// approximations of -approx are float only, and left out
+template <class T> void toonShade(vec3t<T> &result)
+{
+    const T toon = 5;
+    T mean_luminance = (result[RED] + result[GREEN] + result[BLUE])/3;
+    T sub = mean_luminance - floor(mean_luminance * toon) / toon;
+    result -= vec3t<T>(sub);
+}
+
+template <class T> vec3t<T> computeShadedColor(const RenderContext &context, const vec3t<T> &pos, vec3t<T> normal)
+{
+    const Material &material = context.material;
+    const vec3t<T> viewerPosition(0,0,1);
+    vec3t<T> result(0,0,0);
+    normal.normalize();
+    for(size_t i = 0; i < context.lights.size(); i++)
+    {
+        const Light &l = context.lights[i];
+        const vec3t<T> color(l.color), posDir(l.posDir);
+
+        // ambient
+        result += prod(vec3t<T>(material.ka), color);
+
+        // diffusion
+        vec3t<T> lightDir = (l.type == Light::DIRECTIONAL_LIGHT? posDir : posDir - pos);
+        lightDir.normalize();
+        T dotProduct = normal * lightDir;
+        if(dotProduct > 0) result += prod(vec3t<T>(material.kd), color) * dotProduct;
+
+        // specular
+        vec3t<T> r = 2*dotProduct*normal - lightDir;
+        T specularComp = r*viewerPosition;
+        if(specularComp < 0) specularComp = 0;
+        result += prod(vec3t<T>(material.ks), color) * pow(specularComp, (T)material.sp);
+    }
+
+    if(context.shading.toon) toonShade(result);
+
+    return result;
+}
+
+void computeShadedColors(const RenderContext &context, const vec3d* positions, const vec3d* normals, size_t normal_step,
+                         vec3d* colors, size_t count)
+{
+    for(size_t k = 0; k < count; k++)
+    {
+        colors[k] = computeShadedColor(context, positions[k], normals[k * normal_step]);
+    }
+}
+
+// A color into [0, 1], and NaN (from the edge of the sphere) to 0, so that the conversion is defined,
+// then into the bytes of its pixel
+template <class V> void quantizeColor(const V &col, unsigned char* pixel)
+{
+    for(int c = 0; c < 3; c++)
+    {
+        typename V::real_type value = col[c];
+        value = value > 1 ? 1 : value > 0 ? value : 0;
+        pixel[c] = (unsigned char)(255*value);
+    }
+}
+
+// Renders the shape with its positions and colors in V: vec3h, vec3 or vec3d
+template <class V> void renderShape(RenderContext &context)
+{
+    typedef typename V::real_type real;
+    const Viewport &viewport = context.viewport;
+    vector<unsigned char> &frame_buffer = context.frame_buffer;
+    RenderBuffers<V> &buffers = renderBuffers<V>(context);
+    if(context.shape == GlobalConfig::SPHERE)
+    {
+        int drawRadius = min(viewport.w, viewport.h)/2 - 10;  // Make it almost fit the entire window
+        real idrawRadius = real(1) / drawRadius;
+        // a row at a time: its positions, then its colors, then its pixels, so the stages can be timed
+        vector<V> &row_positions = buffers.positions;
+        vector<V> &row_colors = buffers.colors;
+        for (int i = -drawRadius; i <= drawRadius; i++)
+        {
+            int width = floor(sqrt((float)(drawRadius*drawRadius-i*i)));
+            if((i + drawRadius) % TRACE_ROW_BAND == 0) traceBegin(context.trace, "row band");
+            StatsMark t = statsMark(context.stats);
+            row_positions.clear();
+            for (int j = -width; j <= width; j++)
+            {
+                // Calculate the x, y, z of the surface of the sphere
+                real x = j * idrawRadius;
+                real y = i * idrawRadius;
+                real z = sqrt(real(1) - x*x - y*y);
+                row_positions.push_back(V(x,y,z)); // Position on the surface of the sphere
+            }
+            t = statsStage(context.stats, STAGE_GEOMETRY, t);
+
+            traceBegin(context.trace, "computeShadedColor");
+            row_colors.resize(row_positions.size());
+            computeShadedColors(context, &row_positions[0], &row_positions[0], 1, &row_colors[0], row_positions.size());
+            traceEnd(context.trace);
+            t = statsStage(context.stats, STAGE_SHADING, t);
+
+            for (int j = -width; j <= width; j++)
+            {
+                // Set the pixel
+//			setPixel(drawX + j, drawY + i, col.r, col.g, col.b);
+                quantizeColor(row_colors[j + width], &frame_buffer[ (viewport.h -viewport.drawY - i)*viewport.w*RGB_COLOR_SPACE_BIT_COUNT + (viewport.drawX + j)*RGB_COLOR_SPACE_BIT_COUNT]);
+            }
+            statsStage(context.stats, STAGE_QUANTIZATION, t);
+            if((i + drawRadius) % TRACE_ROW_BAND == TRACE_ROW_BAND - 1 || i == drawRadius) traceEnd(context.trace);
+        }
+    }
+    if(context.shape == GlobalConfig::CUBE)
+    {
+        int drawRadius = min(viewport.w, viewport.h)/4 - 10;  // Make it almost fit the entire window
+
+        const vector<V> &positions = buffers.positions;
+        const vector<V> &colors = buffers.colors;
+        getCubePixel(context, buffers);
+        traceBegin(context.trace, "quantization");
+        StatsMark t = statsMark(context.stats);
+        for(size_t i=0;i<positions.size();i++){
+            real x = positions[i][VX], y = positions[i][VY];
+
+            if((viewport.h - viewport.drawY - (int)(y*drawRadius)) < 0){
+                continue;
+            }
+
+            quantizeColor(colors[i], &frame_buffer[ (viewport.h - viewport.drawY - (int)(y*drawRadius))*viewport.w*RGB_COLOR_SPACE_BIT_COUNT + (viewport.drawX + (int)(x*drawRadius))*RGB_COLOR_SPACE_BIT_COUNT]);
+        }
+        statsStage(context.stats, STAGE_QUANTIZATION, t);
+        traceEnd(context.trace);
+    }
+}
+
+// Renders the scene of the context into its frame buffer, at its viewport; call prepareShading
+// after changing the material or the shading first
+int renderImageToBuffer(RenderContext &context)
+{
+    traceBegin(context.trace, "renderImageToBuffer");
+    vector<unsigned char> &frame_buffer = context.frame_buffer;
+    frame_buffer.resize( context.viewport.h * context.viewport.w * RGB_COLOR_SPACE_BIT_COUNT );
+    fill(frame_buffer.begin(), frame_buffer.end(), 0);
+
+    switch(context.shading.precision)
+    {
+        case GlobalConfig::PRECISION_HALF: renderShape<vec3h>(context); break;
+        case GlobalConfig::PRECISION_DOUBLE: renderShape<vec3d>(context); break;
+        default: renderShape<vec3>(context); break;
+    }
+
+    traceEnd(context.trace);
+    return 0;
+}
+
+// Rotates a row of the cube into its positions: in place and then converted to the precision of the
+// positions, or straight into them when it is the same
+template <class M, class Vec, class V> void transformRow(const M &m, Vec* row, V* positions, size_t count)
+{
+    transformPoints(m, row, row, count);
+    convertVectors(row, positions, count);
+}
+
+template <class M, class V> void transformRow(const M &m, V* row, V* positions, size_t count)
+{
+    transformPoints(m, row, positions, count);
+}
+
+// The positions and colors of the cube, in V, into the buffers; the geometry is computed in the scalar
+// of V, in float for half
+template <class V> void getCubePixel(RenderContext &context, RenderBuffers<V> &buffers)
+{
+    typedef typename V::real_type real;
+    typedef typename vec3_of<real>::type Vec;
+    typedef typename mat3_of<real>::type Mat;
+    vector<V> &positions = buffers.positions;
+    vector<V> &colors = buffers.colors;
+    vector<V> &face_normals = buffers.face_normals;
+    vector<Vec> &row = buffers.row;     // a row before the rotation
+    int drawRadius = min(context.viewport.w, context.viewport.h)/4 - 10;  // Make it almost fit the entire window
+    real idrawRadius = real(1) / drawRadius;
+    // Start drawing sphere
+    constexpr real sin45 = real(0.70710678118654752);    // 1/sqrt(2)
+
+    // the rotations of the cube, folded into one, and the normals of its faces, evaluated at compile time
+    constexpr Mat tranformation_matrix(
+        Vec( sin45,sin45,0),  // this matrix for rotation
+        Vec(-sin45,sin45,0),
+        Vec(0,0,1));
+
+    constexpr Mat tranformation_matrix2(
+        Vec(1,0,0),  // this matrix for rotation
+        Vec(0,sin45,-sin45),
+        Vec(0,sin45,sin45));
+
+    constexpr Mat cube_rotation = tranformation_matrix2 * tranformation_matrix;
+
+    static constexpr Vec side_normals[] =
+    {
+        cube_rotation * Vec(0,0,1),
+        cube_rotation * Vec(-1,0,0),
+        cube_rotation * Vec(0,1,0)
+    };
+    positions.clear();
+    colors.clear();
+    face_normals.clear();
+    // a viewport under 44 pixels leaves no room for the cube: its pixels are found from the
+    // positions, which a radius of 0 makes 0/0
+    if(drawRadius <= 0) return;
+    // the positions of all faces first, then their colors, so the stages can be timed
+    traceBegin(context.trace, "cube geometry");
+    StatsMark t = statsMark(context.stats);
+    size_t face_ends[3];
+    size_t side = 2 * drawRadius + 1;
+    row.resize(side);
+    positions.reserve(3 * side * side);
+    for (int i = -drawRadius; i <= drawRadius; i++)
+    {
+        for (int j = -drawRadius; j <= drawRadius; j++)
+        {
+            // Calculate the x, y, z of the surface of the sphere
+            real x = j * idrawRadius;
+            real y = i * idrawRadius;
+            real z = 1;
+            row[j + drawRadius] = Vec(x,y,z); // Position on the surface of the cube, before the rotation
+        }
+        // rotated a row at a time, while the row is still in the cache
+        positions.resize(positions.size() + side);
+        transformRow(cube_rotation, &row[0], &positions[positions.size() - side], side);
+    }
+    face_normals.push_back(V(side_normals[0]));
+    face_ends[0] = positions.size();
+
+    for (int i = -drawRadius; i <= drawRadius; i++)
+    {
+        for (int j = -drawRadius; j <= drawRadius; j++)
+        {
+            // Calculate the x, y, z of the surface of the sphere
+            real x = -1;
+            real y = i * idrawRadius;
+            real z = j * idrawRadius;
+            row[j + drawRadius] = Vec(x,y,z); // Position on the surface of the cube, before the rotation
+        }
+        positions.resize(positions.size() + side);
+        transformRow(cube_rotation, &row[0], &positions[positions.size() - side], side);
+    }
+    face_normals.push_back(V(side_normals[1]));
+    face_ends[1] = positions.size();
+
+    for (int i = -drawRadius; i <= drawRadius; i++)
+    {
+        for (int j = -drawRadius; j <= drawRadius; j++)
+        {
+            // Calculate the x, y, z of the surface of the sphere
+            real x = i * idrawRadius;
+            real y = 1;
+            real z = j * idrawRadius;
+            row[j + drawRadius] = Vec(x,y,z); // Position on the surface of the cube, before the rotation
+        }
+        positions.resize(positions.size() + side);
+        transformRow(cube_rotation, &row[0], &positions[positions.size() - side], side);
+    }
+    face_normals.push_back(V(side_normals[2]));
+    face_ends[2] = positions.size();
+    t = statsStage(context.stats, STAGE_GEOMETRY, t);
+    traceEnd(context.trace);
+
+    for (size_t face = 0; face < 3; face++)
+    {
+        traceBegin(context.trace, "computeShadedColor");
+        size_t start = colors.size();
+        colors.resize(face_ends[face]);
+        computeShadedColors(context, &positions[start], &face_normals[face], 0, &colors[start], face_ends[face] - start);
+        traceEnd(context.trace);
+    }
+    statsStage(context.stats, STAGE_SHADING, t);
+}
+
+// The scene and the shading go into the context, the other options into globalConfig
+void parseArguments(int argc, char* argv[], RenderContext &context)
+{
+    Material &material = context.material;
+    int i = 1;
+    while (i < argc)
+    {
+        if (strcmp(argv[i], "-ka") == 0)
+        {
+            // Ambient color
+            material.ka.r = (float)atof(argv[i+1]);
+            material.ka.g = (float)atof(argv[i+2]);
+            material.ka.b = (float)atof(argv[i+3]);
+            i+=4;
+        }
+        else if (strcmp(argv[i], "-kd") == 0)
+        {
+            // Diffuse color
+            material.kd.r = (float)atof(argv[i+1]);
+            material.kd.g = (float)atof(argv[i+2]);
+            material.kd.b = (float)atof(argv[i+3]);
+            i+=4;
+        }
+        else if (strcmp(argv[i], "-ks") == 0)
+        {
+            // Specular color
+            material.ks.r = (float)atof(argv[i+1]);
+            material.ks.g = (float)atof(argv[i+2]);
+            material.ks.b = (float)atof(argv[i+3]);
+            i+=4;
+        }
+        else if (strcmp(argv[i], "-sp") == 0)
+        {
+            // Specular power
+            material.sp = (float)atof(argv[i+1]);
+            i+=2;
+        }
+        else if ((strcmp(argv[i], "-pl") == 0) || (strcmp(argv[i], "-dl") == 0))
+        {
+            Light light;
+            // Specular color
+            light.posDir.x = (float)atof(argv[i+1]);
+            light.posDir.y = (float)atof(argv[i+2]);
+            light.posDir.z = (float)atof(argv[i+3]);
+            light.color.r = (float)atof(argv[i+4]);
+            light.color.g = (float)atof(argv[i+5]);
+            light.color.b = (float)atof(argv[i+6]);
+            if (strcmp(argv[i], "-pl") == 0)
+            {
+                // Point
+                light.type = Light::POINT_LIGHT;
+            }
+            else
+            {
+                // Directional
+                light.type = Light::DIRECTIONAL_LIGHT;
+            }
+            context.lights.push_back(light);
+            i+=7;
+        }
+        else if (strcmp(argv[i], "-no-display") == 0)
+        {
+            globalConfig.display = false;
+            i+=1;
+        }
+        else if (strcmp(argv[i], "-save") == 0)
+        {
+            globalConfig.imageSave.save = true;
+            globalConfig.imageSave.filepath = argv[i+1];
+            i+=2;
+        }
+        else if (strcmp(argv[i], "-toon") == 0)
+        {
+            context.shading.toon = true;
+            i+=1;
+        }
+        else if (strcmp(argv[i], "-approx") == 0)
+        {
+            unsigned approx = strcmp(argv[i+1], "all") == 0 ? (1u << APPROX_NAME_COUNT) - 1 : 0;
+            for(int k = 0; k < APPROX_NAME_COUNT; k++)
+            {
+                if(strcmp(argv[i+1], approx_names[k]) == 0) approx = 1u << k;
+            }
+            if(approx == 0) printf("INVALID APPROXIMATION : %s\n", argv[i+1]);
+            context.shading.approx |= approx;
+            i+=2;
+        }
+        else if (strcmp(argv[i], "-precision") == 0)
+        {
+            int k = 0;
+            while(k < 3 && strcmp(argv[i+1], precision_names[k]) != 0) k++;
+            if(k == 3) printf("INVALID PRECISION : %s\n", argv[i+1]);
+            else context.shading.precision = (GlobalConfig::PRECISION)k;
+            i+=2;
+        }
+        else if (strcmp(argv[i], "-cube") == 0)
+        {
+            context.shape = GlobalConfig::CUBE;
+            i+=1;
+        }
+        else if (strcmp(argv[i], "-stats") == 0)
+        {
+            globalConfig.stats.enabled = true;
+            i+=1;
+        }
+        else if (strcmp(argv[i], "-counters") == 0)
+        {
+            globalConfig.stats.enabled = true;
+            globalConfig.stats.counters = true;
+            i+=1;
+        }
+        else if (strcmp(argv[i], "-stats-json") == 0)
+        {
+            globalConfig.stats.enabled = true;
+            globalConfig.stats.jsonpath = argv[i+1];
+            i+=2;
+        }
+        else if (strcmp(argv[i], "-compare") == 0)
+        {
+            globalConfig.check.reference = argv[i+1];
+            globalConfig.check.tolerance = atoi(argv[i+2]);
+            i+=3;
+        }
+        else if (strcmp(argv[i], "-budget") == 0)
+        {
+            globalConfig.check.budget = atof(argv[i+1]);
+            i+=2;
+        }
+        else if (strcmp(argv[i], "-trace") == 0)
+        {
+            globalConfig.trace.filepath = argv[i+1];
+            i+=2;
+        }
+        else
+        {
+            printf("INVALID ARGUMENT : %s\n", argv[i]);
+            i++;
+        }
+    }
+}
+
+// Saves the frame buffer of the context, timed and traced into the context
+int saveBufferToFile(RenderContext &context, const char* filepath)
+{
+    // Chunks go to the file as they're made, no copy of the whole PNG is kept in memory
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = LCT_RGB;
+    state.info_png.color.colortype = LCT_RGB;
+    if(context.stats.enabled || context.trace)
+    {
+        state.encoder.stage_callback = pngStageCallback;
+        state.encoder.stage_user = &context;
+    }
+    traceBegin(context.trace, "saveBufferToFile");
+    unsigned error = lodepng_encode_file_state(filepath, &context.frame_buffer[0], context.viewport.w,
+                                               context.viewport.h, &state);
+    traceEnd(context.trace);
+    lodepng_state_cleanup(&state);
+    return error;
+}
+
+//****************************************************
+// Checks of the render (-compare, -budget), for regression testing
+//****************************************************
+
+// Compares the frame buffer with a reference png, returns the number of pixels that differ
+// by more than the tolerance in any channel, or -1 if the reference can't be used
+int compareWithReference(vector<unsigned char> &frame_buffer, const char* filepath, int tolerance, Viewport viewport)
+{
+    unsigned char* reference = NULL;
+    unsigned w, h;
+    unsigned error = lodepng_decode24_file(&reference, &w, &h, filepath);
+    if(error)
+    {
+        printf("Can't read reference %s: %s\n", filepath, lodepng_error_text(error));
+        return -1;
+    }
+    if((int)w != viewport.w || (int)h != viewport.h)
+    {
+        printf("Reference %s is %ux%u, the render is %dx%d\n", filepath, w, h, viewport.w, viewport.h);
+        free(reference);
+        return -1;
+    }
+
+    int differing = 0, max_difference = 0;
+    for(size_t i = 0; i < (size_t)w * h; i++)
+    {
+        int difference = 0;
+        for(int c = 0; c < 3; c++)
+        {
+            int d = abs((int)frame_buffer[i * 3 + c] - (int)reference[i * 3 + c]);
+            if(d > difference) difference = d;
+        }
+        if(difference > tolerance) differing++;
+        if(difference > max_difference) max_difference = difference;
+    }
+    free(reference);
+    printf("Compared with %s: %d of %u pixels differ by more than %d (largest difference %d)\n",
+           filepath, differing, w * h, tolerance, max_difference);
+    return differing;
+}
+
+// Best time of a few renders, in milliseconds
+double timeRender(RenderContext &context)
+{
+    double best = 0;
+    for(int i = 0; i < 3; i++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        renderImageToBuffer(context);
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        if(i == 0 || ms < best) best = ms;
+    }
+    return best;
+}
+
+// Returns 0 if the render of the context passes every check that was asked for, 1 otherwise
+int checkRender(RenderContext &context)
+{
+    int failed = 0;
+    if(globalConfig.check.reference)
+    {
+        if(compareWithReference(context.frame_buffer, globalConfig.check.reference, globalConfig.check.tolerance,
+                                context.viewport) != 0) failed = 1;
+    }
+    if(globalConfig.check.budget > 0)
+    {
+        RenderContext timing = context;     // timed without statistics, and without touching the render
+        timing.stats = FrameStats();
+        timing.trace = NULL;
+        double ms = timeRender(timing);
+        printf("Render took %.3f ms, the budget is %.3f ms\n", ms, globalConfig.check.budget);
+        if(ms > globalConfig.check.budget) failed = 1;
+    }
+    return failed;
+}
+
+// Renders the context once, without a window: saves the image if -save was given and runs the checks
+// of -compare and -budget. Returns 0 if they pass, 1 otherwise
+int renderOnce(RenderContext &context)
+{
+    statsBeginFrame(context.stats);
+    renderImageToBuffer(context);
+    if( globalConfig.imageSave.save )
+    {
+        printf("File saved to %s", globalConfig.imageSave.filepath);
+        saveBufferToFile(context, globalConfig.imageSave.filepath);
+    }
+    statsEndFrame(context.stats, context.viewport);
+    if( checkRender(context) != 0 )
+    {
+        printf("Check FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,255 @@
+// The renderer without the viewer: the scene, the shading and the render of it into a frame buffer,
+// saving that as a png, the checks of -compare and -budget, frame statistics and tracing. It uses no
+// GL, so it is built into a library of its own (the "Core" target) that the viewer (main.cpp), the
+// headless program (headless.cpp) and the benchmarks link, and that other programs can link too:
+// fill a RenderContext (or parseArguments into one), call prepareShading and renderImageToBuffer,
+// and read the RGB pixels of its frame_buffer.
+
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "algebra3.h"
+#include "lodepng.h"
+
+constexpr double PI = 3.14159265;
+
+//****************************************************
+// Some Classes
+//****************************************************
+
+class Viewport;
+
+class Viewport
+{
+public:
+    int w, h; // width and height
+    int drawX;
+    int drawY;
+};
+
+class Material
+{
+public:
+    vec3 ka; // Ambient color
+    vec3 kd; // Diffuse color
+    vec3 ks; // Specular color
+    float sp; // Power coefficient of specular
+
+    Material() : ka(0.0f), kd(0.0f), ks(0.0f), sp(0.0f)
+    {
+    }
+};
+
+class Light
+{
+public:
+    enum LIGHT_TYPE {POINT_LIGHT, DIRECTIONAL_LIGHT};
+
+    vec3 posDir;  // Position (Point light) or Direction (Directional light)
+    vec3 color;   // Color of the light
+    LIGHT_TYPE type;
+
+    Light() : posDir(0.0f), color(0.0f), type(POINT_LIGHT)
+    {
+    }
+};
+
+struct GlobalConfig
+{
+    enum SHAPE {SPHERE, CUBE};
+    // Approximations of the shading that trade accuracy for speed, as flags
+    enum APPROX {APPROX_FAST_POW = 1, APPROX_SPECULAR_TABLE = 2, APPROX_FAST_NORMALIZE = 4};
+    // What the positions and colors are kept in while rendering: half stores them in half floats and
+    // shades in float, double computes everything in double for reference renders
+    enum PRECISION {PRECISION_HALF, PRECISION_FLOAT, PRECISION_DOUBLE};
+
+    // Of a RenderContext
+    struct Shading
+    {
+        bool toon;
+        unsigned approx;        // APPROX flags, 0 for the exact shading
+        PRECISION precision;
+    };
+
+    bool display;
+    struct ImageSave
+    {
+        bool save;
+        char* filepath;
+    } imageSave;
+    struct Stats
+    {
+        bool enabled;
+        char* jsonpath;         // a JSON line per frame is written here, if not NULL
+        bool counters;          // also count cycles, instructions and misses per stage, where the system allows
+    } stats;
+    struct Trace
+    {
+        char* filepath;         // if not NULL, spans are recorded and written here as a Chrome trace at exit
+    } trace;
+    struct Check
+    {
+        char* reference;        // if not NULL, the render is compared with this png
+        int tolerance;          // difference allowed per channel of a pixel
+        double budget;          // milliseconds the render may take, 0 for no limit
+    } check;
+};
+
+const unsigned int RGB_COLOR_SPACE_BIT_COUNT = 3;
+const unsigned int safety_res_pre_allocation = 1920*1080*RGB_COLOR_SPACE_BIT_COUNT;
+
+// pow(x, material.sp) sampled over [0, 1], read with linear interpolation; larger x, which the
+// specular term gets as its reflection isn't normalized, still goes to pow
+const int SPECULAR_TABLE_SIZE = 1024;
+struct SpecularTable
+{
+    float sp;                   // the exponent the table was made for, -1 before it is filled
+    float values[SPECULAR_TABLE_SIZE + 1];
+};
+
+// What a render keeps between frames for the vectors of one precision, so that rendering again
+// allocates nothing: the positions and colors of the cube or of a row of the sphere, the normals of
+// the faces of the cube, and a row of it before the rotation
+template <class V> struct RenderBuffers
+{
+    std::vector<V> positions;
+    std::vector<V> colors;
+    std::vector<V> face_normals;
+    std::vector<typename vec3_of<typename V::real_type>::type> row;
+};
+
+//****************************************************
+// Frame statistics (-stats) and hardware performance counters (-counters)
+//****************************************************
+enum FRAME_STAGE {STAGE_GEOMETRY, STAGE_SHADING, STAGE_QUANTIZATION, STAGE_PRESENTATION,
+                  STAGE_PNG_FILTER, STAGE_PNG_DEFLATE, STAGE_PNG_WRITE, STAGE_FRAME, STAGE_FRAME_INTERVAL, STAGE_COUNT};
+extern const char* stage_names[STAGE_COUNT];
+
+enum COUNTER {COUNTER_CYCLES, COUNTER_INSTRUCTIONS, COUNTER_L1D_MISSES, COUNTER_LLC_MISSES, COUNTER_BRANCH_MISSES,
+              COUNTER_COUNT};
+
+// A point in time, and the counters then
+struct StatsMark
+{
+    double seconds;
+    long long counters[COUNTER_COUNT];
+};
+
+// A group of counters of the thread that opened it
+struct PerfCounters
+{
+    bool open;                  // whether any counter could be opened
+    int leader;                 // the file descriptor the group of counters is read from
+    int index[COUNTER_COUNT];   // position of each counter in a read of the group, -1 if it isn't available
+    int fds[COUNTER_COUNT];     // file descriptor of each counter of the group, in the order of a read
+    int count;                  // counters in the group
+};
+
+struct FrameStats
+{
+    bool enabled;                       // nothing is recorded otherwise
+    PerfCounters perf;
+    double seconds[STAGE_COUNT];        // of the frame being made
+    long long counters[STAGE_COUNT][COUNTER_COUNT];
+    bool used[STAGE_COUNT];             // whether the frame being made has the stage
+    double last_seconds[STAGE_COUNT];   // of the last finished frame, for the overlay
+    bool last_used[STAGE_COUNT];
+    std::vector<double> samples[STAGE_COUNT]; // every finished frame that has the stage, for the summary
+    long long counter_totals[STAGE_COUNT][COUNTER_COUNT]; // of all finished frames
+    double pixels;                      // of all finished frames
+    int frames;
+    StatsMark frame_start;
+    std::vector<int> png_stages;        // stages of lodepng that have begun and not ended, innermost last
+    StatsMark png_stage_start;
+    FILE* json;
+
+    FrameStats();                       // disabled
+};
+
+// The spans of -trace, see renderer.cpp
+class TraceRecorder;
+
+// Everything a render reads and writes. Renders with contexts of their own can run at the same
+// time on any threads; the options of the program (globalConfig) are the only state they share,
+// and only read. Contexts may share a trace recorder, it takes spans from any thread
+class RenderContext
+{
+public:
+    Material material;
+    std::vector<Light> lights;
+    GlobalConfig::Shading shading;
+    GlobalConfig::SHAPE shape;
+    Viewport viewport;
+    std::vector<unsigned char> frame_buffer; // viewport.w x viewport.h RGB pixels
+    SpecularTable specularTable;            // filled by prepareShading
+    FrameStats stats;                       // where the stages of the render are timed, if enabled
+    TraceRecorder* trace;                   // where its spans are recorded, NULL for nowhere
+    RenderBuffers<vec3h> half_buffers;
+    RenderBuffers<vec3> float_buffers;
+    RenderBuffers<vec3d> double_buffers;
+
+    RenderContext() : shape(GlobalConfig::SPHERE), trace(NULL)
+    {
+        shading.toon = false;
+        shading.approx = 0;                 // exact shading by default
+        shading.precision = GlobalConfig::PRECISION_FLOAT;
+        viewport.w = viewport.h = 400;
+        viewport.drawX = viewport.drawY = 200;
+        specularTable.sp = -1;
+    }
+};
+
+//****************************************************
+// Global Variables
+//****************************************************
+
+// The options of the program, set by parseArguments
+extern GlobalConfig globalConfig;
+
+//****************************************************
+// Frame statistics (-stats)
+//****************************************************
+double statsClock(const FrameStats &stats);
+StatsMark statsMark(const FrameStats &stats);
+StatsMark statsStage(FrameStats &stats, FRAME_STAGE stage, const StatsMark &start);
+void statsBeginFrame(FrameStats &stats);
+void statsEndFrame(FrameStats &stats, const Viewport &viewport);
+void statsPrintSummary(const FrameStats &stats);
+void initStats(RenderContext &context);
+void finishStats(RenderContext &context);
+
+//****************************************************
+// Tracing (-trace)
+//****************************************************
+TraceRecorder* newTrace();
+void deleteTrace(TraceRecorder* trace);
+void traceBegin(TraceRecorder* trace, const char* name);
+void traceEnd(TraceRecorder* trace);
+void writeTrace(TraceRecorder* trace, const char* filepath);
+void initTrace(RenderContext &context);
+void finishTrace(RenderContext &context);
+
+//****************************************************
+// Rendering, saving and checking
+//****************************************************
+extern const char* approx_names[];
+const int APPROX_NAME_COUNT = 3;
+extern const char* precision_names[];
+
+void reshape_viewport(int w, int h, Viewport &viewport);
+void prepareShading(RenderContext &context);
+int renderImageToBuffer(RenderContext &context);
+void parseArguments(int argc, char* argv[], RenderContext &context);
+int saveBufferToFile(RenderContext &context, const char* filepath);
+int compareWithReference(std::vector<unsigned char> &frame_buffer, const char* filepath, int tolerance, Viewport viewport);
+double timeRender(RenderContext &context);
+int checkRender(RenderContext &context);
+int renderOnce(RenderContext &context);
+
+#endif // RENDERER_H
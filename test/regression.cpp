@@ -0,0 +1,153 @@
+// Regression test of the renderer: built by the "Test" target.
+//
+// regression [-golden directory] [-update] [-no-budget]
+//
+// Renders every scene of the table below without a window, as the viewer would with
+// its arguments, and compares it with the golden image of the scene in -golden
+// (test/golden by default, the targets run in the directory of the project): a pixel
+// differs if a channel is off by more than the tolerance of the scene, and the scene
+// fails if more pixels differ than it allows, which only the toon scenes do, for the
+// pixels on the edge of a band that float rounding can move to the next one. The
+// render is timed as -budget times it, the best of three, and fails if it takes longer
+// than the budget of the scene; -no-budget leaves the timing out, for Debug builds and
+// sanitizers. Prints a line per scene and exits with 1 if any failed.
+//
+// -update renders the scenes and writes their golden images instead, after a change
+// of the output that was meant; the images are checked in with the change.
+
+#include <string>
+
+// The renderer core, without the viewer; the target links its library
+#include "../renderer.h"
+
+using namespace std;
+
+struct RegressionScene
+{
+    const char* name;           // of the golden image, name.png
+    const char* arguments;      // as the viewer takes them
+    int tolerance;              // difference allowed per channel of a pixel
+    int max_differing;          // pixels allowed to differ by more than the tolerance
+    double budget;              // milliseconds the best of three renders may take
+};
+
+#define MATERIAL "-ka 0.2 0.3 0.3 -kd 1 1 0.5 -ks 1 1 1 -sp 30 "
+// The lights of the Debug and Release targets
+#define LIGHTS "-pl 5 5 5 0.3 0.3 0.3 -pl -5 -2 5 0.5 0.5 1 -dl 0 1 0 0.5 0.3 0.2 "
+// 16 dim lights around the object, half of them directional
+#define MANY_LIGHTS \
+    "-pl -4 0 5 0.1 0.1 0.1 -dl 1 -3 1 0.05 0.1 0.08 -pl -3 1 5 0.1 0.1 0.1 -dl 1 -2 1 0.05 0.1 0.08 " \
+    "-pl -2 2 5 0.1 0.1 0.1 -dl 1 -1 1 0.05 0.1 0.08 -pl -1 0 5 0.1 0.1 0.1 -dl 1 0 1 0.05 0.1 0.08 " \
+    "-pl 0 1 5 0.1 0.1 0.1 -dl 1 1 1 0.05 0.1 0.08 -pl 1 2 5 0.1 0.1 0.1 -dl 1 2 1 0.05 0.1 0.08 " \
+    "-pl 2 0 5 0.1 0.1 0.1 -dl 1 3 1 0.05 0.1 0.08 -pl 3 1 5 0.1 0.1 0.1 -dl 1 4 1 0.05 0.1 0.08 "
+
+static const RegressionScene scenes[] =
+{
+    {"release",             MATERIAL LIGHTS,                    1, 0,   40},
+    {"debug",               MATERIAL LIGHTS "-toon -cube",      1, 16,  40},
+    {"sphere_toon",         MATERIAL LIGHTS "-toon",            1, 16,  40},
+    {"cube",                MATERIAL LIGHTS "-cube",            1, 0,   40},
+    {"sphere_many_lights",  MATERIAL MANY_LIGHTS,               1, 0,   150},
+    {"sphere_many_lights_toon", MATERIAL MANY_LIGHTS "-toon",   1, 16,  150},
+    {"cube_many_lights",    MATERIAL MANY_LIGHTS "-cube",       1, 0,   150},
+    {"cube_many_lights_toon", MATERIAL MANY_LIGHTS "-toon -cube", 1, 16, 150},
+};
+static const int SCENE_COUNT = sizeof(scenes) / sizeof(scenes[0]);
+
+static string regression_golden = "test/golden";
+static bool regression_update = false;
+static bool regression_budget = true;
+
+// The scene of the arguments in a context of its own, at the size of the viewer
+static void setupScene(const RegressionScene &scene, RenderContext &context)
+{
+    // parseArguments takes them as main does, after the name of the program
+    vector<string> words(1, "regression");
+    string arguments = scene.arguments;
+    size_t start = 0;
+    while(start < arguments.size())
+    {
+        size_t end = arguments.find(' ', start);
+        if(end == string::npos) end = arguments.size();
+        if(end > start) words.push_back(arguments.substr(start, end - start));
+        start = end + 1;
+    }
+    vector<char*> argv;
+    for(size_t i = 0; i < words.size(); i++) argv.push_back(&words[i][0]);
+
+    parseArguments((int)argv.size(), &argv[0], context);
+    prepareShading(context);
+    reshape_viewport(400, 400, context.viewport);
+}
+
+// Renders the scene and checks it against its golden image and budget, or writes the image with
+// -update; false if it fails
+static bool runScene(const RegressionScene &scene)
+{
+    RenderContext context;
+    setupScene(scene, context);
+    renderImageToBuffer(context);
+    string golden = regression_golden + "/" + scene.name + ".png";
+
+    if(regression_update)
+    {
+        unsigned error = saveBufferToFile(context, golden.c_str());
+        if(error) printf("%s: can't write %s: %s\n", scene.name, golden.c_str(), lodepng_error_text(error));
+        else printf("%s: wrote %s\n", scene.name, golden.c_str());
+        return error == 0;
+    }
+
+    bool ok = true;
+    int differing = compareWithReference(context.frame_buffer, golden.c_str(), scene.tolerance, context.viewport);
+    if(differing < 0 || differing > scene.max_differing) ok = false;
+    if(regression_budget)
+    {
+        double ms = timeRender(context);
+        printf("Render took %.3f ms, the budget is %.3f ms\n", ms, scene.budget);
+        if(ms > scene.budget) ok = false;
+    }
+    printf("%s: %s\n", scene.name, ok ? "ok" : "FAILED");
+    fflush(stdout);
+    return ok;
+}
+
+void parseRegressionArguments(int argc, char *argv[])
+{
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-golden") == 0 && i + 1 < argc)
+        {
+            regression_golden = argv[++i];
+        }
+        else if(strcmp(argv[i], "-update") == 0)
+        {
+            regression_update = true;
+        }
+        else if(strcmp(argv[i], "-no-budget") == 0)
+        {
+            regression_budget = false;
+        }
+        else
+        {
+            printf("INVALID ARGUMENT : %s\n", argv[i]);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parseRegressionArguments(argc, argv);
+
+    int failures = 0;
+    for(int i = 0; i < SCENE_COUNT; i++)
+    {
+        if(!runScene(scenes[i])) failures++;
+    }
+    if(failures)
+    {
+        printf("%d of %d scene(s) FAILED\n", failures, SCENE_COUNT);
+        return 1;
+    }
+    printf("all %d scenes passed\n", SCENE_COUNT);
+    return 0;
+}